@@ -0,0 +1,519 @@
+#include "audio.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// raylib's copy of stb_vorbis, already built into it for loading OGGs, so just the declarations
+#define STB_VORBIS_HEADER_ONLY
+#include "external/stb_vorbis.c"
+
+#define MIXER_SLEEP 0.002       // between checks on the queue and the stream, seconds
+
+//----------------------------------------------------------------------------------
+// Mixer side
+//----------------------------------------------------------------------------------
+static void StopMusic(AudioMusicStream *m)
+{
+    if (m->decoder!=NULL) stb_vorbis_close(m->decoder);
+    m->decoder = NULL;
+    m->music = NULL;
+}
+
+// decodes a half of the window full, going back to the start at the end of the track
+static void FillMusic(AudioMusicStream *m, int half)
+{
+    const AudioMusic *music = m->music;
+    int16_t *out = m->window[half];
+    uint32_t filled = 0;
+    int restarts = 0;
+    double start = TimerNow();
+    while (filled < AUDIO_MUSIC_WINDOW) {
+        uint32_t n = 0;
+        if (music->ogg) {
+            n = (uint32_t)stb_vorbis_get_samples_short_interleaved(m->decoder, 2, out + filled*2, (AUDIO_MUSIC_WINDOW - filled)*2);
+        } else {
+            n = music->frames - m->position;
+            if (n > AUDIO_MUSIC_WINDOW - filled) n = AUDIO_MUSIC_WINDOW - filled;
+            const int16_t *src = (const int16_t *)(music->data + music->pcm_offset) + (size_t)m->position*music->channels;
+            if (music->channels==1) {
+                for (uint32_t k = 0; k < n; k++) out[(filled + k)*2] = out[(filled + k)*2 + 1] = src[k];
+            } else {
+                memcpy(out + filled*2, src, (size_t)n*4);
+            }
+            m->position += n;
+        }
+        if (n==0) {
+            // twice in a row with nothing means there's nothing in there
+            if (restarts++ > 0) break;
+            if (music->ogg) stb_vorbis_seek_start(m->decoder);
+            m->position = 0;
+        } else {
+            restarts = 0;
+        }
+        filled += n;
+    }
+    m->filled[half] = filled;
+    m->decoded += filled;
+    m->decode_seconds += TimerNow() - start;
+}
+
+static void StartMusic(AudioMusicStream *m, const AudioMusic *music)
+{
+    StopMusic(m);
+    if (music==NULL) return;
+    if (music->ogg) {
+        m->decoder = stb_vorbis_open_memory(music->data, (int)music->size, NULL, NULL);
+        if (m->decoder==NULL) return;
+    }
+    m->music = music;
+    m->position = 0;
+    m->read = 0;
+    m->front = 0;
+    FillMusic(m, 0);
+    FillMusic(m, 1);
+}
+
+static void MixMusic(AudioMusicStream *m, int32_t *mix, uint32_t frames)
+{
+    uint32_t i = 0;
+    while ((m->music!=NULL) && (i < frames)) {
+        if (m->read==m->filled[m->front]) {
+            m->filled[m->front] = 0;
+            m->front ^= 1;
+            m->read = 0;
+            if (m->filled[m->front]==0) {
+                m->underruns++;
+                FillMusic(m, m->front);
+                if (m->filled[m->front]==0) {
+                    StopMusic(m);
+                    break;
+                }
+            }
+        }
+        uint32_t n = m->filled[m->front] - m->read;
+        if (n > frames - i) n = frames - i;
+        const int16_t *src = m->window[m->front] + (size_t)m->read*2;
+        for (uint32_t k = 0; k < 2*n; k++) mix[2*i + k] += src[k];
+        m->read += n;
+        i += n;
+    }
+}
+
+static void Mix(Audio *a, int16_t *out, uint32_t frames)
+{
+    int32_t mix[AUDIO_BUFFER_FRAMES*2];
+    memset(mix, 0, (size_t)frames*2*sizeof(int32_t));
+    for (int v = 0; v < AUDIO_CHANNELS; v++) {
+        AudioVoice *voice = &a->voices[v];
+        uint32_t i = 0;
+        while ((voice->sound!=NULL) && (i < frames)) {
+            const AudioSound *sound = voice->sound;
+            if (voice->position >= sound->frames) {
+                if (!voice->loop) {
+                    voice->sound = NULL;
+                    break;
+                }
+                voice->position = 0;
+            }
+            uint32_t n = sound->frames - voice->position;
+            if (n > frames - i) n = frames - i;
+            const int16_t *src = sound->samples + (size_t)voice->position*sound->channels;
+            int32_t *dst = mix + (size_t)i*2;
+            if (sound->channels==1) {
+                for (uint32_t k = 0; k < n; k++) {
+                    dst[2*k] += src[k];
+                    dst[2*k + 1] += src[k];
+                }
+            } else {
+                for (uint32_t k = 0; k < 2*n; k++) dst[k] += src[k];
+            }
+            i += n;
+            voice->position += n;
+        }
+    }
+    MixMusic(&a->music, mix, frames);
+    if (SynthRender(&a->synth, a->synth_buffer, (int)frames)) {
+        for (uint32_t i = 0; i < frames; i++) {
+            int32_t s = (int32_t)(a->synth_buffer[i]*32767.0f);
+            mix[2*i] += s;
+            mix[2*i + 1] += s;
+        }
+    }
+    for (uint32_t i = 0; i < frames*2; i++) {
+        int32_t s = mix[i];
+        out[i] = (int16_t)((s > 32767) ? 32767 : ((s < -32768) ? -32768 : s));
+    }
+    a->mixed += frames;
+}
+
+static void PutU16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+static void PutU32(uint8_t *p, uint32_t v) { PutU16(p, v & 0xFFFF); PutU16(p + 2, v >> 16); }
+
+void AudioWriteWavHeader(FILE *f, uint64_t frames)
+{
+    uint32_t dataSize = (frames*4 > 0xFFFFFFFFull - 36) ? (uint32_t)(0xFFFFFFFFull - 36) : (uint32_t)(frames*4);
+    uint8_t header[44];
+    memcpy(header, "RIFF", 4);
+    PutU32(header + 4, 36 + dataSize);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    PutU32(header + 16, 16);
+    PutU16(header + 20, 1);
+    PutU16(header + 22, 2);
+    PutU32(header + 24, AUDIO_SAMPLE_RATE);
+    PutU32(header + 28, AUDIO_SAMPLE_RATE*4);
+    PutU16(header + 32, 4);
+    PutU16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    PutU32(header + 40, dataSize);
+    fwrite(header, 1, sizeof(header), f);
+}
+
+// null device: the mix goes nowhere but the checksum (and the file)
+static void MixToMemory(Audio *a, uint32_t frames)
+{
+    while (frames > 0) {
+        uint32_t n = (frames > AUDIO_BUFFER_FRAMES) ? AUDIO_BUFFER_FRAMES : frames;
+        Mix(a, a->buffer, n);
+        const uint8_t *bytes = (const uint8_t *)a->buffer;
+        uint32_t hash = a->checksum;
+        for (uint32_t i = 0; i < n*4; i++) {
+            hash ^= bytes[i];
+            hash *= 16777619u;  // FNV-1a
+        }
+        a->checksum = hash;
+        if (a->wav!=NULL) fwrite(a->buffer, 4, n, a->wav);
+        frames -= n;
+    }
+}
+
+static void Apply(Audio *a, const AudioCommand *cmd)
+{
+    switch (cmd->type) {
+    case AUDIO_CMD_SFX: {
+        int channel = cmd->channel;
+        if (channel < 0) {
+            // first quiet channel, or cut off whichever's been going longest
+            channel = 0;
+            for (int i = 0; i < AUDIO_CHANNELS; i++) {
+                if (a->voices[i].sound==NULL) {
+                    channel = i;
+                    break;
+                }
+                if (a->voices[i].started < a->voices[channel].started) channel = i;
+            }
+        }
+        a->voices[channel] = (AudioVoice){ cmd->sound, 0, 0, a->mixed };
+        break;
+    }
+    case AUDIO_CMD_STOP:
+        a->voices[cmd->channel].sound = NULL;
+        break;
+    case AUDIO_CMD_MUSIC:
+        // asking for what's already playing doesn't restart it
+        if (a->music.music!=cmd->music) StartMusic(&a->music, cmd->music);
+        break;
+    case AUDIO_CMD_SONG:
+        // same as music, asking again doesn't restart it
+        if (a->synth.song!=cmd->song) SynthPlay(&a->synth, cmd->song, 1);
+        break;
+    case AUDIO_CMD_STOP_ALL:
+        for (int i = 0; i < AUDIO_CHANNELS; i++) a->voices[i].sound = NULL;
+        StopMusic(&a->music);
+        SynthStop(&a->synth);
+        break;
+    case AUDIO_CMD_ADVANCE:
+        MixToMemory(a, cmd->frames);
+        break;
+    }
+}
+
+// between mixes (and between commands, the null device can get a lot of frames at once): get the half that's been played out decoded again
+static void DecodeAhead(Audio *a)
+{
+    AudioMusicStream *m = &a->music;
+    if ((m->music!=NULL) && (m->filled[m->front ^ 1]==0)) FillMusic(m, m->front ^ 1);
+}
+
+// each slot goes back to the main thread as soon as it's been acted on
+static void Drain(Audio *a)
+{
+    uint32_t tail = a->tail;
+    uint32_t head = AtomicLoad(&a->head);
+    while (tail!=head) {
+        Apply(a, &a->queue[tail & (AUDIO_QUEUE_SIZE - 1)]);
+        AtomicStore(&a->tail, ++tail);
+        DecodeAhead(a);
+    }
+}
+
+static void Feed(Audio *a)
+{
+    int buffers = 0;
+    while (IsAudioStreamProcessed(a->stream)) {
+        Mix(a, a->buffer, AUDIO_BUFFER_FRAMES);
+        UpdateAudioStream(a->stream, a->buffer, AUDIO_BUFFER_FRAMES);
+        buffers++;
+    }
+    if (buffers >= 2) a->starved++; // both of the stream's buffers had run out, so the card got silence
+}
+
+static void MixerThread(void *arg)
+{
+    Audio *a = arg;
+    while (!AtomicLoad(&a->quit)) {
+        Drain(a);
+        if (a->mode==AUDIO_DEVICE) Feed(a);
+        DecodeAhead(a);
+        TimerSleep(MIXER_SLEEP);
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Main thread side
+//----------------------------------------------------------------------------------
+void AudioInit(Audio *a, AudioMode mode, const char *wavPath)
+{
+    memset(a, 0, sizeof(Audio));
+    if (mode==AUDIO_DEVICE) {
+        InitAudioDevice();
+        if (IsAudioDeviceReady()) {
+            SetAudioStreamBufferSizeDefault(AUDIO_BUFFER_FRAMES);
+            a->stream = LoadAudioStream(AUDIO_SAMPLE_RATE, 16, 2);
+            PlayAudioStream(a->stream);
+        } else {
+            TraceLog(LOG_WARNING, "AUDIO: No sound card, mixing into memory instead");
+            mode = AUDIO_NULL;
+        }
+    }
+    if ((mode==AUDIO_NULL) && (wavPath!=NULL)) {
+        a->wav = fopen(wavPath, "wb");
+        if (a->wav!=NULL) AudioWriteWavHeader(a->wav, 0);
+        else TraceLog(LOG_WARNING, "AUDIO: Can't write %s", wavPath);
+    }
+    a->mode = mode;
+    a->checksum = 2166136261u;
+    SynthInit(&a->synth, AUDIO_SAMPLE_RATE);
+    if (mode==AUDIO_OFF) return;
+    a->threaded = ThreadStart(&a->thread, MixerThread, a);
+    TraceLog(LOG_INFO, "AUDIO: %s at %d Hz, mixing on %s", (mode==AUDIO_DEVICE) ? "Playing" : "Null device",
+        AUDIO_SAMPLE_RATE, a->threaded ? "its own thread" : "the main thread");
+}
+
+void AudioClose(Audio *a)
+{
+    if (a->mode==AUDIO_OFF) return;
+    AtomicStore(&a->quit, 1);
+    if (a->threaded) ThreadJoin(&a->thread);
+    Drain(a);
+    StopMusic(&a->music);
+    if (a->mode==AUDIO_DEVICE) {
+        StopAudioStream(a->stream);
+        UnloadAudioStream(a->stream);
+        CloseAudioDevice();
+    }
+    AudioLog(a);
+    if (a->wav!=NULL) {
+        fseek(a->wav, 0, SEEK_SET);
+        AudioWriteWavHeader(a->wav, a->mixed);
+        fclose(a->wav);
+        a->wav = NULL;
+    }
+    a->mode = AUDIO_OFF;
+}
+
+// sfx()/music() commands get dropped once the queue's down to its reserve
+static void Post(Audio *a, AudioCommand cmd)
+{
+    if ((a->mode==AUDIO_OFF) || a->muted) return;
+    uint32_t head = a->head;
+    if (head - AtomicLoad(&a->tail) >= AUDIO_QUEUE_SIZE - AUDIO_QUEUE_RESERVE) {
+        a->dropped++;
+        return;
+    }
+    a->queue[head & (AUDIO_QUEUE_SIZE - 1)] = cmd;
+    AtomicStore(&a->head, head + 1);
+    a->posted++;
+}
+
+// engine commands can use the reserve, and wait if even that's gone (the mixer's stuck)
+static void PostEngine(Audio *a, AudioCommand cmd)
+{
+    if (a->mode==AUDIO_OFF) return;
+    if (a->head - AtomicLoad(&a->tail) >= AUDIO_QUEUE_SIZE) AudioFlush(a);
+    a->queue[a->head & (AUDIO_QUEUE_SIZE - 1)] = cmd;
+    AtomicStore(&a->head, a->head + 1);
+    a->posted++;
+}
+
+void AudioPlaySfx(Audio *a, const AudioSound *sound, int channel)
+{
+    Post(a, (AudioCommand){ AUDIO_CMD_SFX, (int8_t)channel, 0, sound });
+}
+
+void AudioStopChannel(Audio *a, int channel)
+{
+    Post(a, (AudioCommand){ AUDIO_CMD_STOP, (int8_t)channel, 0, NULL });
+}
+
+void AudioPlayMusic(Audio *a, const AudioMusic *music)
+{
+    Post(a, (AudioCommand){ AUDIO_CMD_MUSIC, 0, 0, NULL, NULL, music });
+}
+
+void AudioPlaySong(Audio *a, const SynthSong *song)
+{
+    Post(a, (AudioCommand){ AUDIO_CMD_SONG, 0, 0, NULL, song });
+}
+
+// this one can't get dropped, or a sound about to be freed might keep playing
+void AudioStopAll(Audio *a)
+{
+    PostEngine(a, (AudioCommand){ AUDIO_CMD_STOP_ALL, 0, 0, NULL });
+}
+
+// the null device can't skip a frame either, or runs wouldn't mix the same
+void AudioFrame(Audio *a)
+{
+    if (a->mode==AUDIO_NULL) PostEngine(a, (AudioCommand){ AUDIO_CMD_ADVANCE, 0, AUDIO_FRAME_SAMPLES, NULL });
+    if (!a->threaded && (a->mode!=AUDIO_OFF)) {
+        Drain(a);
+        if (a->mode==AUDIO_DEVICE) Feed(a);
+        DecodeAhead(a);
+    }
+}
+
+void AudioFlush(Audio *a)
+{
+    if (a->mode==AUDIO_OFF) return;
+    if (!a->threaded) {
+        Drain(a);
+        return;
+    }
+    while (AtomicLoad(&a->tail)!=a->head) TimerSleep(MIXER_SLEEP/4);
+}
+
+void AudioLog(const Audio *a)
+{
+    if (a->mode==AUDIO_OFF) return;
+    TraceLog(LOG_INFO, "AUDIO: %llu commands, %llu dropped, %.1f seconds mixed", (unsigned long long)a->posted,
+        (unsigned long long)a->dropped, (double)a->mixed/AUDIO_SAMPLE_RATE);
+    const AudioMusicStream *m = &a->music;
+    if (m->decoded > 0) {
+        double seconds = (double)m->decoded/AUDIO_SAMPLE_RATE;
+        TraceLog(LOG_INFO, "AUDIO: Music decode took %.1f ms for %.1f seconds of it (%.2f%% of a core), %u underruns",
+            m->decode_seconds*1000.0, seconds, 100.0*m->decode_seconds/seconds, m->underruns);
+    }
+    if (a->mode==AUDIO_DEVICE) TraceLog(LOG_INFO, "AUDIO: Sound card ran dry %u times", a->starved);
+    if (a->mode==AUDIO_NULL) TraceLog(LOG_INFO, "AUDIO: Null device output checksum %08X", a->checksum);
+}
+
+//----------------------------------------------------------------------------------
+// Sounds
+//----------------------------------------------------------------------------------
+int LoadAudioSound(AudioSound *sound, const uint8_t *data, size_t size)
+{
+    memset(sound, 0, sizeof(AudioSound));
+    const char *type = NULL;
+    if ((size >= 12) && (memcmp(data, "RIFF", 4)==0) && (memcmp(data + 8, "WAVE", 4)==0)) type = ".wav";
+    else if ((size >= 4) && (memcmp(data, "OggS", 4)==0)) type = ".ogg";
+    else if ((size >= 4) && (memcmp(data, "fLaC", 4)==0)) type = ".flac";
+    else if ((size >= 3) && ((memcmp(data, "ID3", 3)==0) || ((data[0]==0xFF) && ((data[1] & 0xE0)==0xE0)))) type = ".mp3";
+    if (type==NULL) return 0;
+    Wave wave = LoadWaveFromMemory(type, data, (int)size);
+    if ((wave.data==NULL) || (wave.frameCount==0)) {
+        UnloadWave(wave);
+        return 0;
+    }
+    WaveFormat(&wave, AUDIO_SAMPLE_RATE, 16, (wave.channels > 1) ? 2 : 1);
+    sound->samples = wave.data;
+    sound->frames = wave.frameCount;
+    sound->channels = (int)wave.channels;
+    return 1;
+}
+
+void UnloadAudioSound(AudioSound *sound)
+{
+    MemFree(sound->samples);
+    memset(sound, 0, sizeof(AudioSound));
+}
+
+size_t AudioSoundBytes(const AudioSound *sound)
+{
+    return (size_t)sound->frames*sound->channels*sizeof(int16_t);
+}
+
+//----------------------------------------------------------------------------------
+// Music
+//----------------------------------------------------------------------------------
+static uint32_t GetU32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t GetU16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+// finds the fmt and data chunks
+static int ParseWav(AudioMusic *music, const uint8_t *data, size_t size)
+{
+    int rate = 0, bits = 0, format = 0;
+    size_t offset = 12;
+    while (offset + 8 <= size) {
+        uint32_t chunkSize = GetU32(data + offset + 4);
+        const uint8_t *body = data + offset + 8;
+        if (chunkSize > size - offset - 8) chunkSize = (uint32_t)(size - offset - 8);
+        if ((memcmp(data + offset, "fmt ", 4)==0) && (chunkSize >= 16)) {
+            format = GetU16(body);
+            music->channels = GetU16(body + 2);
+            rate = (int)GetU32(body + 4);
+            bits = GetU16(body + 14);
+        } else if ((memcmp(data + offset, "data", 4)==0) && (format!=0)) {
+            music->pcm_offset = offset + 8;
+            music->frames = (music->channels > 0) ? chunkSize/(2*music->channels) : 0;
+            break;
+        }
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+    if ((format!=1) || (bits!=16) || (music->pcm_offset==0)) {
+        TraceLog(LOG_WARNING, "AUDIO: Music WAVs have to be 16 bit PCM");
+        return 0;
+    }
+    return rate;
+}
+
+int LoadAudioMusic(AudioMusic *music, const uint8_t *data, size_t size)
+{
+    memset(music, 0, sizeof(AudioMusic));
+    int rate = 0;
+    if ((size >= 12) && (memcmp(data, "RIFF", 4)==0) && (memcmp(data + 8, "WAVE", 4)==0)) {
+        rate = ParseWav(music, data, size);
+    } else if ((size >= 4) && (memcmp(data, "OggS", 4)==0)) {
+        stb_vorbis *decoder = stb_vorbis_open_memory(data, (int)size, NULL, NULL);
+        if (decoder!=NULL) {
+            stb_vorbis_info info = stb_vorbis_get_info(decoder);
+            rate = (int)info.sample_rate;
+            music->channels = info.channels;
+            music->frames = stb_vorbis_stream_length_in_samples(decoder);
+            music->ogg = 1;
+            stb_vorbis_close(decoder);
+        }
+    } else {
+        TraceLog(LOG_WARNING, "AUDIO: Music has to be OGG or WAV");
+    }
+    if (rate==0) return 0;
+    if ((rate!=AUDIO_SAMPLE_RATE) || (music->channels < 1) || (music->channels > 2) || (music->frames==0)) {
+        TraceLog(LOG_WARNING, "AUDIO: Music has to be mono or stereo at %d Hz (this is %d channels at %d Hz)",
+            AUDIO_SAMPLE_RATE, music->channels, rate);
+        return 0;
+    }
+    music->data = MemAlloc((unsigned int)size);
+    memcpy(music->data, data, size);
+    music->size = size;
+    return 1;
+}
+
+void UnloadAudioMusic(AudioMusic *music)
+{
+    MemFree(music->data);
+    memset(music, 0, sizeof(AudioMusic));
+}
+
+size_t AudioMusicBytes(const AudioMusic *music)
+{
+    return music->size;
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "raylib.h"
+#include "thread.h"
+#include "synth.h"
+
+// Audio
+// Lua only ever posts commands (play this, stop that) into a single-producer single-
+// consumer ring; a mixer thread takes them out, mixes the voices and keeps an
+// AudioStream fed. Posting never waits: if the ring's full the command gets dropped.
+// (The engine's own commands wait for room instead, they're never dropped.) The mixer
+// never sees the Lua state, only the AudioSounds, SynthSongs and AudioMusic commands
+// point at, which is why those can't be freed until AudioFlush says the mixer's let go
+// of them.
+//
+// Music isn't decoded up front like sounds are: the cart keeps the file (OGG, or 16 bit
+// WAV) as it was, and the mixer thread decodes it a window at a time. The window has two
+// halves; the mixer plays out of one while the other gets decoded in the time between
+// mixes. If the mixer gets to the end of one half and the other isn't ready, that's an
+// underrun, and it has to wait for the decode right there. Memory stays the window plus
+// the decoder's state however long the track is.
+//
+// The null device is for machines without a sound card: the mixer runs as usual, but
+// the output goes into memory (and a WAV file, if asked) instead of to a speaker, paced
+// by the engine's frames rather than the clock, so the same run mixes the same samples.
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_CHANNELS 4                // sfx() channels, music streams on top
+#define AUDIO_QUEUE_SIZE 256            // commands, has to be a power of two
+#define AUDIO_QUEUE_RESERVE 16          // slots Lua can't fill, so the engine's own commands always fit
+#define AUDIO_BUFFER_FRAMES 1024        // per AudioStream update
+#define AUDIO_MUSIC_WINDOW 4096         // frames in each half of the music's decode window
+#define AUDIO_FRAME_SAMPLES (AUDIO_SAMPLE_RATE/60) // what the null device mixes per engine frame
+
+typedef struct {
+    int16_t *samples;           // interleaved, AUDIO_SAMPLE_RATE
+    uint32_t frames;
+    int channels;               // 1 or 2
+} AudioSound;
+
+typedef struct {
+    uint8_t *data;              // the file as it was in the cart
+    size_t size;
+    int ogg;                    // 0 = WAV, samples straight out of data
+    size_t pcm_offset;          // WAV: where the samples start
+    uint32_t frames;
+    int channels;               // 1 or 2
+} AudioMusic;
+
+typedef enum {
+    AUDIO_OFF = 0,
+    AUDIO_DEVICE,               // the sound card
+    AUDIO_NULL,                 // memory (and maybe a WAV file)
+} AudioMode;
+
+typedef enum {
+    AUDIO_CMD_SFX,              // sound on channel (-1 = whichever's free, or has been playing longest)
+    AUDIO_CMD_STOP,             // channel
+    AUDIO_CMD_MUSIC,            // music, streamed and looped (NULL stops it)
+    AUDIO_CMD_STOP_ALL,
+    AUDIO_CMD_ADVANCE,          // null device: mix frames more
+    AUDIO_CMD_SONG,             // song, looped on the synth (NULL releases whatever's playing)
+} AudioCommandType;
+
+typedef struct {
+    uint8_t type;
+    int8_t channel;
+    uint32_t frames;
+    const AudioSound *sound;
+    const SynthSong *song;
+    const AudioMusic *music;
+} AudioCommand;
+
+typedef struct {
+    const AudioSound *sound;    // NULL = quiet
+    uint32_t position;          // frames in
+    int loop;
+    uint64_t started;           // when, in frames mixed, for picking one to cut off
+} AudioVoice;
+
+typedef struct {
+    const AudioMusic *music;    // NULL = quiet
+    void *decoder;              // stb_vorbis, for OGG
+    uint32_t position;          // WAV: frames read so far
+    int16_t window[2][AUDIO_MUSIC_WINDOW*2];    // stereo
+    uint32_t filled[2];         // frames decoded into each half, 0 = waiting to be
+    uint32_t read;              // frames mixed out of the front half
+    int front;
+    // how decoding's going
+    double decode_seconds;
+    uint64_t decoded;           // frames
+    uint32_t underruns;
+} AudioMusicStream;
+
+typedef struct {
+    AudioMode mode;
+    // main thread writes head, mixer writes tail
+    AudioCommand queue[AUDIO_QUEUE_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t quit;
+    uint64_t posted, dropped;   // main thread's
+    int muted;                  // main thread's: sfx()/music()/song() don't get posted (run-ahead frames)
+    // everything past here is the mixer's (or the main thread's, when threaded is 0)
+    Thread thread;
+    int threaded;
+    AudioVoice voices[AUDIO_CHANNELS];
+    AudioMusicStream music;
+    Synth synth;                // song(), mixed in on top of the voices
+    float synth_buffer[AUDIO_BUFFER_FRAMES];
+    AudioStream stream;
+    uint32_t starved;           // times the sound card got to the end of what we'd given it
+    int16_t buffer[AUDIO_BUFFER_FRAMES*2];
+    FILE *wav;
+    uint64_t mixed;             // frames so far
+    uint32_t checksum;          // of everything mixed, to compare null device runs
+} Audio;
+
+// falls back to AUDIO_NULL if the sound card won't open; wavPath only matters for AUDIO_NULL
+void AudioInit(Audio *a, AudioMode mode, const char *wavPath);
+void AudioClose(Audio *a);      // logs what got mixed
+
+// main thread only, none of these wait
+void AudioPlaySfx(Audio *a, const AudioSound *sound, int channel);
+void AudioStopChannel(Audio *a, int channel);
+void AudioPlayMusic(Audio *a, const AudioMusic *music);
+void AudioPlaySong(Audio *a, const SynthSong *song);
+void AudioStopAll(Audio *a);
+void AudioFrame(Audio *a);      // once per engine frame
+// waits for the mixer to get through everything posted so far; after AudioStopAll then
+// AudioFlush, nothing's playing any sound and they can all be freed
+void AudioFlush(Audio *a);
+void AudioLog(const Audio *a);  // AudioClose does this once everything has been mixed
+
+void AudioWriteWavHeader(FILE *f, uint64_t frames);   // 16 bit stereo at AUDIO_SAMPLE_RATE, frames of it after
+
+// WAV, OGG, MP3 or FLAC data (whatever raylib was built with), converted for the mixer
+int LoadAudioSound(AudioSound *sound, const uint8_t *data, size_t size);
+void UnloadAudioSound(AudioSound *sound);
+size_t AudioSoundBytes(const AudioSound *sound);
+
+// OGG or 16 bit WAV data, at AUDIO_SAMPLE_RATE; copied, and checked it'll decode
+int LoadAudioMusic(AudioMusic *music, const uint8_t *data, size_t size);
+void UnloadAudioMusic(AudioMusic *music);
+size_t AudioMusicBytes(const AudioMusic *music);
@@ -0,0 +1,115 @@
+// GIF capture benchmark
+// Hands frames to a capture at a real 60 a second, the way the frame loop does, for a
+// few kinds of scene: a still screen with a bit of it moving, things scattered all over
+// a still background, and the whole screen changing every frame. Reports what handing a
+// frame over costs the caller, what encoding one costs the capture's thread, and how big
+// the GIF came out. The encoder has to keep up: any frame dropped for the ring being full
+// gets flagged and the exit code says so.
+// Writes capture_bench.gif (over again for each scene); --keep leaves one per scene,
+// capture_bench_<scene>.gif, to look at. Build with `make bench` in src/.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "../capture.h"
+#include "../eightbitcolor.h"
+#include "../timer.h"
+
+#define FRAMES 180                  // 3 seconds a scene
+
+static uint32_t state = 0x4E585553;
+
+static uint32_t Random(uint32_t n)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state%n;
+}
+
+static void Background(Screen *s)
+{
+    for (int y = 0; y < SCREEN_HEIGHT; y += 16) {
+        for (int x = 0; x < SCREEN_WIDTH; x += 16) ScreenRect(s, x, y, 16, 16, (uint8_t)(((x ^ y) >> 4) & 1 ? 17 : 18));
+    }
+    ScreenRect(s, 0, 0, SCREEN_WIDTH, 12, 0);
+}
+
+// a player and a score
+static void Still(Screen *s, int frame)
+{
+    Background(s);
+    ScreenRect(s, 4, 2, (frame/3)%100, 8, 200);
+    ScreenCircle(s, 160 + 80*((frame%120) < 60 ? (frame%60)/60.0 : 1 - (frame%60)/60.0), 140, 10, 42);
+}
+
+static void Scattered(Screen *s, int frame)
+{
+    (void)frame;
+    Background(s);
+    for (int i = 0; i < 60; i++) ScreenRect(s, (int)Random(SCREEN_WIDTH), (int)Random(SCREEN_HEIGHT), 3, 3, (uint8_t)Random(256));
+}
+
+// a scrolling pattern, nothing stays put
+static void Scrolling(Screen *s, int frame)
+{
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) s->pixels[y*SCREEN_WIDTH + x] = (uint8_t)(((x + frame) >> 3) + ((y*y) >> 7));
+    }
+    for (int i = 0; i < 20; i++) ScreenCircle(s, Random(SCREEN_WIDTH), Random(SCREEN_HEIGHT), 6, (uint8_t)Random(256));
+}
+
+typedef struct {
+    const char *name;
+    void (*draw)(Screen *s, int frame);
+} Scene;
+
+static const Scene scenes[] = {
+    { "still", Still },
+    { "scattered", Scattered },
+    { "scrolling", Scrolling },
+};
+
+int main(int argc, char **argv)
+{
+    int keep = (argc > 1) && (strcmp(argv[1], "--keep")==0);
+    SetTraceLogLevel(LOG_WARNING);
+    eightbitcolor_init();
+    uint32_t palette[256];
+    for (int i = 0; i < 256; i++) {
+        Color c = eightbitcolor_LUT[i];
+        palette[i] = (uint32_t)c.r|((uint32_t)c.g << 8)|((uint32_t)c.b << 16)|((uint32_t)c.a << 24);
+    }
+
+    static Capture capture;
+    static Screen screen;
+    int failed = 0;
+    printf("%-12s %12s %12s %8s %8s %10s\n", "scene", "hand-over", "encode", "dropped", "frames", "size");
+    for (int n = 0; n < (int)(sizeof(scenes)/sizeof(scenes[0])); n++) {
+        char path[64];
+        if (keep) snprintf(path, sizeof(path), "capture_bench_%s.gif", scenes[n].name);
+        else snprintf(path, sizeof(path), "capture_bench.gif");
+        if (!CaptureStart(&capture, path, palette, 0)) {
+            fprintf(stderr, "can't write %s\n", path);
+            return 1;
+        }
+        double next = TimerNow();
+        for (int frame = 0; frame < FRAMES; frame++) {
+            ScreenInit(&screen);
+            scenes[n].draw(&screen, frame);
+            CaptureFrame(&capture, &screen);
+            next += 1.0/60.0;
+            double left = next - TimerNow();
+            if (left > 0) TimerSleep(left);
+        }
+        CaptureStop(&capture);
+        uint64_t encoded = capture.frames - capture.dropped;
+        printf("%-12s %9.1f us %9.3f ms %8llu %8llu %7.0f KB%s\n", scenes[n].name, capture.copy_seconds*1e6/capture.frames,
+            encoded ? capture.encode_seconds*1000.0/encoded : 0.0, (unsigned long long)capture.dropped,
+            (unsigned long long)capture.written, capture.bytes/1024.0, capture.dropped ? "  FELL BEHIND" : "");
+        if (capture.dropped || capture.failed) failed = 1;
+    }
+    if (!keep) remove("capture_bench.gif");
+    return failed;
+}
@@ -0,0 +1,12 @@
+--! snd 0 ../../resources/coin.wav
+--! music 1 ../../resources/ambient.ogg
+-- Benchmark: music plus a steady stream of sound effects, all four channels busy
+local t = 0
+music(1)
+function doframe()
+    cls(0)
+    t = t + 1
+    if t % 3 == 0 then sfx(0) end
+    if t % 20 == 0 then sfx(0, 3) end
+    print("frame " .. tostring(t), 1, 1, 255)
+end
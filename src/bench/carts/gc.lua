@@ -0,0 +1,16 @@
+--! meta memlimit=32M
+-- Benchmark: allocation churn, lots of short lived tables and strings every frame
+local keep = {}
+local t = 0
+function update()
+    t = t + 1
+    for i = 1, 2000 do
+        local p = { x = i, y = t, name = "particle" .. tostring(i) }
+        if i % 50 == 0 then keep[#keep + 1] = p end
+    end
+    if #keep > 5000 then keep = {} end
+end
+function draw()
+    cls(0)
+    print("kept " .. tostring(#keep) .. ", " .. tostring(mem() // 1024) .. "K", 1, 1, 255)
+end
@@ -0,0 +1,11 @@
+-- Benchmark: reads and writes through pix(), a whole screen's worth a frame
+local t = 0
+function doframe()
+    t = t + 1
+    for y = 0, 239 do
+        for x = 0, 319 do
+            local c = pix(x, y)
+            pix(x, y, (c + x + y + t) % 256)
+        end
+    end
+end
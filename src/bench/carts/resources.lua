@@ -0,0 +1,12 @@
+--! bin 0 ../../resources/ambient.ogg
+--! bin 1 ../../resources/coin.wav
+-- Benchmark: pulling big resources out of the cart and chewing through them
+local t = 0
+function doframe()
+    cls(0)
+    t = t + 1
+    local blob = get_resource(t % 2)
+    local sum = 0
+    for i = 1, #blob, 64 do sum = sum + blob:byte(i) end
+    print(tostring(#blob) .. " bytes, sum " .. tostring(sum), 1, 1, 255)
+end
@@ -0,0 +1,20 @@
+-- Benchmark: filled and outlined shapes all over the screen, every frame
+local N = 1500
+local shapes = {}
+for i = 1, N do
+    shapes[i] = { math.random(-16, 335), math.random(-16, 255), math.random(2, 24), math.random(0, 255) }
+end
+local t = 0
+function doframe()
+    cls(0)
+    t = t + 1
+    for i = 1, N do
+        local s = shapes[i]
+        local x, y = (s[1] + t) % 352 - 16, s[2]
+        if i % 4 == 0 then circ(x, y, s[3] // 2, s[4])
+        elseif i % 4 == 1 then rect(x, y, s[3], s[3], s[4])
+        elseif i % 4 == 2 then rectb(x, y, s[3], s[3], s[4])
+        else line(x, y, x + s[3], y + s[3] // 2, s[4]) end
+    end
+    tri(160, 10, 20, 230, 300, 230, t % 256)
+end
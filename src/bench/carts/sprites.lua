@@ -0,0 +1,22 @@
+--! grph 0 ../../resources/mecha.png
+-- Benchmark: lots of sprites, some scaled, flipped and rotated
+local mecha = define_spr(0, 0, 0, 128, 128, 0)
+local small = define_spr(0, 32, 32, 32, 32, 0)
+local N = 400
+local actors = {}
+for i = 1, N do
+    actors[i] = { x = math.random(0, 319), y = math.random(0, 239), dx = math.random(-3, 3), dy = math.random(-3, 3) }
+end
+local t = 0
+function doframe()
+    cls(1)
+    t = t + 1
+    for i = 1, N do
+        local a = actors[i]
+        a.x = (a.x + a.dx) % 320
+        a.y = (a.y + a.dy) % 240
+        if i % 8 == 0 then spr(small, a.x, a.y, 2, 0, t * 3 % 360)
+        else spr(small, a.x, a.y, 1, i % 4) end
+    end
+    spr(mecha, 96, 56, 1, 0, t % 360)
+end
@@ -0,0 +1,9 @@
+--! song 0 synth.song
+-- Benchmark: the synth playing an eight voice song under a light frame
+local t = 0
+song(0)
+function doframe()
+    cls(0)
+    t = t + 1
+    print("frame " .. tostring(t), 1, 1, 255)
+end
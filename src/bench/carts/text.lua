@@ -0,0 +1,17 @@
+--! font 1 ../../resources/mecha.png
+-- Benchmark: a screen full of text, most of it different every frame, in two fonts
+local words = { "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do" }
+local t = 0
+function doframe()
+    cls(0)
+    t = t + 1
+    for row = 0, 14 do
+        local line = {}
+        for i = 1, 8 do line[i] = words[(row * 8 + i + t) % #words + 1] end
+        local s = table.concat(line, " ")
+        if row % 2 == 1 then font(1) else font() end
+        print(s, 320 - textwidth(s) - (t % 16), row * 16, (row * 17 + t) % 256)
+    end
+    font()
+    print("frame " .. tostring(t), 1, 1, 255)
+end
@@ -0,0 +1,164 @@
+// VM farm benchmark
+// Runs each cart once on its own, then as 2, 4 and 8 separate VMs at the same time, one
+// thread each, the way a test farm would pack carts into a process. Reports frames a
+// second across all of them and how that scales. Every VM gets the same seed and no
+// input, so every one of them has to end on the same screen as the lone run did; any
+// that doesn't gets flagged and the exit code says so.
+// The font's loaded once and shared (nothing writes to it). Audio's off: there's only
+// one sound card, and the null device's mixer thread per VM would just get in the way.
+// Usage: farm_bench [--frames N] cart.rom...
+// Loads resources/matchup_pro.png, so run it from src/. Build with `make bench` in src/,
+// `make benchcarts` builds the carts in bench/carts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "../eightbitcolor.h"
+#include "../lua_api.h"
+#include "../thread.h"
+#include "../timer.h"
+
+#define FRAMES 600
+#define MAX_INSTANCES 8
+#define SEED 0x4E585553
+
+static const int instanceCounts[] = { 2, 4, 8 };
+
+typedef struct {
+    const char *path;
+    int frames;
+    NeXUS_VM *vm;
+    Thread thread;
+    int threaded;
+    uint64_t hash;              // of the last frame's screen
+    int failed;
+} Instance;
+
+static ScreenFont font;
+
+void ErrorScreen(NeXUS_VM *failed, const char *msg)
+{
+    fprintf(stderr, "error: %s\n", msg);
+    failed->should_close = 1;
+}
+
+// Everything nexus.c sets up for a headless run, minus the window, the audio and the input
+static NeXUS_VM *Boot(const char *path)
+{
+    NeXUS_VM *vm = calloc(1, sizeof(NeXUS_VM));
+    if (vm==NULL) return NULL;
+    vm->headless = 1;
+    vm->seed = SEED;
+    vm->font = font;
+    ScreenInit(&vm->screen);
+    TextCacheInit(&vm->text_cache, TEXT_CACHE_BUDGET);
+    LayoutCacheInit(&vm->layout_cache);
+    AudioInit(&vm->audio, AUDIO_OFF, NULL);
+    vm->controls.repeat_delay = DEFAULT_REPEAT_DELAY;
+    vm->controls.repeat_rate = DEFAULT_REPEAT_RATE;
+    vm->cart = LoadCart((char *)path);
+    InitLua(vm);
+    LoadString(vm->L, (char *)vm->cart->code, vm->cart->code_size);
+    if (DoCall(vm->L, 0, 0)!=LUA_OK) {
+        ErrorScreen(vm, lua_tostring(vm->L, -1));
+        lua_pop(vm->L, 1);
+    }
+    return vm;
+}
+
+static void Shutdown(NeXUS_VM *vm)
+{
+    AudioClose(&vm->audio);
+    TextCacheClear(&vm->text_cache);
+    LayoutCacheClear(&vm->layout_cache);
+    CloseLua(vm);
+    FreeCart(vm->cart);
+    free(vm);
+}
+
+static void RunInstance(void *arg)
+{
+    Instance *in = arg;
+    NeXUS_VM *vm = in->vm;
+    int update = IsGlobalFunction(vm, "update");
+    for (int frame = 0; (frame < in->frames) && !vm->should_close; frame++) {
+        RunTasks(vm);
+        if (update) {
+            CallGlobal(vm, "update");
+            CallGlobal(vm, "draw");
+        } else {
+            CallGlobal(vm, "doframe");
+        }
+    }
+    in->hash = ScreenHash(&vm->screen);
+    in->failed = vm->should_close;
+}
+
+// frames a second across all of them
+static double Run(Instance *instances, int count, const char *path, int frames)
+{
+    for (int i = 0; i < count; i++) {
+        instances[i] = (Instance){ path, frames, Boot(path), { 0 }, 0, 0, 0 };
+        if (instances[i].vm==NULL) {
+            fprintf(stderr, "out of memory for %d VMs\n", count);
+            exit(1);
+        }
+    }
+    double start = TimerNow();
+    for (int i = 0; i < count; i++) {
+        instances[i].threaded = ThreadStart(&instances[i].thread, RunInstance, &instances[i]);
+        if (!instances[i].threaded) RunInstance(&instances[i]);
+    }
+    for (int i = 0; i < count; i++) if (instances[i].threaded) ThreadJoin(&instances[i].thread);
+    double elapsed = TimerNow() - start;
+    for (int i = 0; i < count; i++) Shutdown(instances[i].vm);
+    return (double)count*frames/elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = FRAMES;
+    const char **carts = malloc(argc*sizeof(char *));
+    int cartCount = 0;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--frames")==0) && (i + 1 < argc)) frames = atoi(argv[++i]);
+        else carts[cartCount++] = argv[i];
+    }
+    if (cartCount==0) {
+        fprintf(stderr, "usage: farm_bench [--frames N] cart.rom...\n");
+        return 1;
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    eightbitcolor_init();
+    Image fontImage = LoadImage("resources/matchup_pro.png");
+    ImageFormat(&fontImage, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    int fontLoaded = LoadScreenFont(&font, fontImage.data, fontImage.width, fontImage.height, 32, 16);
+    UnloadImage(fontImage);
+    if (!fontLoaded) {
+        fprintf(stderr, "can't load the font\n");
+        return 1;
+    }
+
+    static Instance instances[MAX_INSTANCES];
+    int failed = 0;
+    printf("%-24s %6s %12s %8s  %s\n", "cart", "VMs", "frames/s", "scaling", "output");
+    for (int c = 0; c < cartCount; c++) {
+        const char *name = strrchr(carts[c], '/') ? strrchr(carts[c], '/') + 1 : carts[c];
+        double base = Run(instances, 1, carts[c], frames);
+        uint64_t reference = instances[0].hash;
+        if (instances[0].failed) failed = 1;
+        printf("%-24s %6d %12.0f %7.2fx  %s\n", name, 1, base, 1.0, instances[0].failed ? "ERRORED" : "reference");
+        for (int n = 0; n < (int)(sizeof(instanceCounts)/sizeof(instanceCounts[0])); n++) {
+            int count = instanceCounts[n];
+            double rate = Run(instances, count, carts[c], frames);
+            int same = 1;
+            for (int i = 0; i < count; i++) same = same && !instances[i].failed && (instances[i].hash==reference);
+            if (!same) failed = 1;
+            printf("%-24s %6d %12.0f %7.2fx  %s\n", name, count, rate, rate/base, same ? "identical" : "DIFFERENT");
+        }
+    }
+    UnloadScreenFont(&font);
+    free(carts);
+    return failed;
+}
@@ -0,0 +1,100 @@
+// Frame hash benchmark
+// Times ScreenHash (SIMD where there is any), the same hash done a byte at a time, and
+// the FNV-1a it replaced, over a noisy screen and a mostly flat one, and reports frames
+// hashed a second and GB/s. Checks as it goes that the SIMD and plain versions agree on
+// every screen, and that flipping any one pixel (every pixel, one bit at a time, in a
+// sample of bits) changes the hash; either failing gets flagged and the exit code says so.
+// No window or files needed. Build with `make bench` in src/.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../screen.h"
+#include "../timer.h"
+
+#define ITERATIONS 4000
+#define PASSES 3                    // best of
+
+static uint32_t state = 0x4E585553;
+
+static uint32_t Random(void)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static uint64_t HashFNV(const Screen *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(s->pixels); i++) h = (h ^ s->pixels[i])*0x100000001b3ULL;
+    return h;
+}
+
+static volatile uint64_t sink;
+
+// seconds per frame, best of PASSES
+static double Time(uint64_t (*hash)(const Screen *), const Screen *s)
+{
+    double best = 1e9;
+    for (int pass = 0; pass < PASSES; pass++) {
+        double start = TimerNow();
+        uint64_t h = 0;
+        for (int i = 0; i < ITERATIONS; i++) h ^= hash(s);
+        double elapsed = (TimerNow() - start)/ITERATIONS;
+        sink = h;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// every pixel, with a bit that goes round, has to move the hash off the original
+static int CheckSingleChanges(Screen *s)
+{
+    uint64_t original = ScreenHash(s);
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(s->pixels); i++) {
+        uint8_t bit = (uint8_t)(1 << (i%8));
+        s->pixels[i] ^= bit;
+        if (ScreenHash(s)==original) {
+            if (failed < 10) printf("  flipping a bit at pixel %zu doesn't change the hash\n", i);
+            failed++;
+        }
+        s->pixels[i] ^= bit;
+    }
+    return failed;
+}
+
+int main(void)
+{
+    static Screen screens[2];
+    const char *names[2] = { "noise", "flat" };
+    for (size_t i = 0; i < sizeof(screens[0].pixels); i++) screens[0].pixels[i] = (uint8_t)Random();
+    memset(screens[1].pixels, 0x11, sizeof(screens[1].pixels));
+    for (int y = 60; y < 80; y++) memset(&screens[1].pixels[y*SCREEN_WIDTH + 100], 0x2A, 40);
+
+    int failed = 0;
+    printf("%s hash, %d byte screens\n", ScreenHashHasSIMD() ? "SIMD" : "plain (no SIMD here)", (int)sizeof(screens[0].pixels));
+    printf("%-8s %-10s %12s %10s %10s\n", "screen", "hash", "frames/s", "GB/s", "vs FNV");
+    for (int n = 0; n < 2; n++) {
+        Screen *s = &screens[n];
+        if (ScreenHash(s)!=ScreenHashPlain(s)) {
+            printf("  %s: SIMD and plain hashes DIFFER\n", names[n]);
+            failed = 1;
+        }
+        double fnv = Time(HashFNV, s);
+        double simd = Time(ScreenHash, s);
+        double plain = Time(ScreenHashPlain, s);
+        double bytes = (double)sizeof(s->pixels);
+        printf("%-8s %-10s %12.0f %10.2f %9.1fx\n", names[n], "ScreenHash", 1.0/simd, bytes/simd/1e9, fnv/simd);
+        printf("%-8s %-10s %12.0f %10.2f %9.1fx\n", names[n], "plain", 1.0/plain, bytes/plain/1e9, fnv/plain);
+        printf("%-8s %-10s %12.0f %10.2f %9.1fx\n", names[n], "FNV-1a", 1.0/fnv, bytes/fnv/1e9, 1.0);
+    }
+    for (int n = 0; n < 2; n++) {
+        int misses = CheckSingleChanges(&screens[n]);
+        printf("%s: single bit flips %s\n", names[n], misses ? "MISSED" : "all caught");
+        if (misses) failed = 1;
+    }
+    return failed;
+}
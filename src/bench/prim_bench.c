@@ -0,0 +1,92 @@
+// Primitive call benchmark
+// Draws the same few thousand primitives every frame through the single-call API
+// (rect/circ/line/pix), the batch API with a flat table, and the batch API with a
+// packed string, and reports the cost per primitive.
+// Everything draws into vm.screen on the CPU, so no display needed. Build with `make bench` in src/.
+
+#include <stdio.h>
+#include "raylib.h"
+#include "../eightbitcolor.h"
+#include "../lua_api.h"
+#include "../timer.h"
+
+#define FRAMES 120
+#define PRIMITIVES 4000
+
+static NeXUS_VM vm = { 0 };
+
+void ErrorScreen(NeXUS_VM *failed, const char *msg)
+{
+    fprintf(stderr, "error: %s\n", msg);
+    failed->should_close = 1;
+}
+
+static const char *setup =
+    "N = ...\n"
+    "local function rnd(n) return math.random(0, n - 1) end\n"
+    "rect_t, circ_t, line_t, pix_t = {}, {}, {}, {}\n"
+    "local rect_p, circ_p, line_p, pix_p = {}, {}, {}, {}\n"
+    "for i = 1, N do\n"
+    "    local x, y, c = rnd(320), rnd(240), rnd(256)\n"
+    "    table.move({ x, y, 8, 8, c }, 1, 5, #rect_t + 1, rect_t)\n"
+    "    table.move({ x, y, 4, c }, 1, 4, #circ_t + 1, circ_t)\n"
+    "    table.move({ x, y, x + 10, y + 5, c }, 1, 5, #line_t + 1, line_t)\n"
+    "    table.move({ x, y, c }, 1, 3, #pix_t + 1, pix_t)\n"
+    "    rect_p[i] = string.pack('<hhhhB', x, y, 8, 8, c)\n"
+    "    circ_p[i] = string.pack('<hhhB', x, y, 4, c)\n"
+    "    line_p[i] = string.pack('<hhhhB', x, y, x + 10, y + 5, c)\n"
+    "    pix_p[i] = string.pack('<hhB', x, y, c)\n"
+    "end\n"
+    "rect_s, circ_s, line_s, pix_s = table.concat(rect_p), table.concat(circ_p), table.concat(line_p), table.concat(pix_p)\n"
+    "function single_rect() local t = rect_t for i = 1, #t, 5 do rect(t[i], t[i+1], t[i+2], t[i+3], t[i+4]) end end\n"
+    "function single_circ() local t = circ_t for i = 1, #t, 4 do circ(t[i], t[i+1], t[i+2], t[i+3]) end end\n"
+    "function single_line() local t = line_t for i = 1, #t, 5 do line(t[i], t[i+1], t[i+2], t[i+3], t[i+4]) end end\n"
+    "function single_pix() local t = pix_t for i = 1, #t, 3 do pix(t[i], t[i+1], t[i+2]) end end\n"
+    "function table_rect() rects(rect_t) end\n"
+    "function table_circ() circs(circ_t) end\n"
+    "function table_line() lines(line_t) end\n"
+    "function table_pix() pset(pix_t) end\n"
+    "function packed_rect() rects(rect_s) end\n"
+    "function packed_circ() circs(circ_s) end\n"
+    "function packed_line() lines(line_s) end\n"
+    "function packed_pix() pset(pix_s) end\n";
+
+static double Measure(const char *func)
+{
+    double total = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        double start = TimerNow();
+        CallGlobal(&vm, (char *)func);
+        total += TimerNow() - start;
+    }
+    return total*1e9/((double)FRAMES*PRIMITIVES);
+}
+
+int main(void)
+{
+    SetTraceLogLevel(LOG_WARNING);
+    eightbitcolor_init();
+    ScreenInit(&vm.screen);
+    vm.cart = MemAlloc(sizeof(Cart));
+    InitLua(&vm);
+    lua_State *L = vm.L;
+    luaL_loadstring(L, setup);
+    lua_pushinteger(L, PRIMITIVES);
+    if (DoCall(L, 1, 0)!=LUA_OK) {
+        fprintf(stderr, "setup: %s\n", lua_tostring(L, -1));
+        return 1;
+    }
+
+    const char *kinds[] = { "rect", "circ", "line", "pix" };
+    printf("%-6s %14s %14s %14s\n", "prim", "single ns", "table ns", "packed ns");
+    for (int i = 0; i < 4; i++) {
+        double single = Measure(TextFormat("single_%s", kinds[i]));
+        double table = Measure(TextFormat("table_%s", kinds[i]));
+        double packed = Measure(TextFormat("packed_%s", kinds[i]));
+        printf("%-6s %14.1f %14.1f %14.1f\n", kinds[i], single, table, packed);
+    }
+
+    CloseLua(&vm);
+    MemFree(vm.cart);
+    return 0;
+}
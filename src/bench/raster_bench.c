@@ -0,0 +1,162 @@
+// Tile raster benchmark
+// Draws the same heavy frames straight into the screen, then through the tiles on 1, 2,
+// 4 and 8 threads, and reports recording and flushing time per frame and the speedup
+// over drawing straight in. Every run has to come out byte for byte the same as the
+// straight one; any that doesn't gets flagged and the exit code says so.
+// Scenes: lots of small primitives all over, a few hundred big ones piled on top of each
+// other, and the small ones again under a clip rect that keeps moving.
+// Only the flush splits up, so from the one thread run each scene also gets how many
+// cores the tiles would need to break even if the flush shared out perfectly
+// (record + flush/cores = straight). That's the estimate to go by on a machine with
+// fewer cores than the runs have threads, where those runs only measure the overhead.
+// No window or files needed. Build with `make bench` in src/.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "../raster.h"
+#include "../timer.h"
+
+#define FRAMES 60
+#define PASSES 3                    // best of
+
+static const int threadCounts[] = { 1, 2, 4, 8 };
+
+static ScreenFont font;
+static ScreenImage sprite;
+static uint8_t spritePixels[16*16];
+
+static uint32_t state;
+
+static uint32_t Random(uint32_t n)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state%n;
+}
+
+static void Small(Raster *r, Screen *s, int frame)
+{
+    for (int i = 0; i < 4000; i++) {
+        int x = (int)Random(352) - 16 + frame;
+        int y = (int)Random(272) - 16;
+        uint8_t c = (uint8_t)Random(256);
+        switch (i%8) {
+            case 0: RasterRect(r, s, x, y, 4 + Random(12), 4 + Random(12), c); break;
+            case 1: RasterRectLines(r, s, x, y, 4 + Random(12), 4 + Random(12), c); break;
+            case 2: RasterCircle(r, s, x + 0.5, y + 0.25, 2 + Random(6), c); break;
+            case 3: RasterCircleLines(r, s, x, y, 2 + Random(6), c); break;
+            case 4: RasterLine(r, s, x, y, x + (int)Random(24) - 12, y + (int)Random(24) - 12, c); break;
+            case 5: RasterTriangle(r, s, x, y, x + 10.5, y + 3, x + 2, y + 12.75, c); break;
+            case 6: RasterPixel(r, s, x, y, c); break;
+            case 7: RasterBlit(r, s, &sprite, x, y, 1, (int)Random(4), 0); break;
+        }
+    }
+    for (int i = 0; i < 40; i++) RasterText(r, s, NULL, &font, "SCORE 0012345\nLIVES 3", (int)Random(300), (int)Random(230), (uint8_t)Random(256));
+}
+
+static void Large(Raster *r, Screen *s, int frame)
+{
+    for (int i = 0; i < 300; i++) {
+        double x = Random(320) + frame*0.5;
+        double y = Random(240);
+        uint8_t c = (uint8_t)Random(256);
+        switch (i%4) {
+            case 0: RasterTriangle(r, s, x, y, x - 150 + Random(300), y - 100 + Random(200), Random(320), Random(240), c); break;
+            case 1: RasterCircle(r, s, x, y, 20 + Random(60), c); break;
+            case 2: RasterRect(r, s, (int)x - 60, (int)y - 40, 120, 80, c); break;
+            case 3: RasterBlit(r, s, &sprite, x - 40, y - 40, 5, 0, Random(360)); break;
+        }
+    }
+}
+
+static void Clipped(Raster *r, Screen *s, int frame)
+{
+    for (int i = 0; i < 8; i++) {
+        ScreenClip(s, (frame*3 + i*37)%300 - 20, i*30 - 10, 120, 60);
+        Small(r, s, frame);
+    }
+    ScreenNoClip(s);
+}
+
+typedef void (*Scene)(Raster *r, Screen *s, int frame);
+
+// whole seconds recording and flushing over FRAMES frames, best of PASSES
+static void Run(Raster *r, Screen *s, Scene scene, double *record, double *flush)
+{
+    *record = *flush = 1e30;
+    for (int pass = 0; pass < PASSES; pass++) {
+        double recording = 0;
+        double flushing = 0;
+        ScreenInit(s);
+        for (int frame = 0; frame < FRAMES; frame++) {
+            state = 0x4E585553;
+            double start = TimerNow();
+            RasterClear(r, s, 0);
+            scene(r, s, frame);
+            double recorded = TimerNow();
+            RasterFlush(r, s);
+            recording += recorded - start;
+            flushing += TimerNow() - recorded;
+        }
+        if (recording + flushing < *record + *flush) {
+            *record = recording;
+            *flush = flushing;
+        }
+    }
+}
+
+int main(void)
+{
+    SetTraceLogLevel(LOG_WARNING);
+
+    // a made up font (8 pixels of 5 wide glyphs) and sprite, so there's nothing to load
+    uint8_t packed[8 + 96 + 96*8];
+    memset(packed, 0, sizeof(packed));
+    packed[0] = 32;
+    packed[2] = 96;
+    packed[4] = 8;
+    packed[5] = 9;
+    state = 12345;
+    for (int i = 0; i < 96; i++) packed[8 + i] = 6;
+    for (int i = 0; i < 96*8; i++) packed[8 + 96 + i] = (uint8_t)Random(32);
+    if (!LoadPackedScreenFont(&font, packed, sizeof(packed))) {
+        fprintf(stderr, "can't make the font\n");
+        return 1;
+    }
+    for (int i = 0; i < 16*16; i++) spritePixels[i] = (uint8_t)((i%7==0) ? 0 : (i*13)&0xFF);
+    sprite = (ScreenImage){ 16, 16, spritePixels, 0 };
+
+    const char *names[] = { "small", "large", "clipped" };
+    Scene scenes[] = { Small, Large, Clipped };
+    static Screen straight, tiled;
+    int failed = 0;
+    printf("cores here: %d\n", CoreCount());
+    printf("%-8s %8s %11s %11s %11s %8s  %s\n", "scene", "threads", "record ms", "flush ms", "frame ms", "speedup", "output");
+    for (int i = 0; i < 3; i++) {
+        Raster r;
+        double record, flush;
+        RasterInit(&r, 0);
+        Run(&r, &straight, scenes[i], &record, &flush);
+        double base = (record + flush)*1000.0/FRAMES;
+        double breakEven = 0;
+        printf("%-8s %8s %11.3f %11s %11.3f %8s  %s\n", names[i], "straight", record*1000.0/FRAMES, "-", base, "1.00x", "reference");
+        for (int t = 0; t < (int)(sizeof(threadCounts)/sizeof(threadCounts[0])); t++) {
+            int got = RasterInit(&r, threadCounts[t]);
+            Run(&r, &tiled, scenes[i], &record, &flush);
+            RasterFree(&r);
+            double ms = (record + flush)*1000.0/FRAMES;
+            if (got==1) breakEven = (record < base*FRAMES/1000.0) ? flush/(base*FRAMES/1000.0 - record) : 0;
+            int same = memcmp(straight.pixels, tiled.pixels, sizeof(straight.pixels))==0;
+            if (!same) failed = 1;
+            printf("%-8s %8d %11.3f %11.3f %11.3f %7.2fx  %s\n", names[i], got, record*1000.0/FRAMES, flush*1000.0/FRAMES, ms, base/ms,
+                same ? "identical" : "DIFFERENT");
+        }
+        if (breakEven > 0) printf("%-8s breaks even at about %.1f cores\n", names[i], breakEven);
+        else printf("%-8s never breaks even (recording alone costs more than drawing straight in)\n", names[i]);
+    }
+    UnloadScreenFont(&font);
+    return failed;
+}
@@ -0,0 +1,79 @@
+// Scheduler benchmark
+// 10k tasks that mostly sleep (1-10 seconds at a time), run for a minute of frames,
+// once through spawn()/wait() and once the way carts do it today: a Lua table of
+// coroutines that all get resumed every frame and check their own timers.
+// Build with `make bench` in src/, no window needed.
+
+#include <stdio.h>
+#include <time.h>
+#include "../lua/lua.h"
+#include "../lua/lauxlib.h"
+#include "../lua/lualib.h"
+#include "../sched.h"
+
+#define TASKS 10000
+#define FRAMES 3600
+
+static const char *luaSide =
+    "local N = ...\n"
+    "frame, woke = 0, 0\n"
+    "math.randomseed(1234)\n"
+    "local cos = {}\n"
+    "for i = 1, N do\n"
+    "    cos[i] = coroutine.create(function()\n"
+    "        while true do\n"
+    "            local wake = frame + math.random(60, 600)\n"
+    "            while frame < wake do coroutine.yield() end\n"
+    "            woke = woke + 1\n"
+    "        end\n"
+    "    end)\n"
+    "end\n"
+    "function tick() frame = frame + 1 for i = 1, #cos do coroutine.resume(cos[i]) end end\n";
+
+static const char *nativeSide =
+    "local N = ...\n"
+    "woke = 0\n"
+    "math.randomseed(1234)\n"
+    "for i = 1, N do\n"
+    "    spawn(function()\n"
+    "        while true do\n"
+    "            wait(math.random(60, 600))\n"
+    "            woke = woke + 1\n"
+    "        end\n"
+    "    end)\n"
+    "end\n";
+
+static void Run(const char *name, const char *code, int native)
+{
+    lua_State *L = luaL_newstate();
+    luaL_openlibs(L);
+    OpenScheduler(L);
+    luaL_loadstring(L, code);
+    lua_pushinteger(L, TASKS);
+    if (lua_pcall(L, 1, 0, 0)!=LUA_OK) {
+        fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+        lua_close(L);
+        return;
+    }
+    clock_t start = clock();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        if (native) lua_pushcfunction(L, SchedulerTick);
+        else lua_getglobal(L, "tick");
+        if (lua_pcall(L, 0, 0, 0)!=LUA_OK) {
+            fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+            break;
+        }
+    }
+    double elapsed = (double)(clock() - start)/CLOCKS_PER_SEC;
+    lua_getglobal(L, "woke");
+    printf("%-8s %10.1f us/frame %10lld wakeups\n", name, elapsed*1e6/FRAMES, (long long)lua_tointeger(L, -1));
+    lua_close(L);
+}
+
+int main(void)
+{
+    printf("%d tasks, %d frames\n", TASKS, FRAMES);
+    Run("lua", luaSide, 0);
+    Run("native", nativeSide, 1);
+    return 0;
+}
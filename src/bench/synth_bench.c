@@ -0,0 +1,107 @@
+// Synth benchmark
+// Renders a cart's song offline, once through its orders, with the SIMD loop and with
+// the plain C one, and reports how much faster than real time each went and how many
+// voice-samples a second that is. Both should come out the same; the biggest difference
+// between them gets printed too. No audio device involved.
+// Usage: synth_bench cart.rom [song id] [--wav out.wav]
+// Build with `make bench` in src/, `make benchcarts` builds bench/carts/synth.rom.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "raylib.h"
+#include "../cart.h"
+#include "../synth.h"
+#include "../timer.h"
+
+#define BLOCK AUDIO_BUFFER_FRAMES   // what the mixer asks for at a time
+#define PASSES 5                    // best of
+
+static float *Render(const SynthSong *song, int simd, size_t frames, double *seconds)
+{
+    float *out = malloc(frames*sizeof(float));
+    *seconds = 1e30;
+    for (int pass = 0; pass < PASSES; pass++) {
+        Synth synth;
+        SynthInit(&synth, AUDIO_SAMPLE_RATE);
+        synth.simd = simd;
+        SynthPlay(&synth, song, 0);
+        double start = TimerNow();
+        for (size_t i = 0; i < frames; i += BLOCK) {
+            int n = (frames - i < BLOCK) ? (int)(frames - i) : BLOCK;
+            if (!SynthRender(&synth, out + i, n)) memset(out + i, 0, n*sizeof(float));
+        }
+        double elapsed = TimerNow() - start;
+        if (elapsed < *seconds) *seconds = elapsed;
+    }
+    return out;
+}
+
+static void WriteWav(const char *path, const float *samples, size_t frames)
+{
+    FILE *f = fopen(path, "wb");
+    if (f==NULL) {
+        fprintf(stderr, "can't write %s\n", path);
+        return;
+    }
+    AudioWriteWavHeader(f, frames);
+    for (size_t i = 0; i < frames; i++) {
+        float s = samples[i]*32767.0f;
+        int16_t v = (int16_t)((s > 32767.0f) ? 32767.0f : ((s < -32768.0f) ? -32768.0f : s));
+        int16_t frame[2] = { v, v };
+        fwrite(frame, sizeof(frame), 1, f);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    const char *romPath = NULL, *wavPath = NULL;
+    uint32_t id = 0;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--wav")==0) && (i + 1 < argc)) wavPath = argv[++i];
+        else if (romPath==NULL) romPath = argv[i];
+        else id = (uint32_t)strtoul(argv[i], NULL, 10);
+    }
+    if (romPath==NULL) {
+        fprintf(stderr, "usage: synth_bench cart.rom [song id] [--wav out.wav]\n");
+        return 1;
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    Cart *cart = LoadCart((char *)romPath);
+    Cart_Song *entry = cart->songs;
+    while ((entry!=NULL) && (entry->id!=id)) entry = entry->next;
+    if (entry==NULL) {
+        fprintf(stderr, "%s has no song %u\n", romPath, id);
+        FreeCart(cart);
+        return 1;
+    }
+    const SynthSong *song = &entry->song;
+    double length = SynthSongLength(song);
+    size_t frames = (size_t)(length*AUDIO_SAMPLE_RATE) + AUDIO_SAMPLE_RATE/2; // plus a bit for the releases
+    printf("song %u: %d voices, %.2f s, %zu samples\n", id, song->channels, length, frames);
+
+    double plainSeconds, simdSeconds;
+    float *plain = Render(song, 0, frames, &plainSeconds);
+    float *simd = Render(song, SynthHasSIMD(), frames, &simdSeconds);
+    float diff = 0.0f;
+    for (size_t i = 0; i < frames; i++) {
+        float d = fabsf(plain[i] - simd[i]);
+        if (d > diff) diff = d;
+    }
+
+    double audio = (double)frames/AUDIO_SAMPLE_RATE;
+    double voiceSamples = (double)frames*song->channels;
+    printf("%-6s %12s %14s %18s\n", "loop", "ms", "x realtime", "voice-samples/s");
+    printf("%-6s %12.2f %14.1f %18.3e\n", "plain", plainSeconds*1000.0, audio/plainSeconds, voiceSamples/plainSeconds);
+    printf("%-6s %12.2f %14.1f %18.3e\n", SynthHasSIMD() ? "simd" : "simd*", simdSeconds*1000.0, audio/simdSeconds, voiceSamples/simdSeconds);
+    if (!SynthHasSIMD()) printf("* no SSE2 or NEON in this build, both ran the plain loop\n");
+    printf("max difference %g\n", diff);
+
+    if (wavPath!=NULL) WriteWav(wavPath, simd, frames);
+    free(plain);
+    free(simd);
+    FreeCart(cart);
+    return 0;
+}
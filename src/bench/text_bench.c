@@ -0,0 +1,103 @@
+// Text measuring benchmark
+// textwidth() throughput on HUD-ish ASCII, on text with some UTF-8 in it, and through
+// the Lua API the way centering code calls it, against the old way of measuring
+// (decode every codepoint, look up every glyph).
+// Loads resources/matchup_pro.png, so run it from src/. Build with `make bench` in src/, no window needed.
+
+#include <stdio.h>
+#include <string.h>
+#include "raylib.h"
+#include "../eightbitcolor.h"
+#include "../lua_api.h"
+#include "../timer.h"
+
+#define CALLS 2000000
+
+static NeXUS_VM vm = { 0 };
+
+void ErrorScreen(NeXUS_VM *failed, const char *msg)
+{
+    fprintf(stderr, "error: %s\n", msg);
+    failed->should_close = 1;
+}
+
+// what ScreenTextWidth did before the advance table
+static int DecodingTextWidth(const ScreenFont *font, const char *text)
+{
+    int widest = 0;
+    int width = 0;
+    while (*text) {
+        int bytes = 0;
+        int codepoint = ScreenNextCodepoint(text, &bytes);
+        text += bytes;
+        if (codepoint=='\n') {
+            if (width > widest) widest = width;
+            width = 0;
+            continue;
+        }
+        width += font->glyphs[ScreenGlyphIndex(font, codepoint)].width;
+    }
+    return (width > widest) ? width : widest;
+}
+
+static void Measure(const char *name, const char *text)
+{
+    size_t length = strlen(text);
+    volatile int sink = 0;
+    double start = TimerNow();
+    for (int i = 0; i < CALLS; i++) sink += DecodingTextWidth(&vm.font, text);
+    double decoding = TimerNow() - start;
+    start = TimerNow();
+    for (int i = 0; i < CALLS; i++) sink += ScreenTextWidth(&vm.font, text);
+    double table = TimerNow() - start;
+    if (DecodingTextWidth(&vm.font, text)!=ScreenTextWidth(&vm.font, text)) printf("%s: widths differ!\n", name);
+    printf("%-8s %6zu %12.1f %12.1f %12.1f %12.1f\n", name, length,
+        decoding*1e9/CALLS, table*1e9/CALLS, length*(double)CALLS/decoding/1e6, length*(double)CALLS/table/1e6);
+}
+
+static const char *luaSide =
+    "local N, s = ...\n"
+    "local w = 0\n"
+    "for i = 1, N do w = w + textwidth(s) end\n"
+    "return w\n";
+
+int main(void)
+{
+    SetTraceLogLevel(LOG_WARNING);
+    eightbitcolor_init();
+    Image fontImage = LoadImage("resources/matchup_pro.png");
+    ImageFormat(&fontImage, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    if (!LoadScreenFont(&vm.font, fontImage.data, fontImage.width, fontImage.height, 32, 16)) {
+        fprintf(stderr, "can't load resources/matchup_pro.png\n");
+        return 1;
+    }
+    UnloadImage(fontImage);
+
+    printf("%-8s %6s %12s %12s %12s %12s\n", "text", "bytes", "decode ns", "table ns", "decode MB/s", "table MB/s");
+    Measure("hud", "SCORE: 0012345");
+    Measure("title", "NeXUS");
+    Measure("para", "The quick brown fox jumps over the lazy dog.\nPack my box with five dozen liquor jugs.\nSphinx of black quartz, judge my vow.");
+    Measure("utf8", "Gr\xc3\xbc\xc3\x9f" "e aus K\xc3\xb6ln \xe2\x86\x92 caf\xc3\xa9 na\xc3\xafve \xe2\x9c\x93");
+
+    vm.cart = MemAlloc(sizeof(Cart));
+    InitLua(&vm);
+    lua_State *L = vm.L;
+    const char *strings[] = { "SCORE: 0012345", "NeXUS" };
+    for (int i = 0; i < 2; i++) {
+        luaL_loadstring(L, luaSide);
+        lua_pushinteger(L, CALLS/4);
+        lua_pushstring(L, strings[i]);
+        double start = TimerNow();
+        if (DoCall(L, 2, 1)!=LUA_OK) {
+            fprintf(stderr, "lua: %s\n", lua_tostring(L, -1));
+            return 1;
+        }
+        double elapsed = TimerNow() - start;
+        lua_pop(L, 1);
+        printf("lua textwidth(\"%s\"): %.1f ns/call\n", strings[i], elapsed*1e9/(CALLS/4));
+    }
+    CloseLua(&vm);
+    MemFree(vm.cart);
+    UnloadScreenFont(&vm.font);
+    return 0;
+}
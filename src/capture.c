@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "capture.h"
+#include "timer.h"
+
+#define LZW_CLEAR 256
+#define LZW_END 257
+#define LZW_MAX_CODES 4096
+
+//----------------------------------------------------------------------------------
+// Output
+//----------------------------------------------------------------------------------
+static void Put(Capture *c, const void *data, size_t size)
+{
+    if (fwrite(data, 1, size, c->file)!=size) c->failed = 1;
+    c->bytes += size;
+}
+
+static void Put16(Capture *c, int v)
+{
+    uint8_t b[2] = { (uint8_t)(v & 0xFF), (uint8_t)((v >> 8) & 0xFF) };
+    Put(c, b, 2);
+}
+
+// the encoded frame waits here until its delay's known
+static void Pend(Capture *c, const void *data, size_t size)
+{
+    if (c->pending_size + size > c->pending_capacity) {
+        size_t capacity = c->pending_capacity ? c->pending_capacity : 64*1024;
+        while (capacity < c->pending_size + size) capacity *= 2;
+        uint8_t *grown = realloc(c->pending, capacity);
+        if (grown==NULL) {
+            c->failed = 1;
+            return;
+        }
+        c->pending = grown;
+        c->pending_capacity = capacity;
+    }
+    memcpy(c->pending + c->pending_size, data, size);
+    c->pending_size += size;
+}
+
+// hundredths of a second, rounded, at the start of frame n
+static uint64_t Centiseconds(uint64_t n)
+{
+    return (n*100 + CAPTURE_FRAME_RATE/2)/CAPTURE_FRAME_RATE;
+}
+
+// The pending frame, now it's known how long it stays up
+static void WritePending(Capture *c)
+{
+    if (!c->has_pending) return;
+    uint64_t delay = Centiseconds(c->clock) - Centiseconds(c->pending_start);
+    if (delay > 0xFFFF) delay = 0xFFFF;
+    // graphic control: disposal 1 (leave it up for the next frame to draw over), no transparency
+    uint8_t control[8] = { 0x21, 0xF9, 4, 1 << 2, (uint8_t)(delay & 0xFF), (uint8_t)(delay >> 8), 0, 0 };
+    Put(c, control, sizeof(control));
+    Put(c, c->pending, c->pending_size);
+    c->pending_size = 0;
+    c->has_pending = 0;
+    c->written++;
+}
+
+//----------------------------------------------------------------------------------
+// LZW
+//----------------------------------------------------------------------------------
+// Codes go out least significant bit first, in sub-blocks of up to 255 bytes
+typedef struct {
+    Capture *c;
+    uint32_t bits;
+    int count;
+    uint8_t block[256];         // length, then the bytes
+} BitWriter;
+
+static void PutCode(BitWriter *w, int code, int size)
+{
+    w->bits |= (uint32_t)code << w->count;
+    w->count += size;
+    while (w->count >= 8) {
+        w->block[++w->block[0]] = (uint8_t)(w->bits & 0xFF);
+        w->bits >>= 8;
+        w->count -= 8;
+        if (w->block[0]==255) {
+            Pend(w->c, w->block, 256);
+            w->block[0] = 0;
+        }
+    }
+}
+
+static void EndCodes(BitWriter *w)
+{
+    if (w->count > 0) PutCode(w, 0, 8 - w->count);
+    if (w->block[0] > 0) Pend(w->c, w->block, w->block[0] + 1);
+    uint8_t end = 0;
+    Pend(w->c, &end, 1);
+}
+
+static inline uint32_t LZWSlot(uint32_t key)
+{
+    return (key*2654435761u) >> (32 - 13); // CAPTURE_LZW_TABLE is 1 << 13
+}
+
+// Compresses the w x h rectangle of pixels at (x, y), 8 bit codes to start
+static void Compress(Capture *c, const uint8_t *pixels, int x, int y, int w, int h)
+{
+    BitWriter out = { c, 0, 0, { 0 } };
+    uint8_t minimum = 8;
+    Pend(c, &minimum, 1);
+    memset(c->lzw_keys, 0, sizeof(c->lzw_keys));
+    int size = 9;
+    int next = LZW_END + 1;
+    PutCode(&out, LZW_CLEAR, size);
+
+    int prefix = pixels[y*SCREEN_WIDTH + x];
+    int first = 1;
+    for (int row = y; row < y + h; row++) {
+        const uint8_t *p = pixels + row*SCREEN_WIDTH + x;
+        for (int i = first; i < w; i++) {
+            uint32_t key = ((uint32_t)prefix << 8 | p[i]) + 1;
+            uint32_t slot = LZWSlot(key);
+            while ((c->lzw_keys[slot]!=0) && (c->lzw_keys[slot]!=key)) slot = (slot + 1) & (CAPTURE_LZW_TABLE - 1);
+            if (c->lzw_keys[slot]==key) {
+                prefix = c->lzw_codes[slot];
+                continue;
+            }
+            PutCode(&out, prefix, size);
+            if (next < LZW_MAX_CODES) {
+                // the decoder's a code behind, so it widens as it adds the code that needs it
+                if (next==(1 << size)) size++;
+                c->lzw_keys[slot] = key;
+                c->lzw_codes[slot] = (uint16_t)next++;
+            } else {
+                PutCode(&out, LZW_CLEAR, size);
+                memset(c->lzw_keys, 0, sizeof(c->lzw_keys));
+                size = 9;
+                next = LZW_END + 1;
+            }
+            prefix = p[i];
+        }
+        first = 0;
+    }
+    PutCode(&out, prefix, size);
+    PutCode(&out, LZW_END, size);
+    EndCodes(&out);
+}
+
+//----------------------------------------------------------------------------------
+// Encoder
+//----------------------------------------------------------------------------------
+// Bounding box of what's different from what's up, 0 if nothing is
+static int ChangedRect(const uint8_t *a, const uint8_t *b, int *x, int *y, int *w, int *h)
+{
+    int top = 0, bottom = SCREEN_HEIGHT - 1;
+    while ((top < SCREEN_HEIGHT) && (memcmp(a + top*SCREEN_WIDTH, b + top*SCREEN_WIDTH, SCREEN_WIDTH)==0)) top++;
+    if (top==SCREEN_HEIGHT) return 0;
+    while (memcmp(a + bottom*SCREEN_WIDTH, b + bottom*SCREEN_WIDTH, SCREEN_WIDTH)==0) bottom--;
+    int left = SCREEN_WIDTH, right = -1;
+    for (int row = top; row <= bottom; row++) {
+        const uint8_t *pa = a + row*SCREEN_WIDTH, *pb = b + row*SCREEN_WIDTH;
+        int l = 0, r = SCREEN_WIDTH - 1;
+        while ((l < left) && (pa[l]==pb[l])) l++;
+        while ((r > right) && (pa[r]==pb[r])) r--;
+        if (l < left) left = l;
+        if (r > right) right = r;
+    }
+    *x = left;
+    *y = top;
+    *w = right - left + 1;
+    *h = bottom - top + 1;
+    return 1;
+}
+
+static void Encode(Capture *c, const CaptureSlot *slot)
+{
+    double start = TimerNow();
+    c->clock += slot->frames - 1; // what's up stayed up through any dropped
+    int x = 0, y = 0, w = SCREEN_WIDTH, h = SCREEN_HEIGHT;
+    if (c->has_pending) {
+        // too soon after the last one to be seen, or nothing to see: it just stays up longer
+        int changed = ChangedRect(c->previous, slot->pixels, &x, &y, &w, &h);
+        if (!changed || (Centiseconds(c->clock) - Centiseconds(c->pending_start) < CAPTURE_MIN_DELAY)) {
+            c->clock++;
+            c->encode_seconds += TimerNow() - start;
+            return;
+        }
+        WritePending(c);
+    }
+    // image descriptor, then the pixels
+    uint8_t descriptor[10] = { 0x2C, (uint8_t)(x & 0xFF), (uint8_t)(x >> 8), (uint8_t)(y & 0xFF), (uint8_t)(y >> 8),
+        (uint8_t)(w & 0xFF), (uint8_t)(w >> 8), (uint8_t)(h & 0xFF), (uint8_t)(h >> 8), 0 };
+    Pend(c, descriptor, sizeof(descriptor));
+    Compress(c, slot->pixels, x, y, w, h);
+    for (int row = y; row < y + h; row++) memcpy(c->previous + row*SCREEN_WIDTH + x, slot->pixels + row*SCREEN_WIDTH + x, (size_t)w);
+    c->pending_start = c->clock;
+    c->has_pending = 1;
+    c->clock++;
+    c->encode_seconds += TimerNow() - start;
+}
+
+// Takes the slots in order as they're handed in. There's a post per slot and one more
+// from CaptureStop, which is the only one that can find nothing there.
+static void EncodeThread(void *arg)
+{
+    Capture *c = arg;
+    for (;;) {
+        SemaphoreWait(&c->ready);
+        uint32_t tail = c->tail;
+        if (tail==AtomicLoad(&c->head)) break;
+        Encode(c, &c->slots[tail%CAPTURE_QUEUE]);
+        AtomicStore(&c->tail, tail + 1);
+        if (c->wait) SemaphorePost(&c->freed);
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Capture
+//----------------------------------------------------------------------------------
+int CaptureStart(Capture *c, const char *path, const uint32_t *palette, int wait)
+{
+    CaptureSlot *slots = malloc(CAPTURE_QUEUE*sizeof(CaptureSlot));
+    FILE *f = (slots!=NULL) ? fopen(path, "wb") : NULL;
+    if (f==NULL) {
+        free(slots);
+        return 0;
+    }
+    memset(c, 0, sizeof(Capture));
+    c->file = f;
+    c->slots = slots;
+    c->wait = wait;
+    snprintf(c->path, sizeof(c->path), "%s", path);
+
+    // header, the screen with a 256 color table (that's the palette, once), and loop forever
+    Put(c, "GIF89a", 6);
+    Put16(c, SCREEN_WIDTH);
+    Put16(c, SCREEN_HEIGHT);
+    uint8_t screen[3] = { 0xF7, 0, 0 };
+    Put(c, screen, 3);
+    for (int i = 0; i < 256; i++) {
+        uint8_t rgb[3] = { (uint8_t)(palette[i] & 0xFF), (uint8_t)((palette[i] >> 8) & 0xFF), (uint8_t)((palette[i] >> 16) & 0xFF) };
+        Put(c, rgb, 3);
+    }
+    Put(c, "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+
+    c->threaded = SemaphoreInit(&c->ready);
+    if (c->threaded && !SemaphoreInit(&c->freed)) {
+        SemaphoreDestroy(&c->ready);
+        c->threaded = 0;
+    }
+    if (c->threaded && !ThreadStart(&c->thread, EncodeThread, c)) {
+        SemaphoreDestroy(&c->ready);
+        SemaphoreDestroy(&c->freed);
+        c->threaded = 0;
+    }
+    TraceLog(LOG_INFO, "CAPTURE: Recording to %s%s", path, c->threaded ? "" : " (no thread, encoding as it goes)");
+    return 1;
+}
+
+void CaptureFrame(Capture *c, const Screen *s)
+{
+    if (c->file==NULL) return;
+    double start = TimerNow();
+    c->frames++;
+    uint32_t head = c->head;
+    // (a post per slot freed, so there's always one to come while it's full)
+    while (c->wait && (head - AtomicLoad(&c->tail) >= CAPTURE_QUEUE)) SemaphoreWait(&c->freed);
+    if (head - AtomicLoad(&c->tail) >= CAPTURE_QUEUE) {
+        c->waiting++;
+        c->dropped++;
+        c->copy_seconds += TimerNow() - start;
+        return;
+    }
+    CaptureSlot *slot = &c->slots[head%CAPTURE_QUEUE];
+    memcpy(slot->pixels, s->pixels, sizeof(slot->pixels));
+    slot->frames = 1 + c->waiting;
+    c->waiting = 0;
+    c->copy_seconds += TimerNow() - start;
+    if (!c->threaded) {
+        Encode(c, slot);
+        return;
+    }
+    AtomicStore(&c->head, head + 1);
+    SemaphorePost(&c->ready);
+}
+
+void CaptureStop(Capture *c)
+{
+    if (c->file==NULL) return;
+    if (c->threaded) {
+        SemaphorePost(&c->ready);
+        ThreadJoin(&c->thread);
+        SemaphoreDestroy(&c->ready);
+        SemaphoreDestroy(&c->freed);
+    }
+    c->clock += c->waiting; // the last one stays up for any dropped after it
+    WritePending(c);
+    uint8_t trailer = 0x3B;
+    Put(c, &trailer, 1);
+    if (fclose(c->file)!=0) c->failed = 1;
+    c->file = NULL;
+
+    if (c->failed) TraceLog(LOG_WARNING, "CAPTURE: Couldn't write all of %s", c->path);
+    else TraceLog(LOG_INFO, "CAPTURE: Wrote %s, %.1f s in %llu GIF frames, %.0f KB", c->path, (double)c->clock/CAPTURE_FRAME_RATE,
+        (unsigned long long)c->written, c->bytes/1024.0);
+    if (c->frames > c->dropped) {
+        TraceLog(LOG_INFO, "CAPTURE: %.3f ms a frame to hand over, %.3f ms to encode, %llu of %llu dropped", c->copy_seconds*1000.0/c->frames,
+            c->encode_seconds*1000.0/(double)(c->frames - c->dropped), (unsigned long long)c->dropped, (unsigned long long)c->frames);
+    }
+    free(c->slots);
+    free(c->pending);
+    c->slots = NULL;
+    c->pending = NULL;
+    c->pending_size = c->pending_capacity = 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include "screen.h"
+#include "thread.h"
+
+// GIF capture
+// The screen is 256 palette indices already, which is exactly what a GIF holds, so a
+// capture is the frames as they are plus the palette once. Ctrl+G starts and stops one
+// (nexus_<date>_<time>.gif in the working directory), --gif PATH records the whole run.
+//
+// All the frame loop does is copy the shown frame into a slot of a CAPTURE_QUEUE frame
+// ring. A thread of its own does everything else: crops each frame to the rectangle
+// that changed since the last one it put in the file (what's outside stays up, disposal
+// "leave it"), LZW compresses that and writes it out. If the encoder falls a whole ring
+// behind, frames get dropped rather than making the cart wait; the last one before a
+// drop stays up for their time too, so the GIF keeps real time either way. Running
+// unthrottled (headless, replays) there's no real time to keep, so with wait on the frame
+// loop waits for a slot instead and every frame goes in. Without threads (the web) it
+// all happens on the spot.
+//
+// GIF delays are hundredths of a second, and most viewers slow anything under
+// CAPTURE_MIN_DELAY down to a tenth. So a frame that would leave the one before it up
+// for less than that gets left out (the next one crops against what's up, so nothing it
+// changed is lost), and so does one identical to what's up. At 60 fps that's every third
+// frame left out and 2-3/100 s each, which plays at the right speed everywhere.
+
+#define CAPTURE_QUEUE 64            // frames, about a second
+#define CAPTURE_MIN_DELAY 2         // hundredths of a second
+#define CAPTURE_FRAME_RATE 60       // every frame handed in is a 60th of a second
+#define CAPTURE_LZW_TABLE 8192      // hash slots, twice the 4096 codes GIF has
+
+typedef struct {
+    uint8_t pixels[SCREEN_WIDTH*SCREEN_HEIGHT];
+    uint32_t frames;            // this one, and any dropped right before it
+} CaptureSlot;
+
+typedef struct {
+    FILE *file;                 // NULL = not capturing
+    char path[512];
+    CaptureSlot *slots;
+    volatile uint32_t head;     // slots handed in, the frame loop's to write
+    volatile uint32_t tail;     // slots encoded, the encoder's to write
+    uint32_t waiting;           // frames dropped since the last one that made it in
+    int wait;                   // wait for a slot rather than drop
+    Semaphore ready;            // a post per slot handed in
+    Semaphore freed;            // and per slot encoded, with wait on
+    Thread thread;
+    int threaded;
+    // the encoder's (the frame loop's again once it's stopped)
+    uint8_t previous[SCREEN_WIDTH*SCREEN_HEIGHT];   // what the file shows so far
+    uint64_t clock;             // frames covered so far
+    uint64_t pending_start;     // the last frame encoded waits for its delay, it goes out when the next one's known
+    uint8_t *pending;
+    size_t pending_size, pending_capacity;
+    int has_pending;
+    uint32_t lzw_keys[CAPTURE_LZW_TABLE];   // prefix code << 8 | byte, + 1 (0 = empty)
+    uint16_t lzw_codes[CAPTURE_LZW_TABLE];
+    // what happened
+    uint64_t frames;            // handed in
+    uint64_t dropped;           // the ring was full
+    uint64_t written;           // GIF frames
+    uint64_t bytes;
+    double copy_seconds;        // the frame loop's part
+    double encode_seconds;
+    int failed;                 // a write went wrong
+} Capture;
+
+int CaptureStart(Capture *c, const char *path, const uint32_t *palette, int wait); // palette as 0xAABBGGRR; 0 if it can't
+void CaptureFrame(Capture *c, const Screen *s);     // does nothing when not capturing
+void CaptureStop(Capture *c);                       // waits for the encoder to catch up, finishes the file and logs it
+static inline int Capturing(const Capture *c) { return c->file!=NULL; }
@@ -2,11 +2,40 @@
 #include "cart.h"
 #include "eightbitcolor.h"
 #include "riff.h"
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 
 FourCC _CODE = {'C','O','D','E'};
 FourCC _GRPH = {'G','R','P','H'};
 FourCC _BIN = {'B', 'I', 'N', ' '};
+FourCC _META = {'M','E','T','A'};
+FourCC _FONT = {'F','O','N','T'};
+FourCC _SND = {'S','N','D',' '};
+FourCC _SONG = {'S','O','N','G'};
+FourCC _MUS = {'M','U','S',' '};
+
+// "65536", "512K", "64M", ...; 0 for anything else (junk after it, no digits, a sign,
+// or too big for a size_t)
+size_t ParseSize(const char *str)
+{
+    if ((str==NULL) || (*str < '0') || (*str > '9')) return 0; // (strtoull would take "-1" and " 1")
+    char *end = NULL;
+    errno = 0;
+    unsigned long long size = strtoull(str, &end, 10);
+    if (errno==ERANGE) return 0;
+    unsigned long long unit = 1;
+    if ((*end=='k') || (*end=='K')) unit = 1024ULL;
+    else if ((*end=='m') || (*end=='M')) unit = 1024ULL*1024ULL;
+    else if ((*end=='g') || (*end=='G')) unit = 1024ULL*1024ULL*1024ULL;
+    if (unit > 1) end++;
+    while ((*end==' ') || (*end=='\t')) end++;
+    if (*end!='\0') return 0;
+    if ((size > ULLONG_MAX/unit) || (size*unit > SIZE_MAX)) return 0;
+    return (size_t)(size*unit);
+}
 
 void CartChunkWalker(Cart *cart, RIFF_Chunk *chunk)
 {
@@ -29,31 +58,51 @@ void CartChunkWalker(Cart *cart, RIFF_Chunk *chunk)
             }
         }
         if (riff_fourcc_equals(chunk->type,_GRPH)) {
+            // u32 id, width and height, then the pixels
+            if (chunk->size < 12) {
+                TraceLog(LOG_WARNING, "CART: Graphics chunk is only %u bytes, skipping it", (unsigned)chunk->size);
+                return;
+            }
             uint32_t id = ((uint32_t*)chunk->contains.data)[0];
             uint32_t width = ((uint32_t*)chunk->contains.data)[1];
             uint32_t height = ((uint32_t*)chunk->contains.data)[2];
-            if ((width*height)>(chunk->size-12)) {
+            // (in 64 bits, so a header can't wrap round to something small)
+            uint64_t pixels = (uint64_t)width*height;
+            size_t limit = (cart->memory_limit && (cart->memory_limit < CART_MAX_PAGE_PIXELS)) ? cart->memory_limit : CART_MAX_PAGE_PIXELS;
+            if (pixels > limit) {
+                TraceLog(LOG_WARNING, "CART: Graphics chunk %u is %ux%u, more than the %zu pixels a page can have, skipping it", id, width, height, limit);
+                return;
+            }
+            size_t available = chunk->size - 12;
+            if (pixels > available) {
                 TraceLog(LOG_WARNING, "CART: Truncated graphics chunk; will read all the pixels I can");
             }
-            Image img = GenImageColor(width, height, (Color){255,0,255,255});
-            int x = 0;
-            int y = 0;
-            for (int i=12;i<chunk->size;++i) {
-                ImageDrawPixel(&img, x, y, eightbitcolor_LUT[chunk->contains.data[i]&0xFF]);
-                if ((++x)==width) {
-                    x = 0;
-                    ++y;
-                }
+            // pages stay as palette indices, same as the screen (anything missing comes out magenta)
+            uint8_t *data = MemAlloc(pixels ? (unsigned int)pixels : 1);
+            if (data==NULL) {
+                TraceLog(LOG_WARNING, "CART: No memory for graphics chunk %u (%ux%u), skipping it", id, width, height);
+                return;
             }
+            memset(data, eightbitcolor_nearest((Color){255,0,255,255}), (size_t)pixels);
+            memcpy(data, chunk->contains.data + 12, (available < pixels) ? available : (size_t)pixels);
             Cart_GraphicsPage *grph = MemAlloc(sizeof(Cart_GraphicsPage));
+            if (grph==NULL) {
+                MemFree(data);
+                return;
+            }
             grph->id = id;
             grph->width = width;
             grph->height = height;
-            grph->img = img;
+            grph->pixels = data;
             grph->next = cart->graphics;
             cart->graphics = grph;
+            cart->asset_bytes += sizeof(Cart_GraphicsPage) + (size_t)pixels;
         }
         if (riff_fourcc_equals(chunk->type,_BIN)) {
+            if (chunk->size < 4) {
+                TraceLog(LOG_WARNING, "CART: Binary chunk is only %u bytes, skipping it", (unsigned)chunk->size);
+                return;
+            }
             uint32_t id = ((uint32_t*)chunk->contains.data)[0];
             Cart_Blob *blob = MemAlloc(sizeof(Cart_Blob));
             blob->id = id;
@@ -62,6 +111,75 @@ void CartChunkWalker(Cart *cart, RIFF_Chunk *chunk)
             memcpy(blob->data,chunk->contains.data+4,blob->size);
             blob->next = cart->blobs;
             cart->blobs = blob;
+            cart->asset_bytes += sizeof(Cart_Blob) + blob->size;
+        }
+        if (riff_fourcc_equals(chunk->type,_FONT)) {
+            // u32 id, then a packed font (see screen.h), kept 1 bit per pixel
+            uint32_t id = (chunk->size >= 4) ? ((uint32_t*)chunk->contains.data)[0] : 0;
+            Cart_Font *font = MemAlloc(sizeof(Cart_Font));
+            if ((chunk->size < 4) || !LoadPackedScreenFont(&font->font, chunk->contains.data + 4, chunk->size - 4)) {
+                TraceLog(LOG_WARNING, "CART: Font chunk %u is broken, skipping it", id);
+                MemFree(font);
+            } else {
+                font->id = id;
+                font->next = cart->fonts;
+                cart->fonts = font;
+                cart->asset_bytes += sizeof(Cart_Font) + ScreenFontBytes(&font->font);
+            }
+        }
+        if (riff_fourcc_equals(chunk->type,_SND)) {
+            // u32 id, then a sound file, decoded up front so the mixer never has to
+            uint32_t id = (chunk->size >= 4) ? ((uint32_t*)chunk->contains.data)[0] : 0;
+            Cart_Sound *snd = MemAlloc(sizeof(Cart_Sound));
+            if ((chunk->size < 4) || !LoadAudioSound(&snd->sound, chunk->contains.data + 4, chunk->size - 4)) {
+                TraceLog(LOG_WARNING, "CART: Can't decode sound chunk %u, skipping it", id);
+                MemFree(snd);
+            } else {
+                snd->id = id;
+                snd->next = cart->sounds;
+                cart->sounds = snd;
+                cart->asset_bytes += sizeof(Cart_Sound) + AudioSoundBytes(&snd->sound);
+            }
+        }
+        if (riff_fourcc_equals(chunk->type,_MUS)) {
+            // u32 id, then an OGG or WAV, kept as is and decoded while it plays
+            uint32_t id = (chunk->size >= 4) ? ((uint32_t*)chunk->contains.data)[0] : 0;
+            Cart_Music *mus = MemAlloc(sizeof(Cart_Music));
+            if ((chunk->size < 4) || !LoadAudioMusic(&mus->music, chunk->contains.data + 4, chunk->size - 4)) {
+                TraceLog(LOG_WARNING, "CART: Can't play music chunk %u, skipping it", id);
+                MemFree(mus);
+            } else {
+                mus->id = id;
+                mus->next = cart->music;
+                cart->music = mus;
+                cart->asset_bytes += sizeof(Cart_Music) + AudioMusicBytes(&mus->music);
+            }
+        }
+        if (riff_fourcc_equals(chunk->type,_SONG)) {
+            // u32 id, then a packed song (see synth.h)
+            uint32_t id = (chunk->size >= 4) ? ((uint32_t*)chunk->contains.data)[0] : 0;
+            Cart_Song *song = MemAlloc(sizeof(Cart_Song));
+            if ((chunk->size < 4) || !LoadSynthSong(&song->song, chunk->contains.data + 4, chunk->size - 4)) {
+                TraceLog(LOG_WARNING, "CART: Bad song chunk %u, skipping it", id);
+                MemFree(song);
+            } else {
+                song->id = id;
+                song->next = cart->songs;
+                cart->songs = song;
+                cart->asset_bytes += sizeof(Cart_Song) + SynthSongBytes(&song->song);
+            }
+        }
+        if (riff_fourcc_equals(chunk->type,_META)) {
+            // key=value lines; memlimit is the only key anyone reads so far
+            char *meta = MemAlloc(chunk->size + 1);
+            memcpy(meta, chunk->contains.data, chunk->size);
+            for (char *line = strtok(meta, "\r\n"); line!=NULL; line = strtok(NULL, "\r\n")) {
+                if (strncmp(line, "memlimit=", 9)==0) {
+                    cart->memory_limit = ParseSize(line + 9);
+                    if (cart->memory_limit==0) TraceLog(LOG_WARNING, "CART: Ignoring memlimit=%s, that's not a size (65536, 512K, 64M)", line + 9);
+                }
+            }
+            MemFree(meta);
         }
     }
 }
@@ -88,7 +206,7 @@ Cart *LoadCart(char * filename)
 
 void FreeGraphics(Cart_GraphicsPage *page) {
     if (page->next) FreeGraphics(page->next);
-    UnloadImage(page->img);
+    MemFree(page->pixels);
     MemFree(page);
 }
 
@@ -100,15 +218,61 @@ void FreeBlobs(Cart_Blob *blob) {
 
 void FreeSprites(Cart_Sprites *sprite) {
     if (sprite->next) FreeSprites(sprite->next);
-    UnloadTexture(sprite->texture);
-    UnloadImage(sprite->img);
+    MemFree(sprite->img.pixels);
     MemFree(sprite);
 }
 
+void FreeFonts(Cart_Font *font) {
+    if (font->next) FreeFonts(font->next);
+    UnloadScreenFont(&font->font);
+    MemFree(font);
+}
+
+void FreeSounds(Cart_Sound *snd) {
+    if (snd->next) FreeSounds(snd->next);
+    UnloadAudioSound(&snd->sound);
+    MemFree(snd);
+}
+
+void FreeSongs(Cart_Song *song) {
+    if (song->next) FreeSongs(song->next);
+    UnloadSynthSong(&song->song);
+    MemFree(song);
+}
+
+void FreeMusic(Cart_Music *mus) {
+    if (mus->next) FreeMusic(mus->next);
+    UnloadAudioMusic(&mus->music);
+    MemFree(mus);
+}
+
+void FreeCartSprites(Cart *cart) {
+    for (Cart_Sprites *spr = cart->sprites; spr!=NULL; spr = spr->next) {
+        cart->asset_bytes -= SPRITE_BYTES(spr->img.width, spr->img.height);
+    }
+    if (cart->sprites) FreeSprites(cart->sprites);
+    cart->sprites = NULL;
+}
+
+// Sprites go on the front of the list, so everything before until is newer than it
+void FreeCartSpritesSince(Cart *cart, Cart_Sprites *until) {
+    while ((cart->sprites!=NULL) && (cart->sprites!=until)) {
+        Cart_Sprites *spr = cart->sprites;
+        cart->sprites = spr->next;
+        cart->asset_bytes -= SPRITE_BYTES(spr->img.width, spr->img.height);
+        MemFree(spr->img.pixels);
+        MemFree(spr);
+    }
+}
+
 void FreeCart(Cart *cart) {
     if (cart->code) MemFree(cart->code);
     if (cart->graphics) FreeGraphics(cart->graphics);
     if (cart->blobs) FreeBlobs(cart->blobs);
     if (cart->sprites) FreeSprites(cart->sprites);
+    if (cart->fonts) FreeFonts(cart->fonts);
+    if (cart->sounds) FreeSounds(cart->sounds);
+    if (cart->songs) FreeSongs(cart->songs);
+    if (cart->music) FreeMusic(cart->music);
     MemFree(cart);
 }
\ No newline at end of file
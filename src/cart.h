@@ -1,4 +1,7 @@
 #include "raylib.h"
+#include "screen.h"
+#include "audio.h"
+#include "synth.h"
 #include <stdint.h>
 #include <string.h>
 
@@ -6,7 +9,7 @@ struct Cart_GraphicsPage {
 	uint32_t id;
 	uint32_t width;
 	uint32_t height;
-	Image img;
+	uint8_t *pixels;	// palette indices, width*height
 	struct Cart_GraphicsPage *next;
 };
 
@@ -23,20 +26,63 @@ typedef struct Cart_Blob Cart_Blob;
 
 struct Cart_Sprites {
 	uint32_t id;
-	Image img;
-	Texture2D texture;
+	ScreenImage img;
 	struct Cart_Sprites *next;
 };
 
 typedef struct Cart_Sprites Cart_Sprites;
 
+struct Cart_Font {
+	uint32_t id;
+	ScreenFont font;
+	struct Cart_Font *next;
+};
+
+typedef struct Cart_Font Cart_Font;
+
+struct Cart_Sound {
+	uint32_t id;
+	AudioSound sound;
+	struct Cart_Sound *next;
+};
+
+typedef struct Cart_Sound Cart_Sound;
+
+struct Cart_Song {
+	uint32_t id;
+	SynthSong song;
+	struct Cart_Song *next;
+};
+
+typedef struct Cart_Song Cart_Song;
+
+struct Cart_Music {
+	uint32_t id;
+	AudioMusic music;
+	struct Cart_Music *next;
+};
+
+typedef struct Cart_Music Cart_Music;
+
 typedef struct {
 	unsigned char *code;
 	size_t code_size;
 	Cart_GraphicsPage *graphics;
 	Cart_Blob *blobs;
 	Cart_Sprites *sprites;
+	Cart_Font *fonts;
+	Cart_Sound *sounds;
+	Cart_Song *songs;
+	Cart_Music *music;
+	size_t asset_bytes;	// C-side memory held by graphics/blobs/sprites/fonts/sounds/songs/music, counted against the memory limit
+	size_t memory_limit;	// asked for by the cart's META chunk, 0 if it didn't say
 } Cart;
 
+#define CART_MAX_PAGE_PIXELS (16*1024*1024)	// a graphics page this big or less: a quarter of the default memory limit, and well inside MemAlloc's unsigned int
+#define SPRITE_BYTES(w,h) (sizeof(Cart_Sprites) + (size_t)(w)*(size_t)(h))
+
 Cart *LoadCart(char * filename);
-void FreeCart(Cart *cart);
\ No newline at end of file
+void FreeCart(Cart *cart);	// stop the mixer playing its sounds, songs and music first (AudioStopAll, AudioFlush)
+void FreeCartSprites(Cart *cart);
+void FreeCartSpritesSince(Cart *cart, Cart_Sprites *until);
+size_t ParseSize(const char *str);    // "512K", "64M"...; 0 if it isn't one
\ No newline at end of file
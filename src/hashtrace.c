@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "eightbitcolor.h"
+#include "hashtrace.h"
+#include "timer.h"
+
+uint64_t *LoadHashTrace(const char *path, size_t *count)
+{
+    FILE *f = fopen(path, "rb");
+    if (f==NULL) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (size >= 5) ? malloc((size_t)size) : NULL;
+    if ((data==NULL) || (fread(data, 1, (size_t)size, f)!=(size_t)size) ||
+        (memcmp(data, HASH_TRACE_MAGIC, 4)!=0) || (data[4]!=HASH_TRACE_VERSION)) {
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+    *count = ((size_t)size - 5)/8;   // (a trace cut off mid-hash loses the part)
+    uint64_t *hashes = malloc((*count ? *count : 1)*sizeof(uint64_t));
+    if (hashes!=NULL) {
+        for (size_t i = 0; i < *count; i++) {
+            const uint8_t *p = data + 5 + i*8;
+            uint64_t h = 0;
+            for (int b = 7; b >= 0; b--) h = (h << 8) | p[b];
+            hashes[i] = h;
+        }
+    }
+    free(data);
+    return hashes;
+}
+
+int HashTraceWrite(HashTrace *t, const char *path)
+{
+    t->out = fopen(path, "wb");
+    if (t->out==NULL) return 0;
+    fwrite(HASH_TRACE_MAGIC, 1, 4, t->out);
+    fputc(HASH_TRACE_VERSION, t->out);
+    return 1;
+}
+
+int HashTraceCheck(HashTrace *t, const char *path, const char *diffDir)
+{
+    size_t count = 0;
+    uint64_t *golden = LoadHashTrace(path, &count);
+    if (golden==NULL) return 0;
+    t->golden = golden;
+    t->golden_count = count;
+    t->diff_dir = diffDir;
+    return 1;
+}
+
+static void Dump(HashTrace *t, const Screen *s, uint64_t hash)
+{
+    if ((t->diff_dir==NULL) || (t->dumped >= HASH_TRACE_MAX_DUMPS)) return;
+    uint32_t palette[256];
+    for (int i = 0; i < 256; i++) {
+        Color c = eightbitcolor_LUT[i];
+        palette[i] = (uint32_t)c.r|((uint32_t)c.g << 8)|((uint32_t)c.b << 16)|((uint32_t)c.a << 24);
+    }
+    uint32_t *pixels = malloc(SCREEN_WIDTH*SCREEN_HEIGHT*sizeof(uint32_t));
+    if (pixels==NULL) return;
+    ScreenToRGBA(s, palette, pixels);
+    Image image = { pixels, SCREEN_WIDTH, SCREEN_HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+    char path[1024]; // (not TextFormat, this can be on the pipeline's thread)
+    snprintf(path, sizeof(path), "%s/frame%06llu_%016llx.png", t->diff_dir, (unsigned long long)t->frame, (unsigned long long)hash);
+    if (ExportImage(image, path)) t->dumped++;
+    else TraceLog(LOG_WARNING, "HASH: Can't write %s", path);
+    free(pixels);
+}
+
+void HashTraceFrame(HashTrace *t, const Screen *s)
+{
+    if ((t->out==NULL) && (t->golden==NULL)) return;
+    double start = TimerNow();
+    uint64_t hash = ScreenHash(s);
+    t->seconds += TimerNow() - start;
+    t->frame++;
+    if (t->out!=NULL) {
+        for (int b = 0; b < 8; b++) fputc((int)((hash >> (b*8)) & 0xFF), t->out);
+    }
+    if (t->golden!=NULL) {
+        // frames past the end of the golden trace count as different too
+        if ((t->frame > t->golden_count) || (t->golden[t->frame - 1]!=hash)) {
+            if (t->diverged==0) {
+                t->diverged = t->frame;
+                TraceLog(LOG_WARNING, "HASH: Frame %llu is the first that doesn't match", (unsigned long long)t->frame);
+            }
+            t->mismatches++;
+            Dump(t, s, hash);
+        }
+    }
+}
+
+void HashTraceLog(HashTrace *t)
+{
+    if (t->frame==0) return;
+    TraceLog(LOG_INFO, "HASH: %llu frames hashed, %.3f ms on average", (unsigned long long)t->frame, t->seconds*1000.0/(double)t->frame);
+    if (t->golden==NULL) return;
+    if (t->frame < t->golden_count) TraceLog(LOG_WARNING, "HASH: Stopped %llu frames short of the golden trace", (unsigned long long)(t->golden_count - t->frame));
+    if (t->mismatches==0) TraceLog(LOG_INFO, "HASH: Every frame matches the golden trace");
+    else TraceLog(LOG_WARNING, "HASH: %llu frames differ from the golden trace, from frame %llu on (%d saved)",
+        (unsigned long long)t->mismatches, (unsigned long long)t->diverged, t->dumped);
+}
+
+void HashTraceClose(HashTrace *t)
+{
+    if (t->out!=NULL) fclose(t->out);
+    free((void *)t->golden);
+    memset(t, 0, sizeof(HashTrace));
+}
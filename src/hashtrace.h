@@ -0,0 +1,39 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "screen.h"
+
+// Frame hash traces
+// For checking an optimization didn't change what carts draw, without saving any images:
+// --hashes writes the ScreenHash of every frame to a trace, --golden checks every frame
+// against one made earlier (same cart, same replay) and saves just the frames that came
+// out different as PNGs in --diff-dir. tools/tracecmp compares two traces.
+// The frame hashed is the real one, after the cart and any rewinding, before run-ahead,
+// so traces don't depend on --runahead, --raster-threads or the pipeline.
+//
+// File layout: "NXHT", version byte, then a u64 hash per frame (little endian), from
+// frame 1 on.
+
+#define HASH_TRACE_MAGIC "NXHT"
+#define HASH_TRACE_VERSION 1
+#define HASH_TRACE_MAX_DUMPS 64     // PNGs per run, a cart that's off for good would fill the disk
+
+typedef struct {
+    FILE *out;                  // --hashes
+    const uint64_t *golden;     // --golden
+    size_t golden_count;
+    const char *diff_dir;       // --diff-dir, NULL = don't save any
+    uint64_t frame;             // frames hashed so far
+    uint64_t diverged;          // first frame that didn't match golden (0 = none)
+    uint64_t mismatches;
+    int dumped;
+    double seconds;             // hashing
+} HashTrace;
+
+uint64_t *LoadHashTrace(const char *path, size_t *count);  // NULL if it can't (not there, not a trace)
+int HashTraceWrite(HashTrace *t, const char *path);         // --hashes; 0 if it can't
+int HashTraceCheck(HashTrace *t, const char *path, const char *diffDir); // --golden; 0 if it can't
+void HashTraceFrame(HashTrace *t, const Screen *s);          // every frame, does nothing with neither on
+void HashTraceLog(HashTrace *t);
+void HashTraceClose(HashTrace *t);
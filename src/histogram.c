@@ -0,0 +1,67 @@
+#include "raylib.h"
+#include "histogram.h"
+#include <string.h>
+
+static int BucketFor(double seconds)
+{
+    uint64_t us = (uint64_t)(seconds*1e6);
+    int bucket = 0;
+    while (us && (bucket < HISTOGRAM_BUCKETS - 1)) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// upper edge of a bucket in seconds
+static double BucketEdge(int bucket)
+{
+    return (double)((uint64_t)1 << bucket)/1e6;
+}
+
+void HistogramAdd(Histogram *h, double seconds)
+{
+    h->buckets[BucketFor(seconds)]++;
+    h->count++;
+    h->total += seconds;
+    if (seconds > h->max) h->max = seconds;
+}
+
+void HistogramReset(Histogram *h)
+{
+    const char *name = h->name;
+    memset(h, 0, sizeof(Histogram));
+    h->name = name;
+}
+
+double HistogramPercentile(Histogram *h, double p)
+{
+    if (h->count==0) return 0;
+    uint64_t rank = (uint64_t)(p*(double)h->count);
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) return (i==HISTOGRAM_BUCKETS - 1) ? h->max : BucketEdge(i);
+    }
+    return h->max;
+}
+
+void HistogramLog(Histogram *h)
+{
+    if (h->count==0) {
+        TraceLog(LOG_INFO, "PERF: %s: no samples", h->name);
+        return;
+    }
+    TraceLog(LOG_INFO, "PERF: %s: %llu samples, avg %.3f ms, p50 < %.3f ms, p99 < %.3f ms, max %.3f ms", h->name,
+        (unsigned long long)h->count, h->total*1000.0/h->count, HistogramPercentile(h, 0.5)*1000.0,
+        HistogramPercentile(h, 0.99)*1000.0, h->max*1000.0);
+    uint64_t most = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) if (h->buckets[i] > most) most = h->buckets[i];
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (h->buckets[i]==0) continue;
+        char bar[41] = { 0 };
+        int len = (int)(40*h->buckets[i]/most);
+        memset(bar, '#', len ? len : 1);
+        TraceLog(LOG_INFO, "PERF:     < %9.3f ms |%-40s %llu", BucketEdge(i)*1000.0, bar, (unsigned long long)h->buckets[i]);
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+
+// log2 histogram of durations
+// bucket 0 is under 1us, bucket i is [2^(i-1), 2^i) us, the last one catches everything past that
+#define HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    const char *name;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    double total;   // seconds
+    double max;     // seconds
+} Histogram;
+
+void HistogramAdd(Histogram *h, double seconds);
+void HistogramReset(Histogram *h);
+double HistogramPercentile(Histogram *h, double p);    // upper edge of the bucket p (0-1) falls in, in seconds
+void HistogramLog(Histogram *h);                        // dump through TraceLog
@@ -785,6 +785,13 @@
 ** without modifying the main part of the file.
 */
 
+/*
+** NeXUS: a fixed string hash seed instead of one mixed from the clock and
+** addresses, so iterating a table of strings goes the same way every run
+** (replays depend on it).
+*/
+#define luai_makeseed(L)	((unsigned int)0x4E585553)
+
 
 
 
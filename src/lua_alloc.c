@@ -0,0 +1,386 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lua_alloc.h"
+
+// slab header; pad it out so carved blocks stay 16-byte aligned
+struct LuaAllocSlab {
+    LuaAllocSlab *next;
+    char pad[LUAALLOC_GRANULE - sizeof(void *)];
+};
+
+#define SIZE_CLASS(size) ((((size) + LUAALLOC_GRANULE - 1)/LUAALLOC_GRANULE) - 1)
+#define IS_SMALL(size) ((size)<=LUAALLOC_SMALL_MAX)
+
+void LuaAllocInit(LuaAllocator *a, int pooled)
+{
+    memset(a, 0, sizeof(LuaAllocator));
+    a->pooled = pooled;
+}
+
+int LuaAllocInitArena(LuaAllocator *a, size_t size)
+{
+    LuaAllocInit(a, 1);
+    // only what gets used is ever touched, so the rest never costs real memory
+    size_t units = size/LUAALLOC_LARGE_MIN;
+    size_t mapBytes = (units + LUAALLOC_GRANULE - 1)/LUAALLOC_GRANULE*LUAALLOC_GRANULE;
+    a->arena = malloc(mapBytes + units*LUAALLOC_LARGE_MIN);
+    if (a->arena==NULL) return 0;
+    a->arena_base = a->arena_top = a->arena + mapBytes;
+    a->arena_end = a->arena_base + units*LUAALLOC_LARGE_MIN;
+    return 1;
+}
+
+void LuaAllocRelease(LuaAllocator *a)
+{
+    if (a->arena!=NULL) {
+        free(a->arena);
+        a->arena = a->arena_base = a->arena_top = a->arena_end = NULL;
+        memset(a->large_free_lists, 0, sizeof(a->large_free_lists));
+        memset(a->slabs_with_room, 0, sizeof(a->slabs_with_room));
+    } else {
+        LuaAllocSlab *slab = a->slabs;
+        while (slab!=NULL) {
+            LuaAllocSlab *next = slab->next;
+            free(slab);
+            slab = next;
+        }
+    }
+    a->slabs = NULL;
+    a->carve = a->carve_end = NULL;
+    memset(a->free_lists, 0, sizeof(a->free_lists));
+    a->stats.slab_bytes = 0;
+}
+
+static int LargeClass(size_t size)
+{
+    int sizeClass = 0;
+    while (((size_t)LUAALLOC_LARGE_MIN << sizeClass) < size) sizeClass++;
+    return sizeClass;
+}
+
+//----------------------------------------------------------------------------------
+// Arena mode: buddy blocks
+//----------------------------------------------------------------------------------
+// a free block starts with its links; its map entry is its class + 1, anything else's is 0
+typedef struct ArenaFree {
+    struct ArenaFree *next, *prev;
+} ArenaFree;
+
+#define BLOCK_SIZE(sizeClass) ((size_t)LUAALLOC_LARGE_MIN << (sizeClass))
+#define OFFSET(a, block) ((size_t)((char *)(block) - (a)->arena_base))
+#define MAP(a, offset) ((unsigned char *)(a)->arena_base)[-1 - (ptrdiff_t)((offset)/LUAALLOC_LARGE_MIN)]
+
+static void PushFree(LuaAllocator *a, size_t offset, int sizeClass)
+{
+    ArenaFree *block = (ArenaFree *)(a->arena_base + offset);
+    block->next = a->large_free_lists[sizeClass];
+    block->prev = NULL;
+    if (block->next!=NULL) block->next->prev = block;
+    a->large_free_lists[sizeClass] = block;
+    MAP(a, offset) = (unsigned char)(sizeClass + 1);
+}
+
+static void UnlinkFree(LuaAllocator *a, size_t offset, int sizeClass)
+{
+    ArenaFree *block = (ArenaFree *)(a->arena_base + offset);
+    if (block->prev!=NULL) block->prev->next = block->next;
+    else a->large_free_lists[sizeClass] = block->next;
+    if (block->next!=NULL) block->next->prev = block->prev;
+    MAP(a, offset) = 0;
+}
+
+// merges with its buddy for as long as that's free, and off the top if it ends up there
+static void BuddyFree(LuaAllocator *a, size_t offset, int sizeClass)
+{
+    size_t top = OFFSET(a, a->arena_top);
+    while (sizeClass + 1 < LUAALLOC_LARGE_CLASSES) {
+        size_t buddy = offset ^ BLOCK_SIZE(sizeClass);
+        // (the carved part is all blocks, so the buddy's offset is always some block's start)
+        if ((buddy + BLOCK_SIZE(sizeClass) > top) || (MAP(a, buddy)!=sizeClass + 1)) break;
+        UnlinkFree(a, buddy, sizeClass);
+        offset &= ~BLOCK_SIZE(sizeClass);
+        sizeClass++;
+    }
+    if (offset + BLOCK_SIZE(sizeClass)==top) a->arena_top = a->arena_base + offset; // snapshots get smaller too
+    else PushFree(a, offset, sizeClass);
+}
+
+static void *BuddyAlloc(LuaAllocator *a, int sizeClass)
+{
+    if (sizeClass >= LUAALLOC_LARGE_CLASSES) return NULL;
+    // the smallest free block that's big enough, halved until it's the right size
+    for (int from = sizeClass; from < LUAALLOC_LARGE_CLASSES; from++) {
+        ArenaFree *block = a->large_free_lists[from];
+        if (block==NULL) continue;
+        size_t offset = OFFSET(a, block);
+        UnlinkFree(a, offset, from);
+        while (from > sizeClass) {
+            from--;
+            PushFree(a, offset + BLOCK_SIZE(from), from);
+        }
+        return block;
+    }
+    // none, so a new one off the top; it has to start at a multiple of its size, and
+    // the gap up to there becomes free blocks as big as will line up
+    size_t size = BLOCK_SIZE(sizeClass);
+    size_t top = OFFSET(a, a->arena_top);
+    size_t start = (top + size - 1) & ~(size - 1);
+    size_t capacity = OFFSET(a, a->arena_end);
+    if ((start > capacity) || (size > capacity - start)) return NULL;
+    // (the map down there can have anything in it from before a restore, or a block
+    // that went off the top, and the gap's blocks mustn't see each other as free yet)
+    memset(&MAP(a, start + size - 1), 0, (start + size - top)/LUAALLOC_LARGE_MIN);
+    a->arena_top = a->arena_base + start + size;
+    while (top < start) {
+        int gapClass = 0;
+        while ((top%BLOCK_SIZE(gapClass + 1)==0) && (top + BLOCK_SIZE(gapClass + 1) <= start)) gapClass++;
+        BuddyFree(a, top, gapClass);
+        top += BLOCK_SIZE(gapClass);
+    }
+    return a->arena_base + start;
+}
+
+//----------------------------------------------------------------------------------
+// Arena mode: slabs
+//----------------------------------------------------------------------------------
+// a slab's a buddy block of LUAALLOC_SLAB_SIZE, so any small block finds its slab by rounding down
+typedef struct ArenaSlab {
+    struct ArenaSlab *next, *prev;  // in slabs_with_room, if it's there
+    void *free;                     // its own freed blocks
+    char *carve;                    // never handed out from here to the end
+    uint32_t live;                  // blocks handed out
+    int listed;
+} ArenaSlab;
+
+#define SLAB_HEADER ((sizeof(ArenaSlab) + LUAALLOC_GRANULE - 1)/LUAALLOC_GRANULE*LUAALLOC_GRANULE)
+#define SLAB_OF(a, block) ((ArenaSlab *)((a)->arena_base + (OFFSET(a, block) & ~((size_t)LUAALLOC_SLAB_SIZE - 1))))
+
+static void ListSlab(LuaAllocator *a, ArenaSlab *slab, int sizeClass)
+{
+    slab->prev = NULL;
+    slab->next = a->slabs_with_room[sizeClass];
+    if (slab->next!=NULL) slab->next->prev = slab;
+    a->slabs_with_room[sizeClass] = slab;
+    slab->listed = 1;
+}
+
+static void UnlistSlab(LuaAllocator *a, ArenaSlab *slab, int sizeClass)
+{
+    if (slab->prev!=NULL) slab->prev->next = slab->next;
+    else a->slabs_with_room[sizeClass] = slab->next;
+    if (slab->next!=NULL) slab->next->prev = slab->prev;
+    slab->listed = 0;
+}
+
+static void *ArenaSmallAlloc(LuaAllocator *a, int sizeClass)
+{
+    size_t blockSize = (size_t)(sizeClass + 1)*LUAALLOC_GRANULE;
+    ArenaSlab *slab = a->slabs_with_room[sizeClass];
+    if (slab==NULL) {
+        slab = BuddyAlloc(a, LargeClass(LUAALLOC_SLAB_SIZE));
+        if (slab==NULL) return NULL;
+        memset(slab, 0, sizeof(ArenaSlab));
+        slab->carve = (char *)slab + SLAB_HEADER;
+        ListSlab(a, slab, sizeClass);
+        a->stats.slab_bytes += LUAALLOC_SLAB_SIZE;
+    }
+    void *block = slab->free;
+    if (block!=NULL) {
+        slab->free = *(void **)block;
+        a->stats.class_hits[sizeClass]++;
+    } else {
+        block = slab->carve;
+        slab->carve += blockSize;
+        a->stats.class_carves[sizeClass]++;
+    }
+    slab->live++;
+    if ((slab->free==NULL) && ((size_t)((char *)slab + LUAALLOC_SLAB_SIZE - slab->carve) < blockSize)) UnlistSlab(a, slab, sizeClass);
+    return block;
+}
+
+static void ArenaSmallFree(LuaAllocator *a, void *block, int sizeClass)
+{
+    ArenaSlab *slab = SLAB_OF(a, block);
+    *(void **)block = slab->free;
+    slab->free = block;
+    slab->live--;
+    if (!slab->listed) ListSlab(a, slab, sizeClass);
+    // empty: back to the arena, unless it's all this class has room in (so one
+    // block going back and forth doesn't take a slab with it every time)
+    if ((slab->live==0) && ((a->slabs_with_room[sizeClass]!=slab) || (slab->next!=NULL))) {
+        UnlistSlab(a, slab, sizeClass);
+        BuddyFree(a, OFFSET(a, slab), LargeClass(LUAALLOC_SLAB_SIZE));
+        a->stats.slab_bytes -= LUAALLOC_SLAB_SIZE;
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Both
+//----------------------------------------------------------------------------------
+static void *LargeAlloc(LuaAllocator *a, size_t size)
+{
+    a->stats.large_allocs++;
+    if (a->arena==NULL) return malloc(size);
+    return BuddyAlloc(a, LargeClass(size));
+}
+
+static void LargeFree(LuaAllocator *a, void *block, size_t size)
+{
+    if (a->arena==NULL) free(block);
+    else BuddyFree(a, OFFSET(a, block), LargeClass(size));
+}
+
+static void *SmallAlloc(LuaAllocator *a, int sizeClass)
+{
+    if (a->arena!=NULL) return ArenaSmallAlloc(a, sizeClass);
+    void *block = a->free_lists[sizeClass];
+    if (block!=NULL) {
+        a->free_lists[sizeClass] = *(void **)block;
+        a->stats.class_hits[sizeClass]++;
+        return block;
+    }
+    size_t blockSize = (size_t)(sizeClass + 1)*LUAALLOC_GRANULE;
+    if ((a->carve==NULL) || ((size_t)(a->carve_end - a->carve) < blockSize)) {
+        // whatever's left of the old slab is at most 240 bytes, just leave it
+        LuaAllocSlab *slab = malloc(LUAALLOC_SLAB_SIZE);
+        if (slab==NULL) return NULL;
+        slab->next = a->slabs;
+        a->slabs = slab;
+        a->carve = (char *)(slab + 1);
+        a->carve_end = (char *)slab + LUAALLOC_SLAB_SIZE;
+        a->stats.slab_bytes += LUAALLOC_SLAB_SIZE;
+    }
+    block = a->carve;
+    a->carve += blockSize;
+    a->stats.class_carves[sizeClass]++;
+    return block;
+}
+
+static void SmallFree(LuaAllocator *a, void *block, int sizeClass)
+{
+    if (a->arena!=NULL) {
+        ArenaSmallFree(a, block, sizeClass);
+        return;
+    }
+    *(void **)block = a->free_lists[sizeClass];
+    a->free_lists[sizeClass] = block;
+}
+
+static void *PoolAlloc(LuaAllocator *a, void *ptr, size_t osize, size_t nsize)
+{
+    if (nsize==0) {
+        if (ptr==NULL) return NULL;
+        if (IS_SMALL(osize)) SmallFree(a, ptr, SIZE_CLASS(osize));
+        else LargeFree(a, ptr, osize);
+        return NULL;
+    }
+    if (ptr==NULL) {
+        if (IS_SMALL(nsize)) return SmallAlloc(a, SIZE_CLASS(nsize));
+        return LargeAlloc(a, nsize);
+    }
+    if (IS_SMALL(osize) && IS_SMALL(nsize)) {
+        if (SIZE_CLASS(osize)==SIZE_CLASS(nsize)) return ptr; // still fits
+    } else if (!IS_SMALL(osize) && !IS_SMALL(nsize)) {
+        if (a->arena==NULL) return realloc(ptr, nsize);
+        if (LargeClass(osize)==LargeClass(nsize)) return ptr;
+    }
+    // moving between classes (or between small and large)
+    // NOTE: on failure Lua expects the old block to be left alone, so allocate first
+    void *block = IS_SMALL(nsize) ? SmallAlloc(a, SIZE_CLASS(nsize)) : LargeAlloc(a, nsize);
+    if (block==NULL) return NULL;
+    memcpy(block, ptr, (osize<nsize) ? osize : nsize);
+    if (IS_SMALL(osize)) SmallFree(a, ptr, SIZE_CLASS(osize));
+    else LargeFree(a, ptr, osize);
+    return block;
+}
+
+size_t LuaAllocUsed(LuaAllocator *a)
+{
+    return a->stats.live + ((a->external!=NULL) ? *a->external : 0);
+}
+
+void *LuaAlloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    LuaAllocator *a = (LuaAllocator *)ud;
+    // when ptr is NULL, osize is the type of object being allocated rather than a size
+    if (ptr==NULL) osize = 0;
+
+    // over the limit: fail it, Lua does an emergency collection and then raises a memory error
+    // (shrinking must never fail, so only growth is checked)
+    if (a->limit && (nsize > osize) && ((LuaAllocUsed(a) + (nsize - osize)) > a->limit)) {
+        a->stats.refused_limit++;
+        a->stats.arena_full = 0;
+        return NULL;
+    }
+
+    void *ret = NULL;
+    if (a->pooled) {
+        ret = PoolAlloc(a, ptr, osize, nsize);
+    } else if (nsize==0) {
+        free(ptr);
+    } else {
+        ret = realloc(ptr, nsize);
+    }
+
+    if ((ret==NULL) && (nsize!=0)) {
+        // failed, nothing changed hands (under the limit, so in arena mode it's the arena)
+        if (a->arena!=NULL) {
+            a->stats.refused_arena++;
+            a->stats.arena_full = 1;
+        }
+        return NULL;
+    }
+    a->stats.live = a->stats.live - osize + nsize;
+    if (a->stats.live > a->stats.peak) a->stats.peak = a->stats.live;
+    size_t used = LuaAllocUsed(a);
+    if (used > a->stats.peak_total) a->stats.peak_total = used;
+    return ret;
+}
+
+const char *LuaAllocHeap(const LuaAllocator *a, size_t *size)
+{
+    // the blocks up to arena_top, and the map entries for them just below
+    size_t blocks = (size_t)(a->arena_top - a->arena_base);
+    size_t map = blocks/LUAALLOC_LARGE_MIN;
+    *size = map + blocks;
+    return a->arena_base - map;
+}
+
+int LuaAllocSave(const LuaAllocator *a, LuaAllocSnapshot *s)
+{
+    if (a->arena==NULL) return 0;
+    size_t used = 0;
+    const char *heap = LuaAllocHeap(a, &used);
+    if (used > s->capacity) {
+        char *data = realloc(s->data, used);
+        if (data==NULL) return 0;
+        s->data = data;
+        s->capacity = used;
+    }
+    memcpy(s->data, heap, used);
+    s->size = used;
+    s->allocator = *a;
+    return 1;
+}
+
+void LuaAllocRestore(LuaAllocator *a, const LuaAllocSnapshot *s)
+{
+    // the limit stays whatever it is now, and the stats keep counting except for what's live
+    LuaAllocStats stats = a->stats;
+    size_t limit = a->limit;
+    size_t size = 0;
+    char *heap = (char *)LuaAllocHeap(&s->allocator, &size);
+    memcpy(heap, s->data, size);
+    *a = s->allocator;
+    a->limit = limit;
+    size_t live = a->stats.live, slabBytes = a->stats.slab_bytes;
+    a->stats = stats;
+    a->stats.live = live;
+    a->stats.slab_bytes = slabBytes;
+}
+
+void LuaAllocFreeSnapshot(LuaAllocSnapshot *s)
+{
+    free(s->data);
+    memset(s, 0, sizeof(LuaAllocSnapshot));
+}
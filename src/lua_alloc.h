@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Pool allocator for the Lua state
+// Small blocks (<= LUAALLOC_SMALL_MAX bytes) come out of size-class free lists
+// carved from big slabs; anything bigger goes straight to the system allocator.
+// Every lua_State gets its own LuaAllocator, and a lua_State only ever runs on
+// one thread at a time, so the free lists are effectively thread-local without
+// needing any locking.
+//
+// Arena mode (for run-ahead) takes the slabs and the big blocks out of one block
+// reserved up front instead of the system allocator. Then the whole Lua state is that
+// block's used part plus the bookkeeping in here, always at the same address, so a
+// memcpy saves it and another one puts it back, pointers and all.
+// In there it's a buddy allocator: big blocks round up to a power of two (512 bytes at
+// least), a free one that's bigger than needed gets split, and a freed one merges with
+// its buddy whenever that's free too, so churning through different sizes doesn't use
+// the arena up. Slabs are 64K blocks of it, each for one size class, and go back the
+// moment they're empty (unless it's the only one of its class with room). Which blocks
+// are free is a byte per 512 in a map that grows down from arena_base while the blocks
+// grow up, so the used part is still one piece.
+// Rounding up can make the arena hold up to twice what's live (a 513 byte string takes
+// 1K), which is what it's sized for (see InitLua). A heap that fragments worse than that
+// gets its allocations refused with arena_full set, rather than for the limit.
+
+#define LUAALLOC_GRANULE 16
+#define LUAALLOC_SMALL_MAX 256
+#define LUAALLOC_NUM_CLASSES (LUAALLOC_SMALL_MAX/LUAALLOC_GRANULE)
+#define LUAALLOC_SLAB_SIZE (64*1024)
+#define LUAALLOC_LARGE_MIN (LUAALLOC_SMALL_MAX*2)
+#define LUAALLOC_LARGE_CLASSES 32               // arena mode: 512 bytes, 1K, 2K, ... (a slab is one of them)
+
+typedef struct {
+    size_t live;                                // bytes currently handed out to Lua
+    size_t peak;                                // high water mark of live
+    size_t peak_total;                          // high water mark of live + external
+    size_t slab_bytes;                          // bytes held by slabs (live or not)
+    uint64_t class_hits[LUAALLOC_NUM_CLASSES];  // small allocs served from a free list
+    uint64_t class_carves[LUAALLOC_NUM_CLASSES];// small allocs carved fresh out of a slab
+    uint64_t large_allocs;                      // allocs passed through to the system
+    uint64_t refused_limit;                     // allocations refused for going over the limit
+    uint64_t refused_arena;                     // and for the arena having no block big enough
+    int arena_full;                             // the last one refused was for the arena
+} LuaAllocStats;
+
+typedef struct LuaAllocSlab LuaAllocSlab;
+
+typedef struct {
+    int pooled;                                 // 0 = pass everything through to realloc/free
+    size_t limit;                               // allocations that would grow past this fail, 0 = no limit
+    const size_t *external;                     // other memory counted against the limit (cart assets), may be NULL
+    void *free_lists[LUAALLOC_NUM_CLASSES];
+    LuaAllocSlab *slabs;
+    char *carve;                                // next uncarved byte in the newest slab
+    char *carve_end;
+    char *arena;                                // arena mode, NULL otherwise (the map, then the blocks)
+    char *arena_base;                           // the first block, the map's entries go down from here
+    char *arena_top;                            // past the last block
+    char *arena_end;
+    void *large_free_lists[LUAALLOC_LARGE_CLASSES]; // free buddy blocks of each size
+    void *slabs_with_room[LUAALLOC_NUM_CLASSES];    // arena mode's slabs, by size class
+    LuaAllocStats stats;
+} LuaAllocator;
+
+typedef struct {
+    LuaAllocator allocator;                     // bookkeeping as it was
+    char *data;                                 // the arena's used part (LuaAllocHeap)
+    size_t size;
+    size_t capacity;
+} LuaAllocSnapshot;
+
+void LuaAllocInit(LuaAllocator *a, int pooled);
+int LuaAllocInitArena(LuaAllocator *a, size_t size); // 0 if it can't get the memory
+void LuaAllocRelease(LuaAllocator *a);          // frees every slab (or the arena), only call after lua_close
+size_t LuaAllocUsed(LuaAllocator *a);           // live + external, what the limit is checked against
+void *LuaAlloc(void *ud, void *ptr, size_t osize, size_t nsize);  // lua_Alloc, ud is the LuaAllocator
+
+// arena mode only; the snapshot's buffer grows to fit and gets reused
+const char *LuaAllocHeap(const LuaAllocator *a, size_t *size); // the used part of the arena, all a snapshot keeps
+int LuaAllocSave(const LuaAllocator *a, LuaAllocSnapshot *s);
+void LuaAllocRestore(LuaAllocator *a, const LuaAllocSnapshot *s);
+void LuaAllocFreeSnapshot(LuaAllocSnapshot *s);
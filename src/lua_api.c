@@ -1,9 +1,10 @@
 #include "raylib.h"
 #include "eightbitcolor.h"
-#include "rlgl.h"
 #include "lua_api.h"
-
-lua_State *L;
+#include "lua_alloc.h"
+#include "sched.h"
+#include <time.h>
+#include <math.h>
 
 static const luaL_Reg loadedlibs[] = {
   {LUA_GNAME, luaopen_base},
@@ -17,65 +18,95 @@ static const luaL_Reg loadedlibs[] = {
   {NULL, NULL}
 };
 
-void nullify(const char * global)
+// C-side cart assets share the Lua memory budget
+// (collect first in case garbage is what's in the way)
+static int ReserveAssetMemory(lua_State *L, size_t bytes)
+{
+    NeXUS_VM *vm = VM(L);
+    if (vm->allocator.limit==0) return 1;
+    if ((LuaAllocUsed(&vm->allocator) + bytes) <= vm->allocator.limit) return 1;
+    lua_gc(L, LUA_GCCOLLECT);
+    return (LuaAllocUsed(&vm->allocator) + bytes) <= vm->allocator.limit;
+}
+
+void nullify(lua_State *L, const char * global)
 {
     lua_pushnil(L);
     lua_setglobal(L, global);
 }
 
 // GRAPHICS
+// Everything draws into vm->screen, the indexed framebuffer (see screen.h), through
+// vm->raster, which with --raster-threads holds on to it all until the frame's over (see raster.h)
+
+// coordinates get floored and clamped to something that can't overflow an int
+static int ClampCoord(double v)
+{
+    v = floor(v);
+    if (!(v > -1e8)) return -100000000; // NaN lands here too
+    if (v > 1e8) return 100000000;
+    return (int)v;
+}
+
+static int CheckCoord(lua_State *L, int arg)
+{
+    return ClampCoord(luaL_checknumber(L, arg));
+}
 
 int api_circ(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     double x = luaL_checknumber(L, 1);
     double y = luaL_checknumber(L, 2);
     double rad = luaL_checknumber(L, 3);
     uint8_t color = luaL_checkinteger(L, 4)&0xFF;
-    DrawCircleV((Vector2){x, y}, rad, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    RasterCircle(&vm->raster, &vm->screen, x, y, rad, color);
     return 0;
 }
 
 int api_circb(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     double x = luaL_checknumber(L, 1);
     double y = luaL_checknumber(L, 2);
     double rad = luaL_checknumber(L, 3);
     uint8_t color = luaL_checkinteger(L, 4)&0xFF;
-    DrawCircleLinesV((Vector2){x, y}, rad, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    RasterCircleLines(&vm->raster, &vm->screen, x, y, rad, color);
     return 0;
 }
 
 int api_clip(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     if (lua_isnoneornil(L,1)) {
-        EndScissorMode();
+        ScreenNoClip(&vm->screen);
     } else {
         int x = luaL_checkinteger(L,1);
         int y = luaL_checkinteger(L,2);
         int w = luaL_checkinteger(L,3);
         int h = luaL_checkinteger(L,4);
-        BeginScissorMode(x,y,w,h);
+        ScreenClip(&vm->screen,x,y,w,h);
     }
+    return 0;
 }
 
 int api_cls(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     uint8_t color = luaL_optinteger(L,1,0)&0xFF;
-    ClearBackground(eightbitcolor_LUT[color]);
-    if (HAS_SCREEN()) ImageClearBackground(&vm.screen, eightbitcolor_LUT[color]);
+    RasterClear(&vm->raster, &vm->screen, color);
     return 0;
 }
 
 int api_define_spr(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     uint32_t grph_id = luaL_checkinteger(L,1);
     uint32_t x = luaL_checkinteger(L,2);
     uint32_t y = luaL_checkinteger(L,3);
     uint32_t w = luaL_checkinteger(L,4);
     uint32_t h = luaL_checkinteger(L,5);
-    Cart_GraphicsPage *page = vm.cart->graphics;
+    Cart_GraphicsPage *page = vm->cart->graphics;
     while (page!=NULL && page->id!=grph_id) page = page->next;
     if (page==NULL) luaL_error(L,"no such graphics page %d",grph_id);
     if (x<0 || x>page->width) luaL_error(L, "out of bounds X position");
@@ -84,153 +115,228 @@ int api_define_spr(lua_State *L)
     if (h<1) luaL_error(L, "must have at least 1 height");
     if ((x+w)>page->width) luaL_error(L, "cannot build sprite from X position %d with width %d",x,w);
     if ((y+h)>page->height) luaL_error(L, "cannot build sprite from Y position %d with height %d",y,h);
+    if (!ReserveAssetMemory(L, SPRITE_BYTES(w,h))) luaL_error(L, "not enough memory for a %dx%d sprite",w,h);
     uint32_t spr_id = 0;
-    if (vm.cart->sprites!=NULL) spr_id = vm.cart->sprites->id + 1;
+    if (vm->cart->sprites!=NULL) spr_id = vm->cart->sprites->id + 1;
+    int colorkey = lua_isnoneornil(L, 6) ? -1 : (luaL_checkinteger(L, 6)&0xFF);
     Cart_Sprites *spr = MemAlloc(sizeof(Cart_Sprites));
     spr->id = spr_id;
-    spr->img = ImageFromImage(page->img,(Rectangle){(float)x, (float)y, (float)w, (float)h});
-    if (!lua_isnoneornil(L, 6)) {
-        uint8_t colorkey = luaL_checkinteger(L, 6)&0xFF;
-        for (int y = 0; y<spr->img.height; ++y) {
-            for (int x = 0; x<spr->img.width; ++x) {
-                uint8_t col = eightbitcolor_nearest(GetImageColor(spr->img, x, y));
-                if (col==colorkey) ImageDrawPixel(&spr->img, x, y, (Color){0});
-            }
-        }
+    spr->img.width = w;
+    spr->img.height = h;
+    spr->img.colorkey = colorkey;
+    spr->img.pixels = MemAlloc((size_t)w*h);
+    for (uint32_t row = 0; row < h; ++row) {
+        memcpy(spr->img.pixels + (size_t)row*w, page->pixels + (size_t)(y + row)*page->width + x, w);
     }
-    spr->texture = LoadTextureFromImage(spr->img);
-    spr->next = vm.cart->sprites;
-    vm.cart->sprites = spr;
+    spr->next = vm->cart->sprites;
+    vm->cart->sprites = spr;
+    vm->cart->asset_bytes += SPRITE_BYTES(w,h);
     lua_pushinteger(L, spr_id);
     return 1;
 }
 
+// font(id): print(), printbox() and friends use the cart's FONT chunk id from now on
+// font(): back to the built in one
+int api_font(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    if (lua_isnoneornil(L, 1)) {
+        vm->active_font = &vm->font;
+        return 0;
+    }
+    uint32_t id = luaL_checkinteger(L, 1);
+    Cart_Font *font = vm->cart->fonts;
+    while (font!=NULL && font->id!=id) font = font->next;
+    if (font==NULL) luaL_error(L, "no such font %d", id);
+    vm->active_font = &font->font;
+    return 0;
+}
+
 int api_line(lua_State *L)
 {
-    uint32_t x1 = (uint32_t)luaL_checknumber(L, 1);
-    uint32_t y1 = (uint32_t)luaL_checknumber(L, 2);
-    uint32_t x2 = (uint32_t)luaL_checknumber(L, 3);
-    uint32_t y2 = (uint32_t)luaL_checknumber(L, 4);
+    NeXUS_VM *vm = VM(L);
+    int x1 = CheckCoord(L, 1);
+    int y1 = CheckCoord(L, 2);
+    int x2 = CheckCoord(L, 3);
+    int y2 = CheckCoord(L, 4);
     uint8_t color = luaL_checkinteger(L, 5)&0xFF;
-    DrawLine(x1, y1, x2, y2, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    RasterLine(&vm->raster, &vm->screen, x1, y1, x2, y2, color);
     return 0;
 }
 
 int api_rect(lua_State *L)
 {
-    uint32_t x = (uint32_t)luaL_checknumber(L, 1);
-    uint32_t y = (uint32_t)luaL_checknumber(L, 2);
-    uint32_t w = (uint32_t)luaL_checknumber(L, 3);
-    uint32_t h = (uint32_t)luaL_checknumber(L, 4);
+    NeXUS_VM *vm = VM(L);
+    int x = CheckCoord(L, 1);
+    int y = CheckCoord(L, 2);
+    int w = CheckCoord(L, 3);
+    int h = CheckCoord(L, 4);
     uint8_t color = luaL_checkinteger(L, 5)&0xFF;
-    DrawRectangle(x, y, w, h, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    RasterRect(&vm->raster, &vm->screen, x, y, w, h, color);
     return 0;
 }
 
 int api_rectb(lua_State *L)
 {
-    uint32_t x = (uint32_t)luaL_checknumber(L, 1);
-    uint32_t y = (uint32_t)luaL_checknumber(L, 2);
-    uint32_t w = (uint32_t)luaL_checknumber(L, 3);
-    uint32_t h = (uint32_t)luaL_checknumber(L, 4);
+    NeXUS_VM *vm = VM(L);
+    int x = CheckCoord(L, 1);
+    int y = CheckCoord(L, 2);
+    int w = CheckCoord(L, 3);
+    int h = CheckCoord(L, 4);
     uint8_t color = luaL_checkinteger(L, 5)&0xFF;
-    DrawRectangleLines(x, y, w, h, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    RasterRectLines(&vm->raster, &vm->screen, x, y, w, h, color);
     return 0;
 }
 
 int api_pix(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     int64_t x = luaL_checkinteger(L,1);
     int64_t y = luaL_checkinteger(L,2);
-    // THIS FUNCTION IS VERY HACKY
-    // It may not be performant, you probably shouldn't be doing this
-    // In the original NeXUS  (LOVE2D) we had an imagedata that we carried
-    // until something caused it to become invalid
-    // reads were chonky, writes were also chonky for some godforsaken reason
-    // We should be better off here but who knows
-    // At the very least some graphics operations can update the image like
-    // they would the screen here
-    // (we couldn't do that in LOVE2D)
-    // still is probably a good idea to do all your reads in one go
-    // though pixel writes shouldn't invalidate the screen
-    // (they didn't in LOVE2D either but writes were still chonky)
+    // the screen lives in main memory now, so reads are just reads
+    // (this used to pull the whole framebuffer back off the GPU whenever anything else had drawn)
+    int inside = (x >= 0) && (y >= 0) && (x < SCREEN_WIDTH) && (y < SCREEN_HEIGHT);
     if (lua_isnoneornil(L,3)) {
-        if (NO_SCREEN()) {
-            if (vm.screen.data==NULL) { // no screen data - pull down image
-                // LoadImageFromTexture sets the important bits
-                vm.screen = LoadImageFromTexture(vm.framebuffer.texture);
-            } else { // screen dirty - pull pixels
-                MemFree(vm.screen.data);
-                // yeah this one's a doozy
-                // basically we're doing what LoadImageFromTexture does
-                // which means we directly invoke rlgl
-                vm.screen.data = rlReadTexturePixels(vm.framebuffer.texture.id, vm.framebuffer.texture.width, vm.framebuffer.texture.height, vm.framebuffer.texture.format);
-            }
-        }
-        // we now have a representation of the screen which we can trust in vm.screen
-        Color c = GetImageColor(vm.screen, x, y);
-        lua_pushinteger(L,eightbitcolor_nearest(c));
+        lua_pushinteger(L, inside ? RasterGetPixel(&vm->raster, &vm->screen, (int)x, (int)y) : 0);
         return 1;
-    } else {
-        uint8_t c = luaL_checkinteger(L,3)&0xFF;
-        DrawPixel(x, y, eightbitcolor_LUT[c]);
-        // if we have a screen and it isn't dirty, keep it up to date
-        // if it's not there, we get null pointer references
-        // if it's dirty, there's no point-- we'll pull it down next read anyways!
-        if (HAS_SCREEN()) ImageDrawPixel(&vm.screen, x, y, eightbitcolor_LUT[c]);
     }
+    uint8_t c = luaL_checkinteger(L,3)&0xFF;
+    if (inside) RasterPixel(&vm->raster, &vm->screen, (int)x, (int)y, c);
     return 0;
 }
 
 int api_print(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     const char *str = luaL_checklstring(L,1,0);
     if (!str) return 0;
-    int x = luaL_optinteger(L,2,0);
-    int y = luaL_optinteger(L,3,0);
+    int x = lua_isnoneornil(L,2) ? 0 : CheckCoord(L,2);
+    int y = lua_isnoneornil(L,3) ? 0 : CheckCoord(L,3);
     uint8_t color = luaL_optinteger(L,4,0xFF)&0xFF; // default white text
-    DrawTextEx(vm.font, str, (Vector2){x, y}, 15, 0, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    RasterText(&vm->raster, &vm->screen, &vm->text_cache, vm->active_font, str, x, y, color);
+    return 0;
+}
+
+static const AudioSound *CheckSound(lua_State *L, uint32_t id)
+{
+    NeXUS_VM *vm = VM(L);
+    Cart_Sound *snd = vm->cart->sounds;
+    while (snd!=NULL && snd->id!=id) snd = snd->next;
+    if (snd==NULL) luaL_error(L, "no such sound %d", id);
+    return &snd->sound;
+}
+
+// sfx(id, [ch]): play sound id on channel ch (0-3), or whichever channel's free
+// sfx(-1, ch): stop channel ch
+int api_sfx(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    lua_Integer id = luaL_checkinteger(L, 1);
+    int channel = (int)luaL_optinteger(L, 2, -1);
+    if ((channel < -1) || (channel >= AUDIO_CHANNELS)) luaL_error(L, "no such channel %d", channel);
+    if (id < 0) {
+        if (channel < 0) luaL_error(L, "which channel?");
+        AudioStopChannel(&vm->audio, channel);
+        return 0;
+    }
+    AudioPlaySfx(&vm->audio, CheckSound(L, (uint32_t)id), channel);
+    return 0;
+}
+
+// music(id): loop music id, music() or music(-1) stops it
+int api_music(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    lua_Integer id = luaL_optinteger(L, 1, -1);
+    const AudioMusic *music = NULL;
+    if (id >= 0) {
+        Cart_Music *mus = vm->cart->music;
+        while (mus!=NULL && mus->id!=(uint32_t)id) mus = mus->next;
+        if (mus==NULL) luaL_error(L, "no such music %d", (int)id);
+        music = &mus->music;
+    }
+    AudioPlayMusic(&vm->audio, music);
+    return 0;
+}
+
+// song(id): loop synth song id, song() or song(-1) lets it ring out
+int api_song(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    lua_Integer id = luaL_optinteger(L, 1, -1);
+    const SynthSong *song = NULL;
+    if (id >= 0) {
+        Cart_Song *s = vm->cart->songs;
+        while (s!=NULL && s->id!=(uint32_t)id) s = s->next;
+        if (s==NULL) luaL_error(L, "no such song %d", (int)id);
+        song = &s->song;
+    }
+    AudioPlaySong(&vm->audio, song);
     return 0;
 }
 
 int api_spr(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     uint32_t id = luaL_checkinteger(L, 1);
     double x = luaL_checknumber(L, 2);
     double y = luaL_checknumber(L, 3);
     double scale = luaL_optnumber(L, 4, 1.0f);
     int flip = luaL_optinteger(L, 5, 0)&3;
     double rotate = luaL_optnumber(L, 6, 0.0f);
-    Cart_Sprites *spr = vm.cart->sprites;
+    Cart_Sprites *spr = vm->cart->sprites;
     while (spr!=NULL && spr->id!=id) spr = spr->next;
     if (spr==NULL) luaL_error(L, "invalid sprite %d", id);
-    double sx = scale;
-    double sy = scale;
-    if (flip&1) sx*=-1;
-    if (flip&2) sy*=-1;
-    double width = spr->img.width * sx;
-    double height = spr->img.width * sy;
-    double halfwidth = (width/2.0f);
-    double halfheight = (height/2.0f);
-    DrawTexturePro(spr->texture,(Rectangle){0,0,spr->img.width,spr->img.height},(Rectangle){x+halfwidth,y+halfheight,width,height},(Vector2){halfwidth,halfheight},rotate,WHITE);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen? probably not in this case
+    RasterBlit(&vm->raster, &vm->screen, &spr->img, x, y, scale, flip, rotate);
     return 0;
 }
 
+// printbox(str, x, y, w, [h], [col]): word wrapped to w pixels, only whole lines that fit in h
+// returns how many lines got drawn and how many there are, so dialogue can page through the rest
+int api_printbox(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    const char *str = luaL_checkstring(L, 1);
+    int x = CheckCoord(L, 2);
+    int y = CheckCoord(L, 3);
+    int w = CheckCoord(L, 4);
+    int h = lua_isnoneornil(L, 5) ? -1 : CheckCoord(L, 5);
+    uint8_t color = luaL_optinteger(L, 6, 0xFF)&0xFF;
+    if (w < 1) luaL_error(L, "box must be at least 1 pixel wide");
+    const TextLayout *layout = LayoutText(&vm->layout_cache, vm->active_font, str, w);
+    if (layout==NULL) luaL_error(L, "not enough memory to lay out text");
+    lua_pushinteger(L, RasterLayout(&vm->raster, &vm->screen, vm->active_font, str, layout, x, y, (h < 0) ? -1 : h, color));
+    lua_pushinteger(L, layout->count);
+    return 2;
+}
+
+// measurebox(str, w): width, height and line count printbox would give it
+int api_measurebox(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    const char *str = luaL_checkstring(L, 1);
+    int w = CheckCoord(L, 2);
+    if (w < 1) luaL_error(L, "box must be at least 1 pixel wide");
+    const TextLayout *layout = LayoutText(&vm->layout_cache, vm->active_font, str, w);
+    if (layout==NULL) luaL_error(L, "not enough memory to lay out text");
+    lua_pushinteger(L, layout->width);
+    lua_pushinteger(L, LayoutHeight(vm->active_font, layout->count));
+    lua_pushinteger(L, layout->count);
+    return 3;
+}
+
 int api_textwidth(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     const char *str = luaL_checklstring(L,1,0);
     if (!str) return 0;
-    lua_pushinteger(L, MeasureTextEx(vm.font, str, 15, 0).x);
+    lua_pushinteger(L, ScreenTextWidth(vm->active_font, str));
     return 1;
 }
 
 int api_tri(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     double x1 = luaL_checknumber(L, 1);
     double y1 = luaL_checknumber(L, 2);
     double x2 = luaL_checknumber(L, 3);
@@ -238,13 +344,16 @@ int api_tri(lua_State *L)
     double x3 = luaL_checknumber(L, 5);
     double y3 = luaL_checknumber(L, 6);
     uint8_t color = luaL_checkinteger(L, 7)&0xFF;
-    DrawTriangle((Vector2){x1, y1}, (Vector2){x2, y2}, (Vector2){x3, y3}, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    // the GPU culled backfaces: only triangles that go round counter-clockwise on screen
+    // (y down) ever drew, so carts that lean on that keep drawing what they always did
+    if ((x2 - x1)*(y3 - y1) - (y2 - y1)*(x3 - x1) >= 0) return 0;
+    RasterTriangle(&vm->raster, &vm->screen, x1, y1, x2, y2, x3, y3, color);
     return 0;
 }
 
 int api_trib(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     double x1 = luaL_checknumber(L, 1);
     double y1 = luaL_checknumber(L, 2);
     double x2 = luaL_checknumber(L, 3);
@@ -252,51 +361,223 @@ int api_trib(lua_State *L)
     double x3 = luaL_checknumber(L, 5);
     double y3 = luaL_checknumber(L, 6);
     uint8_t color = luaL_checkinteger(L, 7)&0xFF;
-    DrawTriangleLines((Vector2){x1, y1}, (Vector2){x2, y2}, (Vector2){x3, y3}, eightbitcolor_LUT[color]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    RasterTriangleLines(&vm->raster, &vm->screen, x1, y1, x2, y2, x3, y3, color);
+    return 0;
+}
+
+// BATCHED GRAPHICS
+// rects/circs/lines/pset draw a whole list of primitives in one call. The list is either
+// a flat array of numbers ({x, y, w, h, col, x, y, w, h, col, ...} for rects) or a packed
+// string where every coordinate is a little-endian int16 and every color a byte, i.e. the
+// result of string.pack("<hhhhB", x, y, w, h, col) concatenated together
+
+#define BATCH_MAX_COORDS 4
+
+typedef struct {
+    const unsigned char *packed;    // NULL if we're reading a table
+    size_t count;                   // how many primitives
+    int coords;                     // coordinates per primitive (the color comes after them)
+} Batch;
+
+static void OpenBatch(lua_State *L, int coords, Batch *batch)
+{
+    batch->coords = coords;
+    if (lua_type(L, 1)==LUA_TSTRING) {
+        size_t len = 0;
+        batch->packed = (const unsigned char *)lua_tolstring(L, 1, &len);
+        size_t stride = coords*2 + 1;
+        if (len%stride) luaL_error(L, "packed batch length %d is not a multiple of %d", (int)len, (int)stride);
+        batch->count = len/stride;
+    } else {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        batch->packed = NULL;
+        size_t len = lua_rawlen(L, 1);
+        if (len%(coords + 1)) luaL_error(L, "batch length %d is not a multiple of %d", (int)len, coords + 1);
+        batch->count = len/(coords + 1);
+    }
+}
+
+// reads primitive i into v[0..coords-1] and its color
+static void ReadBatch(lua_State *L, Batch *batch, size_t i, int *v, uint8_t *color)
+{
+    if (batch->packed) {
+        const unsigned char *p = batch->packed + i*(batch->coords*2 + 1);
+        for (int c = 0; c < batch->coords; c++, p += 2) v[c] = (int16_t)(p[0]|(p[1]<<8));
+        *color = p[0];
+    } else {
+        // push the whole primitive then read it back, fewer API calls than get/read/pop each
+        lua_Integer base = (lua_Integer)(i*(batch->coords + 1));
+        int top = lua_gettop(L);
+        for (int c = 0; c <= batch->coords; c++) lua_rawgeti(L, 1, base + c + 1);
+        // coordinates like CheckCoord, the color like luaL_checkinteger
+        for (int c = 0; c < batch->coords; c++) {
+            int isnum = 0;
+            lua_Number n = lua_tonumberx(L, top + c + 1, &isnum);
+            if (!isnum) luaL_error(L, "batch entry %d is not a number", (int)(base + c + 1));
+            v[c] = ClampCoord(n);
+        }
+        int isint = 0;
+        lua_Integer n = lua_tointegerx(L, top + batch->coords + 1, &isint);
+        if (!isint) luaL_error(L, "batch entry %d (a color) is not an integer", (int)(base + batch->coords + 1));
+        *color = n&0xFF;
+        lua_settop(L, top);
+    }
+}
+
+int api_circs(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    Batch batch;
+    int v[BATCH_MAX_COORDS];
+    uint8_t color = 0;
+    OpenBatch(L, 3, &batch);
+    for (size_t i = 0; i < batch.count; i++) {
+        ReadBatch(L, &batch, i, v, &color);
+        RasterCircle(&vm->raster, &vm->screen, v[0], v[1], v[2], color);
+    }
+    return 0;
+}
+
+int api_lines(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    Batch batch;
+    int v[BATCH_MAX_COORDS];
+    uint8_t color = 0;
+    OpenBatch(L, 4, &batch);
+    for (size_t i = 0; i < batch.count; i++) {
+        ReadBatch(L, &batch, i, v, &color);
+        RasterLine(&vm->raster, &vm->screen, v[0], v[1], v[2], v[3], color);
+    }
+    return 0;
+}
+
+int api_pset(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    Batch batch;
+    int v[BATCH_MAX_COORDS];
+    uint8_t color = 0;
+    OpenBatch(L, 2, &batch);
+    for (size_t i = 0; i < batch.count; i++) {
+        ReadBatch(L, &batch, i, v, &color);
+        RasterPixel(&vm->raster, &vm->screen, v[0], v[1], color);
+    }
+    return 0;
+}
+
+int api_rects(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    Batch batch;
+    int v[BATCH_MAX_COORDS];
+    uint8_t color = 0;
+    OpenBatch(L, 4, &batch);
+    for (size_t i = 0; i < batch.count; i++) {
+        ReadBatch(L, &batch, i, v, &color);
+        RasterRect(&vm->raster, &vm->screen, v[0], v[1], v[2], v[3], color);
+    }
     return 0;
 }
 
 // INPUT
 
-int api_btn(lua_State *L)
+// the buttons get read off the tick's snapshot, not the keyboard, so replays see the same thing
+static int PushButtons(lua_State *L, uint8_t bits)
 {
     if (lua_isnoneornil(L, 1)) {
-        uint8_t btn_state = 0;
-        for (int i=0;i<8;++i) {
-            if (IsKeyDown(vm.controls.keyboard[i])) btn_state |= (1<<i);
-        }
-        lua_pushinteger(L, btn_state);
-        return 1;
+        lua_pushinteger(L, bits);
     } else {
         uint8_t id = luaL_checkinteger(L, 1)&7;
-        lua_pushboolean(L, IsKeyDown(vm.controls.keyboard[id]));
-        return 1;
+        lua_pushboolean(L, (bits >> id) & 1);
     }
+    return 1;
+}
+
+// btn([id]): held down
+int api_btn(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    return PushButtons(L, vm->buttons.held);
+}
+
+// btnp([id, [delay, [rate]]]): went down this tick, or has been held long enough to
+// repeat (after delay ticks, then every rate; delay 0 = never repeat)
+int api_btnp(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    if (lua_isnoneornil(L, 2)) return PushButtons(L, vm->buttons.repeat);
+    uint8_t id = luaL_checkinteger(L, 1)&7;
+    int delay = (int)luaL_checkinteger(L, 2);
+    int rate = (int)luaL_optinteger(L, 3, vm->controls.repeat_rate);
+    luaL_argcheck(L, rate > 0, 3, "rate has to be at least 1");
+    lua_pushboolean(L, (vm->buttons.ticks[id] > 0) && ButtonRepeats(vm->buttons.ticks[id], delay, rate));
+    return 1;
+}
+
+// btnr([id]): came up this tick
+int api_btnr(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    return PushButtons(L, vm->buttons.released);
 }
 
 // MISC
 
 int api_epoch(lua_State *L)
 {
-    lua_pushnumber(L,time(NULL));
+    NeXUS_VM *vm = VM(L);
+    // replays hand back whatever the recording got
+    // (frames run ahead don't touch the replay, they get whatever the last real frame did)
+    int64_t t;
+    if (vm->runahead.speculating) {
+        t = vm->runahead.epoch ? vm->runahead.epoch : (int64_t)time(NULL);
+    } else {
+        if (!PlaybackEpoch(&vm->replay, &t)) t = (int64_t)time(NULL);
+        RecordEpoch(&vm->replay, t);
+        vm->runahead.epoch = t;
+    }
+    lua_pushnumber(L,(lua_Number)t);
+    return 1;
+}
+
+int api_frameskip(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    if (!lua_isnoneornil(L, 1)) {
+        lua_Integer skip = luaL_checkinteger(L, 1);
+        if (skip<0 || skip>MAX_FRAMESKIP) luaL_error(L, "frameskip must be between 0 and %d", MAX_FRAMESKIP);
+        vm->frameskip = (int)skip;
+    }
+    lua_pushinteger(L, vm->frameskip);
     return 1;
 }
 
 int api_get_resource(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     uint32_t id = luaL_checkinteger(L, 1);
-    Cart_Blob *blob = vm.cart->blobs;
+    Cart_Blob *blob = vm->cart->blobs;
     while (blob!=NULL && blob->id!=id) blob = blob->next;
     if (blob==NULL) luaL_error("no such resource %d", id);
     lua_pushlstring(L, blob->data, blob->size);
     return 1;
 }
 
+int api_mem(lua_State *L)
+{
+    NeXUS_VM *vm = VM(L);
+    lua_pushinteger(L, (lua_Integer)LuaAllocUsed(&vm->allocator));
+    lua_pushinteger(L, (lua_Integer)vm->allocator.stats.peak_total);
+    lua_pushinteger(L, (lua_Integer)vm->allocator.limit);
+    return 3;
+}
+
 int api_trace(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     char *message = luaL_checklstring(L,1,0);
-    if (!message) return 0;
+    if (!message || vm->runahead.speculating) return 0; // once is enough
     TraceLog(LOG_INFO,"TRACE: %s",message);
     return 0;
 }
@@ -309,18 +590,32 @@ int api_version(lua_State *L)
 
 struct NeXUS_API api_funcs[] = {
     {api_btn, "btn"},
+    {api_btnp, "btnp"},
+    {api_btnr, "btnr"},
     {api_circ, "circ"},
     {api_circb, "circb"},
+    {api_circs, "circs"},
     {api_clip, "clip"},
     {api_cls, "cls"},
     {api_define_spr, "define_spr"},
     {api_epoch, "epoch"},
+    {api_font, "font"},
+    {api_frameskip, "frameskip"},
     {api_get_resource, "get_resource"},
     {api_line, "line"},
+    {api_lines, "lines"},
+    {api_measurebox, "measurebox"},
+    {api_mem, "mem"},
+    {api_music, "music"},
     {api_pix, "pix"},
     {api_print, "print"},
+    {api_printbox, "printbox"},
+    {api_pset, "pset"},
     {api_rect, "rect"},
     {api_rectb, "rectb"},
+    {api_rects, "rects"},
+    {api_sfx, "sfx"},
+    {api_song, "song"},
     {api_spr, "spr"},
     {api_textwidth, "textwidth"},
     {api_trace, "trace"},
@@ -330,19 +625,80 @@ struct NeXUS_API api_funcs[] = {
     {0, 0}
 };
 
-void RegisterFunction(struct NeXUS_API *func)
+void RegisterFunction(lua_State *L, struct NeXUS_API *func)
 {
     lua_pushcfunction(L,func->func);
     lua_setglobal(L,func->name);
 }
 
-void InitLua(void)
+// luaL_newstate's panic just prints to stderr, which nobody sees on a kiosk
+static int Panic(lua_State *L)
+{
+    const char *msg = lua_tostring(L, -1);
+    if (msg == NULL) msg = "error object is not a string";
+    TraceLog(LOG_FATAL, "LUA: Unprotected error in call to Lua API (%s)", msg);
+    return 0;
+}
+
+// the launcher's --memlimit is a hard cap, the cart's META can ask for anything up to it
+static size_t MemoryLimit(NeXUS_VM *vm)
+{
+    size_t limit = vm->cart->memory_limit ? vm->cart->memory_limit : DEFAULT_MEMORY_LIMIT;
+    if (vm->memory_cap) {
+        if ((vm->cart->memory_limit==0) || (limit > vm->memory_cap)) limit = vm->memory_cap;
+    }
+    return limit;
+}
+
+void GrantMemoryHeadroom(NeXUS_VM *vm)
+{
+    if (vm->allocator.limit==0) return;
+    size_t needed = LuaAllocUsed(&vm->allocator) + ERROR_MEMORY_HEADROOM;
+    if (vm->allocator.limit < needed) vm->allocator.limit = needed;
+}
+
+int SaveLuaHeap(NeXUS_VM *vm, LuaAllocSnapshot *s)
+{
+    return LuaAllocSave(&vm->allocator, s);
+}
+
+void RestoreLuaHeap(NeXUS_VM *vm, const LuaAllocSnapshot *s)
+{
+    LuaAllocRestore(&vm->allocator, s);
+}
+
+const LuaAllocator *LuaHeap(NeXUS_VM *vm)
+{
+    return &vm->allocator;
+}
+
+void InitLua(NeXUS_VM *vm)
 {
     // yes I am aware of the Lua Uppercase Accident
     // but all of the other subsystems render their names in allcaps
     // and it'd be awkward if we didn't
     TraceLog(LOG_INFO,"LUA: Initializing Lua runtime");
-    L = luaL_newstate();
+    // NOTE: vm->cart has to be loaded by now, InitLua always runs after LoadCart
+    // run-ahead and rewind need the heap in one piece; big blocks round up to powers of
+    // two in there, so it gets twice the limit (it's only address space until it's used).
+    // Freed blocks merge back together, so the whole limit is usable as long as rounding
+    // and fragmentation stay under 2x; past that it's the arena that runs out (see lua_alloc.h)
+    if ((vm->runahead.frames > 0) || (vm->rewind.seconds > 0)) {
+        if (!LuaAllocInitArena(&vm->allocator, MemoryLimit(vm)*2 + ERROR_MEMORY_HEADROOM*2)) {
+            TraceLog(LOG_WARNING, "LUA: Can't reserve an arena for run-ahead and rewind, turning them off");
+            vm->runahead.frames = 0;
+            vm->rewind.seconds = 0;
+            LuaAllocInit(&vm->allocator, 1);
+        }
+    } else {
+        LuaAllocInit(&vm->allocator, 1);
+    }
+    vm->allocator.external = &vm->cart->asset_bytes;
+    lua_State *L = lua_newstate(LuaAlloc, &vm->allocator);
+    vm->L = L;
+    // everything the API functions need hangs off the VM, coroutines inherit this
+    *(NeXUS_VM **)lua_getextraspace(L) = vm;
+    lua_atpanic(L, Panic);
     TraceLog(LOG_INFO,"LUA: Loading libraries");
     // code yoinked from linit.c (note the missing io and os libs above)
     for (const luaL_Reg *lib = loadedlibs; lib->func; lib++) {
@@ -352,26 +708,47 @@ void InitLua(void)
     // nullify dofile and loadfile
     // technically you can still access the filesystem via `require` but I can't be bothered
     // besides that should be read-only which isn't too bad
-    nullify("dofile");
-    nullify("loadfile");
+    nullify(L, "dofile");
+    nullify(L, "loadfile");
     // load API functions
     // similar run to above
     for (struct NeXUS_API *func = api_funcs; func->func; func++) {
-        RegisterFunction(func);
+        RegisterFunction(L, func);
     }
+    // spawn/wait/waituntil
+    OpenScheduler(L);
+    // a fresh state starts out printing in the built in font
+    vm->active_font = &vm->font;
+    // seed math.random ourselves (Lua would mix the clock with some addresses)
+    // so a replay draws the same numbers as the recording did
+    lua_getglobal(L, "math");
+    lua_getfield(L, -1, "randomseed");
+    lua_pushinteger(L, vm->seed);
+    lua_call(L, 1, 0);
+    lua_pop(L, 1);
     // also initialize GC (the Lua interpreter does it so we should too probably)
     lua_gc(L, LUA_GCRESTART);
-    lua_gc(L, LUA_GCGEN, 0, 0);
+    if (vm->gc_mode==GC_GENERATIONAL) {
+        lua_gc(L, LUA_GCGEN, 0, 0);
+    } else {
+        lua_gc(L, LUA_GCINC, 0, 0, 0);
+        // idle mode: never collect on our own, the main loop steps the collector after presenting
+        if (vm->gc_mode==GC_IDLE) lua_gc(L, LUA_GCSTOP);
+    }
+    // the limit only kicks in once the libraries are loaded, so a cart whose assets
+    // alone blow the budget gets a memory error in its main chunk instead of no Lua at all
+    vm->allocator.limit = MemoryLimit(vm);
+    TraceLog(LOG_INFO,"LUA: Memory limit is %zu bytes (%zu used)",vm->allocator.limit,LuaAllocUsed(&vm->allocator));
     TraceLog(LOG_INFO,"LUA: Lua runtime initialized!");
 }
 
-void SetGlobalString(char *name, char *val)
+void SetGlobalString(lua_State *L, const char *name, const char *val)
 {
     lua_pushstring(L,val);
     lua_setglobal(L,name);
 }
 
-int LoadString(char * code, size_t len)
+int LoadString(lua_State *L, char * code, size_t len)
 {
     return luaL_loadbufferx(L, code, len, "=[ROM code]", "t");
 }
@@ -404,7 +781,7 @@ char * CopyString(const char * from)
 
 // does the call in protected mode
 // yoinked from lua.c
-int DoCall(int narg, int nres)
+int DoCall(lua_State *L, int narg, int nres)
 {
     int status;
     int base = lua_gettop(L) - narg;  /* function index */
@@ -415,14 +792,26 @@ int DoCall(int narg, int nres)
     return status;
 }
 
-int CallGlobal(char * global)
+int CallGlobal(NeXUS_VM *vm, char * global)
 {
+    lua_State *L = vm->L;
     if (lua_getglobal(L, global)==LUA_TFUNCTION) {
-        if (DoCall(0,0)!=LUA_OK) {
+        int status = DoCall(L,0,0);
+        if ((status!=LUA_OK) && vm->runahead.speculating) {
+            // it'll happen for real soon enough, and get the error screen then
+            vm->runahead.failed = 1;
+            lua_pop(L,1);
+        } else if (status!=LUA_OK) {
+            if ((status==LUA_ERRMEM) && vm->allocator.stats.arena_full) {
+                TraceLog(LOG_WARNING,"LUA: Out of memory in %s: the run-ahead/rewind arena's too fragmented for it (%zu of %zu bytes used, %zu KB of arena in use)",
+                    global,LuaAllocUsed(&vm->allocator),vm->allocator.limit,(size_t)(vm->allocator.arena_top - vm->allocator.arena_base)/1024);
+            } else if (status==LUA_ERRMEM) {
+                TraceLog(LOG_WARNING,"LUA: Out of memory in %s (%zu of %zu bytes used)",global,LuaAllocUsed(&vm->allocator),vm->allocator.limit);
+            }
             char *msg = CopyString(lua_tostring(L,-1));
             TraceLog(LOG_ERROR,msg); // TODO: this should take you into the error screen
             lua_pop(L,1);
-            ErrorScreen(msg);
+            ErrorScreen(vm, msg);
             MemFree(msg);
         }
         return 1;
@@ -432,8 +821,56 @@ int CallGlobal(char * global)
     return 0;
 }
 
-void CloseLua(void)
+// resumes whichever spawn()ed tasks are due this frame
+void RunTasks(NeXUS_VM *vm)
+{
+    lua_State *L = vm->L;
+    lua_pushcfunction(L, SchedulerTick);
+    if (DoCall(L,0,0)!=LUA_OK) {
+        if (vm->runahead.speculating) {
+            vm->runahead.failed = 1;
+            lua_pop(L,1);
+            return;
+        }
+        char *msg = CopyString(lua_tostring(L,-1));
+        TraceLog(LOG_ERROR,msg);
+        lua_pop(L,1);
+        ErrorScreen(vm, msg);
+        MemFree(msg);
+    }
+}
+
+int IsGlobalFunction(NeXUS_VM *vm, char * global)
+{
+    lua_State *L = vm->L;
+    int isFunction = lua_getglobal(L, global)==LUA_TFUNCTION;
+    lua_pop(L,1);
+    return isFunction;
+}
+
+static void LogAllocStats(NeXUS_VM *vm)
+{
+    LuaAllocStats *stats = &vm->allocator.stats;
+    TraceLog(LOG_INFO,"LUA: Allocator peak %zu bytes, %zu bytes in slabs, %llu large allocations",
+        stats->peak, stats->slab_bytes, (unsigned long long)stats->large_allocs);
+    if (stats->refused_limit + stats->refused_arena > 0) TraceLog(LOG_INFO,"LUA: %llu allocations refused for the limit, %llu for the arena",
+        (unsigned long long)stats->refused_limit, (unsigned long long)stats->refused_arena);
+    for (int i = 0; i < LUAALLOC_NUM_CLASSES; i++) {
+        if ((stats->class_hits[i] + stats->class_carves[i])==0) continue;
+        TraceLog(LOG_DEBUG,"LUA:     %3d byte class: %llu reused, %llu carved", (i + 1)*LUAALLOC_GRANULE,
+            (unsigned long long)stats->class_hits[i], (unsigned long long)stats->class_carves[i]);
+    }
+}
+
+void CloseLua(NeXUS_VM *vm)
 {
-    lua_close(L);
+    if (vm->L==NULL) return;
+    // nothing to count the cart's assets against on the way out (belt and braces, the
+    // callers close Lua before they free the cart)
+    vm->allocator.external = NULL;
+    lua_close(vm->L);
+    vm->L = NULL;
+    LogAllocStats(vm);
+    LuaAllocRelease(&vm->allocator);
     TraceLog(LOG_INFO,"LUA: Deinitialized Lua runtime");
 }
\ No newline at end of file
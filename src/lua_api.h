@@ -3,17 +3,30 @@
 #include "lua/lualib.h"
 #include "nexus.h"
 
-extern lua_State *L;
+// The VM a state belongs to sits in its extra space (InitLua puts it there, coroutines
+// get a copy), so API functions find theirs from L and any number of VMs can run at once
+static inline NeXUS_VM *VM(lua_State *L)
+{
+    return *(NeXUS_VM **)lua_getextraspace(L);
+}
 
-void InitLua(void);
-void CloseLua(void);
-int LoadString(char * code, size_t len);
-int DoCall(int nargs, int nres);
-int CallGlobal(char * global);
+void InitLua(NeXUS_VM *vm);
+void CloseLua(NeXUS_VM *vm);
+int LoadString(lua_State *L, char * code, size_t len);
+int DoCall(lua_State *L, int nargs, int nres);
+int CallGlobal(NeXUS_VM *vm, char * global);
+void RunTasks(NeXUS_VM *vm);
+int IsGlobalFunction(NeXUS_VM *vm, char * global);
+void SetGlobalString(lua_State *L, const char *name, const char *val);
+void nullify(lua_State *L, const char * global);
+void GrantMemoryHeadroom(NeXUS_VM *vm);
+int SaveLuaHeap(NeXUS_VM *vm, LuaAllocSnapshot *s);      // only with run-ahead on (the heap's in an arena then)
+void RestoreLuaHeap(NeXUS_VM *vm, const LuaAllocSnapshot *s);
+const LuaAllocator *LuaHeap(NeXUS_VM *vm);             // for reading the arena in place
 
-char * CopyString(char * from);
+char * CopyString(const char * from);
 struct NeXUS_API {
     lua_CFunction func;
     const char * name;
 };
-void RegisterFunction(struct NeXUS_API *func);
\ No newline at end of file
+void RegisterFunction(lua_State *L, struct NeXUS_API *func);
\ No newline at end of file
@@ -16,182 +16,992 @@
 #include "eightbitcolor.h"
 #include "lua_api.h"
 #include "nexus.h"
+#include "histogram.h"
+#include "sched.h"
+#include "timer.h"
+#include "profiler.h"
+#include "runahead.h"
+#include "rewind.h"
+#include "thread.h"
+#include "hashtrace.h"
+#include "capture.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
 
 #if defined(PLATFORM_WEB)
     #include <emscripten/emscripten.h>
 #endif
 
-NeXUS_VM vm = { 0 };
+// the one VM the player runs; nothing below the host needs it to be the only one
+static NeXUS_VM instance = { 0 };
+static NeXUS_VM *vm = &instance;
 
 //----------------------------------------------------------------------------------
 // Local Variables Definition (local to this module)
 //----------------------------------------------------------------------------------
-static const int screenWidth = 320;
-static const int screenHeight = 240;
 static const int scale = 3;
+static const double frameTime = 1.0/60.0;   // fixed timestep for carts that define update()/draw()
+static const int maxGamepads = 4;           // how many get read into the buttons
+static const float stickDeadzone = 0.5f;    // how far the left stick has to go to count as a direction
 
 static int ShouldDrawFPS = 0;
 
+static uint32_t palette[256];                       // eightbitcolor_LUT as RGBA8
+static uint32_t presentPixels[SCREEN_WIDTH*SCREEN_HEIGHT];
+static Texture2D presentTexture = { 0 };            // vm->screen goes through this to get to the window
+
+static const double gcSafetyMargin = 0.001;    // how close to the frame deadline GC_IDLE is willing to step
+static double gcStepCost = 0;                   // running average of one LUA_GCSTEP, seconds
+static int gcInCycle = 0;                       // GC_IDLE: partway through a collection cycle
+static int gcNextCycleKB = 0;                   // GC_IDLE: heap size that starts the next cycle
+
+static Histogram cartHistogram = { "cart frame" };         // doframe/update/draw (includes automatic GC)
+static Histogram gcStepHistogram = { "gc step (idle)" };   // each LUA_GCSTEP in GC_IDLE
+static Histogram gcFrameHistogram = { "gc per frame (idle)" };
+
+static Profiler profiler = { 0 };              // phase timings for the last PROFILER_FRAMES frames, always on
+
+static int unthrottled = 0;                     // replays and benchmarks run flat out
+static int keepTimings = 0;
+static FrameTiming *frameTimings = NULL;        // every frame, when we're keeping track (replays, --timings, --bench)
+static size_t frameTimingCount = 0;
+static size_t frameTimingCapacity = 0;
+static int frameLimit = 0;                      // --frames, 0 = run until closed
+static int framesRun = 0;
+static char *lastError = NULL;                  // whatever last sent us to the error screen
+static int errorShown = 0;                      // the error screen is up (no point running it ahead)
+static int rewindHeld = 0;                      // frames Backspace has been down
+static HashTrace hashTrace = { 0 };             // --hashes/--golden
+static Capture capture = { 0 };                 // --gif, ^G
+
+static int pipelineOn = 0;                      // --pipeline on (off by default, it shows input a frame later)
+static Worker pipeline = { 0 };                 // runs the cart's frame while this thread presents the last one
+static FrameInput pipelineInput;
+static Profiler pipelineProfiler = { 0 };       // the worker's phases
+static Screen pipelineScreens[2];               // the frame the worker made last, and the one it's making
+static int pipelineBack = 0;                    // the one it's making
+
 struct NeXUS_API error_screen_funcs[];
 
 //----------------------------------------------------------------------------------
 // Local Functions Declaration
 //----------------------------------------------------------------------------------
 static void UpdateDrawFrame(void);          // Update and draw one frame
-static void _DrawFPS(void);                 // Draw FPS
-static void DrawTextBoxed(Font font, const char *text, Rectangle rec, float fontSize, float spacing, bool wordWrap, Color tint);
+static void BootCart(void);                 // Fresh Lua state for vm->cart, run its main chunk
+static void PresentFrame(const Screen *shown); // Show vm->screen (or the run-ahead frame) in the window
+static void _DrawFPS(Screen *target);       // Draw FPS
+static void ResetFrameTiming(void);         // Reset the fixed timestep state for a fresh cart run
+static void ReadLiveInput(FrameInput *input); // Snapshot the keyboard, gamepads (and dropped files) for this frame
+static void TickButtons(Buttons *b, uint8_t held); // Work out btnp()/btnr() for the next update()/doframe()
+static uint32_t NewSeed(void);              // Seed for a fresh Lua state
+static int FixedSteps(void);                // How many update()s the fixed timestep owes this frame
+static void RunCartFrame(int steps);        // Call into the cart for one frame
+static const Screen *RunAhead(void);        // Run the cart ahead for the frame to show, then put it back
+static const Screen *SimulateFrame(FrameInput *input, Profiler *p); // Everything the frame does to the VM
+static int PipelineWanted(void);            // Can this frame run on the worker
+static const Screen *PipelineWait(void);    // Wait for the worker's frame
+static const Screen *PipelineFrame(const FrameInput *input, const Screen *ready); // Start this one on it
+static void IdleCollect(void);              // GC_IDLE: step the collector until the frame deadline
+static void AddFrameTiming(const FrameTiming *timing);
+static void ReportFrameTimings(const char *path); // Summarize per-frame timings, and write them out as CSV
+static int RunBenchmarks(char **carts, int count, const char *jsonPath);
+static void WriteReport(const char *path, const char *cartPath, const char *replayPath, uint32_t seed); // --report
+static void ToggleCapture(void);            // Start or stop a GIF (^G)
 
 //----------------------------------------------------------------------------------
 // Main entry point
 //----------------------------------------------------------------------------------
-int main(void)
+int main(int argc, char **argv)
 {
-    // Initialization
+    // Launcher options
     //---------------------------------------------------------
-    InitWindow(screenWidth*scale, screenHeight*scale, "NeXUS");
+    const char *cartPath = NULL;
+    const char *recordPath = NULL;
+    const char *replayPath = NULL;
+    const char *timingsPath = NULL;
+    const char *jsonPath = "bench.json";
+    const char *wavPath = NULL;
+    const char *reportPath = NULL;
+    const char *seedArg = NULL;
+    const char *hashesPath = NULL;
+    const char *goldenPath = NULL;
+    const char *diffDir = NULL;
+    const char *gifPath = NULL;
+    int audioMode = -1;     // -1 = the sound card with a window, the null device without
+    int rasterThreads = 0;  // 0 = draw straight into the screen
+    int bench = 0;
+    char **carts = MemAlloc(argc*sizeof(char *)); // positional arguments (only --bench takes more than one)
+    int cartCount = 0;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--memlimit")==0) && (i + 1 < argc)) {
+            vm->memory_cap = ParseSize(argv[++i]);
+            if (vm->memory_cap==0) TraceLog(LOG_WARNING, "NEXUS: Ignoring --memlimit %s, that's not a size (65536, 512K, 64M)", argv[i]);
+        }
+        else if ((strcmp(argv[i], "--record")==0) && (i + 1 < argc)) recordPath = argv[++i];
+        else if ((strcmp(argv[i], "--replay")==0) && (i + 1 < argc)) replayPath = argv[++i];
+        else if ((strcmp(argv[i], "--timings")==0) && (i + 1 < argc)) timingsPath = argv[++i];
+        else if ((strcmp(argv[i], "--frames")==0) && (i + 1 < argc)) frameLimit = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--json")==0) && (i + 1 < argc)) jsonPath = argv[++i];
+        else if ((strcmp(argv[i], "--report")==0) && (i + 1 < argc)) reportPath = argv[++i];
+        else if ((strcmp(argv[i], "--seed")==0) && (i + 1 < argc)) seedArg = argv[++i];
+        else if ((strcmp(argv[i], "--hashes")==0) && (i + 1 < argc)) hashesPath = argv[++i];
+        else if ((strcmp(argv[i], "--golden")==0) && (i + 1 < argc)) goldenPath = argv[++i];
+        else if ((strcmp(argv[i], "--diff-dir")==0) && (i + 1 < argc)) diffDir = argv[++i];
+        else if ((strcmp(argv[i], "--gif")==0) && (i + 1 < argc)) gifPath = argv[++i];
+        else if (strcmp(argv[i], "--headless")==0) vm->headless = 1;
+        else if (strcmp(argv[i], "--bench")==0) bench = 1;
+        else if ((strcmp(argv[i], "--wav")==0) && (i + 1 < argc)) {
+            wavPath = argv[++i];
+            audioMode = AUDIO_NULL;
+        }
+        else if ((strcmp(argv[i], "--audio")==0) && (i + 1 < argc)) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "device")==0) audioMode = AUDIO_DEVICE;
+            else if (strcmp(mode, "null")==0) audioMode = AUDIO_NULL;
+            else if (strcmp(mode, "off")==0) audioMode = AUDIO_OFF;
+            else TraceLog(LOG_WARNING, "NEXUS: Unknown audio mode %s (want device, null or off)", mode);
+        }
+        else if ((strcmp(argv[i], "--gc")==0) && (i + 1 < argc)) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "gen")==0) vm->gc_mode = GC_GENERATIONAL;
+            else if (strcmp(mode, "inc")==0) vm->gc_mode = GC_INCREMENTAL;
+            else if (strcmp(mode, "idle")==0) vm->gc_mode = GC_IDLE;
+            else TraceLog(LOG_WARNING, "NEXUS: Unknown GC mode %s (want gen, inc or idle)", mode);
+        }
+        else if ((strcmp(argv[i], "--runahead")==0) && (i + 1 < argc)) {
+            vm->runahead.frames = atoi(argv[++i]);
+            if (vm->runahead.frames < 0) vm->runahead.frames = 0;
+            if (vm->runahead.frames > RUNAHEAD_MAX_FRAMES) vm->runahead.frames = RUNAHEAD_MAX_FRAMES;
+        }
+        else if ((strcmp(argv[i], "--pipeline")==0) && (i + 1 < argc)) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "on")==0) pipelineOn = 1;
+            else if (strcmp(mode, "off")==0) pipelineOn = 0;
+            else TraceLog(LOG_WARNING, "NEXUS: Unknown pipeline mode %s (want on or off)", mode);
+        }
+        else if ((strcmp(argv[i], "--rewind")==0) && (i + 1 < argc)) {
+            vm->rewind.seconds = atoi(argv[++i]);
+            if (vm->rewind.seconds < 0) vm->rewind.seconds = 0;
+        }
+        else if ((strcmp(argv[i], "--runahead-budget")==0) && (i + 1 < argc)) vm->runahead.budget = atof(argv[++i])/1000.0;
+        else if ((strcmp(argv[i], "--raster-threads")==0) && (i + 1 < argc)) rasterThreads = atoi(argv[++i]);
+        else if (argv[i][0]!='-') carts[cartCount++] = argv[i];
+        else TraceLog(LOG_WARNING, "NEXUS: Ignoring unknown option %s", argv[i]);
+    }
+    if (cartCount > 0) cartPath = carts[0];
+    if (bench) {
+        // benchmarks never need a display, and run every cart as fast as it'll go
+        vm->headless = 1;
+        keepTimings = 1;
+        if (frameLimit==0) frameLimit = 600;
+        if (cartCount==0) {
+            TraceLog(LOG_ERROR, "BENCH: No carts to run");
+            return 1;
+        }
+    }
+    if (vm->headless) unthrottled = 1;
+    if (vm->runahead.budget <= 0) vm->runahead.budget = RUNAHEAD_BUDGET;
+    vm->runahead.cost.name = "runahead save+restore";
+    vm->rewind.capture.name = "rewind capture";
 
-    // Load global data (assets that must be available in all screens, i.e. font)
-    vm.font = LoadFont("resources/matchup_pro.png");
-    SetTextureFilter(vm.font.texture, TEXTURE_FILTER_POINT);
-    SetTextLineSpacing(16);
-
-    // Framebuffer
-    vm.framebuffer = LoadRenderTexture(screenWidth, screenHeight);
-    SetTextureFilter(vm.framebuffer.texture, TEXTURE_FILTER_POINT);
-
-    // Keyboard controls
-    vm.controls.keyboard[0] = KEY_UP;
-    vm.controls.keyboard[1] = KEY_DOWN;
-    vm.controls.keyboard[2] = KEY_LEFT;
-    vm.controls.keyboard[3] = KEY_RIGHT;
-    vm.controls.keyboard[4] = KEY_Z;
-    vm.controls.keyboard[5] = KEY_X;
-    vm.controls.keyboard[6] = KEY_LEFT_SHIFT;
-    vm.controls.keyboard[7] = KEY_ENTER;
+    // Record/replay
+    // A replay brings its own seed and (unless we were given one) its own cart
+    vm->seed = (seedArg!=NULL) ? (uint32_t)strtoul(seedArg, NULL, 0) : NewSeed();
+    if (!bench && (replayPath!=NULL)) {
+        const char *replayCart = NULL;
+        if (!StartPlayback(&vm->replay, replayPath, &vm->seed, &replayCart)) {
+            TraceLog(LOG_ERROR, "REPLAY: Can't play back %s", replayPath);
+            return 1;
+        }
+        if (cartPath==NULL) cartPath = replayCart;
+        unthrottled = 1;
+        keepTimings = 1;
+        TraceLog(LOG_INFO, "REPLAY: Playing back %s on %s", replayPath, cartPath);
+        if (recordPath!=NULL) TraceLog(LOG_WARNING, "REPLAY: Can't record while playing back, ignoring --record");
+    }
+    if (cartPath==NULL) cartPath = "resources/nogameloaded.rom";
+    if ((timingsPath!=NULL) || (reportPath!=NULL)) keepTimings = 1;
+    if (!bench && (hashesPath!=NULL) && !HashTraceWrite(&hashTrace, hashesPath)) TraceLog(LOG_WARNING, "HASH: Can't write frame hashes to %s", hashesPath);
+    if (!bench && (goldenPath!=NULL) && !HashTraceCheck(&hashTrace, goldenPath, diffDir)) TraceLog(LOG_WARNING, "HASH: Can't read the golden trace %s", goldenPath);
+    uint32_t bootSeed = vm->seed;
+    if (!bench && (recordPath!=NULL) && (replayPath==NULL)) {
+        if (StartRecording(&vm->replay, recordPath, vm->seed, cartPath)) TraceLog(LOG_INFO, "REPLAY: Recording to %s", recordPath);
+        else TraceLog(LOG_WARNING, "REPLAY: Can't record to %s", recordPath);
+    }
 
+    // Initialization
+    //---------------------------------------------------------
     // Eight bit color
     eightbitcolor_init();
+    for (int i = 0; i < 256; i++) {
+        Color c = eightbitcolor_LUT[i];
+        palette[i] = (uint32_t)c.r|((uint32_t)c.g << 8)|((uint32_t)c.b << 16)|((uint32_t)c.a << 24);
+    }
+
+    // Everything gets drawn on the CPU, so the window is only there to look at
+    if (!vm->headless) {
+        InitWindow(SCREEN_WIDTH*scale, SCREEN_HEIGHT*scale, "NeXUS");
+        Image frame = { presentPixels, SCREEN_WIDTH, SCREEN_HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        presentTexture = LoadTextureFromImage(frame);
+        SetTextureFilter(presentTexture, TEXTURE_FILTER_POINT);
+    }
+    ScreenInit(&vm->screen);
+
+    // Load global data (assets that must be available in all screens, i.e. font)
+    Image fontImage = LoadImage("resources/matchup_pro.png");
+    ImageFormat(&fontImage, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    int fontLoaded = LoadScreenFont(&vm->font, fontImage.data, fontImage.width, fontImage.height, 32, 16);
+    UnloadImage(fontImage);
+    if (!fontLoaded) {
+        TraceLog(LOG_ERROR, "NEXUS: Can't load the font");
+        if (!vm->headless) CloseWindow();
+        return 1;
+    }
+    TextCacheInit(&vm->text_cache, TEXT_CACHE_BUDGET);
+    LayoutCacheInit(&vm->layout_cache);
+
+    // Audio
+    if (audioMode < 0) audioMode = vm->headless ? AUDIO_NULL : AUDIO_DEVICE;
+    AudioInit(&vm->audio, (AudioMode)audioMode, wavPath);
+
+    // Keyboard and gamepad controls
+    vm->controls.keyboard[0] = KEY_UP;
+    vm->controls.keyboard[1] = KEY_DOWN;
+    vm->controls.keyboard[2] = KEY_LEFT;
+    vm->controls.keyboard[3] = KEY_RIGHT;
+    vm->controls.keyboard[4] = KEY_Z;
+    vm->controls.keyboard[5] = KEY_X;
+    vm->controls.keyboard[6] = KEY_LEFT_SHIFT;
+    vm->controls.keyboard[7] = KEY_ENTER;
+    vm->controls.gamepad[0] = GAMEPAD_BUTTON_LEFT_FACE_UP;
+    vm->controls.gamepad[1] = GAMEPAD_BUTTON_LEFT_FACE_DOWN;
+    vm->controls.gamepad[2] = GAMEPAD_BUTTON_LEFT_FACE_LEFT;
+    vm->controls.gamepad[3] = GAMEPAD_BUTTON_LEFT_FACE_RIGHT;
+    vm->controls.gamepad[4] = GAMEPAD_BUTTON_RIGHT_FACE_DOWN;
+    vm->controls.gamepad[5] = GAMEPAD_BUTTON_RIGHT_FACE_RIGHT;
+    vm->controls.gamepad[6] = GAMEPAD_BUTTON_RIGHT_FACE_LEFT;
+    vm->controls.gamepad[7] = GAMEPAD_BUTTON_MIDDLE_RIGHT;
+    vm->controls.repeat_delay = DEFAULT_REPEAT_DELAY;
+    vm->controls.repeat_rate = DEFAULT_REPEAT_RATE;
+
+    // Heavy drawing gets split up into tiles across threads
+    if ((rasterThreads > 0) && RasterInit(&vm->raster, rasterThreads)) {
+        TraceLog(LOG_INFO, "RASTER: Drawing in tiles on %d threads", vm->raster.threads);
+        // it's slower than drawing straight in below about 3 cores (see raster.h)
+        if (vm->raster.threads > CoreCount()) TraceLog(LOG_WARNING, "RASTER: %d threads on %d cores, expect it to be slower than without", vm->raster.threads, CoreCount());
+    }
+
+    // With --pipeline on the cart runs a frame ahead on its own thread while this one
+    // presents (and waits on vsync). Off by default: it shows what the input did a frame
+    // later than running the frame here would
+    if (pipelineOn && !WorkerStart(&pipeline)) TraceLog(LOG_INFO, "NEXUS: No worker thread, carts run on this one");
+
+    if (bench) {
+        int failed = RunBenchmarks(carts, cartCount, jsonPath);
+        WorkerStop(&pipeline);
+        RasterLog(&vm->raster);
+        RasterFree(&vm->raster);
+        RunaheadLog(&vm->runahead);
+        RunaheadFree(&vm->runahead);
+        RewindLog(&vm->rewind);
+        RewindFree(&vm->rewind);
+        AudioClose(&vm->audio);
+        TextCacheClear(&vm->text_cache);
+        LayoutCacheClear(&vm->layout_cache);
+        UnloadScreenFont(&vm->font);
+        MemFree(carts);
+        return failed;
+    }
 
-    // Lua
-    InitLua();
+    if ((gifPath!=NULL) && !CaptureStart(&capture, gifPath, palette, unthrottled)) TraceLog(LOG_WARNING, "CAPTURE: Can't write %s", gifPath);
 
-    // Load nogameloaded.rom and load the code into the VM
-    vm.cart = LoadCart("resources/nogameloaded.rom");
-    LoadString(vm.cart->code,vm.cart->code_size);
-    DoCall(0,0);
+    // Load the cart (nogameloaded.rom unless we were given one), then Lua, then the code into the VM
+    vm->cart = LoadCart((char *)cartPath);
+    BootCart();
 
 #if defined(PLATFORM_WEB)
     emscripten_set_main_loop(UpdateDrawFrame, 60, 1);
 #else
-    SetTargetFPS(60);       // Set our game to run at 60 frames-per-second
+    // Set our game to run at 60 frames-per-second
+    // (GC_IDLE paces frames itself so it knows how much slack it has to collect in)
+    if (!vm->headless) {
+        if (unthrottled || (vm->gc_mode==GC_IDLE)) SetTargetFPS(0);
+        else SetTargetFPS(60);
+    }
+    vm->frame_deadline = TimerNow();
     //--------------------------------------------------------------------------------------
 
     // Main game loop
-    while (!(WindowShouldClose() || vm.should_close))    // Detect window close button or ESC key
-    {
-        UpdateDrawFrame();
+    if (vm->headless) {
+        while (!vm->should_close) UpdateDrawFrame();
+    } else {
+        while (!(WindowShouldClose() || vm->should_close))    // Detect window close button or ESC key
+        {
+            UpdateDrawFrame();
+        }
     }
 #endif
 
+    WorkerStop(&pipeline); // it might still be on a frame
+    CaptureStop(&capture);
+    HistogramLog(&cartHistogram);
+    TextCacheLog(&vm->text_cache);
+    RasterLog(&vm->raster);
+    RunaheadLog(&vm->runahead);
+    RewindLog(&vm->rewind);
+    HashTraceLog(&hashTrace);
+    if (vm->gc_mode==GC_IDLE) {
+        HistogramLog(&gcStepHistogram);
+        HistogramLog(&gcFrameHistogram);
+    }
+    if (vm->replay.mode==REPLAY_PLAYBACK) {
+        if (vm->replay.diverged) TraceLog(LOG_WARNING, "REPLAY: Cart asked for input the recording doesn't have from frame %llu on, timings past there aren't comparable", (unsigned long long)vm->replay.diverged);
+    }
+    if (frameTimingCount > 0) ReportFrameTimings(timingsPath);
+    else ProfilerLog(&profiler);
+    if (reportPath!=NULL) WriteReport(reportPath, cartPath, replayPath, bootSeed);
+    int errored = (lastError!=NULL);
+    HashTraceClose(&hashTrace);
+    free(frameTimings);
+    StopReplay(&vm->replay);
+
     // Unload global data loaded
-    UnloadFont(vm.font);
-    UnloadRenderTexture(vm.framebuffer);
-    FreeCart(vm.cart);
-    CloseLua();
-    if (vm.screen.data!=NULL) UnloadImage(vm.screen);
+    AudioClose(&vm->audio);  // before the cart, the mixer might still be playing its sounds
+    TextCacheClear(&vm->text_cache);
+    LayoutCacheClear(&vm->layout_cache);
+    UnloadScreenFont(&vm->font);
+    CloseLua(vm); // before the cart, its allocator counts the cart's assets
+    FreeCart(vm->cart);
+    RasterFree(&vm->raster);
+    RunaheadFree(&vm->runahead);
+    RewindFree(&vm->rewind);
+    MemFree(lastError);
+    MemFree(carts);
 
-    CloseWindow();          // Close window and OpenGL context
+    if (!vm->headless) {
+        UnloadTexture(presentTexture);
+        CloseWindow();          // Close window and OpenGL context
+    }
     //--------------------------------------------------------------------------------------
 
-    return 0;
+    return ((reportPath!=NULL) && errored) ? 1 : 0; // whoever wanted the report wants to know without reading it
+}
+
+// Fresh Lua state for vm->cart, then run its main chunk
+static void BootCart(void)
+{
+    errorShown = 0;
+    RewindClear(&vm->rewind);
+    InitLua(vm);
+    ResetFrameTiming();
+    gcInCycle = 0;
+    gcNextCycleKB = 0;
+    LoadString(vm->L,vm->cart->code,vm->cart->code_size);
+    if (DoCall(vm->L,0,0)!=LUA_OK) {
+        char *msg = CopyString(lua_tostring(vm->L,-1));
+        TraceLog(LOG_INFO, "RESET: Lua error: %s",msg);
+        lua_pop(vm->L,1);
+        ErrorScreen(vm, msg);
+        MemFree(msg);
+    }
+    RasterFlush(&vm->raster, &vm->screen); // the main chunk can draw too
 }
 
 // Update and draw game frame
 static void UpdateDrawFrame(void)
 {
+    ProfilerBeginFrame(&profiler);
+
+    // Pipelined, the worker's been running the cart's last frame all this time
+    const Screen *ready = PipelineWait();
+    ProfilerMark(&profiler, PROFILE_WAIT);
+
+    // Input
+    //----------------------------------------------------------------------------------
+    // Everything the cart can see from outside comes in here, live or off a replay
+    FrameInput input = { 0 };
+    if (vm->replay.mode==REPLAY_PLAYBACK) {
+        if (!PlaybackFrame(&vm->replay, &input)) {
+            TraceLog(LOG_INFO, "REPLAY: Replay finished after %llu frames", (unsigned long long)vm->replay.frame);
+            vm->should_close = 1;
+            return;
+        }
+    } else {
+        if (!vm->headless) ReadLiveInput(&input);
+        // a reset gets a fresh seed, which has to be in the recording too
+        if (input.system & (SYSTEM_RESET|SYSTEM_DROP)) input.seed = NewSeed();
+        // going back a frame at a time, then faster the longer it's held (up to 16 at a time)
+        else if (input.system & SYSTEM_REWIND) input.steps = (uint8_t)(1 << ((rewindHeld < 4*60) ? rewindHeld/60 : 4));
+        // (on a reset frame the clock restarts, so it doesn't owe any updates; running
+        // flat out, every frame is worth exactly one)
+        else if (IsGlobalFunction(vm, "update")) input.steps = unthrottled ? 1 : (uint8_t)FixedSteps();
+        RecordFrame(&vm->replay, &input);
+    }
+    if (!vm->headless) {
+        int ctrlDown = IsKeyDown(KEY_LEFT_CONTROL)||IsKeyDown(KEY_RIGHT_CONTROL);
+        if (ctrlDown && IsKeyPressed(KEY_F)) { // toggle FPS counter (^F)
+            if (ShouldDrawFPS) ShouldDrawFPS = 0;
+            else ShouldDrawFPS = 1;
+        }
+        if (ctrlDown && IsKeyPressed(KEY_P)) ProfilerLog(&profiler); // dump phase timings so far (^P)
+        if (ctrlDown && IsKeyPressed(KEY_G)) ToggleCapture(); // record a GIF (^G)
+    }
+    ProfilerMark(&profiler, PROFILE_INPUT);
+
     // Update
     //----------------------------------------------------------------------------------
-    int loaderWantsAReset = 0;
+    const Screen *shown;
+    if (PipelineWanted()) shown = PipelineFrame(&input, ready);
+    else shown = SimulateFrame(&input, &profiler);
+    //----------------------------------------------------------------------------------
+
+    // Draw
+    //----------------------------------------------------------------------------------
+    PresentFrame(shown);
+    //----------------------------------------------------------------------------------
+
+    if (vm->gc_mode==GC_IDLE) IdleCollect();
+
+    const FrameTiming *timing = ProfilerEndFrame(&profiler);
+    if (keepTimings) AddFrameTiming(timing);
+    if ((frameLimit > 0) && (++framesRun >= frameLimit)) vm->should_close = 1;
+}
+
+// Everything a frame does to the VM: loading, resetting, the cart, audio, rewind and
+// run-ahead. Returns the frame to show. With the pipeline going this runs on the worker,
+// charging its own profiler, and nothing else touches the VM until it's done.
+static const Screen *SimulateFrame(FrameInput *input, Profiler *p)
+{
+    vm->input = *input;
+    vm->input.drop = NULL; // the path only lives as long as this function
+
+    if (input->system & SYSTEM_DROP) {
+        TraceLog(LOG_INFO, "LOADER: Loading %s, deinitialize previous cart",input->drop);
+        AudioStopAll(&vm->audio);
+        AudioFlush(&vm->audio);
+        CloseLua(vm); // before the cart goes, see above (the reset below boots a new one)
+        FreeCart(vm->cart);
+        TraceLog(LOG_INFO, "LOADER: Initialize new cart");
+        vm->cart = LoadCart(input->drop);
+        TraceLog(LOG_INFO, "LOADER: Set reset flag so the resetter can do the loading thing");
+        TraceLog(LOG_INFO,"LOADER: Exit loader (all crashes past this point are NOT our fault)");
+    }
+    if (vm->replay.mode!=REPLAY_PLAYBACK) MemFree(input->drop); // live ones are ours
+    ProfilerMark(p, PROFILE_LOADER);
+
+    if (input->system & (SYSTEM_RESET|SYSTEM_DROP)) { // reset ROM (^R, or the loader wants one)
+        vm->seed = input->seed;
+        ScreenInit(&vm->screen);
+        AudioStopAll(&vm->audio);
+        CloseLua(vm); // (already closed for a drop)
+        FreeCartSprites(vm->cart); // free sprites on reset
+        BootCart();
+    }
+    ProfilerMark(p, PROFILE_RESET);
+
+    // rewinding, the cart sits the frame out while it gets put back
+    if (!(input->system & SYSTEM_REWIND)) RunCartFrame(input->steps);
+    ProfilerMark(p, PROFILE_CART);
+    HistogramAdd(&cartHistogram, p->current.ms[PROFILE_CART]/1000.0);
+
+    AudioFrame(&vm->audio);
+    ProfilerMark(p, PROFILE_AUDIO);
+
+    if (input->system & SYSTEM_REWIND) {
+        // the newest capture is the frame before the error, if there was one, so that's the first step
+        if (RewindStep(vm, errorShown ? input->steps - 1 : input->steps)) {
+            errorShown = 0;
+            AudioStopAll(&vm->audio); // sounds don't rewind, they'd only be playing from the wrong place
+            vm->accumulator = 0;      // and the time spent here isn't owed to update()
+            vm->last_time = TimerNow();
+        } else if (vm->rewind.seconds==0) {
+            static int warned = 0;
+            if (!warned) TraceLog(LOG_WARNING, "REWIND: This replay rewinds, it needs --rewind to play back the same");
+            warned = 1;
+        }
+    } else if (!errorShown) {
+        RewindCapture(vm);
+    }
+    HashTraceFrame(&hashTrace, &vm->screen); // the real frame, before run-ahead has a go
+    ProfilerMark(p, PROFILE_REWIND);
+
+    const Screen *shown = RunAhead();
+    ProfilerMark(p, PROFILE_RUNAHEAD);
+    return shown;
+}
+
+//----------------------------------------------------------------------------------
+// Pipeline
+//----------------------------------------------------------------------------------
+// Frames go through the worker unless something here needs the VM in step with this
+// thread: replays (epoch() results go in the same file as the frames, in order), GC_IDLE
+// (it collects after presenting) and the error screen (Ctrl+C puts the message on the
+// clipboard, which only this thread can touch).
+static int PipelineWanted(void)
+{
+    return (pipeline.thread.handle!=NULL) && (vm->replay.mode==REPLAY_OFF) && (vm->gc_mode!=GC_IDLE) && !errorShown;
+}
+
+// What crosses threads, with WorkerRun and WorkerWait as the handoffs (each one a
+// semaphore, so everything written before it is seen after it):
+//  - pipelineInput: this thread fills it in before WorkerRun and leaves it alone until
+//    WorkerWait; the job copies it into vm->input, which only the job touches meanwhile
+//  - errorShown (and gc_mode, replay.mode): the job can change them, this thread only
+//    reads them in PipelineWanted, which comes after PipelineWait
+//  - vm->should_close: the one both sides write while the job runs (the cart erroring
+//    out, --frames running out). It only ever goes from 0 to 1, so the main loop seeing
+//    it a frame late is fine
+//  - pipelineScreens: the job writes pipelineBack, this thread shows the other one
+static void PipelineJob(void *arg)
+{
+    (void)arg;
+    ProfilerBeginFrame(&pipelineProfiler);
+    pipelineScreens[pipelineBack] = *SimulateFrame(&pipelineInput, &pipelineProfiler);
+}
+
+// The frame the worker finished, NULL if it wasn't running one
+static const Screen *PipelineWait(void)
+{
+    if (!pipeline.busy) return NULL;
+    WorkerWait(&pipeline);
+    // its phases go on the frame that shows what it made (so they overlap the rest)
+    for (int phase = PROFILE_LOADER; phase <= PROFILE_RUNAHEAD; phase++) profiler.current.ms[phase] += pipelineProfiler.current.ms[phase];
+    const Screen *done = &pipelineScreens[pipelineBack];
+    pipelineBack ^= 1;
+    return done;
+}
+
+// Hands the worker this frame and returns the one to show meanwhile
+static const Screen *PipelineFrame(const FrameInput *input, const Screen *ready)
+{
+    if (ready==NULL) {
+        // only just started, so the last frame stays up one more
+        pipelineScreens[pipelineBack ^ 1] = vm->screen;
+        ready = &pipelineScreens[pipelineBack ^ 1];
+    }
+    pipelineInput = *input;
+    WorkerRun(&pipeline, PipelineJob, NULL);
+    return ready;
+}
+
+// Converts a frame for the window and shows it
+// Headless there's no window, but the conversion still happens so it still costs what it would
+static void PresentFrame(const Screen *shown)
+{
+    if (ShouldDrawFPS) {
+        // the counter goes on a copy, the cart mustn't see it in pix()
+        static Screen overlay;
+        overlay = *shown;
+        ScreenNoClip(&overlay);
+        _DrawFPS(&overlay);
+        ScreenToRGBA(&overlay, palette, presentPixels);
+    } else {
+        ScreenToRGBA(shown, palette, presentPixels);
+    }
+    CaptureFrame(&capture, shown); // (without the counter)
+    ProfilerMark(&profiler, PROFILE_CONVERT);
+    if (vm->headless) return;
+
+    UpdateTexture(presentTexture, presentPixels);
+    BeginDrawing();
+
+        ClearBackground((Color){255,0,255,255});
+
+        DrawTexturePro(presentTexture,(Rectangle){0,0,(float)SCREEN_WIDTH,(float)SCREEN_HEIGHT},(Rectangle){0,0,(float)SCREEN_WIDTH*scale,(float)SCREEN_HEIGHT*scale},(Vector2){0,0},0,WHITE);
+        ProfilerMark(&profiler, PROFILE_PRESENT);
+
+    EndDrawing();
+    ProfilerMark(&profiler, PROFILE_VSYNC);
+}
+
+// A new GIF each time, named for when it started
+static void ToggleCapture(void)
+{
+    if (Capturing(&capture)) {
+        CaptureStop(&capture);
+        return;
+    }
+    char path[64];
+    time_t now = time(NULL);
+    strftime(path, sizeof(path), "nexus_%Y%m%d_%H%M%S.gif", localtime(&now));
+    if (!CaptureStart(&capture, path, palette, unthrottled)) TraceLog(LOG_WARNING, "CAPTURE: Can't write %s", path);
+}
+
+//----------------------------------------------------------------------------------
+// Input
+//----------------------------------------------------------------------------------
+static void ReadLiveInput(FrameInput *input)
+{
+    for (int i = 0; i < 8; ++i) {
+        if (IsKeyDown(vm->controls.keyboard[i])) input->buttons |= (1<<i);
+    }
+    for (int pad = 0; pad < maxGamepads; pad++) {
+        if (!IsGamepadAvailable(pad)) continue;
+        for (int i = 0; i < 8; ++i) {
+            if (IsGamepadButtonDown(pad, vm->controls.gamepad[i])) input->buttons |= (1<<i);
+        }
+        float x = GetGamepadAxisMovement(pad, GAMEPAD_AXIS_LEFT_X);
+        float y = GetGamepadAxisMovement(pad, GAMEPAD_AXIS_LEFT_Y);
+        if (y < -stickDeadzone) input->buttons |= (1<<0);
+        if (y > stickDeadzone) input->buttons |= (1<<1);
+        if (x < -stickDeadzone) input->buttons |= (1<<2);
+        if (x > stickDeadzone) input->buttons |= (1<<3);
+    }
+    int ctrlDown = IsKeyDown(KEY_LEFT_CONTROL)||IsKeyDown(KEY_RIGHT_CONTROL);
+    if (ctrlDown && IsKeyPressed(KEY_R)) input->system |= SYSTEM_RESET;
+    if (ctrlDown && IsKeyPressed(KEY_C)) input->system |= SYSTEM_COPY;
+    if ((vm->rewind.seconds > 0) && IsKeyDown(KEY_BACKSPACE)) {
+        input->system |= SYSTEM_REWIND;
+        rewindHeld++;
+    } else {
+        rewindHeld = 0;
+    }
     if (IsFileDropped()) {
         FilePathList files = LoadDroppedFiles();
         if (files.count==1) {
-            TraceLog(LOG_INFO, "LOADER: Loading %s, deinitialize previous cart",files.paths[0]);
-            FreeCart(vm.cart);
-            TraceLog(LOG_INFO, "LOADER: Initialize new cart");
-            vm.cart = LoadCart(files.paths[0]);
-            TraceLog(LOG_INFO, "LOADER: Set reset flag so the resetter can do the loading thing");
-            loaderWantsAReset = 1; // set reset flag
-            TraceLog(LOG_INFO,"LOADER: Exit loader (all crashes past this point are NOT our fault)");
+            input->system |= SYSTEM_DROP;
+            input->drop = CopyString(files.paths[0]);
         } else {
             TraceLog(LOG_INFO, "LOADER: Cowardly refusing to figure out which of %d files to load", files.count);
         }
         UnloadDroppedFiles(files);
     }
-    int ctrlDown = IsKeyDown(KEY_LEFT_CONTROL)||IsKeyDown(KEY_RIGHT_CONTROL);
-    if (ctrlDown && IsKeyPressed(KEY_F)) { // toggle FPS counter (^F)
-        if (ShouldDrawFPS) ShouldDrawFPS = 0;
-        else ShouldDrawFPS = 1;
-    }
-    if ((ctrlDown && IsKeyPressed(KEY_R)) // reset ROM (^R)
-        || loaderWantsAReset) {
-        BeginTextureMode(vm.framebuffer);
-            ClearBackground(eightbitcolor_LUT[0]);
-            if (HAS_SCREEN()) {
-                ImageClearBackground(&vm.screen, eightbitcolor_LUT[0]);
-            }
-        EndTextureMode();
-        CloseLua();
-        if (vm.cart->sprites) {
-            FreeSprites(vm.cart->sprites); // free sprites on reset
-            vm.cart->sprites = NULL;
+}
+
+// Edges and repeats off this tick's held buttons; replays only need to keep the held ones
+static void TickButtons(Buttons *b, uint8_t held)
+{
+    b->pressed = held & ~b->held;
+    b->released = b->held & ~held;
+    b->held = held;
+    b->repeat = 0;
+    for (int i = 0; i < 8; i++) {
+        if (!((held >> i) & 1)) {
+            b->ticks[i] = 0;
+            continue;
         }
-        InitLua();
-        LoadString(vm.cart->code,vm.cart->code_size);
-        if (DoCall(0,0)!=LUA_OK) {
-            char *msg = CopyString(lua_tostring(L,-1));
-            TraceLog(LOG_INFO, "RESET: Lua error: %s",msg); // TODO: this should take you into the error screen
-            lua_pop(L,1);
-            ErrorScreen(msg);
-            MemFree(msg);
+        if (b->ticks[i] < UINT32_MAX) b->ticks[i]++;
+        if (ButtonRepeats(b->ticks[i], vm->controls.repeat_delay, vm->controls.repeat_rate)) b->repeat |= (1<<i);
+    }
+}
+
+static uint32_t NewSeed(void)
+{
+    return (uint32_t)time(NULL)*2654435761u ^ (uint32_t)(TimerNow()*1000000.0);
+}
+
+//----------------------------------------------------------------------------------
+// Fixed timestep
+//----------------------------------------------------------------------------------
+static void ResetFrameTiming(void)
+{
+    vm->frameskip = DEFAULT_FRAMESKIP;
+    vm->accumulator = 0;
+    vm->last_time = TimerNow();
+}
+
+// Carts that define update() get it called at a steady 60Hz off an accumulator, and
+// draw() only once we've caught up. If rendering can't keep up, draw() gets skipped
+// (up to vm->frameskip times in a row) so the game itself doesn't slow down.
+// This works out how many updates that is; it goes into the frame's input so a
+// replay runs the same number no matter how fast it's going.
+static int FixedSteps(void)
+{
+    double now = TimerNow();
+    double elapsed = now - vm->last_time;
+    vm->last_time = now;
+    // snap vsync jitter so we don't alternate between 0 and 2 updates a frame
+    if ((elapsed > frameTime*0.95) && (elapsed < frameTime*1.05)) elapsed = frameTime;
+    vm->accumulator += elapsed;
+
+    // past the frameskip limit we just drop the time on the floor and slow down
+    double maxLag = frameTime*(vm->frameskip + 1);
+    if (vm->accumulator > maxLag) vm->accumulator = maxLag;
+
+    int steps = 0;
+    while (vm->accumulator >= frameTime) {
+        vm->accumulator -= frameTime;
+        steps++;
+    }
+    return steps;
+}
+
+// Carts that only define doframe() get called once per rendered frame, like always.
+// spawn()ed tasks get resumed right before each doframe()/update().
+static void RunCartFrame(int steps)
+{
+    if (!IsGlobalFunction(vm, "update")) {
+        TickButtons(&vm->buttons, vm->input.buttons);
+        RunTasks(vm);
+        CallGlobal(vm, "doframe");
+    } else {
+        for (int i = 0; i < steps; i++) {
+            TickButtons(&vm->buttons, vm->input.buttons);
+            RunTasks(vm); // tasks are simulation, so they tick with update()
+            CallGlobal(vm, "update");
         }
+        if (steps > 0) CallGlobal(vm, "draw");
     }
-    BeginTextureMode(vm.framebuffer);
+    // whatever looks at the screen next (run-ahead, rewind, presenting) wants it finished
+    RasterFlush(&vm->raster, &vm->screen);
+}
 
-        // ClearBackground(eightbitcolor_LUT[160]);
+// The frame to show: vm->screen, or with run-ahead on, the one vm->runahead.frames past it
+static const Screen *RunAhead(void)
+{
+    Runahead *r = &vm->runahead;
+    if ((r->frames==0) || errorShown || (vm->input.system & SYSTEM_REWIND)) return &vm->screen;
+    double start = TimerNow();
+    if (!RunaheadSave(vm)) return &vm->screen;
+    double saved = TimerNow();
+    r->speculating = 1;
+    vm->audio.muted = 1;
+    for (int i = 0; (i < r->frames) && !r->failed; i++) RunCartFrame(1);
+    r->speculating = 0;
+    vm->audio.muted = 0;
+    double ran = TimerNow();
+    RunaheadRestore(vm);
+    RunaheadCount(r, saved - start, ran - saved, TimerNow() - ran);
+    // a frame that errored isn't worth showing, the real one'll get there
+    return r->failed ? &vm->screen : &r->screen;
+}
 
-        // DrawTextEx(font,"THIS IS TEXT ON THE SCREEN",(Vector2){80,120-8},15,0,eightbitcolor_LUT[255]);
+//----------------------------------------------------------------------------------
+// Idle GC
+//----------------------------------------------------------------------------------
+// In GC_IDLE the collector never runs on its own, so doframe never eats a collection.
+// Instead, once the frame is presented we step it until the next frame is due (minus
+// a safety margin and the cost of one more step), then sleep out the rest. Cycles only
+// start once the heap has doubled since the last one finished, same as Lua's default pause.
+// NOTE: if a cart allocates faster than the slack lets us collect, it'll eventually hit
+// the memory limit, where Lua's emergency collection still kicks in.
+static void IdleCollect(void)
+{
+    double now = TimerNow();
+    if (vm->frame_deadline < (now - frameTime)) vm->frame_deadline = now; // way behind, don't try to catch up
+    vm->frame_deadline += frameTime;
 
-        CallGlobal("doframe");
+    if (!gcInCycle && (lua_gc(vm->L, LUA_GCCOUNT) >= gcNextCycleKB)) gcInCycle = 1;
 
-    EndTextureMode();
-    //----------------------------------------------------------------------------------
+    double spent = 0;
+    while (gcInCycle) {
+        double start = TimerNow();
+        int done = lua_gc(vm->L, LUA_GCSTEP, 0);
+        now = TimerNow();
+        HistogramAdd(&gcStepHistogram, now - start);
+        gcStepCost = (gcStepCost==0) ? (now - start) : (gcStepCost*0.9 + (now - start)*0.1);
+        spent += now - start;
+        if (done) {
+            gcInCycle = 0;
+            gcNextCycleKB = lua_gc(vm->L, LUA_GCCOUNT)*2;
+        }
+        if ((now + gcStepCost + gcSafetyMargin) >= vm->frame_deadline) break;
+    }
+    if (spent > 0) HistogramAdd(&gcFrameHistogram, spent);
+    ProfilerMark(&profiler, PROFILE_GC);
 
-    // Draw
-    //----------------------------------------------------------------------------------
-    BeginDrawing();
+#if !defined(PLATFORM_WEB)
+    now = TimerNow();
+    if (!unthrottled && (now < vm->frame_deadline)) WaitTime(vm->frame_deadline - now);
+    ProfilerMark(&profiler, PROFILE_SLEEP);
+#endif
+}
 
-        ClearBackground((Color){255,0,255,255});
+//----------------------------------------------------------------------------------
+// Per-frame timings
+//----------------------------------------------------------------------------------
+static void AddFrameTiming(const FrameTiming *timing)
+{
+    if (frameTimingCount==frameTimingCapacity) {
+        size_t capacity = frameTimingCapacity ? frameTimingCapacity*2 : 4096;
+        FrameTiming *timings = realloc(frameTimings, capacity*sizeof(FrameTiming));
+        if (timings==NULL) return;
+        frameTimings = timings;
+        frameTimingCapacity = capacity;
+    }
+    frameTimings[frameTimingCount++] = *timing;
+}
 
-        DrawTexturePro(vm.framebuffer.texture,(Rectangle){0,0,(float)screenWidth,(float)-screenHeight},(Rectangle){0,0,(float)screenWidth*scale,(float)screenHeight*scale},(Vector2){0,0},0,WHITE);
+// Same numbers as ProfilerLog, but over every frame of the run rather than the last few
+static void ReportFrameTimings(const char *path)
+{
+    float *scratch = malloc(frameTimingCount*sizeof(float));
+    if (scratch!=NULL) {
+        TimingStats t = ComputeTimingStats(frameTimings, frameTimingCount, PROFILE_TOTAL, scratch);
+        TraceLog(LOG_INFO, "PERF: %zu frames, mean %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms (frame %zu)",
+            frameTimingCount, t.mean, t.p50, t.p95, t.p99, t.max, t.slowest + 1);
+        for (int phase = PROFILE_TOTAL + 1; phase < PROFILE_PHASES; phase++) {
+            t = ComputeTimingStats(frameTimings, frameTimingCount, phase, scratch);
+            if (t.max==0) continue;
+            TraceLog(LOG_INFO, "PERF:   %-8s mean %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms",
+                profilePhaseNames[phase], t.mean, t.p50, t.p95, t.p99, t.max);
+        }
+        free(scratch);
+    }
 
-        if (ShouldDrawFPS) _DrawFPS();
+    if (path==NULL) return;
+    FILE *f = fopen(path, "w");
+    if (f==NULL) {
+        TraceLog(LOG_WARNING, "PERF: Can't write timings to %s", path);
+        return;
+    }
+    fprintf(f, "frame");
+    for (int phase = 0; phase < PROFILE_PHASES; phase++) fprintf(f, ",%s_ms", profilePhaseNames[phase]);
+    fprintf(f, "\n");
+    for (size_t i = 0; i < frameTimingCount; i++) {
+        fprintf(f, "%zu", i + 1);
+        for (int phase = 0; phase < PROFILE_PHASES; phase++) fprintf(f, ",%.4f", frameTimings[i].ms[phase]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    TraceLog(LOG_INFO, "PERF: Wrote per-frame timings to %s", path);
+}
 
-    EndDrawing();
-    //----------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------
+// Benchmarks
+//----------------------------------------------------------------------------------
+static void WriteJSONString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if ((c=='"') || (c=='\\')) fprintf(f, "\\%c", c);
+        else if (c=='\n') fputs("\\n", f);
+        else if (c=='\t') fputs("\\t", f);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void WriteJSONStats(FILE *f, TimingStats t)
+{
+    fprintf(f, "{\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}", t.mean, t.p50, t.p95, t.p99, t.max);
+}
+
+// Runs each cart for frameLimit frames with nothing held down and the same seed every
+// time, then writes frame time percentiles (overall and per phase) for all of them to
+// jsonPath. A cart that errors still gets its numbers (of the error screen, mind) plus
+// the error, and makes us return 1.
+static int RunBenchmarks(char **carts, int count, const char *jsonPath)
+{
+    FILE *f = fopen(jsonPath, "w");
+    if (f==NULL) {
+        TraceLog(LOG_ERROR, "BENCH: Can't write results to %s", jsonPath);
+        return 1;
+    }
+    int failed = 0;
+    fprintf(f, "{\n  \"frames\": %d,\n  \"carts\": [", frameLimit);
+    for (int c = 0; c < count; c++) {
+        TraceLog(LOG_INFO, "BENCH: Running %s for %d frames", carts[c], frameLimit);
+        vm->seed = 0x4E585553;
+        vm->should_close = 0;
+        framesRun = 0;
+        frameTimingCount = 0;
+        ProfilerReset(&profiler);
+        TextCacheClear(&vm->text_cache);
+        TextCacheInit(&vm->text_cache, TEXT_CACHE_BUDGET); // cold cache and fresh counters for every cart
+        MemFree(lastError);
+        lastError = NULL;
+        ScreenInit(&vm->screen);
+        double decodeBefore = vm->audio.music.decode_seconds;
+        uint64_t decodedBefore = vm->audio.music.decoded;
+        uint32_t underrunsBefore = vm->audio.music.underruns;
+        vm->cart = LoadCart(carts[c]);
+        BootCart();
+        vm->frame_deadline = TimerNow();
+        while (!vm->should_close) UpdateDrawFrame();
+        WorkerWait(&pipeline);
+        if (lastError!=NULL) failed = 1;
+
+        fprintf(f, "%s\n    {\"cart\": ", (c > 0) ? "," : "");
+        WriteJSONString(f, carts[c]);
+        fprintf(f, ", \"frames\": %zu, \"error\": ", frameTimingCount);
+        if (lastError!=NULL) WriteJSONString(f, lastError);
+        else fprintf(f, "null");
+        float *scratch = malloc((frameTimingCount ? frameTimingCount : 1)*sizeof(float));
+        if (scratch!=NULL) {
+            fprintf(f, ",\n     \"frame_ms\": ");
+            WriteJSONStats(f, ComputeTimingStats(frameTimings, frameTimingCount, PROFILE_TOTAL, scratch));
+            fprintf(f, ",\n     \"phases\": {");
+            for (int phase = PROFILE_TOTAL + 1; phase < PROFILE_PHASES; phase++) {
+                fprintf(f, "%s\n       \"%s\": ", (phase > PROFILE_TOTAL + 1) ? "," : "", profilePhaseNames[phase]);
+                WriteJSONStats(f, ComputeTimingStats(frameTimings, frameTimingCount, phase, scratch));
+            }
+            fprintf(f, "}");
+            free(scratch);
+        }
+        fprintf(f, ",\n     \"print_cache\": {\"hits\": %llu, \"misses\": %llu, \"first_seen\": %llu, \"evictions\": %llu}",
+            (unsigned long long)vm->text_cache.hits, (unsigned long long)vm->text_cache.misses,
+            (unsigned long long)vm->text_cache.first_seen, (unsigned long long)vm->text_cache.evictions);
+        if (frameTimingCount > 0) ReportFrameTimings(NULL);
+        TextCacheLog(&vm->text_cache);
+
+        CloseLua(vm);
+        AudioStopAll(&vm->audio);
+        AudioFlush(&vm->audio); // the mixer's let go of the music, so its numbers hold still
+        fprintf(f, ",\n     \"music\": {\"decode_ms\": %.3f, \"decoded_s\": %.3f, \"underruns\": %u}}",
+            (vm->audio.music.decode_seconds - decodeBefore)*1000.0, (double)(vm->audio.music.decoded - decodedBefore)/AUDIO_SAMPLE_RATE,
+            vm->audio.music.underruns - underrunsBefore);
+        FreeCart(vm->cart);
+        vm->cart = NULL;
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+    free(frameTimings);
+    MemFree(lastError);
+    TraceLog(LOG_INFO, "BENCH: Wrote results to %s", jsonPath);
+    return failed;
+}
+
+// One JSON line about the run that just ended, for whoever launched us (nexus-batch):
+// where it started from, the hash of the last real frame (not a run-ahead one, so it
+// doesn't depend on --runahead), frame time percentiles and the error, if there was one
+static void WriteReport(const char *path, const char *cartPath, const char *replayPath, uint32_t seed)
+{
+    FILE *f = fopen(path, "w");
+    if (f==NULL) {
+        TraceLog(LOG_WARNING, "NEXUS: Can't write the report to %s", path);
+        return;
+    }
+    fprintf(f, "{\"cart\": ");
+    WriteJSONString(f, cartPath);
+    fprintf(f, ", \"replay\": ");
+    if (replayPath!=NULL) WriteJSONString(f, replayPath);
+    else fprintf(f, "null");
+    fprintf(f, ", \"seed\": %u, \"frames\": %zu, \"hash\": \"%016llx\"", seed, frameTimingCount, (unsigned long long)ScreenHash(&vm->screen));
+    float *scratch = malloc((frameTimingCount ? frameTimingCount : 1)*sizeof(float));
+    if (scratch!=NULL) {
+        fprintf(f, ", \"frame_ms\": ");
+        WriteJSONStats(f, ComputeTimingStats(frameTimings, frameTimingCount, PROFILE_TOTAL, scratch));
+        free(scratch);
+    }
+    if (vm->replay.mode==REPLAY_PLAYBACK) fprintf(f, ", \"diverged\": %llu", (unsigned long long)vm->replay.diverged);
+    if (hashTrace.golden!=NULL) {
+        fprintf(f, ", \"golden\": {\"frames\": %zu, \"first_diff\": %llu, \"frames_differ\": %llu}", hashTrace.golden_count,
+            (unsigned long long)hashTrace.diverged, (unsigned long long)hashTrace.mismatches);
+    }
+    fprintf(f, ", \"error\": ");
+    if (lastError!=NULL) WriteJSONString(f, lastError);
+    else fprintf(f, "null");
+    fprintf(f, "}\n");
+    fclose(f);
 }
 
 //----------------------------------------------------------------------------------
 // Draw FPS using the Correct(tm) font
 //----------------------------------------------------------------------------------
-static void _DrawFPS(void)
+static void _DrawFPS(Screen *target)
 {
-    Color color = WHITE;                         // Good FPS
+    uint8_t color = 255;                         // Good FPS
     int fps = GetFPS();
 
-    if ((fps < 30) && (fps >= 15)) color = ORANGE;  // Warning FPS
-    else if (fps < 15) color = RED;             // Low FPS
+    if ((fps < 30) && (fps >= 15)) color = eightbitcolor_nearest(ORANGE);  // Warning FPS
+    else if (fps < 15) color = eightbitcolor_nearest(RED);             // Low FPS
 
-    DrawTextEx(vm.font, TextFormat("FPS: %2i", fps), (Vector2){1, 1}, 45, 0, color);
+    ScreenText(target, &vm->font, TextFormat("FPS: %2i", fps), 1, 1, color);
 }
 
 //----------------------------------------------------------------------------------
@@ -220,54 +1030,66 @@ const char * error_screen =
 
 static int in_error_screen = 0;
 
-void ErrorScreen(char *msg)
+void ErrorScreen(NeXUS_VM *vm, const char *msg)
 {
+    lua_State *L = vm->L;
     if (in_error_screen) return;
     in_error_screen = 1;
-    EndScissorMode();
+    MemFree(lastError);
+    lastError = CopyString(msg);
+    ScreenNoClip(&vm->screen);
     // Essentially just a custom `doframe()` with some custom API
     // When you reset the ROM it clears out state anyways
-    SetGlobalString("msg",msg);
+    // (fixed timestep carts have to lose update/draw or they'd shadow our doframe)
+    GrantMemoryHeadroom(vm); // the cart may well have died from running out
+    ClearScheduler(L);     // and its tasks shouldn't keep running behind the error screen
+    AudioStopAll(&vm->audio); // or its music
+    nullify(L, "update");
+    nullify(L, "draw");
+    SetGlobalString(L, "msg",msg);
     for (struct NeXUS_API *func = error_screen_funcs; func->func; ++func) {
-        RegisterFunction(func);
+        RegisterFunction(L, func);
     }
-    if (LoadString(error_screen,strlen(error_screen))>0) {
+    if (LoadString(L, error_screen,strlen(error_screen))>0) {
         TraceLog(LOG_ERROR,"ERROR: Meta error: %s",lua_tostring(L,-1));
         lua_pop(L,1);
-        vm.should_close = 1;
+        vm->should_close = 1;
         in_error_screen = 0;
         return;
     }
-    if (DoCall(0,0)>0) {
+    if (DoCall(L,0,0)>0) {
         TraceLog(LOG_ERROR,"ERROR: Meta error: %s",lua_tostring(L,-1));
         lua_pop(L,1);
-        vm.should_close = 1;
+        vm->should_close = 1;
         in_error_screen = 0;
         return;
     }
+    errorShown = 1;
     in_error_screen = 0;
     return;
 }
 
 int api_print_screenbox(lua_State *L)
 {
+    NeXUS_VM *vm = VM(L);
     const char *str = luaL_checklstring(L,1,0);
     if (!str) return 0;
-    DrawTextBoxed(vm.font, str, (Rectangle){0, 0, 320, 240}, 15, 0, true, eightbitcolor_LUT[255]);
-    vm.screen_dirty = 1; // is it worth it to duplicate on vm.screen?
+    const TextLayout *layout = LayoutText(&vm->layout_cache, &vm->font, str, SCREEN_WIDTH);
+    if (layout!=NULL) RasterLayout(&vm->raster, &vm->screen, &vm->font, str, layout, 0, 0, SCREEN_HEIGHT, 255);
     return 0;
 }
 
 int api_ctrlCPressed(lua_State *L)
 {
-    int ctrlDown = IsKeyDown(KEY_LEFT_CONTROL)||IsKeyDown(KEY_RIGHT_CONTROL);
-    lua_pushboolean(L,ctrlDown && IsKeyPressed(KEY_C));
+    NeXUS_VM *vm = VM(L);
+    lua_pushboolean(L,vm->input.system & SYSTEM_COPY);
     return 1;
 }
 
 int api_copyMsg(lua_State *L)
 {
-    SetClipboardText(lua_tostring(L, 1));
+    NeXUS_VM *vm = VM(L);
+    if (!vm->headless) SetClipboardText(lua_tostring(L, 1));
     return 0;
 }
 
@@ -277,126 +1099,3 @@ struct NeXUS_API error_screen_funcs[] = {
     {api_copyMsg, "copyMsg"},
     {0, 0}
 };
-
-// Draw text using font inside rectangle limits
-// stole from the text_rectangle_bounds example
-static void DrawTextBoxed(Font font, const char *text, Rectangle rec, float fontSize, float spacing, bool wordWrap, Color tint)
-{
-    int length = TextLength(text);  // Total length in bytes of the text, scanned by codepoints in loop
-
-    float textOffsetY = 0;          // Offset between lines (on line break '\n')
-    float textOffsetX = 0.0f;       // Offset X to next character to draw
-
-    float scaleFactor = fontSize/(float)font.baseSize;     // Character rectangle scaling factor
-
-    // Word/character wrapping mechanism variables
-    enum { MEASURE_STATE = 0, DRAW_STATE = 1 };
-    int state = wordWrap? MEASURE_STATE : DRAW_STATE;
-
-    int startLine = -1;         // Index where to begin drawing (where a line begins)
-    int endLine = -1;           // Index where to stop drawing (where a line ends)
-    int lastk = -1;             // Holds last value of the character position
-
-    for (int i = 0, k = 0; i < length; i++, k++)
-    {
-        // Get next codepoint from byte string and glyph index in font
-        int codepointByteCount = 0;
-        int codepoint = GetCodepoint(&text[i], &codepointByteCount);
-        int index = GetGlyphIndex(font, codepoint);
-
-        // NOTE: Normally we exit the decoding sequence as soon as a bad byte is found (and return 0x3f)
-        // but we need to draw all of the bad bytes using the '?' symbol moving one byte
-        if (codepoint == 0x3f) codepointByteCount = 1;
-        i += (codepointByteCount - 1);
-
-        float glyphWidth = 0;
-        if (codepoint != '\n')
-        {
-            glyphWidth = (font.glyphs[index].advanceX == 0) ? font.recs[index].width*scaleFactor : font.glyphs[index].advanceX*scaleFactor;
-
-            if (i + 1 < length) glyphWidth = glyphWidth + spacing;
-        }
-
-        // NOTE: When wordWrap is ON we first measure how much of the text we can draw before going outside of the rec container
-        // We store this info in startLine and endLine, then we change states, draw the text between those two variables
-        // and change states again and again recursively until the end of the text (or until we get outside of the container).
-        // When wordWrap is OFF we don't need the measure state so we go to the drawing state immediately
-        // and begin drawing on the next line before we can get outside the container.
-        if (state == MEASURE_STATE)
-        {
-            // TODO: There are multiple types of spaces in UNICODE, maybe it's a good idea to add support for more
-            // Ref: http://jkorpela.fi/chars/spaces.html
-            if ((codepoint == ' ') || (codepoint == '\t') || (codepoint == '\n')) endLine = i;
-
-            if ((textOffsetX + glyphWidth) > rec.width)
-            {
-                endLine = (endLine < 1)? i : endLine;
-                if (i == endLine) endLine -= codepointByteCount;
-                if ((startLine + codepointByteCount) == endLine) endLine = (i - codepointByteCount);
-
-                state = !state;
-            }
-            else if ((i + 1) == length)
-            {
-                endLine = i;
-                state = !state;
-            }
-            else if (codepoint == '\n') state = !state;
-
-            if (state == DRAW_STATE)
-            {
-                textOffsetX = 0;
-                i = startLine;
-                glyphWidth = 0;
-
-                // Save character position when we switch states
-                int tmp = lastk;
-                lastk = k - 1;
-                k = tmp;
-            }
-        }
-        else
-        {
-            if (codepoint == '\n')
-            {
-                if (!wordWrap)
-                {
-                    textOffsetY += 16; //(font.baseSize + font.baseSize/2)*scaleFactor;
-                    textOffsetX = 0;
-                }
-            }
-            else
-            {
-                if (!wordWrap && ((textOffsetX + glyphWidth) > rec.width))
-                {
-                    textOffsetY += 16; //(font.baseSize + font.baseSize/2)*scaleFactor;
-                    textOffsetX = 0;
-                }
-
-                // When text overflows rectangle height limit, just stop drawing
-                if ((textOffsetY + font.baseSize*scaleFactor) > rec.height) break;
-
-                // Draw current character glyph
-                if ((codepoint != ' ') && (codepoint != '\t'))
-                {
-                    DrawTextCodepoint(font, codepoint, (Vector2){ rec.x + textOffsetX, rec.y + textOffsetY }, fontSize, tint);
-                }
-            }
-
-            if (wordWrap && (i == endLine))
-            {
-                textOffsetY += 16; //(font.baseSize + font.baseSize/2)*scaleFactor;
-                textOffsetX = 0;
-                startLine = endLine;
-                endLine = -1;
-                glyphWidth = 0;
-                k = lastk;
-
-                state = !state;
-            }
-        }
-
-        // if ((textOffsetX != 0) || (codepoint != ' ')) textOffsetX += glyphWidth;  // avoid leading spaces
-        textOffsetX += glyphWidth;
-    }
-}
\ No newline at end of file
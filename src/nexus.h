@@ -1,23 +1,127 @@
 #pragma once
 #include "cart.h"
+#include "replay.h"
+#include "textcache.h"
+#include "textlayout.h"
+#include "lua_alloc.h"
+#include "histogram.h"
+#include "raster.h"
 
 typedef struct {
     KeyboardKey keyboard[8];
+    GamepadButton gamepad[8];   // any gamepad that's plugged in, the left stick does the directions too
+    int repeat_delay;           // btnp(): ticks held before it starts repeating (0 = it doesn't)
+    int repeat_rate;            // and then every this many ticks
 } Controls;
 
+// Button state as the cart sees it, one bit per button. Worked out from FrameInput's
+// buttons every tick (each update() or doframe() call), so a second update() in the
+// same frame doesn't see the press again, and one with none doesn't lose it.
+typedef struct {
+    uint8_t held;
+    uint8_t pressed;            // went down this tick
+    uint8_t released;           // came up this tick
+    uint8_t repeat;             // pressed, or held long enough to go again (btnp())
+    uint32_t ticks[8];          // how long each has been held, 0 = it's up
+} Buttons;
+
+// Run-ahead (see runahead.h)
+typedef struct {
+    int frames;                 // --runahead: how far past the real frame the shown one is, 0 = off
+    double budget;              // seconds saving and restoring may take a frame before frames comes down
+    int over_budget;            // frames in a row they've gone over
+    int speculating;            // in frames that'll be thrown away: no sound, no replay, no error screen
+    int failed;                 // the cart errored in one of them
+    int64_t epoch;              // last real epoch(), which is what they get
+    // the real frame, kept while they run
+    LuaAllocSnapshot heap;
+    Screen screen;              // and after, the frame to show
+    Buttons buttons;
+    const ScreenFont *active_font;
+    int frameskip;
+    Cart_Sprites *sprites;
+    size_t asset_bytes;
+    // how it's going
+    uint64_t runs, failures;
+    double save_seconds, run_seconds, restore_seconds;
+    size_t peak_bytes;
+    Histogram cost;             // save + restore, per frame
+} Runahead;
+
+// Rewind (see rewind.h)
+typedef struct {
+    uint8_t *data;              // the state XORed with the frame before's (a keyframe's isn't), run-length coded
+    size_t bytes;
+    size_t size;                // how big the state was
+    int key;
+} RewindFrame;
+
+typedef struct {
+    int seconds;                // --rewind: how much history to keep, 0 = off
+    RewindFrame *frames;        // ring, oldest first
+    int capacity, first, count;
+    int since_key;              // frames since the newest keyframe
+    uint8_t *state;             // the newest frame's state, whole (zeros past state_size)
+    size_t state_size, state_capacity;
+    uint8_t *scratch;           // the encoder writes here first
+    size_t scratch_capacity;
+    size_t bytes, key_bytes;    // all of frames' data, and the keyframes' part of it
+    // how it's going
+    uint64_t captures, rewinds;
+    double capture_seconds;
+    size_t peak_bytes;
+    Histogram capture;
+} Rewind;
+
+typedef enum {
+    GC_GENERATIONAL = 0,    // Lua collects whenever allocation says so (the default)
+    GC_INCREMENTAL,         // same, but incremental
+    GC_IDLE,                // no automatic collection, the engine steps it after presenting
+} GCMode;
+
 typedef struct {
     Cart *cart;
-    RenderTexture2D framebuffer;
-    Image screen;
-    int screen_dirty;
+    Screen screen;          // what the cart draws into
+    Raster raster;          // and how (--raster-threads)
     int should_close;
-    Font font;
+    int headless;           // no window at all (--headless, --bench)
+    ScreenFont font;        // the built in one
+    const ScreenFont *active_font; // what print() draws with, font() picks
+    TextCache text_cache;   // print()ed strings, pre-rasterized
+    LayoutCache layout_cache; // printbox() line breaks
     Controls controls;
+    Buttons buttons;        // btn()/btnp()/btnr()
+    int frameskip;          // max draw() calls skipped in a row when update() falls behind
+    double accumulator;     // unsimulated time for the fixed timestep
+    double last_time;
+    size_t memory_cap;      // --memlimit, hard ceiling from whoever launched us (0 = not given)
+    GCMode gc_mode;         // --gc
+    double frame_deadline;  // when the next frame is due (GC_IDLE does its own frame pacing)
+    FrameInput input;       // everything from outside the cart gets to see this frame
+    uint32_t seed;          // math.random seed for the next InitLua
+    Replay replay;          // --record/--replay
+    Audio audio;            // sfx()/music() go through here
+    Runahead runahead;      // --runahead
+    Rewind rewind;          // --rewind
+    struct lua_State *L;    // the cart's, from InitLua to CloseLua
+    LuaAllocator allocator; // where L's memory comes from
 } NeXUS_VM;
 
-extern NeXUS_VM vm;
+#define DEFAULT_REPEAT_DELAY 15     // btnp() repeats after a quarter second held...
+#define DEFAULT_REPEAT_RATE 4       // ...15 times a second
+
+// btnp()'s rule: on the tick it goes down, then delay ticks later, then every rate ticks
+static inline int ButtonRepeats(uint32_t ticks, int delay, int rate)
+{
+    if (ticks==1) return 1;
+    if ((delay <= 0) || (ticks <= (uint32_t)delay)) return 0;
+    return ((ticks - 1 - (uint32_t)delay) % (uint32_t)rate)==0;
+}
+
+#define DEFAULT_FRAMESKIP 4
+#define MAX_FRAMESKIP 10
 
-#define HAS_SCREEN() ((vm.screen.data!=NULL)&&(!vm.screen_dirty))
-#define NO_SCREEN() ((vm.screen.data==NULL)||(vm.screen_dirty))
+#define DEFAULT_MEMORY_LIMIT (64*1024*1024)     // when neither the launcher nor the cart says otherwise
+#define ERROR_MEMORY_HEADROOM (256*1024)        // extra room the error screen gets after a cart runs out
 
-void ErrorScreen(const char *msg);
\ No newline at end of file
+void ErrorScreen(NeXUS_VM *vm, const char *msg); // up to whoever runs the VM (nexus.c, the benches)
\ No newline at end of file
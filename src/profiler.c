@@ -0,0 +1,94 @@
+#include "raylib.h"
+#include "profiler.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+const char *profilePhaseNames[PROFILE_PHASES] = {
+    "total", "input", "loader", "reset", "cart", "audio", "rewind", "runahead", "wait", "convert", "present", "vsync", "gc", "sleep"
+};
+
+void ProfilerReset(Profiler *p)
+{
+    memset(p, 0, sizeof(Profiler));
+}
+
+void ProfilerBeginFrame(Profiler *p)
+{
+    memset(&p->current, 0, sizeof(FrameTiming));
+    p->frame_start = p->last_mark = TimerNow();
+}
+
+void ProfilerMark(Profiler *p, ProfilePhase phase)
+{
+    double now = TimerNow();
+    p->current.ms[phase] += (float)((now - p->last_mark)*1000.0);
+    p->last_mark = now;
+}
+
+const FrameTiming *ProfilerEndFrame(Profiler *p)
+{
+    p->current.ms[PROFILE_TOTAL] = (float)((p->last_mark - p->frame_start)*1000.0);
+    FrameTiming *slot = &p->ring[p->next];
+    *slot = p->current;
+    p->next = (p->next + 1)%PROFILER_FRAMES;
+    if (p->count < PROFILER_FRAMES) p->count++;
+    p->frames++;
+    return slot;
+}
+
+static int CompareFloat(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+TimingStats ComputeTimingStats(const FrameTiming *frames, size_t count, ProfilePhase phase, float *scratch)
+{
+    TimingStats stats = { 0 };
+    if (count==0) return stats;
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        scratch[i] = frames[i].ms[phase];
+        sum += scratch[i];
+        if (scratch[i] > frames[stats.slowest].ms[phase]) stats.slowest = i;
+    }
+    qsort(scratch, count, sizeof(float), CompareFloat);
+    #define PCT(p) scratch[(size_t)((count - 1)*(p))]
+    stats.frames = count;
+    stats.min = scratch[0];
+    stats.mean = sum/count;
+    stats.p50 = PCT(0.5);
+    stats.p95 = PCT(0.95);
+    stats.p99 = PCT(0.99);
+    stats.max = scratch[count - 1];
+    #undef PCT
+    return stats;
+}
+
+// slowest comes back as a frame number (from 1, counting every frame ever ended)
+TimingStats ProfilerStats(const Profiler *p, ProfilePhase phase)
+{
+    static float scratch[PROFILER_FRAMES];
+    TimingStats stats = ComputeTimingStats(p->ring, p->count, phase, scratch);
+    if (p->count==0) return stats;
+    // ring index to age: the oldest frame sits at next once the ring has wrapped
+    size_t oldest = (p->count < PROFILER_FRAMES) ? 0 : p->next;
+    size_t age = (stats.slowest + PROFILER_FRAMES - oldest)%PROFILER_FRAMES;
+    stats.slowest = (size_t)(p->frames - p->count) + age + 1;
+    return stats;
+}
+
+void ProfilerLog(const Profiler *p)
+{
+    if (p->count==0) return;
+    TimingStats total = ProfilerStats(p, PROFILE_TOTAL);
+    TraceLog(LOG_INFO, "PROFILE: Last %zu frames: min %.3f ms, avg %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms (frame %zu)",
+        total.frames, total.min, total.mean, total.p50, total.p95, total.p99, total.max, total.slowest);
+    for (int phase = PROFILE_TOTAL + 1; phase < PROFILE_PHASES; phase++) {
+        TimingStats t = ProfilerStats(p, phase);
+        if (t.max==0) continue; // never happened, e.g. the loader
+        TraceLog(LOG_INFO, "PROFILE:   %-8s min %.3f ms, avg %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms (frame %zu)",
+            profilePhaseNames[phase], t.min, t.mean, t.p50, t.p95, t.p99, t.max, t.slowest);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Per-phase frame profiler
+// A frame is split into phases by marks: each ProfilerMark() charges the time since
+// the previous one (or since ProfilerBeginFrame) to a phase, so every microsecond of the
+// frame lands somewhere and it's one clock read per phase. The last PROFILER_FRAMES
+// frames are kept in a ring buffer for stats, anything older is gone.
+// With the pipeline going, loader through runahead happen on the worker during the
+// frame before, so they can add up to more than total.
+
+#define PROFILER_FRAMES 1024
+
+typedef enum {
+    PROFILE_TOTAL = 0,
+    PROFILE_INPUT,      // keyboard/replay, hotkeys
+    PROFILE_LOADER,     // loading a dropped cart
+    PROFILE_RESET,      // fresh Lua state and the cart's main chunk
+    PROFILE_CART,       // tasks, doframe/update/draw, including automatic GC
+    PROFILE_AUDIO,      // handing the frame's commands to the mixer (and mixing, without a mixer thread)
+    PROFILE_REWIND,     // capturing the frame for rewind (or rewinding)
+    PROFILE_RUNAHEAD,   // saving, the frames run ahead, restoring
+    PROFILE_WAIT,       // pipelined: waiting for the worker to finish the cart's frame
+    PROFILE_CONVERT,    // palette indices to RGBA (and the FPS counter)
+    PROFILE_PRESENT,    // texture upload and the scaled draw
+    PROFILE_VSYNC,      // EndDrawing: buffer swap, event polling, raylib's frame limiter
+    PROFILE_GC,         // GC_IDLE stepping
+    PROFILE_SLEEP,      // GC_IDLE waiting out the rest of the frame
+    PROFILE_PHASES
+} ProfilePhase;
+
+extern const char *profilePhaseNames[PROFILE_PHASES];
+
+typedef struct {
+    float ms[PROFILE_PHASES];
+} FrameTiming;
+
+typedef struct {
+    size_t frames;
+    double min, mean, p50, p95, p99, max;   // ms
+    size_t slowest;                         // index of the max frame in whatever was passed in
+} TimingStats;
+
+typedef struct {
+    FrameTiming ring[PROFILER_FRAMES];
+    uint32_t next;                  // where the next frame goes
+    uint32_t count;                 // frames in the ring
+    uint64_t frames;                // frames ever ended
+    double frame_start;
+    double last_mark;
+    FrameTiming current;
+} Profiler;
+
+void ProfilerReset(Profiler *p);
+void ProfilerBeginFrame(Profiler *p);
+void ProfilerMark(Profiler *p, ProfilePhase phase);       // time since the last mark goes to phase
+const FrameTiming *ProfilerEndFrame(Profiler *p);         // the frame that just finished
+TimingStats ProfilerStats(const Profiler *p, ProfilePhase phase);   // over the frames in the ring
+void ProfilerLog(const Profiler *p);                      // dump through TraceLog
+
+// scratch needs room for count floats
+TimingStats ComputeTimingStats(const FrameTiming *frames, size_t count, ProfilePhase phase, float *scratch);
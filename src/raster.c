@@ -0,0 +1,458 @@
+#include "raylib.h"
+#include "raster.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+enum {
+    RASTER_CLEAR = 0,
+    RASTER_PIXEL,
+    RASTER_RECT,
+    RASTER_RECT_LINES,
+    RASTER_CIRCLE,
+    RASTER_CIRCLE_LINES,
+    RASTER_LINE,
+    RASTER_TRIANGLE,
+    RASTER_TRIANGLE_LINES,
+    RASTER_BLIT,
+    RASTER_TEXT,
+};
+
+// same as screen.c's: anything else draws nothing there, so it doesn't get recorded
+static int Reasonable(double v)
+{
+    return (v > -1e9) && (v < 1e9);
+}
+
+// buffers only ever grow
+static int Grow(void **buffer, size_t *capacity, size_t count, size_t size)
+{
+    if (count <= *capacity) return 1;
+    size_t newCapacity = (*capacity > 0) ? *capacity : 256;
+    while (newCapacity < count) newCapacity *= 2;
+    void *grown = realloc(*buffer, newCapacity*size);
+    if (grown==NULL) return 0;
+    *buffer = grown;
+    *capacity = newCapacity;
+    return 1;
+}
+
+static void Draw(Screen *s, const Raster *r, const RasterCommand *c)
+{
+    const int *i = c->u.i;
+    const double *d = c->u.d;
+    switch (c->op) {
+        case RASTER_CLEAR: ScreenClear(s, c->color); break;
+        case RASTER_PIXEL: ScreenPixel(s, i[0], i[1], c->color); break;
+        case RASTER_RECT: ScreenRect(s, i[0], i[1], i[2], i[3], c->color); break;
+        case RASTER_RECT_LINES: ScreenRectLines(s, i[0], i[1], i[2], i[3], c->color); break;
+        case RASTER_CIRCLE: ScreenCircle(s, d[0], d[1], d[2], c->color); break;
+        case RASTER_CIRCLE_LINES: ScreenCircleLines(s, d[0], d[1], d[2], c->color); break;
+        case RASTER_LINE: ScreenLine(s, i[0], i[1], i[2], i[3], c->color); break;
+        case RASTER_TRIANGLE: ScreenTriangle(s, d[0], d[1], d[2], d[3], d[4], d[5], c->color); break;
+        case RASTER_TRIANGLE_LINES: ScreenTriangleLines(s, d[0], d[1], d[2], d[3], d[4], d[5], c->color); break;
+        case RASTER_BLIT: ScreenBlit(s, c->u.blit.img, c->u.blit.x, c->u.blit.y, c->u.blit.scale, c->flip, c->u.blit.rotation); break;
+        case RASTER_TEXT: ScreenTextRange(s, c->u.text.font, r->text + c->u.text.at, c->u.text.length, c->u.text.x, c->u.text.y, c->color); break;
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Recording
+//----------------------------------------------------------------------------------
+static void Discard(Raster *r)
+{
+    for (int t = 0; t < RASTER_TILES; t++) r->bins[t].count = 0;
+    r->count = 0;
+    r->pending = 0;
+    r->text_size = 0;
+}
+
+// Keeps c for the flush, in every tile of [x0, x1) x [y0, y1), the most it could touch
+static void Record(Raster *r, Screen *s, RasterCommand *c, int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    if (x0 < s->clip_x0) x0 = s->clip_x0;
+    if (y0 < s->clip_y0) y0 = s->clip_y0;
+    if (x1 > s->clip_x1) x1 = s->clip_x1;
+    if (y1 > s->clip_y1) y1 = s->clip_y1;
+    if ((x0 >= x1) || (y0 >= y1)) return; // clipped away, it wouldn't have drawn a thing
+    c->clip_x0 = (int16_t)s->clip_x0;
+    c->clip_y0 = (int16_t)s->clip_y0;
+    c->clip_x1 = (int16_t)s->clip_x1;
+    c->clip_y1 = (int16_t)s->clip_y1;
+    int tx0 = (int)x0/RASTER_TILE;
+    int ty0 = (int)y0/RASTER_TILE;
+    int tx1 = (int)(x1 - 1)/RASTER_TILE;
+    int ty1 = (int)(y1 - 1)/RASTER_TILE;
+
+    // all the room first, so running out can't leave it in half its tiles
+    int ok = Grow((void **)&r->commands, &r->capacity, r->count + 1, sizeof(RasterCommand));
+    for (int ty = ty0; ok && (ty <= ty1); ty++) {
+        for (int tx = tx0; ok && (tx <= tx1); tx++) {
+            RasterBin *b = &r->bins[ty*RASTER_TILES_X + tx];
+            ok = Grow((void **)&b->commands, &b->capacity, b->count + 1, sizeof(uint32_t));
+        }
+    }
+    if (!ok) {
+        // draw what's waiting then this, straight in (text it points at is still there after a flush)
+        r->fallbacks++;
+        RasterFlush(r, s);
+        Draw(s, r, c);
+        return;
+    }
+    uint32_t index = (uint32_t)r->count;
+    r->commands[r->count++] = *c;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            RasterBin *b = &r->bins[ty*RASTER_TILES_X + tx];
+            b->commands[b->count++] = index;
+        }
+    }
+    r->recorded++;
+    r->pending += (size_t)(tx1 - tx0 + 1)*(ty1 - ty0 + 1);
+}
+
+void RasterClear(Raster *r, Screen *s, uint8_t color)
+{
+    if (r->threads==0) {
+        ScreenClear(s, color);
+        return;
+    }
+    // over the whole screen, whatever's waiting would only get drawn over
+    if ((s->clip_x0==0) && (s->clip_y0==0) && (s->clip_x1==SCREEN_WIDTH) && (s->clip_y1==SCREEN_HEIGHT)) {
+        r->discarded += r->count;
+        Discard(r);
+    }
+    RasterCommand c = { RASTER_CLEAR, color };
+    Record(r, s, &c, s->clip_x0, s->clip_y0, s->clip_x1, s->clip_y1);
+}
+
+// only has to wait if something's going to draw in its tile (and then it draws the lot)
+uint8_t RasterGetPixel(Raster *r, Screen *s, int x, int y)
+{
+    if ((r->count > 0) && (x >= 0) && (y >= 0) && (x < SCREEN_WIDTH) && (y < SCREEN_HEIGHT)) {
+        if (r->bins[(y/RASTER_TILE)*RASTER_TILES_X + x/RASTER_TILE].count > 0) RasterFlush(r, s);
+    }
+    return ScreenGetPixel(s, x, y);
+}
+
+void RasterPixel(Raster *r, Screen *s, int x, int y, uint8_t color)
+{
+    // with nothing waiting it can't jump the queue, and pix() read-modify-write loops
+    // would flush on every read otherwise
+    if ((r->threads==0) || (r->count==0)) {
+        ScreenPixel(s, x, y, color);
+        return;
+    }
+    RasterCommand c = { RASTER_PIXEL, color };
+    c.u.i[0] = x;
+    c.u.i[1] = y;
+    Record(r, s, &c, x, y, (int64_t)x + 1, (int64_t)y + 1);
+}
+
+static void RecordRect(Raster *r, Screen *s, int op, int x, int y, int w, int h, uint8_t color)
+{
+    if ((w <= 0) || (h <= 0)) return;
+    RasterCommand c = { (uint8_t)op, color };
+    c.u.i[0] = x;
+    c.u.i[1] = y;
+    c.u.i[2] = w;
+    c.u.i[3] = h;
+    Record(r, s, &c, x, y, (int64_t)x + w, (int64_t)y + h);
+}
+
+void RasterRect(Raster *r, Screen *s, int x, int y, int w, int h, uint8_t color)
+{
+    if (r->threads==0) ScreenRect(s, x, y, w, h, color);
+    else RecordRect(r, s, RASTER_RECT, x, y, w, h, color);
+}
+
+void RasterRectLines(Raster *r, Screen *s, int x, int y, int w, int h, uint8_t color)
+{
+    if (r->threads==0) ScreenRectLines(s, x, y, w, h, color);
+    else RecordRect(r, s, RASTER_RECT_LINES, x, y, w, h, color);
+}
+
+static void RecordCircle(Raster *r, Screen *s, int op, double x, double y, double radius, uint8_t color)
+{
+    if (!(radius > 0) || !Reasonable(x) || !Reasonable(y) || !Reasonable(radius)) return;
+    RasterCommand c = { (uint8_t)op, color };
+    c.u.d[0] = x;
+    c.u.d[1] = y;
+    c.u.d[2] = radius;
+    Record(r, s, &c, (int64_t)floor(x - radius) - 1, (int64_t)floor(y - radius) - 1, (int64_t)ceil(x + radius) + 1, (int64_t)ceil(y + radius) + 1);
+}
+
+void RasterCircle(Raster *r, Screen *s, double x, double y, double radius, uint8_t color)
+{
+    if (r->threads==0) ScreenCircle(s, x, y, radius, color);
+    else RecordCircle(r, s, RASTER_CIRCLE, x, y, radius, color);
+}
+
+void RasterCircleLines(Raster *r, Screen *s, double x, double y, double radius, uint8_t color)
+{
+    if (r->threads==0) ScreenCircleLines(s, x, y, radius, color);
+    else RecordCircle(r, s, RASTER_CIRCLE_LINES, x, y, radius, color);
+}
+
+void RasterLine(Raster *r, Screen *s, int x1, int y1, int x2, int y2, uint8_t color)
+{
+    if (r->threads==0) {
+        ScreenLine(s, x1, y1, x2, y2, color);
+        return;
+    }
+    RasterCommand c = { RASTER_LINE, color };
+    c.u.i[0] = x1;
+    c.u.i[1] = y1;
+    c.u.i[2] = x2;
+    c.u.i[3] = y2;
+    Record(r, s, &c, (x1 < x2) ? x1 : x2, (y1 < y2) ? y1 : y2, (int64_t)((x1 > x2) ? x1 : x2) + 1, (int64_t)((y1 > y2) ? y1 : y2) + 1);
+}
+
+static void RecordTriangle(Raster *r, Screen *s, int op, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color)
+{
+    if (!Reasonable(x1) || !Reasonable(y1) || !Reasonable(x2) || !Reasonable(y2) || !Reasonable(x3) || !Reasonable(y3)) return;
+    RasterCommand c = { (uint8_t)op, color };
+    c.u.d[0] = x1;
+    c.u.d[1] = y1;
+    c.u.d[2] = x2;
+    c.u.d[3] = y2;
+    c.u.d[4] = x3;
+    c.u.d[5] = y3;
+    double left = fmin(x1, fmin(x2, x3));
+    double top = fmin(y1, fmin(y2, y3));
+    double right = fmax(x1, fmax(x2, x3));
+    double bottom = fmax(y1, fmax(y2, y3));
+    Record(r, s, &c, (int64_t)floor(left) - 1, (int64_t)floor(top) - 1, (int64_t)ceil(right) + 1, (int64_t)ceil(bottom) + 1);
+}
+
+void RasterTriangle(Raster *r, Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color)
+{
+    if (r->threads==0) ScreenTriangle(s, x1, y1, x2, y2, x3, y3, color);
+    else RecordTriangle(r, s, RASTER_TRIANGLE, x1, y1, x2, y2, x3, y3, color);
+}
+
+void RasterTriangleLines(Raster *r, Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color)
+{
+    if (r->threads==0) ScreenTriangleLines(s, x1, y1, x2, y2, x3, y3, color);
+    else RecordTriangle(r, s, RASTER_TRIANGLE_LINES, x1, y1, x2, y2, x3, y3, color);
+}
+
+void RasterBlit(Raster *r, Screen *s, const ScreenImage *img, double x, double y, double scale, int flip, double rotation)
+{
+    if (r->threads==0) {
+        ScreenBlit(s, img, x, y, scale, flip, rotation);
+        return;
+    }
+    if (!(scale > 0) || (img->width <= 0) || (img->height <= 0)) return;
+    double w = img->width*scale;
+    double h = img->height*scale;
+    if (!Reasonable(x) || !Reasonable(y) || !Reasonable(w) || !Reasonable(h) || !Reasonable(rotation)) return;
+    RasterCommand c = { RASTER_BLIT, 0, (uint8_t)flip };
+    c.u.blit.img = img;
+    c.u.blit.x = x;
+    c.u.blit.y = y;
+    c.u.blit.scale = scale;
+    c.u.blit.rotation = rotation;
+    // whatever the rotation, it stays within (w + h)/2 of its center
+    double cx = x + w/2;
+    double cy = y + h/2;
+    double reach = (w + h)/2;
+    Record(r, s, &c, (int64_t)floor(cx - reach) - 1, (int64_t)floor(cy - reach) - 1, (int64_t)ceil(cx + reach) + 1, (int64_t)ceil(cy + reach) + 1);
+}
+
+// the first length bytes of text (up to a 0), copied since the string won't be around at the flush
+static void RecordText(Raster *r, Screen *s, const ScreenFont *font, const char *text, size_t length, int x, int y, uint8_t color)
+{
+    const char *end = memchr(text, 0, length);
+    if (end!=NULL) length = (size_t)(end - text);
+    if (length==0) return;
+    if (!Grow((void **)&r->text, &r->text_capacity, r->text_size + length + 1, 1)) {
+        r->fallbacks++;
+        RasterFlush(r, s);
+        ScreenTextRange(s, font, text, length, x, y, color);
+        return;
+    }
+    char *copy = r->text + r->text_size;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    RasterCommand c = { RASTER_TEXT, color };
+    c.u.text.font = font;
+    c.u.text.at = r->text_size;
+    c.u.text.length = length;
+    c.u.text.x = x;
+    c.u.text.y = y;
+    r->text_size += length + 1;
+
+    // widest line, by however many lines there are (they could go up, line_spacing's signed)
+    int lines = 1;
+    for (size_t i = 0; i < length; i++) lines += (copy[i]=='\n');
+    int64_t last = (int64_t)y + (int64_t)(lines - 1)*font->line_spacing;
+    int64_t top = (last < y) ? last : y;
+    int64_t bottom = ((last > y) ? last : y) + font->height;
+    Record(r, s, &c, x, top, (int64_t)x + ScreenTextWidth(font, copy), bottom);
+}
+
+void RasterText(Raster *r, Screen *s, TextCache *cache, const ScreenFont *font, const char *text, int x, int y, uint8_t color)
+{
+    if (r->threads > 0) RecordText(r, s, font, text, strlen(text), x, y, color);
+    else if (cache!=NULL) TextCachePrint(cache, s, font, text, x, y, color);
+    else ScreenText(s, font, text, x, y, color);
+}
+
+int RasterLayout(Raster *r, Screen *s, const ScreenFont *font, const char *text, const TextLayout *layout, int x, int y, int maxHeight, uint8_t color)
+{
+    if (r->threads==0) return DrawLayout(s, font, text, layout, x, y, maxHeight, color);
+    int drawn = 0;
+    for (int i = 0; i < layout->count; i++) {
+        if ((maxHeight >= 0) && (LayoutHeight(font, i + 1) > maxHeight)) break;
+        const TextLine *line = &layout->lines[i];
+        RecordText(r, s, font, text + line->start, (size_t)line->length, x, y + i*font->line_spacing, color);
+        drawn++;
+    }
+    return drawn;
+}
+
+//----------------------------------------------------------------------------------
+// Drawing the tiles
+//----------------------------------------------------------------------------------
+static void DrawTile(Raster *r, Screen *scratch, int tile)
+{
+    int x0 = (tile%RASTER_TILES_X)*RASTER_TILE;
+    int y0 = (tile/RASTER_TILES_X)*RASTER_TILE;
+    int x1 = (x0 + RASTER_TILE < SCREEN_WIDTH) ? x0 + RASTER_TILE : SCREEN_WIDTH;
+    int y1 = (y0 + RASTER_TILE < SCREEN_HEIGHT) ? y0 + RASTER_TILE : SCREEN_HEIGHT;
+    uint8_t *target = r->target->pixels;
+    for (int y = y0; y < y1; y++) memcpy(scratch->pixels + y*SCREEN_WIDTH + x0, target + y*SCREEN_WIDTH + x0, (size_t)(x1 - x0));
+    const RasterBin *b = &r->bins[tile];
+    for (size_t i = 0; i < b->count; i++) {
+        const RasterCommand *c = &r->commands[b->commands[i]];
+        scratch->clip_x0 = (c->clip_x0 > x0) ? c->clip_x0 : x0;
+        scratch->clip_y0 = (c->clip_y0 > y0) ? c->clip_y0 : y0;
+        scratch->clip_x1 = (c->clip_x1 < x1) ? c->clip_x1 : x1;
+        scratch->clip_y1 = (c->clip_y1 < y1) ? c->clip_y1 : y1;
+        Draw(scratch, r, c);
+    }
+    for (int y = y0; y < y1; y++) memcpy(target + y*SCREEN_WIDTH + x0, scratch->pixels + y*SCREEN_WIDTH + x0, (size_t)(x1 - x0));
+}
+
+// its own run of tiles first, then the others', a tile at a time
+static void DrawTiles(void *arg)
+{
+    RasterCrew *self = arg;
+    Raster *r = self->raster;
+    int me = (int)(self - r->crew);
+    for (int k = 0; k < r->active; k++) {
+        RasterCrew *from = &r->crew[(me + k)%r->active];
+        uint32_t i;
+        while ((i = AtomicAdd(&from->next, 1) - 1) < from->end) {
+            DrawTile(r, self->scratch, r->order[i]);
+            self->tiles++;
+            if (k > 0) self->steals++;
+        }
+    }
+}
+
+static void DrawInTiles(Raster *r, Screen *s)
+{
+    int n = 0;
+    for (int t = 0; t < RASTER_TILES; t++) {
+        if (r->bins[t].count > 0) r->order[n++] = (uint8_t)t;
+    }
+    r->target = s;
+    r->active = (r->threads < n) ? r->threads : n;
+    for (int i = 0; i < r->active; i++) {
+        r->crew[i].next = (uint32_t)(n*i/r->active);
+        r->crew[i].end = (uint32_t)(n*(i + 1)/r->active);
+    }
+    for (int i = 1; i < r->active; i++) WorkerRun(&r->crew[i].worker, DrawTiles, &r->crew[i]);
+    DrawTiles(&r->crew[0]);
+    for (int i = 1; i < r->active; i++) WorkerWait(&r->crew[i].worker);
+}
+
+void RasterFlush(Raster *r, Screen *s)
+{
+    if (r->count==0) return;
+    double start = TimerNow();
+    r->binned += r->pending;
+    if (r->pending < RASTER_SERIAL_BELOW) {
+        // not worth waking anyone for, straight in it goes
+        int clip[4] = { s->clip_x0, s->clip_y0, s->clip_x1, s->clip_y1 };
+        for (size_t i = 0; i < r->count; i++) {
+            const RasterCommand *c = &r->commands[i];
+            s->clip_x0 = c->clip_x0;
+            s->clip_y0 = c->clip_y0;
+            s->clip_x1 = c->clip_x1;
+            s->clip_y1 = c->clip_y1;
+            Draw(s, r, c);
+        }
+        s->clip_x0 = clip[0];
+        s->clip_y0 = clip[1];
+        s->clip_x1 = clip[2];
+        s->clip_y1 = clip[3];
+        r->serial_flushes++;
+    } else {
+        DrawInTiles(r, s);
+    }
+    Discard(r);
+
+    double seconds = TimerNow() - start;
+    r->flushes++;
+    r->flush_seconds += seconds;
+    HistogramAdd(&r->flush, seconds);
+}
+
+//----------------------------------------------------------------------------------
+// Setup
+//----------------------------------------------------------------------------------
+int RasterInit(Raster *r, int threads)
+{
+    memset(r, 0, sizeof(Raster));
+    r->flush.name = "raster flush";
+    if (threads <= 0) return 0;
+    if (threads > RASTER_MAX_THREADS) threads = RASTER_MAX_THREADS;
+    for (int i = 0; i < threads; i++) {
+        RasterCrew *c = &r->crew[i];
+        c->raster = r;
+        c->scratch = malloc(sizeof(Screen));
+        if (c->scratch==NULL) break;
+        if ((i > 0) && !WorkerStart(&c->worker)) {
+            free(c->scratch);
+            c->scratch = NULL;
+            break;
+        }
+        r->threads++;
+    }
+    if (r->threads < threads) TraceLog(LOG_WARNING, "RASTER: Only got %d of %d threads", r->threads, threads);
+    return r->threads;
+}
+
+void RasterLog(Raster *r)
+{
+    if (r->flushes==0) return;
+    uint64_t tiles = 0;
+    uint64_t steals = 0;
+    for (int i = 0; i < r->threads; i++) {
+        tiles += r->crew[i].tiles;
+        steals += r->crew[i].steals;
+    }
+    TraceLog(LOG_INFO, "RASTER: %d threads, %llu flushes (%llu too small to split up), %.1f commands each on average, %.3f ms per flush",
+        r->threads, (unsigned long long)r->flushes, (unsigned long long)r->serial_flushes, (double)r->recorded/(double)r->flushes,
+        r->flush_seconds*1000.0/(double)r->flushes);
+    TraceLog(LOG_INFO, "RASTER: %.1f tiles per command, %.1f%% of tiles stolen, %llu commands dropped under a cls(), %llu drawn straight in for lack of memory",
+        (r->recorded > 0) ? (double)r->binned/(double)r->recorded : 0.0, (tiles > 0) ? 100.0*(double)steals/(double)tiles : 0.0,
+        (unsigned long long)r->discarded, (unsigned long long)r->fallbacks);
+    HistogramLog(&r->flush);
+}
+
+void RasterFree(Raster *r)
+{
+    for (int i = 0; i < r->threads; i++) {
+        if (i > 0) WorkerStop(&r->crew[i].worker);
+        free(r->crew[i].scratch);
+    }
+    for (int t = 0; t < RASTER_TILES; t++) free(r->bins[t].commands);
+    free(r->commands);
+    free(r->text);
+    memset(r, 0, sizeof(Raster));
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "screen.h"
+#include "textcache.h"
+#include "textlayout.h"
+#include "thread.h"
+#include "histogram.h"
+
+// Tile-binned raster
+// With threads on, what the cart draws in a frame piles up in a list instead of going
+// straight into the screen, each command noting which RASTER_TILE square tiles it can
+// touch. RasterFlush then hands the tiles out to a pool of threads. A thread draws a
+// tile by replaying just that tile's commands, in the order they were made, clipped to
+// the tile, into its own copy of the tile.
+//
+// That comes out exactly what drawing them straight in would have. Nothing in screen.c
+// depends on where the clip rect is: every primitive works each pixel out on its own and
+// the clip only decides which of them get written. And inside one tile the order's kept.
+//
+// Every thread starts on its own run of tiles, and one that runs out steals from the
+// others' runs, a tile at a time. The busy part of the screen is usually all in one
+// place, so without the stealing the thread that got it would set the pace.
+//
+// Anything that reads the screen has to flush first: RasterGetPixel does (only if its
+// tile has something waiting), the engine does at the end of every cart frame. Sprites
+// and fonts have to stay put until then. Between flushes everything's for the same screen.
+// A lone pixel with nothing waiting goes straight in too (it can't jump the queue if
+// there isn't one), so pix() read-modify-write loops don't flush on every read.
+// threads 0 (a zeroed Raster) doesn't record anything, the calls go straight to the screen.
+//
+// When it pays
+// Recording, binning and redrawing the edges of everything once per tile costs more
+// than drawing straight in: on one thread the tiled path takes 1.2-2.1x as long
+// (bench/raster_bench: 0.47x on lots of small things, 0.74x on big ones piled up, 0.85x
+// under a moving clip). Only the flush splits up, so with the flush shared perfectly
+// the tiles break even at record + flush/threads = straight, which for those scenes is
+// about 3, 2 and 2 threads, each on a core of its own. So expect it to lose below 3 real
+// cores and only start to win from 4. raster_bench prints that estimate for the machine
+// it runs on. Those numbers come from a single-core machine (where 2-8 threads only
+// measure the overhead of handing tiles out); nothing here has been measured on
+// several cores yet, which is why it stays off unless --raster-threads asks for it.
+// RASTER_SERIAL_BELOW and RASTER_TILE are starting points, not tuned values. Below the
+// cutoff a flush is a handful of small draws, less work than waking the threads, and it
+// only decides flushes that small. The tile size does move the crossover: smaller tiles
+// share out more evenly but redraw more edges. Set both from raster_bench runs on
+// multi-core machines before the raster becomes more than an opt-in.
+
+#define RASTER_TILE 32              // (untuned, see above)
+#define RASTER_TILES_X ((SCREEN_WIDTH + RASTER_TILE - 1)/RASTER_TILE)
+#define RASTER_TILES_Y ((SCREEN_HEIGHT + RASTER_TILE - 1)/RASTER_TILE)
+#define RASTER_TILES (RASTER_TILES_X*RASTER_TILES_Y)
+#define RASTER_MAX_THREADS 16
+#define RASTER_SERIAL_BELOW 64      // flushes with fewer command-tiles than this just draw in order, here (untuned)
+
+typedef struct {
+    uint8_t op;
+    uint8_t color;
+    uint8_t flip;
+    int16_t clip_x0, clip_y0;   // the screen's clip rect when it was drawn
+    int16_t clip_x1, clip_y1;
+    union {
+        int i[4];
+        double d[6];
+        struct { const ScreenImage *img; double x, y, scale, rotation; } blit;
+        struct { const ScreenFont *font; size_t at, length; int x, y; } text; // at: into the raster's text
+    } u;
+} RasterCommand;
+
+typedef struct {
+    uint32_t *commands;         // the ones that touch this tile, in order
+    size_t count, capacity;
+} RasterBin;
+
+struct Raster;
+
+// one per thread drawing tiles, the first is whoever flushes
+typedef struct {
+    struct Raster *raster;
+    Worker worker;              // (not the first's)
+    Screen *scratch;            // tiles get drawn here, then copied out
+    volatile uint32_t next;     // its run of tiles is [next, end) in the raster's order
+    uint32_t end;
+    uint64_t tiles, steals;
+} RasterCrew;
+
+typedef struct Raster {
+    int threads;                // 0 = straight to the screen
+    RasterCommand *commands;
+    size_t count, capacity;
+    size_t pending;             // commands times the tiles each is in
+    char *text;                 // what print() and friends draw, copied
+    size_t text_size, text_capacity;
+    RasterBin bins[RASTER_TILES];
+    RasterCrew crew[RASTER_MAX_THREADS];
+    int active;                 // how many of them this flush
+    uint8_t order[RASTER_TILES]; // tiles with anything in them
+    Screen *target;             // this flush's
+    // how it's going
+    uint64_t flushes, serial_flushes, recorded, discarded, binned, fallbacks;
+    double flush_seconds;
+    Histogram flush;
+} Raster;
+
+int RasterInit(Raster *r, int threads);    // how many threads it got (can be fewer, 0 if none at all)
+void RasterFlush(Raster *r, Screen *s);     // draws everything waiting
+void RasterLog(Raster *r);
+void RasterFree(Raster *r);                 // waiting draws are dropped
+
+// Same as the Screen* calls (print goes through the cache when it's not recording)
+void RasterClear(Raster *r, Screen *s, uint8_t color);
+uint8_t RasterGetPixel(Raster *r, Screen *s, int x, int y);
+void RasterPixel(Raster *r, Screen *s, int x, int y, uint8_t color);
+void RasterRect(Raster *r, Screen *s, int x, int y, int w, int h, uint8_t color);
+void RasterRectLines(Raster *r, Screen *s, int x, int y, int w, int h, uint8_t color);
+void RasterCircle(Raster *r, Screen *s, double x, double y, double radius, uint8_t color);
+void RasterCircleLines(Raster *r, Screen *s, double x, double y, double radius, uint8_t color);
+void RasterLine(Raster *r, Screen *s, int x1, int y1, int x2, int y2, uint8_t color);
+void RasterTriangle(Raster *r, Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color);
+void RasterTriangleLines(Raster *r, Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color);
+void RasterBlit(Raster *r, Screen *s, const ScreenImage *img, double x, double y, double scale, int flip, double rotation);
+void RasterText(Raster *r, Screen *s, TextCache *cache, const ScreenFont *font, const char *text, int x, int y, uint8_t color); // cache can be NULL
+int RasterLayout(Raster *r, Screen *s, const ScreenFont *font, const char *text, const TextLayout *layout, int x, int y, int maxHeight, uint8_t color); // DrawLayout
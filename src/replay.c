@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+
+//----------------------------------------------------------------------------------
+// Writing
+//----------------------------------------------------------------------------------
+static void WriteU32(FILE *f, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) fputc((v >> (i*8)) & 0xFF, f);
+}
+
+static void WriteVarint(FILE *f, uint32_t v)
+{
+    while (v >= 0x80) {
+        fputc((v & 0x7F) | 0x80, f);
+        v >>= 7;
+    }
+    fputc(v, f);
+}
+
+static void WriteString(FILE *f, const char *s)
+{
+    uint32_t len = (uint32_t)strlen(s);
+    WriteVarint(f, len);
+    fwrite(s, 1, len, f);
+}
+
+static void WriteFrameBytes(FILE *f, const FrameInput *input)
+{
+    fputc(input->buttons, f);
+    fputc(input->system, f);
+    fputc(input->steps, f);
+}
+
+// write out the frames being coalesced, if any
+static void FlushRun(Replay *r)
+{
+    if (r->run_length==0) return;
+    if (r->run_length==1) {
+        fputc('F', r->file);
+    } else {
+        fputc('R', r->file);
+        WriteVarint(r->file, r->run_length);
+    }
+    WriteFrameBytes(r->file, &r->run);
+    r->run_length = 0;
+}
+
+int StartRecording(Replay *r, const char *path, uint32_t seed, const char *cart)
+{
+    memset(r, 0, sizeof(Replay));
+    r->file = fopen(path, "wb");
+    if (r->file==NULL) return 0;
+    fwrite(REPLAY_MAGIC, 1, 4, r->file);
+    fputc(REPLAY_VERSION, r->file);
+    WriteU32(r->file, seed);
+    WriteString(r->file, cart);
+    r->mode = REPLAY_RECORD;
+    return 1;
+}
+
+void RecordFrame(Replay *r, const FrameInput *input)
+{
+    if (r->mode!=REPLAY_RECORD) return;
+    r->frame++;
+    if (input->system==0) {
+        // most frames look exactly like the one before
+        if ((r->run_length > 0) && (r->run_length < UINT32_MAX)
+            && (r->run.buttons==input->buttons) && (r->run.steps==input->steps)) {
+            r->run_length++;
+            return;
+        }
+        FlushRun(r);
+        r->run = *input;
+        r->run.drop = NULL;
+        r->run_length = 1;
+        return;
+    }
+    FlushRun(r);
+    fputc('F', r->file);
+    WriteFrameBytes(r->file, input);
+    if (input->system & SYSTEM_DROP) WriteString(r->file, input->drop ? input->drop : "");
+    if (input->system & (SYSTEM_RESET|SYSTEM_DROP)) WriteU32(r->file, input->seed);
+}
+
+void RecordEpoch(Replay *r, int64_t t)
+{
+    if (r->mode!=REPLAY_RECORD) return;
+    FlushRun(r); // it belongs to the frame that's pending
+    fputc('E', r->file);
+    uint64_t v = (uint64_t)t;
+    for (int i = 0; i < 8; i++) fputc((int)((v >> (i*8)) & 0xFF), r->file);
+}
+
+//----------------------------------------------------------------------------------
+// Reading
+//----------------------------------------------------------------------------------
+static int ReadByte(Replay *r, uint8_t *v)
+{
+    if (r->offset >= r->size) return 0;
+    *v = r->data[r->offset++];
+    return 1;
+}
+
+static int ReadU32(Replay *r, uint32_t *v)
+{
+    if (r->size - r->offset < 4) return 0;
+    const unsigned char *p = r->data + r->offset;
+    *v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    r->offset += 4;
+    return 1;
+}
+
+static int ReadVarint(Replay *r, uint32_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t b;
+        if (!ReadByte(r, &b)) return 0;
+        *v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return 1;
+    }
+    return 0;
+}
+
+// returns a NUL terminated copy, or NULL if the data's cut short
+static char *ReadString(Replay *r)
+{
+    uint32_t len;
+    if (!ReadVarint(r, &len) || (r->size - r->offset < len)) return NULL;
+    char *s = malloc(len + 1);
+    if (s==NULL) return NULL;
+    memcpy(s, r->data + r->offset, len);
+    s[len] = '\0';
+    r->offset += len;
+    return s;
+}
+
+static int ReadFrameBytes(Replay *r, FrameInput *input)
+{
+    return ReadByte(r, &input->buttons) && ReadByte(r, &input->system) && ReadByte(r, &input->steps);
+}
+
+int StartPlayback(Replay *r, const char *path, uint32_t *seed, const char **cart)
+{
+    memset(r, 0, sizeof(Replay));
+    FILE *f = fopen(path, "rb");
+    if (f==NULL) return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 5) {
+        fclose(f);
+        return 0;
+    }
+    r->data = malloc((size_t)size);
+    if ((r->data==NULL) || (fread(r->data, 1, (size_t)size, f)!=(size_t)size)) {
+        fclose(f);
+        StopReplay(r);
+        return 0;
+    }
+    fclose(f);
+    r->size = (size_t)size;
+
+    if ((memcmp(r->data, REPLAY_MAGIC, 4)!=0) || (r->data[4]!=REPLAY_VERSION)) {
+        StopReplay(r);
+        return 0;
+    }
+    r->offset = 5;
+    if (!ReadU32(r, seed) || ((r->cart = ReadString(r))==NULL)) {
+        StopReplay(r);
+        return 0;
+    }
+    *cart = r->cart;
+    r->mode = REPLAY_PLAYBACK;
+    return 1;
+}
+
+static void Diverged(Replay *r)
+{
+    if (r->diverged==0) r->diverged = r->frame;
+}
+
+int PlaybackFrame(Replay *r, FrameInput *input)
+{
+    if (r->mode!=REPLAY_PLAYBACK) return 0;
+    free(r->drop);
+    r->drop = NULL;
+
+    if (r->run_left > 0) {
+        r->run_left--;
+        r->frame++;
+        *input = r->run;
+        return 1;
+    }
+
+    uint8_t tag;
+    do {
+        if (!ReadByte(r, &tag)) return 0;
+        if (tag=='E') {
+            // an epoch() result nobody asked for this time around, skip it
+            if (r->size - r->offset < 8) return 0;
+            r->offset += 8;
+            Diverged(r);
+        }
+    } while (tag=='E');
+
+    memset(input, 0, sizeof(FrameInput));
+    if (tag=='R') {
+        uint32_t count;
+        if (!ReadVarint(r, &count) || (count==0) || !ReadFrameBytes(r, &r->run)) return 0;
+        r->run.drop = NULL;
+        r->run_left = count - 1;
+        *input = r->run;
+    } else if (tag=='F') {
+        if (!ReadFrameBytes(r, input)) return 0;
+        if (input->system & SYSTEM_DROP) {
+            r->drop = ReadString(r);
+            if (r->drop==NULL) return 0;
+            input->drop = r->drop;
+        }
+        if ((input->system & (SYSTEM_RESET|SYSTEM_DROP)) && !ReadU32(r, &input->seed)) return 0;
+    } else {
+        return 0;   // out of data (or garbage)
+    }
+    r->frame++;
+    return 1;
+}
+
+int PlaybackEpoch(Replay *r, int64_t *t)
+{
+    if (r->mode!=REPLAY_PLAYBACK) return 0;
+    // (frames in the middle of a run had no epoch() calls when they were recorded)
+    if ((r->run_left > 0) || (r->offset >= r->size) || (r->data[r->offset]!='E') || (r->size - r->offset < 9)) {
+        Diverged(r);
+        return 0;
+    }
+    const unsigned char *p = r->data + r->offset + 1;
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (i*8);
+    *t = (int64_t)v;
+    r->offset += 9;
+    return 1;
+}
+
+void StopReplay(Replay *r)
+{
+    if (r->file!=NULL) {
+        FlushRun(r);
+        fclose(r->file);
+    }
+    free(r->data);
+    free(r->cart);
+    free(r->drop);
+    memset(r, 0, sizeof(Replay));
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Input recording and replay
+// Everything from outside that a cart can see gets funneled through a FrameInput at
+// the start of each frame (plus epoch() results as they happen), so writing those down
+// is enough to play a session back frame for frame.
+//
+// File layout: "NXRP", version byte, u32 seed, varint length + path of the boot cart,
+// then a stream of records, one tag byte each:
+//   'F' buttons system steps              one frame
+//   'R' varint count buttons system steps  count identical frames (system is always 0)
+//   'E' i64                                an epoch() result, during the frame before it
+// A frame with SYSTEM_DROP set is followed by varint length + path of the dropped cart,
+// and one with SYSTEM_RESET or SYSTEM_DROP by the u32 seed of the fresh Lua state.
+// Numbers are little endian, varints are LEB128.
+
+#define REPLAY_MAGIC "NXRP"
+#define REPLAY_VERSION 1
+
+#define SYSTEM_RESET (1<<0)     // Ctrl+R
+#define SYSTEM_COPY (1<<1)      // Ctrl+C (the error screen copies its message)
+#define SYSTEM_DROP (1<<2)      // a cart got dropped on the window
+#define SYSTEM_REWIND (1<<3)    // Backspace, with --rewind on; the cart doesn't run, steps is how many frames back
+
+typedef struct {
+    uint8_t buttons;    // bit i = vm.controls button i held
+    uint8_t system;     // SYSTEM_* this frame
+    uint8_t steps;      // update() calls this frame, for fixed timestep carts (frames back, for SYSTEM_REWIND)
+    uint32_t seed;      // math.random seed, if SYSTEM_RESET or SYSTEM_DROP
+    char *drop;         // dropped cart path, if SYSTEM_DROP (owned by whoever filled it in)
+} FrameInput;
+
+typedef enum {
+    REPLAY_OFF = 0,
+    REPLAY_RECORD,
+    REPLAY_PLAYBACK,
+} ReplayMode;
+
+typedef struct {
+    ReplayMode mode;
+    uint64_t frame;             // frames recorded/played so far
+    // recording
+    FILE *file;
+    FrameInput run;             // plain frame being coalesced into an 'R' record
+    uint32_t run_length;
+    // playback
+    unsigned char *data;
+    size_t size;
+    size_t offset;
+    char *cart;                 // the boot cart from the header
+    uint32_t run_left;          // frames of the current 'R' record still to hand out
+    char *drop;                 // the last frame's dropped cart path
+    uint64_t diverged;          // first frame the cart asked for something the recording didn't have (0 = never)
+} Replay;
+
+// both return 0 on failure (can't open/write, not a replay, wrong version)
+// seed and cart are what the session started with; playback hands them back
+// (cart stays valid until StopReplay)
+int StartRecording(Replay *r, const char *path, uint32_t seed, const char *cart);
+int StartPlayback(Replay *r, const char *path, uint32_t *seed, const char **cart);
+void StopReplay(Replay *r);
+
+void RecordFrame(Replay *r, const FrameInput *input);
+void RecordEpoch(Replay *r, int64_t t);
+
+// 0 once the replay has run out of frames
+int PlaybackFrame(Replay *r, FrameInput *input);
+// 0 if the recording had no epoch() call here, which means the replay has diverged
+int PlaybackEpoch(Replay *r, int64_t *t);
@@ -0,0 +1,290 @@
+#include "rewind.h"
+#include "lua_api.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// What goes in front of vm->screen and the heap in a frame's state
+typedef struct {
+    LuaAllocator allocator;
+    Buttons buttons;
+    const ScreenFont *active_font;
+    int frameskip;
+    Cart_Sprites *sprites;
+    size_t asset_bytes;
+    size_t heap_size;
+} RewindHeader;
+
+typedef struct {
+    uint8_t *out;
+    size_t size;
+    size_t capacity;
+    size_t zeros;               // unchanged bytes since the last run written out
+} DeltaWriter;
+
+// buffers only ever grow; with zero set the new part starts out zeroed
+static int Grow(uint8_t **buffer, size_t *capacity, size_t size, int zero)
+{
+    if (size <= *capacity) return 1;
+    size_t newCapacity = (*capacity > 0) ? *capacity : 64*1024;
+    while (newCapacity < size) newCapacity *= 2;
+    uint8_t *grown = realloc(*buffer, newCapacity);
+    if (grown==NULL) return 0;
+    if (zero) memset(grown + *capacity, 0, newCapacity - *capacity);
+    *buffer = grown;
+    *capacity = newCapacity;
+    return 1;
+}
+
+static uint64_t Load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void PutVarint(DeltaWriter *w, size_t v)
+{
+    while (v >= 0x80) {
+        w->out[w->size++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    w->out[w->size++] = (uint8_t)v;
+}
+
+static size_t GetVarint(const uint8_t **p)
+{
+    size_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *(*p)++;
+        v |= (size_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+// Writes out where cur differs from state (from zeros, for a keyframe), XORed, then
+// leaves cur in state
+static int EncodePiece(DeltaWriter *w, uint8_t *state, const uint8_t *cur, size_t n, int key)
+{
+    size_t i = 0;
+    while (i < n) {
+        // unchanged, a word at a time where it can
+        size_t start = i;
+        if (key) {
+            while ((i + 8 <= n) && (Load64(cur + i)==0)) i += 8;
+            while ((i < n) && (cur[i]==0)) i++;
+        } else {
+            while ((i + 8 <= n) && (Load64(cur + i)==Load64(state + i))) i += 8;
+            while ((i < n) && (cur[i]==state[i])) i++;
+        }
+        w->zeros += i - start;
+        if (i==n) break;
+
+        // changed, up to 8 unchanged in a row (a shorter gap costs more to skip than to keep)
+        start = i;
+        int same = 0;
+        while ((i < n) && (same < 8)) {
+            same = (cur[i]==(key ? 0 : state[i])) ? same + 1 : 0;
+            i++;
+        }
+        size_t length = i - start - same;
+        i = start + length;
+        if (!Grow(&w->out, &w->capacity, w->size + length + 2*10, 0)) return 0;
+        PutVarint(w, w->zeros);
+        PutVarint(w, length);
+        for (size_t j = start; j < i; j++) w->out[w->size++] = cur[j] ^ (key ? 0 : state[j]);
+        w->zeros = 0;
+    }
+    memcpy(state, cur, n);
+    return 1;
+}
+
+static void ApplyDelta(uint8_t *state, const RewindFrame *f)
+{
+    const uint8_t *p = f->data;
+    const uint8_t *end = f->data + f->bytes;
+    size_t at = 0;
+    while (p < end) {
+        at += GetVarint(&p);
+        size_t length = GetVarint(&p);
+        for (size_t i = 0; i < length; i++) state[at + i] ^= p[i];
+        p += length;
+        at += length;
+    }
+}
+
+// i counts from the oldest
+static RewindFrame *Frame(Rewind *r, int i)
+{
+    return &r->frames[(r->first + i) % r->capacity];
+}
+
+static void Forget(Rewind *r, RewindFrame *f)
+{
+    r->bytes -= f->bytes;
+    if (f->key) r->key_bytes -= f->bytes;
+    free(f->data);
+    memset(f, 0, sizeof(*f));
+}
+
+// the oldest keyframe and the deltas that hang off it
+static void DropOldest(Rewind *r)
+{
+    do {
+        Forget(r, Frame(r, 0));
+        r->first = (r->first + 1) % r->capacity;
+        r->count--;
+    } while ((r->count > 0) && !Frame(r, 0)->key);
+}
+
+void RewindCapture(NeXUS_VM *vm)
+{
+    Rewind *r = &vm->rewind;
+    const LuaAllocator *a = LuaHeap(vm);
+    if ((r->seconds <= 0) || (a->arena==NULL)) return;
+    double start = TimerNow();
+    if (r->frames==NULL) {
+        r->capacity = r->seconds*REWIND_FRAME_RATE + REWIND_KEYFRAME; // a whole keyframe's worth goes at once
+        r->frames = calloc(r->capacity, sizeof(RewindFrame));
+        if (r->frames==NULL) {
+            TraceLog(LOG_WARNING, "REWIND: Can't keep %d seconds of history, turning it off", r->seconds);
+            r->seconds = 0;
+            return;
+        }
+    }
+
+    RewindHeader header;
+    memset(&header, 0, sizeof(header)); // the padding's part of the state too
+    header.allocator = *a;
+    header.buttons = vm->buttons;
+    header.active_font = vm->active_font;
+    header.frameskip = vm->frameskip;
+    header.sprites = vm->cart->sprites;
+    header.asset_bytes = vm->cart->asset_bytes;
+    const char *heap = LuaAllocHeap(a, &header.heap_size);
+    size_t size = sizeof(header) + sizeof(Screen) + header.heap_size;
+    if (!Grow(&r->state, &r->state_capacity, size, 1)) {
+        TraceLog(LOG_WARNING, "REWIND: Out of memory for a %zu KB state, starting over", size/1024);
+        RewindClear(r);
+        return;
+    }
+
+    if (r->count==r->capacity) DropOldest(r);
+    int key = (r->count==0) || (r->since_key + 1 >= REWIND_KEYFRAME);
+    r->since_key = key ? 0 : r->since_key + 1;
+
+    DeltaWriter w = { r->scratch, 0, r->scratch_capacity, 0 };
+    uint8_t *state = r->state;
+    int ok = EncodePiece(&w, state, (const uint8_t *)&header, sizeof(header), key);
+    state += sizeof(header);
+    ok = ok && EncodePiece(&w, state, (const uint8_t *)&vm->screen, sizeof(Screen), key);
+    state += sizeof(Screen);
+    ok = ok && EncodePiece(&w, state, (const uint8_t *)heap, header.heap_size, key);
+    // a smaller heap than last frame's (straight after a rewind): the rest goes back to zeros
+    static const uint8_t zeros[4096] = { 0 };
+    for (size_t at = size; ok && (at < r->state_size); at += sizeof(zeros)) {
+        size_t n = (r->state_size - at < sizeof(zeros)) ? r->state_size - at : sizeof(zeros);
+        ok = EncodePiece(&w, r->state + at, zeros, n, key);
+    }
+    r->scratch = w.out;
+    r->scratch_capacity = w.capacity;
+    RewindFrame f = { NULL, w.size, size, key };
+    if (ok && (w.size > 0)) {
+        f.data = malloc(w.size);
+        ok = (f.data!=NULL);
+        if (ok) memcpy(f.data, w.out, w.size);
+    }
+    if (!ok) {
+        // the state's half written, none of it can be trusted now
+        TraceLog(LOG_WARNING, "REWIND: Out of memory encoding a frame, starting over");
+        if (size > r->state_size) r->state_size = size;
+        RewindClear(r);
+        return;
+    }
+    r->state_size = size;
+    *Frame(r, r->count++) = f;
+    r->bytes += f.bytes;
+    if (key) r->key_bytes += f.bytes;
+    // too big: drop keyframes off the old end, but never the newest one
+    while ((r->bytes > REWIND_MAX_BYTES) && (r->count > r->since_key + 1)) DropOldest(r);
+    if (r->bytes > r->peak_bytes) r->peak_bytes = r->bytes;
+
+    double seconds = TimerNow() - start;
+    r->captures++;
+    r->capture_seconds += seconds;
+    HistogramAdd(&r->capture, seconds);
+}
+
+int RewindStep(NeXUS_VM *vm, int frames)
+{
+    Rewind *r = &vm->rewind;
+    if (r->count==0) return 0;
+    int newest = r->count - 1;
+    int target = (frames < newest) ? newest - frames : 0;
+    int key = target;
+    while (!Frame(r, key)->key) key--; // the oldest always is one
+    int crossesKey = 0;
+    for (int i = target + 1; i <= newest; i++) crossesKey |= Frame(r, i)->key;
+    if (!crossesKey) {
+        // back from the newest, one delta at a time
+        for (int i = newest; i > target; i--) ApplyDelta(r->state, Frame(r, i));
+    } else {
+        // a keyframe has no delta to go back past, so forward from the one before target
+        memset(r->state, 0, r->state_size);
+        for (int i = key; i <= target; i++) ApplyDelta(r->state, Frame(r, i));
+    }
+    r->state_size = Frame(r, target)->size;
+    // where we went back to is the newest frame now
+    for (int i = newest; i > target; i--) Forget(r, Frame(r, i));
+    r->count = target + 1;
+    r->since_key = target - key;
+
+    RewindHeader header;
+    memcpy(&header, r->state, sizeof(header));
+    memcpy(&vm->screen, r->state + sizeof(header), sizeof(Screen));
+    LuaAllocSnapshot heap = { header.allocator, (char *)r->state + sizeof(header) + sizeof(Screen), header.heap_size, header.heap_size };
+    RestoreLuaHeap(vm, &heap);
+    vm->buttons = header.buttons;
+    vm->active_font = header.active_font;
+    vm->frameskip = header.frameskip;
+    FreeCartSpritesSince(vm->cart, header.sprites);
+    vm->cart->asset_bytes = header.asset_bytes;
+    r->rewinds++;
+    return 1;
+}
+
+void RewindClear(Rewind *r)
+{
+    while (r->count > 0) DropOldest(r);
+    r->first = 0;
+    r->since_key = 0;
+    if (r->state!=NULL) memset(r->state, 0, r->state_size);
+    r->state_size = 0;
+}
+
+void RewindLog(Rewind *r)
+{
+    if (r->captures==0) return;
+    double seconds = (double)r->count/REWIND_FRAME_RATE;
+    TraceLog(LOG_INFO, "REWIND: %.1f s of history in %zu KB, %.0f KB per second (%.0f%% of it keyframes), up to %zu KB",
+        seconds, r->bytes/1024, (seconds > 0) ? (double)r->bytes/1024.0/seconds : 0.0,
+        (r->bytes > 0) ? 100.0*(double)r->key_bytes/(double)r->bytes : 0.0, r->peak_bytes/1024);
+    TraceLog(LOG_INFO, "REWIND: Capture %.3f ms on average over %llu frames, state %zu KB, rewound %llu times",
+        r->capture_seconds*1000.0/(double)r->captures, (unsigned long long)r->captures, r->state_size/1024, (unsigned long long)r->rewinds);
+    HistogramLog(&r->capture);
+}
+
+void RewindFree(Rewind *r)
+{
+    RewindClear(r);
+    free(r->frames);
+    free(r->state);
+    free(r->scratch);
+    r->frames = NULL;
+    r->state = r->scratch = NULL;
+    r->capacity = 0;
+    r->state_capacity = r->scratch_capacity = 0;
+}
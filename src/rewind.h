@@ -0,0 +1,31 @@
+#pragma once
+#include "nexus.h"
+
+// Rewind
+// Keeps the last vm->rewind.seconds of a cart's run so it can be stepped back through
+// frame by frame (hold Backspace) and picked up again from any of them, to catch the
+// frame where something went wrong.
+//
+// A frame's state is everything run-ahead saves: the Lua arena's used part (so this
+// needs the arena too), vm->screen, and the bits of vm that go with them. Most of that
+// doesn't change from one frame to the next, so each frame keeps only its XOR with the
+// frame before, with the runs of zeros squeezed out:
+//   varint zeros, varint length, length bytes to XOR in, ...    (varints are LEB128)
+// XOR goes both ways, so one delta takes the newest state back a frame as cheaply as
+// it took the one before forward. Every REWIND_KEYFRAME frames is a keyframe instead
+// (the state XORed with nothing), which is where longer jumps start from and where the
+// history gets cut when it's too long (vm->rewind.seconds) or too big (REWIND_MAX_BYTES).
+//
+// Rewinding is a SYSTEM_REWIND frame, so it goes in recordings like any other input
+// and plays back the same (with the same --rewind).
+
+#define REWIND_SECONDS 30               // default for --rewind
+#define REWIND_FRAME_RATE 60            // captures a second
+#define REWIND_KEYFRAME 60              // frames
+#define REWIND_MAX_BYTES (256*1024*1024)
+
+void RewindCapture(NeXUS_VM *vm);       // the frame that just ran; call after the cart's done with it
+int RewindStep(NeXUS_VM *vm, int frames); // puts the VM back to that many frames before the newest capture (as far as there's history), 0 if there's none
+void RewindClear(Rewind *r);            // a fresh Lua state, none of the history applies anymore
+void RewindLog(Rewind *r);
+void RewindFree(Rewind *r);
@@ -0,0 +1,79 @@
+#include "runahead.h"
+#include "lua_api.h"
+#include <string.h>
+
+int RunaheadSave(NeXUS_VM *vm)
+{
+    Runahead *r = &vm->runahead;
+    if (!SaveLuaHeap(vm, &r->heap)) return 0;
+    r->screen = vm->screen;
+    r->buttons = vm->buttons;
+    r->active_font = vm->active_font;
+    r->frameskip = vm->frameskip;
+    r->sprites = vm->cart->sprites;
+    r->asset_bytes = vm->cart->asset_bytes;
+    r->failed = 0;
+    if (r->heap.size > r->peak_bytes) r->peak_bytes = r->heap.size;
+    return 1;
+}
+
+// a piece at a time, so there's never a whole Screen on the stack
+static void SwapScreens(Screen *a, Screen *b)
+{
+    uint8_t tmp[4096];
+    uint8_t *x = (uint8_t *)a, *y = (uint8_t *)b;
+    for (size_t i = 0; i < sizeof(Screen); i += sizeof(tmp)) {
+        size_t n = (sizeof(Screen) - i < sizeof(tmp)) ? sizeof(Screen) - i : sizeof(tmp);
+        memcpy(tmp, x + i, n);
+        memcpy(x + i, y + i, n);
+        memcpy(y + i, tmp, n);
+    }
+}
+
+void RunaheadRestore(NeXUS_VM *vm)
+{
+    Runahead *r = &vm->runahead;
+    RestoreLuaHeap(vm, &r->heap);
+    SwapScreens(&vm->screen, &r->screen);
+    vm->buttons = r->buttons;
+    vm->active_font = r->active_font;
+    vm->frameskip = r->frameskip;
+    FreeCartSpritesSince(vm->cart, r->sprites);
+    vm->cart->asset_bytes = r->asset_bytes;
+}
+
+void RunaheadCount(Runahead *r, double save, double run, double restore)
+{
+    r->runs++;
+    if (r->failed) r->failures++;
+    r->save_seconds += save;
+    r->run_seconds += run;
+    r->restore_seconds += restore;
+    HistogramAdd(&r->cost, save + restore);
+    if (save + restore <= r->budget) {
+        r->over_budget = 0;
+        return;
+    }
+    if (++r->over_budget < RUNAHEAD_STRIKES) return;
+    r->over_budget = 0;
+    r->frames--;
+    TraceLog(LOG_WARNING, "RUNAHEAD: Saving and restoring %zu KB takes %.2f ms, over the %.2f ms budget, %s",
+        r->heap.size/1024, (save + restore)*1000.0, r->budget*1000.0, r->frames ? "running fewer frames ahead" : "giving up");
+    if (r->frames > 0) TraceLog(LOG_WARNING, "RUNAHEAD: Now %d frames ahead", r->frames);
+}
+
+void RunaheadLog(Runahead *r)
+{
+    if (r->runs==0) return;
+    double n = (double)r->runs;
+    TraceLog(LOG_INFO, "RUNAHEAD: %d frames ahead, %llu times (%llu cut short by errors), heap up to %zu KB",
+        r->frames, (unsigned long long)r->runs, (unsigned long long)r->failures, r->peak_bytes/1024);
+    TraceLog(LOG_INFO, "RUNAHEAD: Save %.3f ms, frames ahead %.3f ms, restore %.3f ms on average",
+        r->save_seconds*1000.0/n, r->run_seconds*1000.0/n, r->restore_seconds*1000.0/n);
+    HistogramLog(&r->cost);
+}
+
+void RunaheadFree(Runahead *r)
+{
+    LuaAllocFreeSnapshot(&r->heap);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "nexus.h"
+
+// Run-ahead
+// Whatever a button does shows up a frame or two after the frame that read it. Run-ahead
+// hides that the way emulators do: after the real frame, save everything the cart can
+// change, run the cart vm->runahead.frames more frames on the same input, show the last
+// of them, and put everything back. The real timeline never sees the extra frames, so
+// replays and the audio come out the same as without.
+//
+// Saving is cheap because the Lua state lives in one arena (LuaAllocInitArena) at a
+// fixed address: copying its used part is the whole heap. The rest is vm->screen, the
+// buttons, the font, frameskip and any sprites made in the meantime. Carts that keep
+// state anywhere else (there isn't anywhere else, yet) wouldn't rewind right.
+//
+// Saving and restoring have a budget; over it for RUNAHEAD_STRIKES frames in a row and
+// frames comes down by one (eventually to 0, off).
+
+#define RUNAHEAD_MAX_FRAMES 8
+#define RUNAHEAD_BUDGET 0.002       // seconds, default for --runahead-budget
+#define RUNAHEAD_STRIKES 60
+
+int RunaheadSave(NeXUS_VM *vm);     // 0 if it couldn't (no arena, no memory)
+void RunaheadRestore(NeXUS_VM *vm); // runahead.screen ends up with the run-ahead frame, vm->screen with the real one
+void RunaheadCount(Runahead *r, double save, double run, double restore); // stats, and the budget
+void RunaheadLog(Runahead *r);
+void RunaheadFree(Runahead *r);
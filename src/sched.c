@@ -0,0 +1,292 @@
+#include <stdint.h>
+#include "lua/lauxlib.h"
+#include "sched.h"
+
+#define SCHED_KEY "NeXUS.scheduler"
+#define NO_TASK (-1)
+
+static char waitMarker; // its address tags the values wait()/waituntil() yield
+
+typedef struct {
+    int32_t next;       // next task on whatever list this one is on
+    uint32_t wake;      // frame a sleeping task wakes on
+    int thread;         // ref to the coroutine in the anchor table
+    int pred;           // ref to the waituntil() predicate, LUA_NOREF when sleeping
+} SchedTask;
+
+typedef struct {
+    int32_t head;
+    int32_t tail;
+} TaskList;
+
+typedef struct {
+    SchedTask *tasks;   // node pool, allocated through the state's allocator
+    int32_t capacity;
+    int32_t free;       // free nodes, chained through next
+    int32_t count;      // live tasks
+    uint32_t frame;
+    lua_State *running; // task being resumed right now, so wait() can tell it's in one
+    TaskList wheel[SCHED_WHEEL_SIZE];
+    TaskList poll;      // waituntil() tasks, their predicates get checked every tick
+    TaskList ready;     // spawned since the last tick
+} Scheduler;
+
+static void ListInit(TaskList *list)
+{
+    list->head = NO_TASK;
+    list->tail = NO_TASK;
+}
+
+static void ListPush(Scheduler *s, TaskList *list, int32_t t)
+{
+    s->tasks[t].next = NO_TASK;
+    if (list->tail==NO_TASK) list->head = t;
+    else s->tasks[list->tail].next = t;
+    list->tail = t;
+}
+
+static void ResetLists(Scheduler *s)
+{
+    for (int i = 0; i < SCHED_WHEEL_SIZE; i++) ListInit(&s->wheel[i]);
+    ListInit(&s->poll);
+    ListInit(&s->ready);
+    s->free = NO_TASK;
+    for (int32_t i = s->capacity - 1; i >= 0; i--) {
+        s->tasks[i].next = s->free;
+        s->free = i;
+    }
+    s->count = 0;
+}
+
+// pushes the scheduler userdata
+static Scheduler *PushScheduler(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, SCHED_KEY);
+    Scheduler *s = (Scheduler *)lua_touserdata(L, -1);
+    if (s==NULL) luaL_error(L, "scheduler not initialized");
+    return s;
+}
+
+static int32_t AllocTask(lua_State *L, Scheduler *s)
+{
+    if (s->free==NO_TASK) {
+        void *ud = NULL;
+        lua_Alloc allocf = lua_getallocf(L, &ud);
+        int32_t capacity = s->capacity ? s->capacity*2 : 64;
+        SchedTask *tasks = allocf(ud, s->tasks, (size_t)s->capacity*sizeof(SchedTask), (size_t)capacity*sizeof(SchedTask));
+        if (tasks==NULL) luaL_error(L, "not enough memory for another task");
+        for (int32_t i = capacity - 1; i >= s->capacity; i--) {
+            tasks[i].next = s->free;
+            s->free = i;
+        }
+        s->tasks = tasks;
+        s->capacity = capacity;
+    }
+    int32_t t = s->free;
+    s->free = s->tasks[t].next;
+    s->count++;
+    return t;
+}
+
+// anchor is the stack index of the anchor table
+static void FreeTask(lua_State *L, Scheduler *s, int anchor, int32_t t)
+{
+    luaL_unref(L, anchor, s->tasks[t].thread);
+    luaL_unref(L, anchor, s->tasks[t].pred);
+    s->tasks[t].next = s->free;
+    s->free = t;
+    s->count--;
+}
+
+static int SchedulerGC(lua_State *L)
+{
+    Scheduler *s = (Scheduler *)lua_touserdata(L, 1);
+    void *ud = NULL;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    if (s->tasks) allocf(ud, s->tasks, (size_t)s->capacity*sizeof(SchedTask), 0);
+    s->tasks = NULL;
+    s->capacity = 0;
+    return 0;
+}
+
+// spawn(fn, ...) -> the task's coroutine
+static int api_spawn(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    int nargs = lua_gettop(L);  // fn + its arguments
+    Scheduler *s = PushScheduler(L);
+    int sidx = lua_gettop(L);
+    int32_t t = AllocTask(L, s);
+
+    lua_State *co = lua_newthread(L);
+    int cidx = lua_gettop(L);
+    for (int i = 1; i <= nargs; i++) lua_pushvalue(L, i);
+    lua_xmove(L, co, nargs);
+
+    lua_getiuservalue(L, sidx, 1);
+    lua_pushvalue(L, cidx);
+    s->tasks[t].thread = luaL_ref(L, -2);
+    s->tasks[t].pred = LUA_NOREF;
+    s->tasks[t].wake = 0;
+    lua_pop(L, 1);
+    ListPush(s, &s->ready, t);
+
+    lua_pushvalue(L, cidx);
+    return 1;
+}
+
+static void CheckInTask(lua_State *L, const char *func)
+{
+    Scheduler *s = PushScheduler(L);
+    if (s->running!=L) luaL_error(L, "%s() can only be called from a task started with spawn()", func);
+    lua_pop(L, 1);
+}
+
+// wait(frames = 1)
+static int api_wait(lua_State *L)
+{
+    lua_Integer frames = luaL_optinteger(L, 1, 1);
+    CheckInTask(L, "wait");
+    if (frames < 1) frames = 1;
+    if (frames > 0x7FFFFFFF) frames = 0x7FFFFFFF;
+    lua_pushlightuserdata(L, &waitMarker);
+    lua_pushinteger(L, frames);
+    return lua_yield(L, 2);
+}
+
+// waituntil(fn), resumes the first tick fn() returns something truthy
+static int api_waituntil(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    CheckInTask(L, "waituntil");
+    lua_pushlightuserdata(L, &waitMarker);
+    lua_pushvalue(L, 1);
+    return lua_yield(L, 2);
+}
+
+void OpenScheduler(lua_State *L)
+{
+    Scheduler *s = (Scheduler *)lua_newuserdatauv(L, sizeof(Scheduler), 1);
+    s->tasks = NULL;
+    s->capacity = 0;
+    s->frame = 0;
+    s->running = NULL;
+    ResetLists(s);
+    lua_newtable(L);                // anchor table, keeps the coroutines and predicates alive
+    lua_setiuservalue(L, -2, 1);
+    lua_newtable(L);                // metatable, just for __gc
+    lua_pushcfunction(L, SchedulerGC);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, SCHED_KEY);
+
+    lua_register(L, "spawn", api_spawn);
+    lua_register(L, "wait", api_wait);
+    lua_register(L, "waituntil", api_waituntil);
+}
+
+void ClearScheduler(lua_State *L)
+{
+    Scheduler *s = PushScheduler(L);
+    ResetLists(s);
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+    lua_pop(L, 1);
+}
+
+int SchedulerTaskCount(lua_State *L)
+{
+    Scheduler *s = PushScheduler(L);
+    lua_pop(L, 1);
+    return s->count;
+}
+
+int SchedulerTick(lua_State *L)
+{
+    Scheduler *s = PushScheduler(L);
+    int sidx = lua_gettop(L);
+    lua_getiuservalue(L, sidx, 1);
+    int anchor = lua_gettop(L);
+    s->frame++;
+
+    // everything due this tick goes on the run list, in a stable order:
+    // tasks waking up, then tasks whose predicate came true, then freshly spawned ones
+    TaskList run;
+    ListInit(&run);
+
+    TaskList *slot = &s->wheel[s->frame & (SCHED_WHEEL_SIZE - 1)];
+    int32_t t = slot->head;
+    ListInit(slot);
+    while (t!=NO_TASK) {
+        int32_t next = s->tasks[t].next;
+        // a slot also holds tasks due a whole number of wheel turns from now
+        ListPush(s, (s->tasks[t].wake==s->frame) ? &run : slot, t);
+        t = next;
+    }
+
+    t = s->poll.head;
+    ListInit(&s->poll);
+    while (t!=NO_TASK) {
+        int32_t next = s->tasks[t].next;
+        lua_rawgeti(L, anchor, s->tasks[t].pred);
+        if (lua_pcall(L, 0, 1, 0)!=LUA_OK) return lua_error(L);
+        int ready = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        if (ready) {
+            luaL_unref(L, anchor, s->tasks[t].pred);
+            s->tasks[t].pred = LUA_NOREF;
+            ListPush(s, &run, t);
+        } else {
+            ListPush(s, &s->poll, t);
+        }
+        t = next;
+    }
+
+    t = s->ready.head;
+    ListInit(&s->ready);
+    while (t!=NO_TASK) {
+        int32_t next = s->tasks[t].next;
+        ListPush(s, &run, t);
+        t = next;
+    }
+
+    t = run.head;
+    while (t!=NO_TASK) {
+        int32_t next = s->tasks[t].next; // read it now, the task is about to land on another list
+        lua_rawgeti(L, anchor, s->tasks[t].thread);
+        lua_State *co = lua_tothread(L, -1);
+        lua_pop(L, 1);  // still anchored
+
+        int nres = 0;
+        int nargs = (lua_status(co)==LUA_OK) ? lua_gettop(co) - 1 : 0; // first run passes spawn()'s arguments
+        s->running = co;
+        int status = lua_resume(co, L, nargs, &nres);
+        s->running = NULL;
+
+        if (status==LUA_YIELD) {
+            if ((nres==2) && (lua_touserdata(co, -2)==&waitMarker) && lua_isfunction(co, -1)) {
+                lua_xmove(co, L, 1);
+                s->tasks[t].pred = luaL_ref(L, anchor);
+                ListPush(s, &s->poll, t);
+                nres--;
+            } else {
+                // plain coroutine.yield() counts as wait(1)
+                lua_Integer frames = 1;
+                if ((nres==2) && (lua_touserdata(co, -2)==&waitMarker)) frames = lua_tointeger(co, -1);
+                s->tasks[t].wake = s->frame + (uint32_t)frames;
+                ListPush(s, &s->wheel[s->tasks[t].wake & (SCHED_WHEEL_SIZE - 1)], t);
+            }
+            lua_pop(co, nres);
+        } else if (status==LUA_OK) {
+            FreeTask(L, s, anchor, t);
+        } else {
+            const char *msg = lua_tostring(co, -1);
+            luaL_traceback(L, co, msg ? msg : "(error object is not a string)", 0);
+            FreeTask(L, s, anchor, t);
+            return lua_error(L);
+        }
+        t = next;
+    }
+    lua_pop(L, 2);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "lua/lua.h"
+
+// Cooperative task scheduler
+// spawn(fn, ...) starts fn as a task on the next tick, wait(frames) and waituntil(fn)
+// suspend the calling task. Sleeping tasks sit in a timer wheel keyed by the frame they
+// wake on and waituntil tasks sit on a poll list, so a tick only touches tasks that are
+// actually due (or whose predicate needs checking) instead of resuming every coroutine.
+// All the bookkeeping lives in the Lua heap, so every lua_State has its own scheduler.
+
+#define SCHED_WHEEL_SIZE 256    // power of two
+
+void OpenScheduler(lua_State *L);       // creates the scheduler and registers spawn/wait/waituntil
+int SchedulerTick(lua_State *L);        // lua_CFunction: advance one frame, run due tasks (raises task errors)
+void ClearScheduler(lua_State *L);      // drop every task (e.g. when the error screen takes over)
+int SchedulerTaskCount(lua_State *L);
@@ -0,0 +1,767 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "screen.h"
+#include "thread.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #include <emmintrin.h>
+    #define SCREEN_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define SCREEN_NEON
+#endif
+
+#define MAX_FONT_GLYPHS 256
+#define COORD_LIMIT 32767       // lines get their endpoints clamped to this, so a wild one can't spin forever
+
+// false for NaN, infinities and anything too far off screen to ever matter
+static int Reasonable(double v)
+{
+    return (v > -1e9) && (v < 1e9);
+}
+
+static int ClampCoord(int v)
+{
+    if (v < -COORD_LIMIT) return -COORD_LIMIT;
+    if (v > COORD_LIMIT) return COORD_LIMIT;
+    return v;
+}
+
+//----------------------------------------------------------------------------------
+// Basics
+//----------------------------------------------------------------------------------
+void ScreenInit(Screen *s)
+{
+    memset(s->pixels, 0, sizeof(s->pixels));
+    ScreenNoClip(s);
+}
+
+void ScreenNoClip(Screen *s)
+{
+    s->clip_x0 = 0;
+    s->clip_y0 = 0;
+    s->clip_x1 = SCREEN_WIDTH;
+    s->clip_y1 = SCREEN_HEIGHT;
+}
+
+void ScreenClip(Screen *s, int x, int y, int w, int h)
+{
+    // clamp in 64 bits, x + w can overflow for silly values
+    int64_t x1 = (int64_t)x + w;
+    int64_t y1 = (int64_t)y + h;
+    s->clip_x0 = (x < 0) ? 0 : ((x > SCREEN_WIDTH) ? SCREEN_WIDTH : x);
+    s->clip_y0 = (y < 0) ? 0 : ((y > SCREEN_HEIGHT) ? SCREEN_HEIGHT : y);
+    s->clip_x1 = (x1 < s->clip_x0) ? s->clip_x0 : ((x1 > SCREEN_WIDTH) ? SCREEN_WIDTH : (int)x1);
+    s->clip_y1 = (y1 < s->clip_y0) ? s->clip_y0 : ((y1 > SCREEN_HEIGHT) ? SCREEN_HEIGHT : (int)y1);
+}
+
+// fills [x0, x1) on row y, clipped
+static void Span(Screen *s, int y, int x0, int x1, uint8_t color)
+{
+    if ((y < s->clip_y0) || (y >= s->clip_y1)) return;
+    if (x0 < s->clip_x0) x0 = s->clip_x0;
+    if (x1 > s->clip_x1) x1 = s->clip_x1;
+    if (x1 > x0) memset(&s->pixels[y*SCREEN_WIDTH + x0], color, (size_t)(x1 - x0));
+}
+
+void ScreenClear(Screen *s, uint8_t color)
+{
+    for (int y = s->clip_y0; y < s->clip_y1; y++) Span(s, y, s->clip_x0, s->clip_x1, color);
+}
+
+uint8_t ScreenGetPixel(const Screen *s, int x, int y)
+{
+    if ((x < 0) || (y < 0) || (x >= SCREEN_WIDTH) || (y >= SCREEN_HEIGHT)) return 0;
+    return s->pixels[y*SCREEN_WIDTH + x];
+}
+
+void ScreenPixel(Screen *s, int x, int y, uint8_t color)
+{
+    if ((x < s->clip_x0) || (y < s->clip_y0) || (x >= s->clip_x1) || (y >= s->clip_y1)) return;
+    s->pixels[y*SCREEN_WIDTH + x] = color;
+}
+
+//----------------------------------------------------------------------------------
+// Shapes
+// Filled shapes cover the pixels whose centers fall inside them, same as the GPU did
+//----------------------------------------------------------------------------------
+void ScreenRect(Screen *s, int x, int y, int w, int h, uint8_t color)
+{
+    if ((w <= 0) || (h <= 0)) return;
+    int64_t x1 = (int64_t)x + w;
+    int64_t y1 = (int64_t)y + h;
+    int y0 = (y < s->clip_y0) ? s->clip_y0 : y;
+    if (y1 > s->clip_y1) y1 = s->clip_y1;
+    int x0 = (x < s->clip_x0) ? s->clip_x0 : x;
+    if (x1 > s->clip_x1) x1 = s->clip_x1;
+    if (x0 >= x1) return;
+    for (int row = y0; row < y1; row++) memset(&s->pixels[row*SCREEN_WIDTH + x0], color, (size_t)(x1 - x0));
+}
+
+void ScreenRectLines(Screen *s, int x, int y, int w, int h, uint8_t color)
+{
+    if ((w <= 0) || (h <= 0)) return;
+    ScreenRect(s, x, y, w, 1, color);
+    if (h > 1) ScreenRect(s, x, y + h - 1, w, 1, color);
+    if (h > 2) {
+        ScreenRect(s, x, y + 1, 1, h - 2, color);
+        if (w > 1) ScreenRect(s, x + w - 1, y + 1, 1, h - 2, color);
+    }
+}
+
+void ScreenCircle(Screen *s, double x, double y, double radius, uint8_t color)
+{
+    if (!(radius > 0) || !Reasonable(x) || !Reasonable(y) || !Reasonable(radius)) return;
+    double top = ceil(y - radius - 0.5);
+    double bottom = floor(y + radius - 0.5);
+    if (top < s->clip_y0) top = s->clip_y0;
+    if (bottom >= s->clip_y1) bottom = s->clip_y1 - 1;
+    for (int row = (int)top; row <= (int)bottom; row++) {
+        double dy = row + 0.5 - y;
+        double half = sqrt(radius*radius - dy*dy);
+        double x0 = ceil(x - half - 0.5);
+        double x1 = floor(x + half - 0.5) + 1;
+        if (x0 < s->clip_x0) x0 = s->clip_x0;
+        if (x1 > s->clip_x1) x1 = s->clip_x1;
+        if (x1 > x0) Span(s, row, (int)x0, (int)x1, color);
+    }
+}
+
+// midpoint circle around the pixel the center falls in
+void ScreenCircleLines(Screen *s, double x, double y, double radius, uint8_t color)
+{
+    if (!(radius > 0) || (radius > COORD_LIMIT) || !Reasonable(x) || !Reasonable(y)) return;
+    int cx = (int)floor(x);
+    int cy = (int)floor(y);
+    int r = (int)(radius + 0.5);
+    int f = 1 - r;
+    int ddx = 1;
+    int ddy = -2*r;
+    int px = 0;
+    int py = r;
+    ScreenPixel(s, cx, cy + r, color);
+    ScreenPixel(s, cx, cy - r, color);
+    ScreenPixel(s, cx + r, cy, color);
+    ScreenPixel(s, cx - r, cy, color);
+    while (px < py) {
+        if (f >= 0) {
+            py--;
+            ddy += 2;
+            f += ddy;
+        }
+        px++;
+        ddx += 2;
+        f += ddx;
+        ScreenPixel(s, cx + px, cy + py, color);
+        ScreenPixel(s, cx - px, cy + py, color);
+        ScreenPixel(s, cx + px, cy - py, color);
+        ScreenPixel(s, cx - px, cy - py, color);
+        ScreenPixel(s, cx + py, cy + px, color);
+        ScreenPixel(s, cx - py, cy + px, color);
+        ScreenPixel(s, cx + py, cy - px, color);
+        ScreenPixel(s, cx - py, cy - px, color);
+    }
+}
+
+// Bresenham, both ends included
+void ScreenLine(Screen *s, int x1, int y1, int x2, int y2, uint8_t color)
+{
+    x1 = ClampCoord(x1);
+    y1 = ClampCoord(y1);
+    x2 = ClampCoord(x2);
+    y2 = ClampCoord(y2);
+    // entirely off one side of the clip rect
+    if (((x1 < s->clip_x0) && (x2 < s->clip_x0)) || ((x1 >= s->clip_x1) && (x2 >= s->clip_x1))) return;
+    if (((y1 < s->clip_y0) && (y2 < s->clip_y0)) || ((y1 >= s->clip_y1) && (y2 >= s->clip_y1))) return;
+    if (y1==y2) { // the common case in UI code
+        if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
+        Span(s, y1, x1, x2 + 1, color);
+        return;
+    }
+    int dx = abs(x2 - x1);
+    int sx = (x1 < x2) ? 1 : -1;
+    int dy = -abs(y2 - y1);
+    int sy = (y1 < y2) ? 1 : -1;
+    int err = dx + dy;
+    while (1) {
+        ScreenPixel(s, x1, y1, color);
+        if ((x1==x2) && (y1==y2)) break;
+        int e2 = 2*err;
+        if (e2 >= dy) {
+            err += dy;
+            x1 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y1 += sy;
+        }
+    }
+}
+
+// x where the edge a->b crosses row center y
+static double EdgeX(double ax, double ay, double bx, double by, double y)
+{
+    if (by==ay) return ax;
+    return ax + (bx - ax)*(y - ay)/(by - ay);
+}
+
+// NOTE: winding doesn't matter here; tri() culls the clockwise ones itself, like the GPU did
+void ScreenTriangle(Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color)
+{
+    if (!Reasonable(x1) || !Reasonable(y1) || !Reasonable(x2) || !Reasonable(y2) || !Reasonable(x3) || !Reasonable(y3)) return;
+    // sort by y
+    double t;
+    if (y2 < y1) { t = x1; x1 = x2; x2 = t; t = y1; y1 = y2; y2 = t; }
+    if (y3 < y1) { t = x1; x1 = x3; x3 = t; t = y1; y1 = y3; y3 = t; }
+    if (y3 < y2) { t = x2; x2 = x3; x3 = t; t = y2; y2 = y3; y3 = t; }
+
+    double top = ceil(y1 - 0.5);
+    double bottom = ceil(y3 - 0.5);   // exclusive
+    if (top < s->clip_y0) top = s->clip_y0;
+    if (bottom > s->clip_y1) bottom = s->clip_y1;
+    for (int row = (int)top; row < (int)bottom; row++) {
+        double yc = row + 0.5;
+        double xa = EdgeX(x1, y1, x3, y3, yc);
+        double xb = (yc < y2) ? EdgeX(x1, y1, x2, y2, yc) : EdgeX(x2, y2, x3, y3, yc);
+        if (xa > xb) { t = xa; xa = xb; xb = t; }
+        double x0 = ceil(xa - 0.5);
+        double xe = ceil(xb - 0.5);
+        if (x0 < s->clip_x0) x0 = s->clip_x0;
+        if (xe > s->clip_x1) xe = s->clip_x1;
+        if (xe > x0) Span(s, row, (int)x0, (int)xe, color);
+    }
+}
+
+void ScreenTriangleLines(Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color)
+{
+    if (!Reasonable(x1) || !Reasonable(y1) || !Reasonable(x2) || !Reasonable(y2) || !Reasonable(x3) || !Reasonable(y3)) return;
+    int ix1 = (int)floor(x1), iy1 = (int)floor(y1);
+    int ix2 = (int)floor(x2), iy2 = (int)floor(y2);
+    int ix3 = (int)floor(x3), iy3 = (int)floor(y3);
+    ScreenLine(s, ix1, iy1, ix2, iy2, color);
+    ScreenLine(s, ix2, iy2, ix3, iy3, color);
+    ScreenLine(s, ix3, iy3, ix1, iy1, color);
+}
+
+//----------------------------------------------------------------------------------
+// Images
+//----------------------------------------------------------------------------------
+void ScreenBlit(Screen *s, const ScreenImage *img, double x, double y, double scale, int flip, double rotation)
+{
+    if (!(scale > 0) || (img->width <= 0) || (img->height <= 0)) return;
+    double w = img->width*scale;
+    double h = img->height*scale;
+    if (!Reasonable(x) || !Reasonable(y) || !Reasonable(w) || !Reasonable(h) || !Reasonable(rotation)) return;
+    double angle = fmod(rotation, 360.0);
+    if (angle < 0) angle += 360.0;
+
+    if (angle==0) {
+        // axis aligned: work out which source column every screen column reads once
+        int x0 = (int)fmax(ceil(x - 0.5), s->clip_x0);
+        int x1 = (int)fmin(ceil(x + w - 0.5), s->clip_x1);
+        int y0 = (int)fmax(ceil(y - 0.5), s->clip_y0);
+        int y1 = (int)fmin(ceil(y + h - 0.5), s->clip_y1);
+        if ((x0 >= x1) || (y0 >= y1)) return;
+        int columns[SCREEN_WIDTH];
+        for (int px = x0; px < x1; px++) {
+            int u = (int)((px + 0.5 - x)/scale);
+            if (u >= img->width) u = img->width - 1;
+            columns[px - x0] = (flip & 1) ? (img->width - 1 - u) : u;
+        }
+        for (int py = y0; py < y1; py++) {
+            int v = (int)((py + 0.5 - y)/scale);
+            if (v >= img->height) v = img->height - 1;
+            if (flip & 2) v = img->height - 1 - v;
+            const uint8_t *src = img->pixels + (size_t)v*img->width;
+            uint8_t *dst = s->pixels + py*SCREEN_WIDTH;
+            if (img->colorkey < 0) {
+                for (int px = x0; px < x1; px++) dst[px] = src[columns[px - x0]];
+            } else {
+                for (int px = x0; px < x1; px++) {
+                    uint8_t c = src[columns[px - x0]];
+                    if (c!=img->colorkey) dst[px] = c;
+                }
+            }
+        }
+        return;
+    }
+
+    // rotated around its center (clockwise, since y points down): map every pixel in
+    // the rotated bounding box back into the image
+    double rad = angle*3.14159265358979323846/180.0;
+    double c = cos(rad);
+    double sn = sin(rad);
+    double cx = x + w/2;
+    double cy = y + h/2;
+    double ex = (fabs(w*c) + fabs(h*sn))/2;
+    double ey = (fabs(w*sn) + fabs(h*c))/2;
+    int x0 = (int)fmax(floor(cx - ex), s->clip_x0);
+    int x1 = (int)fmin(ceil(cx + ex), s->clip_x1);
+    int y0 = (int)fmax(floor(cy - ey), s->clip_y0);
+    int y1 = (int)fmin(ceil(cy + ey), s->clip_y1);
+    for (int py = y0; py < y1; py++) {
+        double dy = py + 0.5 - cy;
+        for (int px = x0; px < x1; px++) {
+            double dx = px + 0.5 - cx;
+            double lx = dx*c + dy*sn + w/2;
+            double ly = -dx*sn + dy*c + h/2;
+            if ((lx < 0) || (ly < 0) || (lx >= w) || (ly >= h)) continue;
+            int u = (int)(lx/scale);
+            int v = (int)(ly/scale);
+            if (u >= img->width) u = img->width - 1;
+            if (v >= img->height) v = img->height - 1;
+            if (flip & 1) u = img->width - 1 - u;
+            if (flip & 2) v = img->height - 1 - v;
+            uint8_t col = img->pixels[(size_t)v*img->width + u];
+            if (col!=img->colorkey) s->pixels[py*SCREEN_WIDTH + px] = col;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Text
+//----------------------------------------------------------------------------------
+static volatile uint32_t fontSerial = 0;     // shared by every VM in the process
+
+// glyphs and rows for count glyphs of the given widths, rows zeroed
+static int AllocFont(ScreenFont *font, int count, int height, const int *widths)
+{
+    font->glyphs = calloc((size_t)count, sizeof(ScreenGlyph));
+    font->bitmap = calloc((size_t)count*height + 1, sizeof(uint32_t));
+    if ((font->glyphs==NULL) || (font->bitmap==NULL)) {
+        UnloadScreenFont(font);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        font->glyphs[i].width = widths[i];
+        font->glyphs[i].rows = font->bitmap + (size_t)i*height;
+    }
+    font->height = height;
+    font->count = count;
+    return 1;
+}
+
+static void FinishFont(ScreenFont *font, int first, int lineSpacing)
+{
+    font->line_spacing = lineSpacing;
+    font->first = first;
+    font->fallback = (('?' >= first) && ('?' < first + font->count)) ? ('?' - first) : 0;
+    font->serial = AtomicAdd(&fontSerial, 1);
+    for (int c = 0; c < 128; c++) {
+        font->ascii_glyph[c] = (int16_t)ScreenGlyphIndex(font, c);
+        font->ascii_advance[c] = (c=='\n') ? 0 : (uint8_t)font->glyphs[font->ascii_glyph[c]].width;
+    }
+}
+
+// the key color is whatever the top left pixel is (magenta in every font we have)
+int LoadScreenFont(ScreenFont *font, const uint8_t *rgba, int width, int height, int first, int lineSpacing)
+{
+    memset(font, 0, sizeof(ScreenFont));
+    if ((rgba==NULL) || (width <= 0) || (height <= 0)) return 0;
+    #define PIXEL(px, py) (rgba + ((size_t)(py)*width + (px))*4)
+    #define IS_KEY(px, py) (memcmp(PIXEL(px, py), rgba, 4)==0)
+
+    // the border before the first glyph gives the spacing between glyphs and rows
+    int spacing = 0;
+    int rowGap = 0;
+    for (rowGap = 0; rowGap < height; rowGap++) {
+        for (spacing = 0; spacing < width; spacing++) {
+            if (!IS_KEY(spacing, rowGap)) break;
+        }
+        if (spacing < width) break;
+    }
+    if ((spacing==0) || (rowGap==0) || (rowGap==height)) return 0;
+    int glyphHeight = 0;
+    while ((rowGap + glyphHeight < height) && !IS_KEY(spacing, rowGap + glyphHeight)) glyphHeight++;
+
+    int xs[MAX_FONT_GLYPHS], ys[MAX_FONT_GLYPHS], ws[MAX_FONT_GLYPHS];
+    int count = 0;
+    for (int row = rowGap; row + glyphHeight <= height; row += glyphHeight + rowGap) {
+        int px = spacing;
+        while ((px < width) && !IS_KEY(px, row) && (count < MAX_FONT_GLYPHS)) {
+            int w = 0;
+            while ((px + w < width) && !IS_KEY(px + w, row)) w++;
+            xs[count] = px;
+            ys[count] = row;
+            ws[count] = (w > SCREEN_GLYPH_MAX_WIDTH) ? SCREEN_GLYPH_MAX_WIDTH : w;
+            count++;
+            px += w + spacing;
+        }
+    }
+    if (count==0) return 0;
+
+    if (!AllocFont(font, count, glyphHeight, ws)) return 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t *rows = font->bitmap + (size_t)i*glyphHeight;
+        for (int gy = 0; gy < glyphHeight; gy++) {
+            for (int gx = 0; gx < ws[i]; gx++) {
+                const uint8_t *p = PIXEL(xs[i] + gx, ys[i] + gy);
+                if (!IS_KEY(xs[i] + gx, ys[i] + gy) && (p[3] > 0)) rows[gy] |= 1u << gx;
+            }
+        }
+    }
+    #undef IS_KEY
+    #undef PIXEL
+
+    FinishFont(font, first, lineSpacing);
+    return 1;
+}
+
+#define PACKED_FONT_HEADER 8
+
+int LoadPackedScreenFont(ScreenFont *font, const uint8_t *data, size_t size)
+{
+    memset(font, 0, sizeof(ScreenFont));
+    if ((data==NULL) || (size < PACKED_FONT_HEADER)) return 0;
+    int first = data[0]|(data[1] << 8);
+    int count = data[2]|(data[3] << 8);
+    int height = data[4];
+    int lineSpacing = data[5];
+    if ((count==0) || (height==0) || (size < PACKED_FONT_HEADER + (size_t)count)) return 0;
+
+    // check it all fits before allocating anything
+    const uint8_t *widths = data + PACKED_FONT_HEADER;
+    int *ws = malloc((size_t)count*sizeof(int));
+    if (ws==NULL) return 0;
+    size_t need = PACKED_FONT_HEADER + (size_t)count;
+    for (int i = 0; i < count; i++) {
+        ws[i] = widths[i];
+        if (ws[i] > SCREEN_GLYPH_MAX_WIDTH) {
+            free(ws);
+            return 0;
+        }
+        need += (size_t)height*((ws[i] + 7)/8);
+    }
+    if ((need > size) || !AllocFont(font, count, height, ws)) {
+        free(ws);
+        return 0;
+    }
+
+    const uint8_t *p = widths + count;
+    for (int i = 0; i < count; i++) {
+        uint32_t *rows = font->bitmap + (size_t)i*height;
+        int bytes = (ws[i] + 7)/8;
+        for (int gy = 0; gy < height; gy++) {
+            uint32_t row = 0;
+            for (int b = 0; b < bytes; b++) row |= (uint32_t)*p++ << (8*b);
+            // stray bits past the glyph's width would draw into its neighbour
+            rows[gy] = (ws[i] < 32) ? (row & ((1u << ws[i]) - 1)) : row;
+        }
+    }
+    free(ws);
+
+    FinishFont(font, first, lineSpacing);
+    return 1;
+}
+
+size_t PackScreenFont(const ScreenFont *font, uint8_t *out)
+{
+    size_t size = PACKED_FONT_HEADER + (size_t)font->count;
+    for (int i = 0; i < font->count; i++) size += (size_t)font->height*((font->glyphs[i].width + 7)/8);
+    if (out==NULL) return size;
+
+    out[0] = font->first & 0xFF;
+    out[1] = (font->first >> 8) & 0xFF;
+    out[2] = font->count & 0xFF;
+    out[3] = (font->count >> 8) & 0xFF;
+    out[4] = (uint8_t)font->height;
+    out[5] = (uint8_t)font->line_spacing;
+    out[6] = out[7] = 0;
+    uint8_t *p = out + PACKED_FONT_HEADER;
+    for (int i = 0; i < font->count; i++) *p++ = (uint8_t)font->glyphs[i].width;
+    for (int i = 0; i < font->count; i++) {
+        int bytes = (font->glyphs[i].width + 7)/8;
+        for (int gy = 0; gy < font->height; gy++) {
+            uint32_t row = font->glyphs[i].rows[gy];
+            for (int b = 0; b < bytes; b++) *p++ = (row >> (8*b)) & 0xFF;
+        }
+    }
+    return size;
+}
+
+size_t ScreenFontBytes(const ScreenFont *font)
+{
+    return (size_t)font->count*(sizeof(ScreenGlyph) + (size_t)font->height*sizeof(uint32_t));
+}
+
+void UnloadScreenFont(ScreenFont *font)
+{
+    free(font->glyphs);
+    free(font->bitmap);
+    memset(font, 0, sizeof(ScreenFont));
+}
+
+int ScreenNextCodepoint(const char *text, int *bytes)
+{
+    const unsigned char *p = (const unsigned char *)text;
+    *bytes = 1;
+    if (p[0] < 0x80) return p[0];
+    if (((p[0] & 0xE0)==0xC0) && ((p[1] & 0xC0)==0x80)) {
+        int cp = ((p[0] & 0x1F) << 6)|(p[1] & 0x3F);
+        if (cp < 0x80) return '?'; // overlong
+        *bytes = 2;
+        return cp;
+    }
+    if (((p[0] & 0xF0)==0xE0) && ((p[1] & 0xC0)==0x80) && ((p[2] & 0xC0)==0x80)) {
+        int cp = ((p[0] & 0x0F) << 12)|((p[1] & 0x3F) << 6)|(p[2] & 0x3F);
+        if ((cp < 0x800) || ((cp >= 0xD800) && (cp <= 0xDFFF))) return '?';
+        *bytes = 3;
+        return cp;
+    }
+    if (((p[0] & 0xF8)==0xF0) && ((p[1] & 0xC0)==0x80) && ((p[2] & 0xC0)==0x80) && ((p[3] & 0xC0)==0x80)) {
+        int cp = ((p[0] & 0x07) << 18)|((p[1] & 0x3F) << 12)|((p[2] & 0x3F) << 6)|(p[3] & 0x3F);
+        if ((cp < 0x10000) || (cp > 0x10FFFF)) return '?';
+        *bytes = 4;
+        return cp;
+    }
+    return '?';
+}
+
+int ScreenGlyphIndex(const ScreenFont *font, int codepoint)
+{
+    int index = codepoint - font->first;
+    if ((index < 0) || (index >= font->count)) return font->fallback;
+    return index;
+}
+
+// lowest set bit, v can't be 0
+#if defined(_MSC_VER)
+static inline int LowestBit(uint32_t v)
+{
+    unsigned long index;
+    _BitScanForward(&index, v);
+    return (int)index;
+}
+#else
+#define LowestBit(v) __builtin_ctz(v)
+#endif
+
+// A glyph row is one word: clipping is a mask over it, blank rows cost a compare, and
+// otherwise it's one store per pixel of ink instead of a test per pixel of the box
+void ScreenDrawGlyph(Screen *s, const ScreenFont *font, int index, int x, int y, uint8_t color)
+{
+    const ScreenGlyph *glyph = &font->glyphs[index];
+    // none of it's in the clip rect (in 64 bits, x and y can be anything an int can)
+    if (((int64_t)x >= s->clip_x1) || ((int64_t)x + glyph->width <= s->clip_x0)) return;
+    if (((int64_t)y >= s->clip_y1) || ((int64_t)y + font->height <= s->clip_y0)) return;
+    int gx0 = (x < s->clip_x0) ? (s->clip_x0 - x) : 0;
+    int gx1 = (x + glyph->width > s->clip_x1) ? (s->clip_x1 - x) : glyph->width;
+    int gy0 = (y < s->clip_y0) ? (s->clip_y0 - y) : 0;
+    int gy1 = (y + font->height > s->clip_y1) ? (s->clip_y1 - y) : font->height;
+    if (gx0 >= gx1) return;
+    uint32_t keep = ((gx1 < 32) ? ((1u << gx1) - 1) : 0xFFFFFFFFu) & ~((1u << gx0) - 1);
+    uint8_t *dst = s->pixels + (y + gy0)*SCREEN_WIDTH + x;
+    for (int gy = gy0; gy < gy1; gy++, dst += SCREEN_WIDTH) {
+        uint32_t bits = glyph->rows[gy] & keep;
+        while (bits) {
+            dst[LowestBit(bits)] = color;
+            bits &= bits - 1;
+        }
+    }
+}
+
+void ScreenText(Screen *s, const ScreenFont *font, const char *text, int x, int y, uint8_t color)
+{
+    ScreenTextRange(s, font, text, strlen(text), x, y, color);
+}
+
+void ScreenTextRange(Screen *s, const ScreenFont *font, const char *text, size_t length, int x, int y, uint8_t color)
+{
+    const char *end = text + length;
+    int penX = x;
+    while ((text < end) && *text) {
+        int codepoint = (unsigned char)*text;
+        int index;
+        if (codepoint < 0x80) {
+            index = font->ascii_glyph[codepoint];
+            text++;
+        } else {
+            int bytes = 0;
+            codepoint = ScreenNextCodepoint(text, &bytes);
+            index = ScreenGlyphIndex(font, codepoint);
+            text += bytes;
+        }
+        if (codepoint=='\n') {
+            if (y >= s->clip_y1 - font->line_spacing) return; // every line from here on's below the clip
+            penX = x;
+            y += font->line_spacing;
+            continue;
+        }
+        if (penX >= s->clip_x1) continue; // the rest of the line's off to the right (and penX stays put, so it can't overflow)
+        if ((codepoint!=' ') && (codepoint!='\t')) ScreenDrawGlyph(s, font, index, penX, y, color);
+        penX += font->glyphs[index].width;
+    }
+}
+
+int ScreenTextWidth(const ScreenFont *font, const char *text)
+{
+    const unsigned char *p = (const unsigned char *)text;
+    int widest = 0;
+    int width = 0;
+    while (*p) {
+        // plain ASCII straight off the table, newlines are the only thing to look out for
+        while ((*p!=0) && (*p < 0x80) && (*p!='\n')) width += font->ascii_advance[*p++];
+        if (*p=='\n') {
+            if (width > widest) widest = width;
+            width = 0;
+            p++;
+        } else if (*p!=0) {
+            int bytes = 0;
+            width += ScreenAdvance(font, ScreenNextCodepoint((const char *)p, &bytes));
+            p += bytes;
+        }
+    }
+    return (width > widest) ? width : widest;
+}
+
+//----------------------------------------------------------------------------------
+// Output
+//----------------------------------------------------------------------------------
+void ScreenToRGBA(const Screen *s, const uint32_t *palette, uint32_t *out)
+{
+    for (int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; i++) out[i] = palette[s->pixels[i]];
+}
+
+//----------------------------------------------------------------------------------
+// Hashing
+//----------------------------------------------------------------------------------
+// XXH3's inner loop, more or less: eight 64 bit lanes go through the pixels 64 bytes at
+// a time, each adding the 32x32 bit product of its word's halves (XORed with a key) and
+// the word next door; every HASH_SCRAMBLE stripes the lanes get mixed up so nothing
+// cancels out over a long stretch. That's two multiplies a lane SSE2 and NEON can do
+// side by side. Not for anything adversarial, just for telling frames apart fast.
+#define HASH_STRIPE 64
+#define HASH_SCRAMBLE 16
+#define HASH_PRIME32 0x9E3779B1u
+#define HASH_PRIME64 0x9E3779B185EBCA87ULL
+
+static const uint64_t hashKeys[8] = {  // the start of XXH3's secret
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+static inline uint64_t Load64LE(const uint8_t *p)
+{
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+        ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static void HashStripesPlain(uint64_t *acc, const uint8_t *p, size_t stripes)
+{
+    for (size_t n = 0; n < stripes; n++, p += HASH_STRIPE) {
+        for (int i = 0; i < 8; i++) {
+            uint64_t data = Load64LE(p + i*8);
+            uint64_t keyed = data ^ hashKeys[i];
+            acc[i ^ 1] += data;
+            acc[i] += (keyed & 0xFFFFFFFFu)*(keyed >> 32);
+        }
+        if ((n + 1)%HASH_SCRAMBLE==0) {
+            for (int i = 0; i < 8; i++) acc[i] = (acc[i] ^ (acc[i] >> 47) ^ hashKeys[i])*HASH_PRIME32;
+        }
+    }
+}
+
+#if defined(SCREEN_SSE2)
+static void HashStripesSIMD(uint64_t *acc, const uint8_t *p, size_t stripes)
+{
+    __m128i a[4], k[4];
+    const __m128i prime = _mm_set1_epi32((int)HASH_PRIME32);
+    for (int j = 0; j < 4; j++) {
+        a[j] = _mm_loadu_si128((const __m128i *)(acc + j*2));
+        k[j] = _mm_loadu_si128((const __m128i *)(hashKeys + j*2));
+    }
+    for (size_t n = 0; n < stripes; n++, p += HASH_STRIPE) {
+        for (int j = 0; j < 4; j++) {
+            __m128i data = _mm_loadu_si128((const __m128i *)(p + j*16));
+            __m128i keyed = _mm_xor_si128(data, k[j]);
+            __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            a[j] = _mm_add_epi64(a[j], _mm_add_epi64(product, swapped));
+        }
+        if ((n + 1)%HASH_SCRAMBLE==0) {
+            for (int j = 0; j < 4; j++) {
+                __m128i x = _mm_xor_si128(_mm_xor_si128(a[j], _mm_srli_epi64(a[j], 47)), k[j]);
+                // 64x32 bit multiply, a half at a time
+                __m128i lo = _mm_mul_epu32(x, prime);
+                __m128i hi = _mm_mul_epu32(_mm_srli_epi64(x, 32), prime);
+                a[j] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+            }
+        }
+    }
+    for (int j = 0; j < 4; j++) _mm_storeu_si128((__m128i *)(acc + j*2), a[j]);
+}
+#elif defined(SCREEN_NEON)
+static void HashStripesSIMD(uint64_t *acc, const uint8_t *p, size_t stripes)
+{
+    uint64x2_t a[4], k[4];
+    for (int j = 0; j < 4; j++) {
+        a[j] = vld1q_u64(acc + j*2);
+        k[j] = vld1q_u64(hashKeys + j*2);
+    }
+    for (size_t n = 0; n < stripes; n++, p += HASH_STRIPE) {
+        for (int j = 0; j < 4; j++) {
+            uint64x2_t data = vreinterpretq_u64_u8(vld1q_u8(p + j*16));
+            uint64x2_t keyed = veorq_u64(data, k[j]);
+            uint64x2_t product = vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+            uint64x2_t swapped = vextq_u64(data, data, 1);
+            a[j] = vaddq_u64(a[j], vaddq_u64(product, swapped));
+        }
+        if ((n + 1)%HASH_SCRAMBLE==0) {
+            for (int j = 0; j < 4; j++) {
+                uint64x2_t x = veorq_u64(veorq_u64(a[j], vshrq_n_u64(a[j], 47)), k[j]);
+                uint64x2_t lo = vmull_n_u32(vmovn_u64(x), HASH_PRIME32);
+                uint64x2_t hi = vmull_n_u32(vshrn_n_u64(x, 32), HASH_PRIME32);
+                a[j] = vaddq_u64(lo, vshlq_n_u64(hi, 32));
+            }
+        }
+    }
+    for (int j = 0; j < 4; j++) vst1q_u64(acc + j*2, a[j]);
+}
+#endif
+
+static inline uint64_t Avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+static uint64_t HashPixels(const uint8_t *p, size_t n, int simd)
+{
+    uint64_t acc[8];
+    for (int i = 0; i < 8; i++) acc[i] = hashKeys[i];
+    size_t stripes = n/HASH_STRIPE;
+#if defined(SCREEN_SSE2) || defined(SCREEN_NEON)
+    if (simd) HashStripesSIMD(acc, p, stripes);
+    else HashStripesPlain(acc, p, stripes);
+#else
+    (void)simd;
+    HashStripesPlain(acc, p, stripes);
+#endif
+    uint64_t h = (uint64_t)n*HASH_PRIME64;
+    for (int i = 0; i < 8; i++) h = (h ^ Avalanche(acc[i]))*HASH_PRIME64;
+    for (size_t i = stripes*HASH_STRIPE; i < n; i++) h = (h ^ p[i])*HASH_PRIME64; // (the screen has no tail)
+    return Avalanche(h);
+}
+
+uint64_t ScreenHash(const Screen *s)
+{
+    return HashPixels(s->pixels, sizeof(s->pixels), 1);
+}
+
+uint64_t ScreenHashPlain(const Screen *s)
+{
+    return HashPixels(s->pixels, sizeof(s->pixels), 0);
+}
+
+int ScreenHashHasSIMD(void)
+{
+#if defined(SCREEN_SSE2) || defined(SCREEN_NEON)
+    return 1;
+#else
+    return 0;
+#endif
+}
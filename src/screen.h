@@ -0,0 +1,109 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Indexed framebuffer
+// Carts draw into a 320x240 buffer of palette indices, entirely on the CPU. A frame
+// comes out the same with or without a window (or a GPU), pix() is a plain lookup,
+// and whatever wants the frame (the window, a benchmark, a capture) converts it itself.
+// No raylib in here, so tools and benchmarks can draw without a display.
+//
+// Compatibility with the raylib (GPU) renderer this replaced, as far as carts can see:
+//   tri()    same: only triangles that wind counter-clockwise on screen draw, the GPU
+//            culled the rest as backfaces (the culling's in tri() now, not down here)
+//   spr()    sprites come out their own height; the GPU path used the width for both,
+//            so non-square sprites got squashed square. Flipping mirrors the sprite in
+//            its own box; the GPU mirrored it about (x, y), so flipped sprites landed to
+//            the left of/above where they were asked for (with culling on, if at all).
+//            Rotation's still in degrees around the sprite's center.
+//   print()  glyphs at the font's own pixel size, nothing blended or filtered; the GPU
+//            drew DrawTextEx at size 15, scaled if the font image wasn't 15 high
+//   pix()    reads give the index that was drawn; the GPU path read RGBA back and took
+//            the nearest palette color, which is the same index unless two palette
+//            entries share a color
+//   clip()   a rect clamped to the screen that everything honors, cls() included (like
+//            glClear under a scissor); the GPU scissor did the same on the render texture
+// Every palette entry is opaque, so overwriting instead of blending changes nothing.
+
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+
+typedef struct {
+    uint8_t pixels[SCREEN_WIDTH*SCREEN_HEIGHT];
+    int clip_x0, clip_y0;       // drawing only touches [clip_x0, clip_x1) x [clip_y0, clip_y1)
+    int clip_x1, clip_y1;
+} Screen;
+
+typedef struct {
+    int width;
+    int height;
+    uint8_t *pixels;
+    int colorkey;               // index left out when blitting, -1 for none
+} ScreenImage;
+
+#define SCREEN_GLYPH_MAX_WIDTH 32   // a glyph row is one uint32_t
+
+typedef struct {
+    int width;                  // also how far the pen moves
+    const uint32_t *rows;       // one per line of the font's height, bit x set = ink in column x
+} ScreenGlyph;
+
+typedef struct {
+    int height;
+    int line_spacing;           // how far '\n' moves down
+    int first;                  // codepoint of glyphs[0]
+    int count;
+    int fallback;               // glyph for codepoints the font doesn't have
+    uint32_t serial;            // different for every font ever loaded, for caches that hold on to what a font drew
+    ScreenGlyph *glyphs;
+    uint32_t *bitmap;           // all the rows, back to back
+    // built at load so ASCII never needs decoding or a glyph lookup
+    int16_t ascii_glyph[128];   // glyph index per ASCII codepoint
+    uint8_t ascii_advance[128]; // and how far it moves the pen ('\n' is 0, it doesn't)
+} ScreenFont;
+
+void ScreenInit(Screen *s);                                     // cleared to 0, nothing clipped
+void ScreenClip(Screen *s, int x, int y, int w, int h);
+void ScreenNoClip(Screen *s);
+void ScreenClear(Screen *s, uint8_t color);                     // clipped, like glClear under a scissor
+uint8_t ScreenGetPixel(const Screen *s, int x, int y);          // 0 off screen
+uint64_t ScreenHash(const Screen *s);                           // of the pixels, for telling frames apart (not the clip rect)
+uint64_t ScreenHashPlain(const Screen *s);                      // same, without SIMD (for comparing)
+int ScreenHashHasSIMD(void);
+void ScreenPixel(Screen *s, int x, int y, uint8_t color);
+void ScreenRect(Screen *s, int x, int y, int w, int h, uint8_t color);
+void ScreenRectLines(Screen *s, int x, int y, int w, int h, uint8_t color);
+void ScreenCircle(Screen *s, double x, double y, double radius, uint8_t color);
+void ScreenCircleLines(Screen *s, double x, double y, double radius, uint8_t color);
+void ScreenLine(Screen *s, int x1, int y1, int x2, int y2, uint8_t color);
+void ScreenTriangle(Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color);
+void ScreenTriangleLines(Screen *s, double x1, double y1, double x2, double y2, double x3, double y3, uint8_t color);
+// flip: bit 0 = horizontal, bit 1 = vertical; rotation in degrees around the image's center
+void ScreenBlit(Screen *s, const ScreenImage *img, double x, double y, double scale, int flip, double rotation);
+
+// Text
+// Fonts come from raylib-style font images: glyphs on a key-colored background, in
+// rows, starting at `first`. Parsed the same way LoadFontFromImage does it.
+// Glyphs wider than SCREEN_GLYPH_MAX_WIDTH get cut down to it.
+int LoadScreenFont(ScreenFont *font, const uint8_t *rgba, int width, int height, int first, int lineSpacing);
+// Packed fonts are what a cart's FONT chunk holds after its u32 id: u16 first, u16 count,
+// u8 height, u8 line spacing, u16 0, a u8 width per glyph, then each glyph's rows top to
+// bottom, (width+7)/8 bytes a row with the leftmost column in bit 0. Little endian.
+int LoadPackedScreenFont(ScreenFont *font, const uint8_t *data, size_t size);
+size_t PackScreenFont(const ScreenFont *font, uint8_t *out);   // returns the size, out can be NULL to just ask
+size_t ScreenFontBytes(const ScreenFont *font);                // memory it's holding on to
+void UnloadScreenFont(ScreenFont *font);
+int ScreenNextCodepoint(const char *text, int *bytes);         // invalid UTF-8 comes out as '?', 1 byte
+int ScreenGlyphIndex(const ScreenFont *font, int codepoint);
+static inline int ScreenAdvance(const ScreenFont *font, int codepoint)
+{
+    if ((codepoint >= 0) && (codepoint < 128)) return font->ascii_advance[codepoint];
+    return font->glyphs[ScreenGlyphIndex(font, codepoint)].width;
+}
+void ScreenDrawGlyph(Screen *s, const ScreenFont *font, int index, int x, int y, uint8_t color);
+void ScreenText(Screen *s, const ScreenFont *font, const char *text, int x, int y, uint8_t color);
+void ScreenTextRange(Screen *s, const ScreenFont *font, const char *text, size_t length, int x, int y, uint8_t color); // first length bytes
+int ScreenTextWidth(const ScreenFont *font, const char *text);  // widest line
+
+// palette holds 0xAABBGGRR per index, i.e. RGBA8 bytes on a little endian machine
+void ScreenToRGBA(const Screen *s, const uint32_t *palette, uint32_t *out);
@@ -0,0 +1,457 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "synth.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #include <emmintrin.h>
+    #define SYNTH_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define SYNTH_NEON
+#endif
+
+#define SONG_HEADER 8
+#define SONG_INSTRUMENT 10
+#define SYNTH_MASTER 0.25f          // four voices flat out is about full scale
+#define NOISE_RATE 8.0f             // noise steps this many times a note's period
+
+//----------------------------------------------------------------------------------
+// Songs
+//----------------------------------------------------------------------------------
+static uint16_t GetU16(const uint8_t *p) { return (uint16_t)(p[0]|(p[1] << 8)); }
+static void PutU16(uint8_t *p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+
+int LoadSynthSong(SynthSong *song, const uint8_t *data, size_t size)
+{
+    memset(song, 0, sizeof(SynthSong));
+    if ((data==NULL) || (size < SONG_HEADER) || (data[0]!=SYNTH_VERSION)) return 0;
+    int channels = data[1];
+    int speed = data[2];
+    int instruments = data[3];
+    int patterns = data[4];
+    int orders = data[5];
+    int rows = data[6];
+    if ((channels < 1) || (channels > SYNTH_VOICES) || (speed < 1) || (instruments < 1) || (patterns < 1) || (orders < 1) || (rows < 1)) return 0;
+    size_t cells = (size_t)patterns*rows*channels;
+    if (size < SONG_HEADER + (size_t)instruments*SONG_INSTRUMENT + orders + cells*2) return 0;
+
+    song->instruments = calloc(instruments, sizeof(SynthInstrument));
+    song->orders = malloc(orders);
+    song->cells = malloc(cells*sizeof(SynthCell));
+    if ((song->instruments==NULL) || (song->orders==NULL) || (song->cells==NULL)) {
+        UnloadSynthSong(song);
+        return 0;
+    }
+    song->channels = channels;
+    song->speed = speed;
+    song->rows = rows;
+    song->instrument_count = instruments;
+    song->pattern_count = patterns;
+    song->order_count = orders;
+
+    const uint8_t *p = data + SONG_HEADER;
+    for (int i = 0; i < instruments; i++, p += SONG_INSTRUMENT) {
+        SynthInstrument *inst = &song->instruments[i];
+        inst->wave = p[0];
+        inst->volume = p[1];
+        inst->duty = p[2];
+        inst->sustain = p[3];
+        inst->attack = GetU16(p + 4);
+        inst->decay = GetU16(p + 6);
+        inst->release = GetU16(p + 8);
+        if (inst->wave >= SYNTH_WAVES) goto bad;
+    }
+    for (int i = 0; i < orders; i++) {
+        song->orders[i] = *p++;
+        if (song->orders[i] >= patterns) goto bad;
+    }
+    for (size_t i = 0; i < cells; i++, p += 2) {
+        song->cells[i].note = p[0];
+        song->cells[i].instrument = p[1];
+        if ((p[0]!=0) && (p[0]!=SYNTH_NOTE_OFF) && ((p[0] > 127) || (p[1] >= instruments))) goto bad;
+    }
+    return 1;
+
+bad:
+    UnloadSynthSong(song);
+    return 0;
+}
+
+size_t PackSynthSong(const SynthSong *song, uint8_t *out)
+{
+    size_t cells = (size_t)song->pattern_count*song->rows*song->channels;
+    size_t size = SONG_HEADER + (size_t)song->instrument_count*SONG_INSTRUMENT + song->order_count + cells*2;
+    if (out==NULL) return size;
+
+    uint8_t *p = out;
+    *p++ = SYNTH_VERSION;
+    *p++ = (uint8_t)song->channels;
+    *p++ = (uint8_t)song->speed;
+    *p++ = (uint8_t)song->instrument_count;
+    *p++ = (uint8_t)song->pattern_count;
+    *p++ = (uint8_t)song->order_count;
+    *p++ = (uint8_t)song->rows;
+    *p++ = 0;
+    for (int i = 0; i < song->instrument_count; i++, p += SONG_INSTRUMENT) {
+        const SynthInstrument *inst = &song->instruments[i];
+        p[0] = inst->wave;
+        p[1] = inst->volume;
+        p[2] = inst->duty;
+        p[3] = inst->sustain;
+        PutU16(p + 4, inst->attack);
+        PutU16(p + 6, inst->decay);
+        PutU16(p + 8, inst->release);
+    }
+    memcpy(p, song->orders, song->order_count);
+    p += song->order_count;
+    for (size_t i = 0; i < cells; i++) {
+        *p++ = song->cells[i].note;
+        *p++ = song->cells[i].instrument;
+    }
+    return size;
+}
+
+void UnloadSynthSong(SynthSong *song)
+{
+    free(song->instruments);
+    free(song->orders);
+    free(song->cells);
+    memset(song, 0, sizeof(SynthSong));
+}
+
+size_t SynthSongBytes(const SynthSong *song)
+{
+    return (size_t)song->instrument_count*sizeof(SynthInstrument) + song->order_count
+        + (size_t)song->pattern_count*song->rows*song->channels*sizeof(SynthCell);
+}
+
+double SynthSongLength(const SynthSong *song)
+{
+    return (double)song->order_count*song->rows*song->speed/SYNTH_TICK_RATE;
+}
+
+//----------------------------------------------------------------------------------
+// Sequencer and envelopes
+//----------------------------------------------------------------------------------
+void SynthInit(Synth *s, uint32_t sampleRate)
+{
+    memset(s, 0, sizeof(Synth));
+    s->sample_rate = sampleRate;
+    s->simd = SynthHasSIMD();
+    for (int v = 0; v < SYNTH_VOICES; v++) {
+        s->noise[v] = 0x9E3779B9u*(uint32_t)(v + 1); // xorshift can't start at 0
+        s->duty[v] = 0.5f;
+    }
+}
+
+static void Release(Synth *s)
+{
+    for (int v = 0; v < SYNTH_VOICES; v++) {
+        if (s->stage[v]!=ENVELOPE_OFF) s->stage[v] = ENVELOPE_RELEASE;
+    }
+}
+
+void SynthPlay(Synth *s, const SynthSong *song, int loop)
+{
+    Release(s);
+    s->song = song;
+    s->loop = loop;
+    s->ended = 0;
+    s->order = s->row = s->tick = 0;
+    s->tick_left = 0;
+    s->tick_error = 0;
+}
+
+void SynthStop(Synth *s)
+{
+    SynthPlay(s, NULL, 0);
+    for (int v = 0; v < SYNTH_VOICES; v++) {
+        s->stage[v] = ENVELOPE_OFF;
+        s->instrument[v] = NULL;
+        s->level[v] = 0.0f;
+        s->amp[v] = 0.0f;
+    }
+}
+
+static void NoteOn(Synth *s, int v, int note, const SynthInstrument *inst)
+{
+    float step = 440.0f*powf(2.0f, (note - 69)/12.0f)/(float)s->sample_rate;
+    if (inst->wave==SYNTH_NOISE) step *= NOISE_RATE;
+    if (step > 0.5f) step = 0.5f; // the phase can only wrap once a sample
+    s->step[v] = step;
+    s->duty[v] = inst->duty/256.0f;
+    for (int w = 0; w < SYNTH_WAVES; w++) s->weight[w][v] = (w==inst->wave) ? 1.0f : 0.0f;
+    s->instrument[v] = inst;
+    s->stage[v] = ENVELOPE_ATTACK; // from wherever the level is now, so a retrigger doesn't click
+}
+
+static void Tick(Synth *s)
+{
+    const SynthSong *song = s->song;
+    if ((song==NULL) || s->ended) return;
+    if (s->tick==0) {
+        const SynthCell *cells = song->cells + ((size_t)song->orders[s->order]*song->rows + s->row)*song->channels;
+        for (int ch = 0; ch < song->channels; ch++) {
+            if (cells[ch].note==SYNTH_NOTE_OFF) {
+                if (s->stage[ch]!=ENVELOPE_OFF) s->stage[ch] = ENVELOPE_RELEASE;
+            } else if (cells[ch].note!=0) {
+                NoteOn(s, ch, cells[ch].note, &song->instruments[cells[ch].instrument]);
+            }
+        }
+    }
+    if (++s->tick < song->speed) return;
+    s->tick = 0;
+    if (++s->row < song->rows) return;
+    s->row = 0;
+    if (++s->order < song->order_count) return;
+    s->order = 0;
+    if (!s->loop) {
+        s->ended = 1;
+        Release(s);
+    }
+}
+
+// where the voice's volume is n samples from now (stage changes land on block edges)
+static float Envelope(Synth *s, int v, int n)
+{
+    const SynthInstrument *inst = s->instrument[v];
+    float ms = n*1000.0f/(float)s->sample_rate;
+    float sustain = inst->sustain/255.0f;
+    float level = s->level[v];
+    switch (s->stage[v]) {
+    case ENVELOPE_ATTACK:
+        level = inst->attack ? (level + ms/inst->attack) : 1.0f;
+        if (level >= 1.0f) {
+            level = 1.0f;
+            s->stage[v] = ENVELOPE_DECAY;
+        }
+        break;
+    case ENVELOPE_DECAY:
+        level = inst->decay ? (level - ms*(1.0f - sustain)/inst->decay) : sustain;
+        if (level <= sustain) {
+            level = sustain;
+            s->stage[v] = ENVELOPE_SUSTAIN;
+        }
+        break;
+    case ENVELOPE_SUSTAIN:
+        level = sustain;
+        break;
+    case ENVELOPE_RELEASE:
+        level = inst->release ? (level - ms/inst->release) : 0.0f;
+        if (level <= 0.0f) {
+            level = 0.0f;
+            s->stage[v] = ENVELOPE_OFF;
+        }
+        break;
+    default:
+        level = 0.0f;
+        break;
+    }
+    s->level[v] = level;
+    return level*(inst->volume/255.0f)*SYNTH_MASTER;
+}
+
+//----------------------------------------------------------------------------------
+// Oscillators
+//----------------------------------------------------------------------------------
+// Every voice computes every wave and keeps the one its weights pick, which costs a few
+// multiplies but means no branches and no lookups, so four voices fit in one register.
+// The plain loop does exactly the same math in the same order, lane by lane.
+
+#if defined(SYNTH_SSE2)
+typedef __m128 vfloat;
+typedef __m128 vmask;
+typedef __m128i vuint;
+#define VLoad(p) _mm_loadu_ps(p)
+#define VStore(p, v) _mm_storeu_ps(p, v)
+#define VSet(x) _mm_set1_ps(x)
+#define VAdd(a, b) _mm_add_ps(a, b)
+#define VSub(a, b) _mm_sub_ps(a, b)
+#define VMul(a, b) _mm_mul_ps(a, b)
+#define VAbs(a) _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+#define VGreaterEqual(a, b) _mm_cmpge_ps(a, b)
+#define VLess(a, b) _mm_cmplt_ps(a, b)
+#define VSelect(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define VMasked(m, a) _mm_and_ps(m, a)
+#define ULoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define UStore(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define UXorLeft(x, n) _mm_xor_si128(x, _mm_slli_epi32(x, n))
+#define UXorRight(x, n) _mm_xor_si128(x, _mm_srli_epi32(x, n))
+#define USelect(m, a, b) _mm_or_si128(_mm_and_si128(_mm_castps_si128(m), a), _mm_andnot_si128(_mm_castps_si128(m), b))
+#define UToFloat(x) _mm_cvtepi32_ps(x)
+static inline float VSum(vfloat v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+#elif defined(SYNTH_NEON)
+typedef float32x4_t vfloat;
+typedef uint32x4_t vmask;
+typedef uint32x4_t vuint;
+#define VLoad(p) vld1q_f32(p)
+#define VStore(p, v) vst1q_f32(p, v)
+#define VSet(x) vdupq_n_f32(x)
+#define VAdd(a, b) vaddq_f32(a, b)
+#define VSub(a, b) vsubq_f32(a, b)
+#define VMul(a, b) vmulq_f32(a, b)
+#define VAbs(a) vabsq_f32(a)
+#define VGreaterEqual(a, b) vcgeq_f32(a, b)
+#define VLess(a, b) vcltq_f32(a, b)
+#define VSelect(m, a, b) vbslq_f32(m, a, b)
+#define VMasked(m, a) vreinterpretq_f32_u32(vandq_u32(m, vreinterpretq_u32_f32(a)))
+#define ULoad(p) vld1q_u32(p)
+#define UStore(p, v) vst1q_u32(p, v)
+#define UXorLeft(x, n) veorq_u32(x, vshlq_n_u32(x, n))
+#define UXorRight(x, n) veorq_u32(x, vshrq_n_u32(x, n))
+#define USelect(m, a, b) vbslq_u32(m, a, b)
+#define UToFloat(x) vcvtq_f32_s32(vreinterpretq_s32_u32(x))
+static inline float VSum(vfloat v)
+{
+    float32x2_t half = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+}
+#endif
+
+int SynthHasSIMD(void)
+{
+#if defined(SYNTH_SSE2) || defined(SYNTH_NEON)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#if defined(SYNTH_SSE2) || defined(SYNTH_NEON)
+static void RenderLanes(Synth *s, float *out, int n, const float *start, const float *slope)
+{
+    const vfloat one = VSet(1.0f), minusOne = VSet(-1.0f), two = VSet(2.0f), four = VSet(4.0f);
+    const vfloat half = VSet(0.5f), minusFour = VSet(-4.0f), sineFix = VSet(0.225f), noiseScale = VSet(1.0f/2147483648.0f);
+    vfloat phase[2], step[2], duty[2], held[2], amp[2], ramp[2], weight[SYNTH_WAVES][2];
+    vuint noise[2];
+    for (int g = 0; g < 2; g++) {
+        phase[g] = VLoad(s->phase + 4*g);
+        step[g] = VLoad(s->step + 4*g);
+        duty[g] = VLoad(s->duty + 4*g);
+        held[g] = VLoad(s->held + 4*g);
+        amp[g] = VLoad(start + 4*g);
+        ramp[g] = VLoad(slope + 4*g);
+        noise[g] = ULoad(s->noise + 4*g);
+        for (int w = 0; w < SYNTH_WAVES; w++) weight[w][g] = VLoad(s->weight[w] + 4*g);
+    }
+    for (int i = 0; i < n; i++) {
+        vfloat mix[2];
+        for (int g = 0; g < 2; g++) {
+            vfloat ph = VAdd(phase[g], step[g]);
+            vmask wrap = VGreaterEqual(ph, one);
+            ph = VSub(ph, VMasked(wrap, one));
+            phase[g] = ph;
+            vuint x = noise[g];
+            x = UXorLeft(x, 13);
+            x = UXorRight(x, 17);
+            x = UXorLeft(x, 5);
+            noise[g] = USelect(wrap, x, noise[g]);
+            held[g] = VSelect(wrap, VMul(UToFloat(x), noiseScale), held[g]);
+
+            vfloat saw = VSub(VMul(ph, two), one);
+            vfloat square = VSelect(VLess(ph, duty[g]), one, minusOne);
+            vfloat triangle = VSub(one, VMul(four, VAbs(VSub(ph, half))));
+            vfloat sine = VMul(VMul(minusFour, saw), VSub(one, VAbs(saw)));
+            sine = VAdd(VMul(sineFix, VSub(VMul(sine, VAbs(sine)), sine)), sine);
+            vfloat osc = VAdd(VMul(square, weight[SYNTH_SQUARE][g]), VMul(triangle, weight[SYNTH_TRIANGLE][g]));
+            osc = VAdd(osc, VMul(saw, weight[SYNTH_SAW][g]));
+            osc = VAdd(osc, VMul(sine, weight[SYNTH_SINE][g]));
+            osc = VAdd(osc, VMul(held[g], weight[SYNTH_NOISE][g]));
+            mix[g] = VMul(osc, amp[g]);
+            amp[g] = VAdd(amp[g], ramp[g]);
+        }
+        out[i] = VSum(VAdd(mix[0], mix[1]));
+    }
+    for (int g = 0; g < 2; g++) {
+        VStore(s->phase + 4*g, phase[g]);
+        VStore(s->held + 4*g, held[g]);
+        UStore(s->noise + 4*g, noise[g]);
+    }
+}
+#endif
+
+static void RenderPlain(Synth *s, float *out, int n, const float *start, const float *slope)
+{
+    float amp[SYNTH_VOICES];
+    memcpy(amp, start, sizeof(amp));
+    for (int i = 0; i < n; i++) {
+        float mix[SYNTH_VOICES];
+        for (int v = 0; v < SYNTH_VOICES; v++) {
+            float ph = s->phase[v] + s->step[v];
+            int wrap = (ph >= 1.0f);
+            if (wrap) ph -= 1.0f;
+            s->phase[v] = ph;
+            if (wrap) {
+                uint32_t x = s->noise[v];
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                s->noise[v] = x;
+                s->held[v] = (float)(int32_t)x*(1.0f/2147483648.0f);
+            }
+
+            float saw = ph*2.0f - 1.0f;
+            float square = (ph < s->duty[v]) ? 1.0f : -1.0f;
+            float triangle = 1.0f - 4.0f*fabsf(ph - 0.5f);
+            float sine = (-4.0f*saw)*(1.0f - fabsf(saw));
+            sine = 0.225f*(sine*fabsf(sine) - sine) + sine;
+            float osc = square*s->weight[SYNTH_SQUARE][v] + triangle*s->weight[SYNTH_TRIANGLE][v];
+            osc = osc + saw*s->weight[SYNTH_SAW][v];
+            osc = osc + sine*s->weight[SYNTH_SINE][v];
+            osc = osc + s->held[v]*s->weight[SYNTH_NOISE][v];
+            mix[v] = osc*amp[v];
+            amp[v] = amp[v] + slope[v];
+        }
+        // same order the lanes get added up in
+        float lanes[4];
+        for (int l = 0; l < 4; l++) lanes[l] = mix[l] + mix[l + 4];
+        out[i] = (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+    }
+}
+
+int SynthRender(Synth *s, float *out, int frames)
+{
+    int audible = 0;
+    int done = 0;
+    while (done < frames) {
+        if (s->tick_left==0) {
+            Tick(s);
+            s->tick_error += s->sample_rate;
+            s->tick_left = s->tick_error/SYNTH_TICK_RATE;
+            s->tick_error -= s->tick_left*SYNTH_TICK_RATE;
+        }
+        int n = frames - done;
+        if (n > SYNTH_BLOCK) n = SYNTH_BLOCK;
+        if ((uint32_t)n > s->tick_left) n = (int)s->tick_left;
+
+        // envelopes move once a block, the oscillators ramp between where they were and where they're going
+        float start[SYNTH_VOICES], slope[SYNTH_VOICES];
+        int active = 0;
+        for (int v = 0; v < SYNTH_VOICES; v++) {
+            float end = (s->stage[v]!=ENVELOPE_OFF) ? Envelope(s, v, n) : 0.0f;
+            start[v] = s->amp[v];
+            slope[v] = (end - start[v])/n;
+            s->amp[v] = end;
+            if ((start[v]!=0.0f) || (end!=0.0f)) active = 1;
+        }
+        if (!active) {
+            memset(out + done, 0, n*sizeof(float));
+        } else {
+#if defined(SYNTH_SSE2) || defined(SYNTH_NEON)
+            if (s->simd) RenderLanes(s, out + done, n, start, slope);
+            else
+#endif
+            RenderPlain(s, out + done, n, start, slope);
+            audible = 1;
+        }
+        done += n;
+        s->tick_left -= n;
+    }
+    return audible;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Chiptune synth
+// A few bytes of song instead of megabytes of samples: instruments (an oscillator and
+// an ADSR envelope) and patterns of notes, played by a tick-based sequencer like the
+// trackers do it. The oscillators are plain math on a phase, no tables, so all the
+// voices go through the inner loop side by side in SIMD lanes. Envelopes move once per
+// block and get ramped across it. No raylib in here, the mixer thread and the offline
+// benchmark both drive it directly.
+//
+// Songs are what a cart's SONG chunk holds after its u32 id:
+//   u8 version (1), u8 channels, u8 speed (ticks per row), u8 instruments, u8 patterns,
+//   u8 orders, u8 rows per pattern, u8 0
+//   instruments, 10 bytes each: u8 wave, u8 volume, u8 duty, u8 sustain,
+//                               u16 attack, u16 decay, u16 release (milliseconds)
+//   orders: a pattern index each
+//   patterns: rows x channels cells, 2 bytes each: u8 note, u8 instrument
+// Notes are MIDI numbers (60 is middle C), 0 is nothing, SYNTH_NOTE_OFF releases.
+
+#define SYNTH_VOICES 8              // two lanes of four, a song can use up to this many channels
+#define SYNTH_BLOCK 64              // samples between envelope updates
+#define SYNTH_TICK_RATE 60          // sequencer ticks a second
+#define SYNTH_NOTE_OFF 255
+#define SYNTH_VERSION 1
+
+typedef enum {
+    SYNTH_SQUARE = 0,
+    SYNTH_TRIANGLE,
+    SYNTH_SAW,
+    SYNTH_SINE,
+    SYNTH_NOISE,
+    SYNTH_WAVES
+} SynthWave;
+
+typedef struct {
+    uint8_t wave;
+    uint8_t volume;
+    uint8_t duty;               // square: how much of the period is high, 128 = half
+    uint8_t sustain;            // level after the decay, 255 = volume
+    uint16_t attack, decay, release;
+} SynthInstrument;
+
+typedef struct {
+    uint8_t note;
+    uint8_t instrument;
+} SynthCell;
+
+typedef struct {
+    int channels;
+    int speed;
+    int rows;
+    int instrument_count;
+    int pattern_count;
+    int order_count;
+    SynthInstrument *instruments;
+    uint8_t *orders;
+    SynthCell *cells;           // pattern_count*rows*channels
+} SynthSong;
+
+int LoadSynthSong(SynthSong *song, const uint8_t *data, size_t size);
+size_t PackSynthSong(const SynthSong *song, uint8_t *out);     // returns the size, out can be NULL to just ask
+void UnloadSynthSong(SynthSong *song);
+size_t SynthSongBytes(const SynthSong *song);
+double SynthSongLength(const SynthSong *song);                 // seconds, once through the orders
+
+typedef enum {
+    ENVELOPE_OFF = 0,
+    ENVELOPE_ATTACK,
+    ENVELOPE_DECAY,
+    ENVELOPE_SUSTAIN,
+    ENVELOPE_RELEASE,
+} SynthEnvelope;
+
+typedef struct {
+    const SynthSong *song;      // NULL = quiet
+    int loop;
+    int ended;                  // got to the end of the orders without looping
+    int order, row, tick;
+    uint32_t tick_left;         // samples until the next tick
+    uint32_t tick_error;        // for sample rates that don't divide by SYNTH_TICK_RATE
+    uint32_t sample_rate;
+    int simd;                   // 0 = the plain C loop (same output, for comparing)
+    // voices, one array per field so a whole lane's worth loads at once
+    float phase[SYNTH_VOICES];  // 0-1
+    float step[SYNTH_VOICES];   // phase per sample
+    float duty[SYNTH_VOICES];
+    float weight[SYNTH_WAVES][SYNTH_VOICES]; // 1 for the voice's wave, 0 for the rest
+    uint32_t noise[SYNTH_VOICES];            // xorshift state, stepped each time the phase wraps
+    float held[SYNTH_VOICES];                // noise output between steps
+    float amp[SYNTH_VOICES];                 // where the last block's ramp ended
+    // envelopes, per block
+    const SynthInstrument *instrument[SYNTH_VOICES];
+    int stage[SYNTH_VOICES];
+    float level[SYNTH_VOICES];
+} Synth;
+
+void SynthInit(Synth *s, uint32_t sampleRate);
+void SynthPlay(Synth *s, const SynthSong *song, int loop);    // NULL stops (everything releases)
+void SynthStop(Synth *s);                                       // cut off now, nothing points at the song after this
+int SynthRender(Synth *s, float *out, int frames);            // mono, about -1 to 1; 0 if it was all silence
+int SynthHasSIMD(void);
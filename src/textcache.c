@@ -0,0 +1,180 @@
+#include "raylib.h"
+#include "textcache.h"
+#include <stdlib.h>
+#include <string.h>
+
+void TextCacheInit(TextCache *c, size_t budget)
+{
+    memset(c, 0, sizeof(TextCache));
+    c->budget = budget;
+}
+
+static uint32_t HashText(uint32_t font, const char *text, size_t length)
+{
+    uint32_t hash = 2166136261u ^ font;    // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void Unlink(TextCache *c, TextRun *run)
+{
+    if (run->newer) run->newer->older = run->older;
+    else c->newest = run->older;
+    if (run->older) run->older->newer = run->newer;
+    else c->oldest = run->newer;
+    run->newer = run->older = NULL;
+}
+
+static void PushNewest(TextCache *c, TextRun *run)
+{
+    run->older = c->newest;
+    if (c->newest) c->newest->newer = run;
+    c->newest = run;
+    if (c->oldest==NULL) c->oldest = run;
+}
+
+static void Evict(TextCache *c, TextRun *run)
+{
+    TextRun **link = &c->buckets[run->hash%TEXT_CACHE_BUCKETS];
+    while (*link!=run) link = &(*link)->chain;
+    *link = run->chain;
+    Unlink(c, run);
+    c->bytes -= run->bytes;
+    free(run);
+}
+
+void TextCacheClear(TextCache *c)
+{
+    while (c->oldest) Evict(c, c->oldest);
+    free(c->scratch);
+    c->scratch = NULL;
+    memset(c->seen, 0, sizeof(c->seen));
+}
+
+// Draws the text into a scratch screen and pulls the spans back out
+static TextRun *Rasterize(TextCache *c, const ScreenFont *font, const char *text, size_t length, uint32_t hash)
+{
+    int width = ScreenTextWidth(font, text);
+    int lines = 1;
+    for (size_t i = 0; i < length; i++) if (text[i]=='\n') lines++;
+    int height = (lines - 1)*font->line_spacing + font->height;
+    if ((width > SCREEN_WIDTH) || (height > SCREEN_HEIGHT) || (width==0)) return NULL;
+
+    if ((c->scratch==NULL) && ((c->scratch = malloc(sizeof(Screen)))==NULL)) return NULL;
+    Screen *scratch = c->scratch;
+    ScreenClip(scratch, 0, 0, width, height);
+    ScreenClear(scratch, 0);
+    ScreenText(scratch, font, text, 0, 0, 1);
+
+    int count = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = scratch->pixels + y*SCREEN_WIDTH;
+        for (int x = 0; x < width; x++) {
+            if (row[x] && ((x==0) || !row[x - 1])) count++;
+        }
+    }
+
+    size_t bytes = sizeof(TextRun) + count*sizeof(TextSpan) + length + 1;
+    if (bytes > c->budget) return NULL;
+    TextRun *run = malloc(bytes);
+    if (run==NULL) return NULL;
+    memset(run, 0, sizeof(TextRun));
+    TextSpan *spans = (TextSpan *)(run + 1);
+    char *copy = (char *)(spans + count);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    int n = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = scratch->pixels + y*SCREEN_WIDTH;
+        for (int x = 0; x < width; x++) {
+            if (!row[x]) continue;
+            int start = x;
+            while ((x < width) && row[x]) x++;
+            spans[n++] = (TextSpan){ (int16_t)start, (int16_t)y, (uint16_t)(x - start) };
+        }
+    }
+    run->hash = hash;
+    run->font = font->serial;
+    run->length = length;
+    run->text = copy;
+    run->spans = spans;
+    run->span_count = count;
+    run->bytes = bytes;
+    return run;
+}
+
+static void DrawRun(Screen *s, const TextRun *run, int x, int y, uint8_t color)
+{
+    for (int i = 0; i < run->span_count; i++) {
+        const TextSpan *span = &run->spans[i];
+        int sy = y + span->y;
+        if ((sy < s->clip_y0) || (sy >= s->clip_y1)) continue;
+        int x0 = x + span->x;
+        int x1 = x0 + span->length;
+        if (x0 < s->clip_x0) x0 = s->clip_x0;
+        if (x1 > s->clip_x1) x1 = s->clip_x1;
+        if (x0 < x1) memset(s->pixels + sy*SCREEN_WIDTH + x0, color, x1 - x0);
+    }
+}
+
+void TextCachePrint(TextCache *c, Screen *s, const ScreenFont *font, const char *text, int x, int y, uint8_t color)
+{
+    size_t length = strlen(text);
+    if ((length==0) || (length > TEXT_CACHE_MAX_TEXT) || (c->budget==0)) {
+        c->uncached++;
+        ScreenText(s, font, text, x, y, color);
+        return;
+    }
+
+    uint32_t hash = HashText(font->serial, text, length);
+    TextRun **bucket = &c->buckets[hash%TEXT_CACHE_BUCKETS];
+    for (TextRun *run = *bucket; run!=NULL; run = run->chain) {
+        if ((run->hash==hash) && (run->font==font->serial) && (run->length==length) && (memcmp(run->text, text, length)==0)) {
+            c->hits++;
+            if (c->newest!=run) {
+                Unlink(c, run);
+                PushNewest(c, run);
+            }
+            DrawRun(s, run, x, y, color);
+            return;
+        }
+    }
+
+    c->misses++;
+    // the first time it's only noted; if it comes round again it's worth a run
+    uint32_t *seen = &c->seen[hash%TEXT_CACHE_SEEN];
+    if (*seen!=hash) {
+        *seen = hash;
+        c->first_seen++;
+        c->uncached++;
+        ScreenText(s, font, text, x, y, color);
+        return;
+    }
+    TextRun *run = Rasterize(c, font, text, length, hash);
+    if (run==NULL) {
+        c->uncached++;
+        ScreenText(s, font, text, x, y, color);
+        return;
+    }
+    while ((c->bytes + run->bytes > c->budget) && (c->oldest!=NULL)) {
+        Evict(c, c->oldest);
+        c->evictions++;
+    }
+    run->chain = *bucket;
+    *bucket = run;
+    PushNewest(c, run);
+    c->bytes += run->bytes;
+    DrawRun(s, run, x, y, color);
+}
+
+void TextCacheLog(const TextCache *c)
+{
+    uint64_t lookups = c->hits + c->misses;
+    if (lookups==0) return;
+    TraceLog(LOG_INFO, "TEXT: print cache: %llu hits, %llu misses (%.1f%% hit rate, %llu seen for the first time), %llu evictions, %llu drawn uncached, %zu/%zu bytes",
+        (unsigned long long)c->hits, (unsigned long long)c->misses, 100.0*c->hits/lookups, (unsigned long long)c->first_seen,
+        (unsigned long long)c->evictions, (unsigned long long)c->uncached, c->bytes, c->budget);
+}
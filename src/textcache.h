@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "screen.h"
+
+// Text run cache
+// HUD text is mostly the same strings every frame ("SCORE", menus), and each print()
+// of one decodes the UTF-8, looks up every glyph and clips every glyph all over again.
+// This keeps the ink of recently printed strings as a list of horizontal spans, so a
+// repeat is one memset per span. Runs are keyed by font and string; color isn't part of
+// the key, the spans don't care.
+// Least recently used runs get thrown out to stay under the byte budget.
+// A string only gets a run the second time it misses. Until then just its hash goes in a
+// small table of strings seen once, and it's drawn the plain way. So text that's new
+// every frame (a timer, "frame 1234") costs nothing extra and doesn't push the HUD out.
+
+#define TEXT_CACHE_BUCKETS 512
+#define TEXT_CACHE_BUDGET (256*1024)
+#define TEXT_CACHE_MAX_TEXT 512     // longer strings are probably one-offs, just draw them
+#define TEXT_CACHE_SEEN 1024        // hashes of strings seen once (a collision only admits one early)
+
+typedef struct {
+    int16_t x, y;       // relative to where the text's drawn
+    uint16_t length;
+} TextSpan;
+
+typedef struct TextRun {
+    uint32_t hash;
+    uint32_t font;              // serial of the font it was drawn in
+    size_t length;              // bytes of text
+    const char *text;           // these two point into the same allocation as the run
+    const TextSpan *spans;
+    int span_count;
+    size_t bytes;               // everything, for the budget
+    struct TextRun *newer, *older;
+    struct TextRun *chain;      // next in the hash bucket
+} TextRun;
+
+typedef struct {
+    TextRun *buckets[TEXT_CACHE_BUCKETS];
+    TextRun *newest, *oldest;
+    size_t bytes;
+    size_t budget;
+    Screen *scratch;            // misses get drawn here first
+    uint32_t seen[TEXT_CACHE_SEEN];
+    uint64_t hits, misses, evictions, uncached;
+    uint64_t first_seen;        // misses drawn the plain way, not cached yet (counted in uncached too)
+} TextCache;
+
+void TextCacheInit(TextCache *c, size_t budget);
+void TextCacheClear(TextCache *c);          // drop every run, what's been seen and the scratch screen (the counters stay)
+void TextCachePrint(TextCache *c, Screen *s, const ScreenFont *font, const char *text, int x, int y, uint8_t color); // same as ScreenText
+void TextCacheLog(const TextCache *c);
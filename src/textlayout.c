@@ -0,0 +1,164 @@
+#include "textlayout.h"
+#include <stdlib.h>
+#include <string.h>
+
+void LayoutCacheInit(LayoutCache *c)
+{
+    memset(c, 0, sizeof(LayoutCache));
+}
+
+static void FreeLayout(TextLayout *layout)
+{
+    free(layout->text);
+    free(layout->lines);
+    memset(layout, 0, sizeof(TextLayout));
+}
+
+void LayoutCacheClear(LayoutCache *c)
+{
+    for (int i = 0; i < LAYOUT_CACHE_SIZE; i++) FreeLayout(&c->entries[i]);
+    FreeLayout(&c->scratch);
+}
+
+static uint32_t HashLayout(uint32_t font, const char *text, size_t length, int maxWidth)
+{
+    uint32_t hash = 2166136261u ^ (uint32_t)maxWidth ^ (font << 16);    // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int AddLine(TextLayout *layout, int start, int end, int width)
+{
+    if (layout->count==layout->capacity) {
+        int capacity = layout->capacity ? layout->capacity*2 : 8;
+        TextLine *lines = realloc(layout->lines, capacity*sizeof(TextLine));
+        if (lines==NULL) return 0;
+        layout->lines = lines;
+        layout->capacity = capacity;
+    }
+    layout->lines[layout->count++] = (TextLine){ start, end - start, width };
+    if (width > layout->width) layout->width = width;
+    return 1;
+}
+
+// The one pass: width is the pen position on the current line. At the first space of a
+// run we remember where the line would end if it broke there; at each space after that,
+// where the next line would pick up. Only ink can overflow, spaces at the end of a line
+// just get dropped.
+static int Break(const ScreenFont *font, TextLayout *layout, const char *text, size_t length, int maxWidth)
+{
+    layout->count = 0;
+    layout->width = 0;
+    int lineStart = 0;
+    int width = 0;
+    int breakEnd = -1;      // where the line ends if we break at the last space run
+    int breakWidth = 0;     // its width then
+    int resume = 0;         // where the next line starts then
+    int resumeWidth = 0;    // and how much of the current width that skips
+    int inSpaces = 0;
+    int i = 0;
+    while (i < (int)length) {
+        int bytes = 1;
+        int codepoint = (unsigned char)text[i];
+        if (codepoint >= 0x80) codepoint = ScreenNextCodepoint(text + i, &bytes);
+        if (codepoint=='\n') {
+            if (!AddLine(layout, lineStart, inSpaces ? breakEnd : i, inSpaces ? breakWidth : width)) return 0;
+            i += bytes;
+            lineStart = i;
+            width = 0;
+            breakEnd = -1;
+            inSpaces = 0;
+            continue;
+        }
+        int advance = ScreenAdvance(font, codepoint);
+        if ((codepoint==' ') || (codepoint=='\t')) {
+            if (!inSpaces) {
+                breakEnd = i;
+                breakWidth = width;
+                inSpaces = 1;
+            }
+            width += advance;
+            i += bytes;
+            resume = i;
+            resumeWidth = width;
+            continue;
+        }
+        inSpaces = 0;
+        if ((maxWidth > 0) && (width + advance > maxWidth) && (i > lineStart)) {
+            if (breakEnd > lineStart) {
+                // back to the last space run (a line can't start with one, so > not >=)
+                if (!AddLine(layout, lineStart, breakEnd, breakWidth)) return 0;
+                lineStart = resume;
+                width -= resumeWidth;
+            } else if ((breakEnd==lineStart) && (resume > lineStart)) {
+                // only spaces before this word, drop them
+                lineStart = resume;
+                width -= resumeWidth;
+            } else {
+                // one word wider than the box, cut it here
+                if (!AddLine(layout, lineStart, i, width)) return 0;
+                lineStart = i;
+                width = 0;
+            }
+            breakEnd = -1;
+            if (width + advance > maxWidth) continue; // still doesn't fit on the fresh line, go around again
+        }
+        width += advance;
+        i += bytes;
+    }
+    if (!AddLine(layout, lineStart, inSpaces ? breakEnd : (int)length, inSpaces ? breakWidth : width)) return 0;
+    return 1;
+}
+
+const TextLayout *LayoutText(LayoutCache *c, const ScreenFont *font, const char *text, int maxWidth)
+{
+    size_t length = strlen(text);
+    if (maxWidth < 0) maxWidth = 0;
+    if (length > LAYOUT_MAX_CACHED_TEXT) {
+        c->misses++;
+        return Break(font, &c->scratch, text, length, maxWidth) ? &c->scratch : NULL;
+    }
+
+    uint32_t hash = HashLayout(font->serial, text, length, maxWidth);
+    TextLayout *entry = &c->entries[hash%LAYOUT_CACHE_SIZE];
+    if ((entry->text!=NULL) && (entry->hash==hash) && (entry->font==font->serial) && (entry->max_width==maxWidth)
+        && (entry->length==length) && (memcmp(entry->text, text, length)==0)) {
+        c->hits++;
+        return entry;
+    }
+
+    c->misses++;
+    char *copy = realloc(entry->text, length + 1);
+    if (copy==NULL) return NULL;
+    memcpy(copy, text, length + 1);
+    entry->text = copy;
+    entry->hash = hash;
+    entry->font = font->serial;
+    entry->max_width = maxWidth;
+    entry->length = length;
+    if (!Break(font, entry, text, length, maxWidth)) {
+        FreeLayout(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+int LayoutHeight(const ScreenFont *font, int lines)
+{
+    return (lines > 0) ? (lines - 1)*font->line_spacing + font->height : 0;
+}
+
+int DrawLayout(Screen *s, const ScreenFont *font, const char *text, const TextLayout *layout, int x, int y, int maxHeight, uint8_t color)
+{
+    int drawn = 0;
+    for (int i = 0; i < layout->count; i++) {
+        if ((maxHeight >= 0) && (LayoutHeight(font, i + 1) > maxHeight)) break;
+        const TextLine *line = &layout->lines[i];
+        ScreenTextRange(s, font, text + line->start, (size_t)line->length, x, y + i*font->line_spacing, color);
+        drawn++;
+    }
+    return drawn;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "screen.h"
+
+// Word-wrapped text layout
+// Breaks text into lines no wider than a box in one pass over it: lines break at the
+// last run of spaces that fits, words too long for a line on their own get cut, and
+// '\n' always breaks. The result for the last few (text, width) pairs is kept around,
+// since dialogue boxes lay out the same string every frame. Entries remember the font too.
+
+#define LAYOUT_CACHE_SIZE 64        // direct mapped, a collision just replaces the old entry
+#define LAYOUT_MAX_CACHED_TEXT 4096 // longer texts get laid out every time
+
+typedef struct {
+    int start;          // byte offset into the text
+    int length;         // bytes, not counting the spaces or '\n' it broke at
+    int width;          // pixels
+} TextLine;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t font;      // serial of the font it was measured with
+    int max_width;      // what it was laid out for (0 = only break at '\n')
+    size_t length;
+    char *text;         // copy, for telling entries apart
+    TextLine *lines;
+    int count;
+    int capacity;
+    int width;          // widest line
+} TextLayout;
+
+typedef struct {
+    TextLayout entries[LAYOUT_CACHE_SIZE];
+    TextLayout scratch;             // for texts too long to cache
+    uint64_t hits, misses;
+} LayoutCache;
+
+void LayoutCacheInit(LayoutCache *c);
+void LayoutCacheClear(LayoutCache *c);
+// stays valid until the next LayoutText on the same cache, NULL if out of memory
+const TextLayout *LayoutText(LayoutCache *c, const ScreenFont *font, const char *text, int maxWidth);
+// draws as many whole lines as fit in maxHeight (below 0 = no limit), returns how many
+int DrawLayout(Screen *s, const ScreenFont *font, const char *text, const TextLayout *layout, int x, int y, int maxHeight, uint8_t color);
+int LayoutHeight(const ScreenFont *font, int lines);
@@ -0,0 +1,237 @@
+#include "thread.h"
+#include <stddef.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+    #include <limits.h>
+#elif !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    #include <pthread.h>
+    #include <stdlib.h>
+    #include <unistd.h>
+    #define HAVE_PTHREADS
+#endif
+
+#if defined(_WIN32)
+static DWORD WINAPI Trampoline(LPVOID arg)
+{
+    Thread *t = arg;
+    t->func(t->arg);
+    return 0;
+}
+
+int ThreadStart(Thread *t, ThreadFunc func, void *arg)
+{
+    t->func = func;
+    t->arg = arg;
+    t->handle = CreateThread(NULL, 0, Trampoline, t, 0, NULL);
+    return t->handle!=NULL;
+}
+
+void ThreadJoin(Thread *t)
+{
+    if (t->handle==NULL) return;
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    t->handle = NULL;
+}
+
+int SemaphoreInit(Semaphore *s)
+{
+    s->handle = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    return s->handle!=NULL;
+}
+
+void SemaphoreDestroy(Semaphore *s)
+{
+    if (s->handle!=NULL) CloseHandle(s->handle);
+    s->handle = NULL;
+}
+
+void SemaphorePost(Semaphore *s)
+{
+    ReleaseSemaphore(s->handle, 1, NULL);
+}
+
+void SemaphoreWait(Semaphore *s)
+{
+    WaitForSingleObject(s->handle, INFINITE);
+}
+#elif defined(HAVE_PTHREADS)
+static void *Trampoline(void *arg)
+{
+    Thread *t = arg;
+    t->func(t->arg);
+    return NULL;
+}
+
+int ThreadStart(Thread *t, ThreadFunc func, void *arg)
+{
+    t->func = func;
+    t->arg = arg;
+    pthread_t *handle = malloc(sizeof(pthread_t));
+    if (handle==NULL) return 0;
+    if (pthread_create(handle, NULL, Trampoline, t)!=0) {
+        free(handle);
+        t->handle = NULL;
+        return 0;
+    }
+    t->handle = handle;
+    return 1;
+}
+
+void ThreadJoin(Thread *t)
+{
+    if (t->handle==NULL) return;
+    pthread_join(*(pthread_t *)t->handle, NULL);
+    free(t->handle);
+    t->handle = NULL;
+}
+
+// (unnamed POSIX semaphores aren't there on macOS, so it's a count under a mutex)
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int count;
+} PosixSemaphore;
+
+int SemaphoreInit(Semaphore *s)
+{
+    PosixSemaphore *ps = malloc(sizeof(PosixSemaphore));
+    s->handle = ps;
+    if (ps==NULL) return 0;
+    ps->count = 0;
+    if (pthread_mutex_init(&ps->mutex, NULL)!=0) {
+        free(ps);
+        s->handle = NULL;
+        return 0;
+    }
+    if (pthread_cond_init(&ps->cond, NULL)!=0) {
+        pthread_mutex_destroy(&ps->mutex);
+        free(ps);
+        s->handle = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void SemaphoreDestroy(Semaphore *s)
+{
+    PosixSemaphore *ps = s->handle;
+    if (ps==NULL) return;
+    pthread_cond_destroy(&ps->cond);
+    pthread_mutex_destroy(&ps->mutex);
+    free(ps);
+    s->handle = NULL;
+}
+
+void SemaphorePost(Semaphore *s)
+{
+    PosixSemaphore *ps = s->handle;
+    pthread_mutex_lock(&ps->mutex);
+    ps->count++;
+    pthread_cond_signal(&ps->cond);
+    pthread_mutex_unlock(&ps->mutex);
+}
+
+void SemaphoreWait(Semaphore *s)
+{
+    PosixSemaphore *ps = s->handle;
+    pthread_mutex_lock(&ps->mutex);
+    while (ps->count==0) pthread_cond_wait(&ps->cond, &ps->mutex);
+    ps->count--;
+    pthread_mutex_unlock(&ps->mutex);
+}
+#else
+// the web build without pthreads: everyone does their own work
+int ThreadStart(Thread *t, ThreadFunc func, void *arg)
+{
+    t->handle = NULL;
+    t->func = func;
+    t->arg = arg;
+    return 0;
+}
+
+void ThreadJoin(Thread *t)
+{
+    (void)t;
+}
+
+int SemaphoreInit(Semaphore *s)
+{
+    s->handle = NULL;
+    return 0;
+}
+
+void SemaphoreDestroy(Semaphore *s) { (void)s; }
+void SemaphorePost(Semaphore *s) { (void)s; }
+void SemaphoreWait(Semaphore *s) { (void)s; }
+#endif
+
+int CoreCount(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+#elif defined(HAVE_PTHREADS)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+static void WorkerLoop(void *arg)
+{
+    Worker *w = arg;
+    for (;;) {
+        SemaphoreWait(&w->go);
+        if (AtomicLoad(&w->quit)) break;
+        w->job(w->arg);
+        SemaphorePost(&w->done);
+    }
+}
+
+int WorkerStart(Worker *w)
+{
+    w->quit = 0;
+    w->busy = 0;
+    if (!SemaphoreInit(&w->go)) return 0;
+    if (!SemaphoreInit(&w->done)) {
+        SemaphoreDestroy(&w->go);
+        return 0;
+    }
+    if (!ThreadStart(&w->thread, WorkerLoop, w)) {
+        SemaphoreDestroy(&w->go);
+        SemaphoreDestroy(&w->done);
+        return 0;
+    }
+    return 1;
+}
+
+void WorkerRun(Worker *w, ThreadFunc job, void *arg)
+{
+    w->job = job;
+    w->arg = arg;
+    w->busy = 1;
+    SemaphorePost(&w->go);
+}
+
+void WorkerWait(Worker *w)
+{
+    if (!w->busy) return;
+    SemaphoreWait(&w->done);
+    w->busy = 0;
+}
+
+void WorkerStop(Worker *w)
+{
+    if (w->thread.handle==NULL) return;
+    WorkerWait(w);
+    AtomicStore(&w->quit, 1);
+    SemaphorePost(&w->go);
+    ThreadJoin(&w->thread);
+    SemaphoreDestroy(&w->go);
+    SemaphoreDestroy(&w->done);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+
+// Threads and atomics
+// Just enough to run something on its own thread and pass counters back and forth.
+// (kept away from raylib.h like timer.c, windows.h and raylib.h don't get along)
+
+typedef void (*ThreadFunc)(void *arg);
+
+typedef struct {
+    void *handle;
+    ThreadFunc func;
+    void *arg;
+} Thread;
+
+// 0 if there's no thread (no threads on this platform, or making one failed), the
+// caller has to do the work itself then. t has to stay put until ThreadJoin.
+int ThreadStart(Thread *t, ThreadFunc func, void *arg);
+void ThreadJoin(Thread *t);
+
+// Counting semaphore, for when a thread has to really wait on another rather than poll
+typedef struct {
+    void *handle;
+} Semaphore;
+
+int SemaphoreInit(Semaphore *s);        // starts at 0; 0 if it couldn't (or there are no threads)
+void SemaphoreDestroy(Semaphore *s);
+void SemaphorePost(Semaphore *s);
+void SemaphoreWait(Semaphore *s);
+
+// A thread that runs one job at a time for whoever owns it. Everything the job touches
+// is the worker's between WorkerRun and WorkerWait, and the owner's again after.
+typedef struct {
+    Thread thread;
+    Semaphore go, done;
+    ThreadFunc job;
+    void *arg;
+    volatile uint32_t quit;
+    int busy;                   // (owner's side) started and not waited for yet
+} Worker;
+
+int WorkerStart(Worker *w);                             // 0 if there's no thread, the owner runs the jobs itself then
+void WorkerRun(Worker *w, ThreadFunc job, void *arg);   // returns straight away
+void WorkerWait(Worker *w);                             // until the job's done (straight away if there isn't one)
+void WorkerStop(Worker *w);                             // waits out the job first
+
+int CoreCount(void);    // cores this machine has to run threads on (1 if it can't tell)
+
+// Loads acquire, stores release, adds do both. Enough for one thread handing another
+// a slot index, which is all anything here does with them.
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    static inline uint32_t AtomicLoad(volatile uint32_t *p) { return (uint32_t)_InterlockedOr((volatile long *)p, 0); }
+    static inline void AtomicStore(volatile uint32_t *p, uint32_t v) { _InterlockedExchange((volatile long *)p, (long)v); }
+    static inline uint32_t AtomicAdd(volatile uint32_t *p, uint32_t v) { return (uint32_t)_InterlockedExchangeAdd((volatile long *)p, (long)v) + v; }
+#else
+    static inline uint32_t AtomicLoad(volatile uint32_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+    static inline void AtomicStore(volatile uint32_t *p, uint32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+    static inline uint32_t AtomicAdd(volatile uint32_t *p, uint32_t v) { return __atomic_add_fetch(p, v, __ATOMIC_ACQ_REL); }
+#endif
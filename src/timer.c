@@ -0,0 +1,45 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+    #define _POSIX_C_SOURCE 199309L // clock_gettime under -std=c99
+#endif
+#include "timer.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#elif defined(__EMSCRIPTEN__)
+    #include <emscripten.h>
+#else
+    #include <time.h>
+#endif
+
+double TimerNow(void)
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER now;
+    if (frequency.QuadPart==0) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart/(double)frequency.QuadPart;
+#elif defined(__EMSCRIPTEN__)
+    return emscripten_get_now()/1000.0;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec*1e-9;
+#endif
+}
+
+void TimerSleep(double seconds)
+{
+    if (seconds <= 0) return;
+#if defined(_WIN32)
+    Sleep((DWORD)(seconds*1000.0));
+#elif defined(__EMSCRIPTEN__)
+    (void)seconds; // can't block the browser's thread
+#else
+    struct timespec duration;
+    duration.tv_sec = (time_t)seconds;
+    duration.tv_nsec = (long)((seconds - (double)duration.tv_sec)*1e9);
+    nanosleep(&duration, NULL);
+#endif
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Monotonic clock
+// raylib's GetTime() only works once InitWindow has run, this works with or without one.
+// (kept away from raylib.h, windows.h and raylib.h don't get along)
+
+double TimerNow(void);      // seconds since some arbitrary point
+void TimerSleep(double seconds);  // at least this long, give or take the OS (does nothing on the web)
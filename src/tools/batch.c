@@ -0,0 +1,440 @@
+// Batch runner (nexus-batch)
+// Runs a manifest of jobs, each a cart with or without a replay for some frames, and
+// writes what came of each to a JSON lines file. Every job is its own windowless nexus
+// process (--headless --report), so a cart that crashes the engine, or hangs past
+// --timeout, takes down its own job and nothing else. A pool of threads, one per core
+// unless told otherwise, each starts a job and waits on it.
+//
+// Manifest: a job a line, blank lines and # comments skipped, paths can't have spaces
+// (and are as nexus sees them, run from src/ for its font)
+//   cart.rom [replay.nxrp | -] [frames] [golden.nxht]
+// frames 0 (or left out) plays a replay to its end; without a replay it's 600. With a
+// golden trace (from nexus --hashes) every frame's checked against it (--golden).
+// Jobs without a replay all get the same seed (--seed), so their hashes can be compared
+// run to run (as long as they don't look at epoch()).
+//
+// Output, in manifest order, one line a job:
+//   {"job": 3, "status": "ok", "seconds": 1.52, <nexus's report: cart, replay, seed,
+//    frames, hash, frame_ms, diverged, golden, error>}
+// status is ok, error (the cart errored, the report says what), mismatch (frames didn't
+// match the golden trace), crashed, timeout or failed (nexus wouldn't start, or left no
+// report); those last three only get cart, replay and error. The exit code is 1 if any
+// job wasn't ok. A manifest with no jobs in it gets an empty results file and exits 0.
+//
+// Usage: nexus-batch manifest.txt [--out results.jsonl] [--jobs N] [--nexus path]
+//                    [--timeout seconds] [--seed N] [-- more nexus options]
+// Build with `make tools` in src/ (POSIX and Windows, not the web).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../thread.h"
+#include "../timer.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <sys/wait.h>
+#endif
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_TIMEOUT 300         // seconds
+#define DEFAULT_SEED 0x4E585553     // same as --bench
+#define MAX_ARGS 64
+
+typedef enum {
+    JOB_OK = 0,
+    JOB_ERROR,
+    JOB_CRASHED,
+    JOB_TIMEOUT,
+    JOB_FAILED,
+    JOB_MISMATCH,
+} JobStatus;
+
+static const char *statusNames[] = { "ok", "error", "crashed", "timeout", "failed", "mismatch" };
+
+typedef struct {
+    int line;                   // in the manifest
+    char *cart;
+    char *replay;               // NULL for none
+    int frames;
+    char *golden;               // NULL for none
+    // filled in by whoever runs it
+    JobStatus status;
+    char *report;               // nexus's line, NULL if it didn't leave one
+    char detail[128];           // what went wrong, when there's no report to say
+    double seconds;
+} Job;
+
+typedef struct {
+    Job *jobs;
+    int count;
+    volatile uint32_t next;     // next job nobody's taken
+    Semaphore done;             // a post per finished job
+    volatile uint32_t *finished; // per job, set once it's all filled in
+    const char *nexus;
+    const char *out;
+    int timeout;
+    uint32_t seed;
+    char **extra;               // passed through to nexus
+    int extra_count;
+} Batch;
+
+//----------------------------------------------------------------------------------
+// Running one
+//----------------------------------------------------------------------------------
+#if defined(_WIN32)
+// CreateProcess wants one command line, quoted the way the C runtime unquotes it
+static void AppendQuoted(char *cmd, size_t size, const char *arg)
+{
+    size_t at = strlen(cmd);
+    if ((at > 0) && (at + 1 < size)) cmd[at++] = ' ';
+    if (at + 1 < size) cmd[at++] = '"';
+    for (const char *p = arg; *p && (at + 3 < size); p++) {
+        int slashes = 0;
+        while (*p=='\\') { slashes++; p++; }
+        // backslashes only need doubling in front of a quote (or the closing one)
+        int doubled = (*p=='"') || (*p=='\0');
+        for (int i = 0; (i < slashes*(doubled ? 2 : 1)) && (at + 3 < size); i++) cmd[at++] = '\\';
+        if (*p=='\0') break;
+        if (*p=='"') cmd[at++] = '\\';
+        cmd[at++] = *p;
+    }
+    if (at + 1 < size) cmd[at++] = '"';
+    cmd[at] = '\0';
+}
+
+static void Spawn(Job *job, char **args, int timeout)
+{
+    char cmd[8192] = "";
+    for (int i = 0; args[i]!=NULL; i++) AppendQuoted(cmd, sizeof(cmd), args[i]);
+    SECURITY_ATTRIBUTES inherit = { sizeof(inherit), NULL, TRUE };
+    HANDLE null = CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_WRITE, &inherit, OPEN_EXISTING, 0, NULL);
+    STARTUPINFOA si;
+    memset(&si, 0, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = null;
+    si.hStdOutput = null;
+    si.hStdError = null;
+    PROCESS_INFORMATION pi;
+    if (!CreateProcessA(NULL, cmd, NULL, NULL, TRUE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
+        job->status = JOB_FAILED;
+        snprintf(job->detail, sizeof(job->detail), "can't start %s (error %lu)", args[0], (unsigned long)GetLastError());
+        if (null!=INVALID_HANDLE_VALUE) CloseHandle(null);
+        return;
+    }
+    if (WaitForSingleObject(pi.hProcess, (timeout > 0) ? (DWORD)timeout*1000 : INFINITE)==WAIT_TIMEOUT) {
+        TerminateProcess(pi.hProcess, 1);
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        job->status = JOB_TIMEOUT;
+        snprintf(job->detail, sizeof(job->detail), "still running after %d seconds", timeout);
+    } else {
+        DWORD code = 0;
+        GetExitCodeProcess(pi.hProcess, &code);
+        // exceptions (access violations, stack overflows...) come back as NTSTATUS codes
+        if (code >= 0xC0000000u) {
+            job->status = JOB_CRASHED;
+            snprintf(job->detail, sizeof(job->detail), "crashed with exception 0x%08lx", (unsigned long)code);
+        } else {
+            job->status = (code==0) ? JOB_OK : JOB_ERROR;
+        }
+    }
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    if (null!=INVALID_HANDLE_VALUE) CloseHandle(null);
+}
+#else
+static void Spawn(Job *job, char **args, int timeout)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        job->status = JOB_FAILED;
+        snprintf(job->detail, sizeof(job->detail), "can't fork");
+        return;
+    }
+    if (pid==0) {
+        // only async-signal-safe calls from here to the exec (the parent has threads)
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) {
+            dup2(null, 0);
+            dup2(null, 1);
+            dup2(null, 2);
+        }
+        if (timeout > 0) alarm((unsigned)timeout); // lasts through the exec, and SIGALRM kills
+        execv(args[0], args);
+        _exit(127);
+    }
+    int status = 0;
+    while ((waitpid(pid, &status, 0) < 0)) {} // (EINTR)
+    if (WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        job->status = (sig==SIGALRM) ? JOB_TIMEOUT : JOB_CRASHED;
+        if (sig==SIGALRM) snprintf(job->detail, sizeof(job->detail), "still running after %d seconds", timeout);
+        else snprintf(job->detail, sizeof(job->detail), "killed by signal %d", sig);
+    } else if (WEXITSTATUS(status)==127) {
+        job->status = JOB_FAILED;
+        snprintf(job->detail, sizeof(job->detail), "can't run %s", args[0]);
+    } else {
+        job->status = (WEXITSTATUS(status)==0) ? JOB_OK : JOB_ERROR;
+    }
+}
+#endif
+
+// the whole file, minus the trailing newline; NULL if there's nothing that looks like a report
+static char *ReadReport(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f==NULL) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = (size > 0) ? malloc((size_t)size + 1) : NULL;
+    if ((text!=NULL) && (fread(text, 1, (size_t)size, f)!=(size_t)size)) {
+        free(text);
+        text = NULL;
+    }
+    fclose(f);
+    if (text==NULL) return NULL;
+    text[size] = '\0';
+    while ((size > 0) && isspace((unsigned char)text[size - 1])) text[--size] = '\0';
+    if ((text[0]!='{') || (text[size - 1]!='}')) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static void RunJob(Batch *b, int index)
+{
+    Job *job = &b->jobs[index];
+    char reportPath[1024], seed[16], frames[16];
+    snprintf(reportPath, sizeof(reportPath), "%s.%d.tmp", b->out, index);
+    snprintf(seed, sizeof(seed), "%u", b->seed);
+    snprintf(frames, sizeof(frames), "%d", job->frames);
+    remove(reportPath);
+
+    char *args[MAX_ARGS];
+    int n = 0;
+    args[n++] = (char *)b->nexus;
+    args[n++] = "--headless";
+    args[n++] = "--audio";
+    args[n++] = "off";
+    args[n++] = "--report";
+    args[n++] = reportPath;
+    if (job->replay!=NULL) {
+        args[n++] = "--replay";
+        args[n++] = job->replay;
+    } else {
+        args[n++] = "--seed";
+        args[n++] = seed;
+    }
+    if (job->frames > 0) {
+        args[n++] = "--frames";
+        args[n++] = frames;
+    }
+    if (job->golden!=NULL) {
+        args[n++] = "--golden";
+        args[n++] = job->golden;
+    }
+    for (int i = 0; (i < b->extra_count) && (n < MAX_ARGS - 2); i++) args[n++] = b->extra[i];
+    args[n++] = job->cart;
+    args[n] = NULL;
+
+    double start = TimerNow();
+    Spawn(job, args, b->timeout);
+    job->seconds = TimerNow() - start;
+    job->report = ReadReport(reportPath);
+    remove(reportPath);
+    // ok or error is only what nexus said; without its report there's nothing to go on
+    if ((job->report==NULL) && (job->status <= JOB_ERROR)) {
+        job->status = JOB_FAILED;
+        snprintf(job->detail, sizeof(job->detail), "nexus left no report");
+    }
+    const char *differ = (job->report!=NULL) ? strstr(job->report, "\"frames_differ\": ") : NULL;
+    if ((job->status==JOB_OK) && (differ!=NULL) && (atoi(differ + 17) > 0)) job->status = JOB_MISMATCH;
+}
+
+static void Work(void *arg)
+{
+    Batch *b = arg;
+    for (;;) {
+        uint32_t index = AtomicAdd(&b->next, 1) - 1;
+        if (index >= (uint32_t)b->count) break;
+        RunJob(b, (int)index);
+        AtomicStore(&b->finished[index], 1);
+        SemaphorePost(&b->done);
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Manifest and results
+//----------------------------------------------------------------------------------
+static char *Copy(const char *s)
+{
+    size_t length = strlen(s);
+    char *copy = malloc(length + 1);
+    if (copy!=NULL) memcpy(copy, s, length + 1);
+    return copy;
+}
+
+// 0 if it can't be opened; one with no jobs in it is fine (*jobs NULL, *count 0)
+static int LoadManifest(const char *path, Job **loaded, int *count)
+{
+    FILE *f = fopen(path, "r");
+    if (f==NULL) return 0;
+    Job *jobs = NULL;
+    int capacity = 0;
+    *count = 0;
+    char line[4096];
+    for (int number = 1; fgets(line, sizeof(line), f)!=NULL; number++) {
+        char *hash = strchr(line, '#');
+        if (hash!=NULL) *hash = '\0';
+        char *cart = strtok(line, " \t\r\n");
+        if (cart==NULL) continue;
+        char *replay = strtok(NULL, " \t\r\n");
+        char *frames = strtok(NULL, " \t\r\n");
+        char *golden = strtok(NULL, " \t\r\n");
+        if ((replay!=NULL) && (strcmp(replay, "-")==0)) replay = NULL;
+        if (*count==capacity) {
+            capacity = capacity ? capacity*2 : 256;
+            Job *grown = realloc(jobs, (size_t)capacity*sizeof(Job));
+            if (grown==NULL) break;
+            jobs = grown;
+        }
+        Job *job = &jobs[(*count)++];
+        memset(job, 0, sizeof(Job));
+        job->line = number;
+        job->cart = Copy(cart);
+        job->replay = (replay!=NULL) ? Copy(replay) : NULL;
+        job->frames = (frames!=NULL) ? atoi(frames) : 0;
+        if ((job->frames <= 0) && (replay==NULL)) job->frames = DEFAULT_FRAMES;
+        job->golden = (golden!=NULL) ? Copy(golden) : NULL;
+    }
+    fclose(f);
+    *loaded = jobs;
+    return 1;
+}
+
+static void WriteJSONString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if ((c=='"') || (c=='\\')) fprintf(f, "\\%c", c);
+        else if (c=='\n') fputs("\\n", f);
+        else if (c=='\t') fputs("\\t", f);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void WriteResult(FILE *f, int index, const Job *job)
+{
+    fprintf(f, "{\"job\": %d, \"status\": \"%s\", \"seconds\": %.3f", index, statusNames[job->status], job->seconds);
+    if (job->report!=NULL) {
+        fprintf(f, ", %s\n", job->report + 1); // the report's an object too, so it just carries on this one
+        return;
+    }
+    fprintf(f, ", \"cart\": ");
+    WriteJSONString(f, job->cart);
+    fprintf(f, ", \"replay\": ");
+    if (job->replay!=NULL) WriteJSONString(f, job->replay);
+    else fprintf(f, "null");
+    fprintf(f, ", \"error\": ");
+    WriteJSONString(f, job->detail);
+    fprintf(f, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *manifest = NULL;
+    Batch b;
+    memset(&b, 0, sizeof(b));
+    b.nexus = "./nexus";
+#if defined(_WIN32)
+    b.nexus = "nexus.exe";
+#endif
+    b.out = "results.jsonl";
+    b.timeout = DEFAULT_TIMEOUT;
+    b.seed = DEFAULT_SEED;
+    int threads = CoreCount();
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--out")==0) && (i + 1 < argc)) b.out = argv[++i];
+        else if ((strcmp(argv[i], "--jobs")==0) && (i + 1 < argc)) threads = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--nexus")==0) && (i + 1 < argc)) b.nexus = argv[++i];
+        else if ((strcmp(argv[i], "--timeout")==0) && (i + 1 < argc)) b.timeout = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--seed")==0) && (i + 1 < argc)) b.seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--")==0) {
+            b.extra = argv + i + 1;
+            b.extra_count = argc - i - 1;
+            break;
+        }
+        else if (manifest==NULL) manifest = argv[i];
+        else fprintf(stderr, "ignoring %s\n", argv[i]);
+    }
+    if (manifest==NULL) {
+        fprintf(stderr, "usage: nexus-batch manifest.txt [--out results.jsonl] [--jobs N] [--nexus path] [--timeout seconds] [--seed N] [-- nexus options]\n");
+        return 1;
+    }
+    if (!LoadManifest(manifest, &b.jobs, &b.count)) {
+        fprintf(stderr, "can't read %s\n", manifest);
+        return 1;
+    }
+    FILE *out = fopen(b.out, "w");
+    if (out==NULL) {
+        fprintf(stderr, "can't write %s\n", b.out);
+        return 1;
+    }
+    b.finished = calloc((size_t)b.count + 1, sizeof(uint32_t));
+    if (threads < 1) threads = 1;
+    if (threads > b.count) threads = (b.count > 0) ? b.count : 1;
+    printf("%d jobs from %s on %d threads, results to %s\n", b.count, manifest, threads, b.out);
+
+    // the pool; without threads (or a semaphore to hear back on) this thread does the lot
+    Thread *pool = calloc((size_t)threads, sizeof(Thread));
+    int started = 0;
+    if (SemaphoreInit(&b.done)) {
+        while ((started < threads) && ThreadStart(&pool[started], Work, &b)) started++;
+        if (started==0) SemaphoreDestroy(&b.done);
+    }
+    int counts[6] = { 0 };
+    double start = TimerNow();
+    for (int written = 0; written < b.count;) {
+        if (started > 0) SemaphoreWait(&b.done);
+        else Work(&b);
+        // results go out in manifest order, as soon as everything before them's done
+        while ((written < b.count) && AtomicLoad(&b.finished[written])) {
+            Job *job = &b.jobs[written];
+            WriteResult(out, written, job);
+            fflush(out);
+            counts[job->status]++;
+            if (job->status!=JOB_OK) printf("line %d: %s %s%s%s\n", job->line, statusNames[job->status], job->cart,
+                (job->replay!=NULL) ? " " : "", (job->replay!=NULL) ? job->replay : "");
+            free(job->report);
+            job->report = NULL;
+            written++;
+        }
+    }
+    for (int i = 0; i < started; i++) ThreadJoin(&pool[i]);
+    if (started > 0) SemaphoreDestroy(&b.done);
+    fclose(out);
+
+    printf("%d ok, %d errored, %d mismatched, %d crashed, %d timed out, %d failed in %.1f s\n", counts[JOB_OK], counts[JOB_ERROR],
+        counts[JOB_MISMATCH], counts[JOB_CRASHED], counts[JOB_TIMEOUT], counts[JOB_FAILED], TimerNow() - start);
+    for (int i = 0; i < b.count; i++) {
+        free(b.jobs[i].cart);
+        free(b.jobs[i].replay);
+        free(b.jobs[i].golden);
+    }
+    free(b.jobs);
+    free((void *)b.finished);
+    free(pool);
+    return (counts[JOB_OK]==b.count) ? 0 : 1;
+}
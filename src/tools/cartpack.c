@@ -0,0 +1,387 @@
+// Cart packer
+// Turns a .lua file into a .rom: the code goes in a CODE chunk, and directives in
+// comments at the top pull in everything else (paths are relative to the .lua file):
+//   --! grph ID path.png     graphics page, converted to the nearest palette colors
+//   --! bin ID path          raw resource for get_resource(ID)
+//   --! snd ID path          sound for sfx(ID), stored as is (WAV, OGG, MP3, FLAC)
+//   --! music ID path        music for music(ID), stored as is (OGG, or 16 bit WAV) and streamed
+//   --! song ID path.song    chiptune song for song(ID), see below
+//   --! font ID path.png [first [spacing]]
+//                            raylib-style font image for font(ID), packed 1 bit per pixel;
+//                            glyphs start at codepoint first (32), lines are spacing apart
+//                            (height + 1)
+//   --! meta key=value       cart metadata, e.g. memlimit=16M
+// Usage: cartpack cart.lua cart.rom
+//
+// Songs are text, one command a line, # starts a comment:
+//   channels 4           voices the song uses, up to 8 (before any pattern)
+//   rows 16              rows per pattern (before any pattern)
+//   speed 6              ticks per row, there are 60 ticks a second
+//   instrument 0 square vol=200 duty=128 a=5 d=80 s=128 r=120
+//                        wave is square, triangle, saw, sine or noise; vol, duty and s
+//                        (sustain) go to 255, a/d/r are milliseconds
+//   order 0 0 1          patterns in the order they play
+//   pattern 0            followed by its rows, one a line: a cell per channel, each
+//                        C-4 (note, instrument as last time on that channel), C#4:1 (and
+//                        instrument 1), === (release) or ... (nothing); | is ignored
+// Build with `make tools` in src/.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "../eightbitcolor.h"
+#include "../screen.h"
+#include "../synth.h"
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static void Append(Buffer *b, const void *data, size_t size)
+{
+    if (b->size + size > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while (capacity < b->size + size) capacity *= 2;
+        b->data = realloc(b->data, capacity);
+        if (b->data==NULL) {
+            fprintf(stderr, "cartpack: out of memory\n");
+            exit(1);
+        }
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void AppendU32(Buffer *b, uint32_t v)
+{
+    unsigned char bytes[4] = { v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, (v >> 24) & 0xFF };
+    Append(b, bytes, 4);
+}
+
+// chunk header, then whatever the caller appends, then Pad()
+static void Pad(Buffer *b)
+{
+    if (b->size & 1) Append(b, "", 1);
+}
+
+static void Chunk(Buffer *b, const char *type, const void *head, size_t headSize, const void *data, size_t size)
+{
+    Append(b, type, 4);
+    AppendU32(b, (uint32_t)(headSize + size));
+    if (headSize) Append(b, head, headSize);
+    if (size) Append(b, data, size);
+    Pad(b);
+}
+
+static int AddGraphics(Buffer *b, uint32_t id, const char *path)
+{
+    Image img = LoadImage(path);
+    if (img.data==NULL) return 0;
+    ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    size_t pixels = (size_t)img.width*img.height;
+    unsigned char *indices = malloc(pixels ? pixels : 1);
+    const Color *rgba = img.data;
+    uint8_t magenta = eightbitcolor_nearest((Color){255,0,255,255});
+    for (size_t i = 0; i < pixels; i++) indices[i] = (rgba[i].a < 128) ? magenta : eightbitcolor_nearest(rgba[i]);
+    unsigned char head[12];
+    uint32_t fields[3] = { id, (uint32_t)img.width, (uint32_t)img.height };
+    for (int i = 0; i < 12; i++) head[i] = (fields[i/4] >> ((i%4)*8)) & 0xFF;
+    Chunk(b, "GRPH", head, sizeof(head), indices, pixels);
+    free(indices);
+    UnloadImage(img);
+    return 1;
+}
+
+static int AddFont(Buffer *b, uint32_t id, const char *path, int first, int spacing)
+{
+    Image img = LoadImage(path);
+    if (img.data==NULL) return 0;
+    ImageFormat(&img, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    ScreenFont font;
+    int ok = LoadScreenFont(&font, img.data, img.width, img.height, first, spacing);
+    UnloadImage(img);
+    if (!ok) return 0;
+    if (spacing <= 0) font.line_spacing = font.height + 1;
+    size_t size = PackScreenFont(&font, NULL);
+    unsigned char *packed = malloc(size);
+    PackScreenFont(&font, packed);
+    unsigned char head[4] = { id & 0xFF, (id >> 8) & 0xFF, (id >> 16) & 0xFF, (id >> 24) & 0xFF };
+    Chunk(b, "FONT", head, sizeof(head), packed, size);
+    free(packed);
+    UnloadScreenFont(&font);
+    return 1;
+}
+
+static int ParseNote(const char *token, int *note, int *instrument)
+{
+    static const int semitones[7] = { 9, 11, 0, 2, 4, 5, 7 }; // A B C D E F G
+    if ((token[0] < 'A') || (token[0] > 'G')) return 0;
+    int n = semitones[token[0] - 'A'];
+    if (token[1]=='#') n++;
+    else if (token[1]!='-') return 0;
+    char *end = NULL;
+    long octave = strtol(token + 2, &end, 10);
+    if ((end==token + 2) || (octave < 0) || (octave > 9)) return 0;
+    n += (int)(octave + 1)*12;
+    if (n > 127) return 0;
+    *note = n;
+    if (*end==':') {
+        *instrument = (int)strtol(end + 1, &end, 10);
+        if ((*instrument < 0) || (*instrument > 255)) return 0;
+    }
+    return *end=='\0';
+}
+
+static int AddSong(Buffer *b, uint32_t id, const char *path)
+{
+    char *text = LoadFileText(path);
+    if (text==NULL) {
+        fprintf(stderr, "cartpack: can't read %s\n", path);
+        return 0;
+    }
+    SynthInstrument instruments[256];
+    uint8_t orders[256];
+    SynthCell *patterns[256] = { 0 };
+    int instrumentCount = 0, patternCount = 0, orderCount = 0;
+    int channels = 4, rows = 32, speed = 6;
+    int pattern = -1, row = 0;
+    int lastInstrument[SYNTH_VOICES] = { 0 };
+    int ok = 1;
+    int lineNumber = 0;
+    for (char *line = strtok(text, "\n"); ok && (line!=NULL); line = strtok(NULL, "\n")) {
+        lineNumber++;
+        char *tokens[64];
+        int count = 0;
+        for (char *t = line; *t && (count < 64); ) {
+            while (*t && strchr(" \t\r", *t)) *t++ = '\0';
+            if ((*t=='\0') || (*t=='#')) break;
+            if (*t!='|') tokens[count++] = t;
+            while (*t && !strchr(" \t\r", *t)) t++;
+        }
+        if (count==0) continue;
+        #define FAIL(...) do { fprintf(stderr, "cartpack: %s:%d: ", path, lineNumber); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); ok = 0; } while (0)
+        if ((strcmp(tokens[0], "channels")==0) || (strcmp(tokens[0], "rows")==0) || (strcmp(tokens[0], "speed")==0)) {
+            int value = (count==2) ? atoi(tokens[1]) : 0;
+            if (tokens[0][0]=='s') {
+                if ((value < 1) || (value > 255)) FAIL("speed goes from 1 to 255");
+                speed = value;
+            } else if (patternCount > 0) {
+                FAIL("%s has to come before the patterns", tokens[0]);
+            } else if (tokens[0][0]=='c') {
+                if ((value < 1) || (value > SYNTH_VOICES)) FAIL("channels goes from 1 to %d", SYNTH_VOICES);
+                channels = value;
+            } else {
+                if ((value < 1) || (value > 255)) FAIL("rows goes from 1 to 255");
+                rows = value;
+            }
+        } else if (strcmp(tokens[0], "instrument")==0) {
+            static const char *waves[SYNTH_WAVES] = { "square", "triangle", "saw", "sine", "noise" };
+            int index = (count >= 3) ? atoi(tokens[1]) : -1;
+            if ((index < 0) || (index > 255)) {
+                FAIL("instrument needs a number (0-255) and a wave");
+                break;
+            }
+            while (instrumentCount <= index) instruments[instrumentCount++] = (SynthInstrument){ SYNTH_SQUARE, 255, 128, 255, 0, 0, 0 };
+            SynthInstrument *inst = &instruments[index];
+            int wave = 0;
+            while ((wave < SYNTH_WAVES) && (strcmp(tokens[2], waves[wave])!=0)) wave++;
+            if (wave==SYNTH_WAVES) FAIL("no such wave %s", tokens[2]);
+            inst->wave = (uint8_t)wave;
+            for (int i = 3; i < count; i++) {
+                char *eq = strchr(tokens[i], '=');
+                int value = eq ? atoi(eq + 1) : -1;
+                if (eq) *eq = '\0';
+                if ((value < 0) || (value > 65535)) FAIL("bad setting %s", tokens[i]);
+                else if ((strcmp(tokens[i], "vol")==0) && (value < 256)) inst->volume = (uint8_t)value;
+                else if ((strcmp(tokens[i], "duty")==0) && (value < 256)) inst->duty = (uint8_t)value;
+                else if ((strcmp(tokens[i], "s")==0) && (value < 256)) inst->sustain = (uint8_t)value;
+                else if (strcmp(tokens[i], "a")==0) inst->attack = (uint16_t)value;
+                else if (strcmp(tokens[i], "d")==0) inst->decay = (uint16_t)value;
+                else if (strcmp(tokens[i], "r")==0) inst->release = (uint16_t)value;
+                else FAIL("bad setting %s", tokens[i]);
+            }
+        } else if (strcmp(tokens[0], "order")==0) {
+            for (int i = 1; ok && (i < count); i++) {
+                int index = atoi(tokens[i]);
+                if ((index < 0) || (index > 255) || (orderCount==255)) FAIL("orders are patterns 0-255, 255 of them at most");
+                else orders[orderCount++] = (uint8_t)index;
+            }
+        } else if (strcmp(tokens[0], "pattern")==0) {
+            pattern = (count==2) ? atoi(tokens[1]) : -1;
+            if ((pattern < 0) || (pattern > 254)) {
+                FAIL("pattern needs a number (0-254)");
+                break;
+            }
+            if (patterns[pattern]!=NULL) FAIL("pattern %d again", pattern);
+            patterns[pattern] = calloc((size_t)rows*channels, sizeof(SynthCell));
+            if (pattern >= patternCount) patternCount = pattern + 1;
+            row = 0;
+            memset(lastInstrument, 0, sizeof(lastInstrument));
+        } else if (pattern >= 0) {
+            if (count!=channels) FAIL("a row needs %d cells, this one has %d", channels, count);
+            else if (row >= rows) FAIL("pattern %d has more than %d rows", pattern, rows);
+            for (int ch = 0; ok && (ch < channels); ch++) {
+                SynthCell *cell = &patterns[pattern][row*channels + ch];
+                int note = 0;
+                if (strcmp(tokens[ch], "...")==0) continue;
+                if (strcmp(tokens[ch], "===")==0) {
+                    cell->note = SYNTH_NOTE_OFF;
+                } else if (ParseNote(tokens[ch], &note, &lastInstrument[ch])) {
+                    cell->note = (uint8_t)note;
+                    cell->instrument = (uint8_t)lastInstrument[ch];
+                } else {
+                    FAIL("can't read note %s", tokens[ch]);
+                }
+            }
+            row++;
+        } else {
+            FAIL("don't know what to do with %s", tokens[0]);
+        }
+        #undef FAIL
+    }
+    UnloadFileText(text);
+
+    if (ok && ((patternCount==0) || (orderCount==0) || (instrumentCount==0))) {
+        fprintf(stderr, "cartpack: %s needs at least an instrument, a pattern and an order\n", path);
+        ok = 0;
+    }
+    SynthSong song = { channels, speed, rows, instrumentCount, patternCount, orderCount, instruments, orders, NULL };
+    if (ok) {
+        for (int i = 0; i < orderCount; i++) {
+            if (orders[i] >= patternCount) {
+                fprintf(stderr, "cartpack: %s plays pattern %d, which isn't there\n", path, orders[i]);
+                ok = 0;
+            }
+        }
+        song.cells = calloc((size_t)patternCount*rows*channels, sizeof(SynthCell));
+        for (int p = 0; ok && (p < patternCount); p++) {
+            if (patterns[p]!=NULL) memcpy(song.cells + (size_t)p*rows*channels, patterns[p], (size_t)rows*channels*sizeof(SynthCell));
+        }
+        for (size_t i = 0; ok && (i < (size_t)patternCount*rows*channels); i++) {
+            if ((song.cells[i].note!=0) && (song.cells[i].note!=SYNTH_NOTE_OFF) && (song.cells[i].instrument >= instrumentCount)) {
+                fprintf(stderr, "cartpack: %s uses instrument %d, which isn't there\n", path, song.cells[i].instrument);
+                ok = 0;
+            }
+        }
+    }
+    if (ok) {
+        size_t size = PackSynthSong(&song, NULL);
+        unsigned char *packed = malloc(size);
+        PackSynthSong(&song, packed);
+        unsigned char head[4] = { id & 0xFF, (id >> 8) & 0xFF, (id >> 16) & 0xFF, (id >> 24) & 0xFF };
+        Chunk(b, "SONG", head, sizeof(head), packed, size);
+        free(packed);
+    }
+    free(song.cells);
+    for (int p = 0; p < 256; p++) free(patterns[p]);
+    return ok;
+}
+
+static int AddBinary(Buffer *b, const char *type, uint32_t id, const char *path)
+{
+    int size = 0;
+    unsigned char *data = LoadFileData(path, &size);
+    if (data==NULL) return 0;
+    unsigned char head[4] = { id & 0xFF, (id >> 8) & 0xFF, (id >> 16) & 0xFF, (id >> 24) & 0xFF };
+    Chunk(b, type, head, sizeof(head), data, (size_t)size);
+    UnloadFileData(data);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc!=3) {
+        fprintf(stderr, "usage: cartpack cart.lua cart.rom\n");
+        return 1;
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    eightbitcolor_init();
+
+    char *code = LoadFileText(argv[1]);
+    if (code==NULL) {
+        fprintf(stderr, "cartpack: can't read %s\n", argv[1]);
+        return 1;
+    }
+    const char *dir = GetDirectoryPath(argv[1]);
+    char base[4096];
+    snprintf(base, sizeof(base), "%s", dir);
+
+    Buffer chunks = { 0 };
+    Buffer meta = { 0 };
+    Chunk(&chunks, "CODE", NULL, 0, code, strlen(code));
+
+    int failed = 0;
+    for (const char *line = code; *line; ) {
+        const char *end = strchr(line, '\n');
+        size_t length = end ? (size_t)(end - line) : strlen(line);
+        if ((length > 4) && (strncmp(line, "--! ", 4)==0)) {
+            char directive[4096];
+            snprintf(directive, sizeof(directive), "%.*s", (int)(length - 4), line + 4);
+            directive[strcspn(directive, "\r")] = '\0';
+            char kind[16] = { 0 };
+            unsigned int id = 0;
+            char file[2048] = { 0 };
+            char path[8192];
+            if ((sscanf(directive, "%15s %u %2047[^\n]", kind, &id, file)==3) && (strcmp(kind, "grph")==0 || strcmp(kind, "bin")==0 || strcmp(kind, "snd")==0 || strcmp(kind, "music")==0)) {
+                snprintf(path, sizeof(path), "%s/%s", base, file);
+                int ok = 0;
+                if (kind[0]=='g') ok = AddGraphics(&chunks, id, path);
+                else ok = AddBinary(&chunks, (kind[0]=='s') ? "SND " : ((kind[0]=='m') ? "MUS " : "BIN "), id, path);
+                if (!ok) {
+                    fprintf(stderr, "cartpack: can't load %s\n", path);
+                    failed = 1;
+                }
+            } else if ((sscanf(directive, "%15s %u %2047[^\n]", kind, &id, file)==3) && (strcmp(kind, "song")==0)) {
+                snprintf(path, sizeof(path), "%s/%s", base, file);
+                if (!AddSong(&chunks, id, path)) failed = 1;
+            } else if (strncmp(directive, "font ", 5)==0) {
+                int first = 32;
+                int spacing = 0;
+                if (sscanf(directive, "font %u %2047s %d %d", &id, file, &first, &spacing) < 2) {
+                    fprintf(stderr, "cartpack: \"--! %s\" needs an id and a path\n", directive);
+                    failed = 1;
+                } else {
+                    snprintf(path, sizeof(path), "%s/%s", base, file);
+                    if (!AddFont(&chunks, id, path, first, spacing)) {
+                        fprintf(stderr, "cartpack: can't load a font from %s\n", path);
+                        failed = 1;
+                    }
+                }
+            } else if (strncmp(directive, "meta ", 5)==0) {
+                Append(&meta, directive + 5, strlen(directive + 5));
+                Append(&meta, "\n", 1);
+            } else {
+                fprintf(stderr, "cartpack: don't know what to do with \"--! %s\"\n", directive);
+                failed = 1;
+            }
+        } else if ((length > 0) && (strncmp(line, "--", 2)!=0)) {
+            break; // directives only count in the header
+        }
+        if (end==NULL) break;
+        line = end + 1;
+    }
+    if (meta.size) Chunk(&chunks, "META", NULL, 0, meta.data, meta.size);
+    UnloadFileText(code);
+    if (failed) return 1;
+
+    FILE *f = fopen(argv[2], "wb");
+    if (f==NULL) {
+        fprintf(stderr, "cartpack: can't write %s\n", argv[2]);
+        return 1;
+    }
+    Buffer header = { 0 };
+    Append(&header, "RIFF", 4);
+    AppendU32(&header, (uint32_t)(4 + chunks.size));
+    Append(&header, "NXSR", 4);
+    fwrite(header.data, 1, header.size, f);
+    fwrite(chunks.data, 1, chunks.size, f);
+    fclose(f);
+    free(header.data);
+    free(chunks.data);
+    free(meta.data);
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Frame hash trace compare (tracecmp)
+// Compares two traces written by nexus --hashes, frame by frame: how long each is, the
+// first frame they disagree on and every run of frames that differ after it. Traces only
+// hold hashes, so to see what a frame looked like, play the same cart and replay again
+// with the other trace as the golden one: nexus --golden b.nxht --diff-dir out/ ...
+// saves the frames that don't match as PNGs.
+// The exit code is 0 if they're the same, 1 if not, 2 if one couldn't be read.
+// Usage: tracecmp a.nxht b.nxht [--ranges N]   (N runs listed at most, 20)
+// Build with `make tools` in src/.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../hashtrace.h"
+
+#define DEFAULT_RANGES 20
+
+int main(int argc, char **argv)
+{
+    const char *paths[2] = { NULL, NULL };
+    int maxRanges = DEFAULT_RANGES;
+    int pathCount = 0;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--ranges")==0) && (i + 1 < argc)) maxRanges = atoi(argv[++i]);
+        else if (pathCount < 2) paths[pathCount++] = argv[i];
+        else fprintf(stderr, "ignoring %s\n", argv[i]);
+    }
+    if (pathCount < 2) {
+        fprintf(stderr, "usage: tracecmp a.nxht b.nxht [--ranges N]\n");
+        return 2;
+    }
+    uint64_t *traces[2];
+    size_t counts[2];
+    for (int t = 0; t < 2; t++) {
+        traces[t] = LoadHashTrace(paths[t], &counts[t]);
+        if (traces[t]==NULL) {
+            fprintf(stderr, "can't read %s (not there, or not a frame hash trace)\n", paths[t]);
+            return 2;
+        }
+    }
+
+    printf("%s: %zu frames\n%s: %zu frames\n", paths[0], counts[0], paths[1], counts[1]);
+    size_t common = (counts[0] < counts[1]) ? counts[0] : counts[1];
+    size_t differ = 0, ranges = 0, first = 0;
+    for (size_t i = 0; i < common;) {
+        if (traces[0][i]==traces[1][i]) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while ((i < common) && (traces[0][i]!=traces[1][i])) i++;
+        if (ranges==0) {
+            first = start + 1;
+            printf("first difference at frame %zu: %016llx vs %016llx\n", first,
+                (unsigned long long)traces[0][start], (unsigned long long)traces[1][start]);
+        }
+        if ((int)ranges < maxRanges) {
+            if (i - start==1) printf("  frame %zu\n", start + 1);
+            else printf("  frames %zu-%zu (%zu)\n", start + 1, i, i - start);
+        } else if ((int)ranges==maxRanges) {
+            printf("  ...\n");
+        }
+        ranges++;
+        differ += i - start;
+    }
+    int same = (differ==0) && (counts[0]==counts[1]);
+    if (same) printf("identical\n");
+    else {
+        printf("%zu of %zu frames differ, in %zu runs\n", differ, common, ranges);
+        if (counts[0]!=counts[1]) printf("and one runs %zu frames longer\n", (counts[0] > counts[1]) ? counts[0] - common : counts[1] - common);
+    }
+    free(traces[0]);
+    free(traces[1]);
+    return same ? 0 : 1;
+}